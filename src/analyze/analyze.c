@@ -13,6 +13,7 @@
 
 #include "alloc-util.h"
 #include "analyze-verify.h"
+#include "bus-common-errors.h"
 #include "bus-error.h"
 #include "bus-unit-util.h"
 #include "bus-util.h"
@@ -1779,6 +1780,96 @@ static int service_watchdogs(int argc, char *argv[], void *userdata) {
         return 0;
 }
 
+static int event_loop_profiling(int argc, char *argv[], void *userdata) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        int b, r;
+
+        assert(IN_SET(argc, 1, 2));
+        assert(argv);
+
+        r = acquire_bus(&bus, NULL);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create bus connection: %m");
+
+        /* get EventLoopProfiling */
+        if (argc == 1) {
+                r = sd_bus_get_property_trivial(
+                                bus,
+                                "org.freedesktop.systemd1",
+                                "/org/freedesktop/systemd1",
+                                "org.freedesktop.systemd1.Manager",
+                                "EventLoopProfiling",
+                                &error,
+                                'b',
+                                &b);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to get event loop profiling state: %s", bus_error_message(&error, r));
+
+                printf("%s\n", yes_no(!!b));
+
+                return 0;
+        }
+
+        /* set EventLoopProfiling */
+        b = parse_boolean(argv[1]);
+        if (b < 0) {
+                log_error("Failed to parse event-loop-profiling argument.");
+                return -EINVAL;
+        }
+
+        r = sd_bus_set_property(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "EventLoopProfiling",
+                        &error,
+                        "b",
+                        b);
+        if (r < 0)
+                return log_error_errno(r, "Failed to set event loop profiling state: %s", bus_error_message(&error, r));
+
+        return 0;
+}
+
+static int event_loop_statistics(int argc, char *argv[], void *userdata) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        const char *text = NULL;
+        int r;
+
+        r = acquire_bus(&bus, NULL);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create bus connection: %m");
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetEventLoopStatistics",
+                        &error,
+                        &reply,
+                        NULL);
+        if (sd_bus_error_has_name(&error, BUS_ERROR_NO_EVENT_LOOP_STATISTICS)) {
+                log_error("Event loop profiling is not enabled, use 'systemd-analyze event-loop-profiling yes' first.");
+                return -ENODATA;
+        }
+        if (r < 0)
+                return log_error_errno(r, "Failed to issue method call GetEventLoopStatistics: %s", bus_error_message(&error, r));
+
+        r = sd_bus_message_read(reply, "s", &text);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        (void) pager_open(arg_pager_flags);
+
+        fputs(text, stdout);
+        return 0;
+}
+
 static int do_verify(int argc, char *argv[], void *userdata) {
         return verify_units(strv_skip(argv, 1), arg_scope, arg_man, arg_generators);
 }
@@ -1826,6 +1917,9 @@ static int help(int argc, char *argv[], void *userdata) {
                "  verify FILE...           Check unit files for correctness\n"
                "  calendar SPEC...         Validate repetitive calendar time events\n"
                "  service-watchdogs [BOOL] Get/set service watchdog state\n"
+               "  event-loop-profiling [BOOL]\n"
+               "                           Get/set event loop profiling state of manager\n"
+               "  event-loop-statistics    Print event loop statistics of manager\n"
                "  timespan SPAN...         Validate a time span\n"
                "\nSee the %s for details.\n"
                , program_invocation_short_name
@@ -1997,27 +2091,29 @@ static int parse_argv(int argc, char *argv[]) {
 static int run(int argc, char *argv[]) {
 
         static const Verb verbs[] = {
-                { "help",              VERB_ANY, VERB_ANY, 0,            help                   },
-                { "time",              VERB_ANY, 1,        VERB_DEFAULT, analyze_time           },
-                { "blame",             VERB_ANY, 1,        0,            analyze_blame          },
-                { "critical-chain",    VERB_ANY, VERB_ANY, 0,            analyze_critical_chain },
-                { "plot",              VERB_ANY, 1,        0,            analyze_plot           },
-                { "dot",               VERB_ANY, VERB_ANY, 0,            dot                    },
-                { "log-level",         VERB_ANY, 2,        0,            get_or_set_log_level   },
-                { "log-target",        VERB_ANY, 2,        0,            get_or_set_log_target  },
+                { "help",                  VERB_ANY, VERB_ANY, 0,            help                   },
+                { "time",                  VERB_ANY, 1,        VERB_DEFAULT, analyze_time           },
+                { "blame",                 VERB_ANY, 1,        0,            analyze_blame          },
+                { "critical-chain",        VERB_ANY, VERB_ANY, 0,            analyze_critical_chain },
+                { "plot",                  VERB_ANY, 1,        0,            analyze_plot           },
+                { "dot",                   VERB_ANY, VERB_ANY, 0,            dot                    },
+                { "log-level",             VERB_ANY, 2,        0,            get_or_set_log_level   },
+                { "log-target",            VERB_ANY, 2,        0,            get_or_set_log_target  },
                 /* The following four verbs are deprecated aliases */
-                { "set-log-level",     2,        2,        0,            set_log_level          },
-                { "get-log-level",     VERB_ANY, 1,        0,            get_log_level          },
-                { "set-log-target",    2,        2,        0,            set_log_target         },
-                { "get-log-target",    VERB_ANY, 1,        0,            get_log_target         },
-                { "dump",              VERB_ANY, 1,        0,            dump                   },
-                { "cat-config",        2,        VERB_ANY, 0,            cat_config             },
-                { "unit-paths",        1,        1,        0,            dump_unit_paths        },
-                { "syscall-filter",    VERB_ANY, VERB_ANY, 0,            dump_syscall_filters   },
-                { "verify",            2,        VERB_ANY, 0,            do_verify              },
-                { "calendar",          2,        VERB_ANY, 0,            test_calendar          },
-                { "service-watchdogs", VERB_ANY, 2,        0,            service_watchdogs      },
-                { "timespan",          2,        VERB_ANY, 0,            dump_timespan          },
+                { "set-log-level",         2,        2,        0,            set_log_level          },
+                { "get-log-level",         VERB_ANY, 1,        0,            get_log_level          },
+                { "set-log-target",        2,        2,        0,            set_log_target         },
+                { "get-log-target",        VERB_ANY, 1,        0,            get_log_target         },
+                { "dump",                  VERB_ANY, 1,        0,            dump                   },
+                { "cat-config",            2,        VERB_ANY, 0,            cat_config             },
+                { "unit-paths",            1,        1,        0,            dump_unit_paths        },
+                { "syscall-filter",        VERB_ANY, VERB_ANY, 0,            dump_syscall_filters   },
+                { "verify",                2,        VERB_ANY, 0,            do_verify              },
+                { "calendar",              2,        VERB_ANY, 0,            test_calendar          },
+                { "service-watchdogs",     VERB_ANY, 2,        0,            service_watchdogs      },
+                { "event-loop-profiling",  VERB_ANY, 2,        0,            event_loop_profiling   },
+                { "event-loop-statistics", VERB_ANY, 1,        0,            event_loop_statistics  },
+                { "timespan",              2,        VERB_ANY, 0,            dump_timespan          },
                 {}
         };
 
@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+/*
+ * Hierarchical Timer Wheel
+ * The timer wheel sorts nodes by a 64bit key into buckets ("slots") of
+ * increasing width. Level 0 has 64 slots of 2^10 units each, every further
+ * level has 64 slots 64 times as wide as the ones below. A node is kept on the
+ * lowest level whose slot range still covers it relative to the current base,
+ * and moves down the levels as the base is advanced towards it. Insertion and
+ * removal are O(1), and so is finding the slot holding the smallest key, as
+ * all keys on a level are smaller than all keys on the levels above it. The
+ * exact minimum is cached, and the one slot found is only scanned for it again
+ * after the minimum node was removed or moved to a later key.
+ *
+ * Nodes with keys below the base are "expired" and may be popped off. Nodes
+ * too far in the future for the top level are kept in an overflow list.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "timer-wheel.h"
+
+#define LEVEL_SHIFT(level) (10U + 6U * (level))
+
+#define LEVEL_EXPIRED UINT8_MAX
+#define LEVEL_OVERFLOW (UINT8_MAX - 1)
+
+struct TimerWheel {
+        uint64_t base;
+        size_t n_nodes;
+
+        /* The node with the smallest key, only valid if min_valid is set. NULL if the wheel is empty. */
+        TimerWheelNode *min;
+        bool min_valid;
+
+        /* One bit per non-empty slot */
+        uint64_t bitmap[TIMER_WHEEL_LEVELS];
+        LIST_HEAD(TimerWheelNode, slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]);
+
+        LIST_HEAD(TimerWheelNode, expired);
+        LIST_HEAD(TimerWheelNode, overflow);
+};
+
+assert_cc(TIMER_WHEEL_SLOTS == sizeof(uint64_t) * 8);
+assert_cc(LEVEL_SHIFT(TIMER_WHEEL_LEVELS) < 64);
+
+TimerWheel *timer_wheel_new(uint64_t base) {
+        TimerWheel *w;
+
+        w = new0(TimerWheel, 1);
+        if (!w)
+                return NULL;
+
+        w->base = base;
+        w->min_valid = true;
+        return w;
+}
+
+static void forget_list(TimerWheelNode **l) {
+        TimerWheelNode *n;
+
+        while ((n = *l)) {
+                LIST_REMOVE(nodes, *l, n);
+                n->linked = false;
+        }
+}
+
+TimerWheel *timer_wheel_free(TimerWheel *w) {
+        unsigned level, slot;
+
+        if (!w)
+                return NULL;
+
+        /* The nodes are owned by the caller, we just unlink them */
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+                for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                        forget_list(&w->slots[level][slot]);
+
+        forget_list(&w->expired);
+        forget_list(&w->overflow);
+
+        return mfree(w);
+}
+
+static TimerWheelNode **node_list(TimerWheel *w, TimerWheelNode *n) {
+        assert(w);
+        assert(n);
+        assert(n->linked);
+
+        if (n->level == LEVEL_EXPIRED)
+                return &w->expired;
+        if (n->level == LEVEL_OVERFLOW)
+                return &w->overflow;
+
+        assert(n->level < TIMER_WHEEL_LEVELS);
+        return &w->slots[n->level][n->slot];
+}
+
+static void link_node(TimerWheel *w, TimerWheelNode *n) {
+        unsigned level;
+
+        assert(w);
+        assert(n);
+        assert(!n->linked);
+
+        n->linked = true;
+
+        if (n->key < w->base) {
+                n->level = LEVEL_EXPIRED;
+                LIST_PREPEND(nodes, w->expired, n);
+                return;
+        }
+
+        /* Find the lowest level on which the node and the base lie in the same revolution of the wheel */
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+                if ((n->key >> LEVEL_SHIFT(level + 1)) == (w->base >> LEVEL_SHIFT(level + 1)))
+                        break;
+
+        if (level >= TIMER_WHEEL_LEVELS) {
+                n->level = LEVEL_OVERFLOW;
+                LIST_PREPEND(nodes, w->overflow, n);
+                return;
+        }
+
+        n->level = level;
+        n->slot = (n->key >> LEVEL_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+
+        LIST_PREPEND(nodes, w->slots[level][n->slot], n);
+        w->bitmap[level] |= UINT64_C(1) << n->slot;
+}
+
+static void unlink_node(TimerWheel *w, TimerWheelNode *n) {
+        TimerWheelNode **l;
+
+        assert(w);
+        assert(n);
+
+        l = node_list(w, n);
+        LIST_REMOVE(nodes, *l, n);
+
+        if (!*l && n->level < TIMER_WHEEL_LEVELS)
+                w->bitmap[n->level] &= ~(UINT64_C(1) << n->slot);
+
+        n->linked = false;
+}
+
+void timer_wheel_add(TimerWheel *w, TimerWheelNode *n, uint64_t key) {
+        assert(w);
+        assert(n);
+
+        if (n->linked) {
+                unlink_node(w, n);
+
+                /* Another node might be the minimum now */
+                if (w->min == n && key > n->key) {
+                        w->min = NULL;
+                        w->min_valid = false;
+                }
+        } else
+                w->n_nodes++;
+
+        n->key = key;
+        link_node(w, n);
+
+        if (w->min_valid && (!w->min || key < w->min->key))
+                w->min = n;
+}
+
+void timer_wheel_remove(TimerWheel *w, TimerWheelNode *n) {
+        assert(w);
+        assert(n);
+
+        if (!n->linked)
+                return;
+
+        unlink_node(w, n);
+
+        assert(w->n_nodes > 0);
+        w->n_nodes--;
+
+        if (w->min == n) {
+                w->min = NULL;
+                w->min_valid = w->n_nodes == 0;
+        }
+}
+
+static TimerWheelNode *list_min(TimerWheelNode *l) {
+        TimerWheelNode *i, *m = NULL;
+
+        LIST_FOREACH(nodes, i, l)
+                if (!m || i->key < m->key)
+                        m = i;
+
+        return m;
+}
+
+static TimerWheelNode *find_min(TimerWheel *w) {
+        unsigned level;
+
+        assert(w);
+
+        if (w->expired)
+                return list_min(w->expired);
+
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+                if (w->bitmap[level] != 0)
+                        return list_min(w->slots[level][__builtin_ctzll(w->bitmap[level])]);
+
+        return list_min(w->overflow);
+}
+
+TimerWheelNode *timer_wheel_peek(TimerWheel *w) {
+        if (!w)
+                return NULL;
+
+        /* Moving the base only moves nodes between slots, their keys and hence the minimum stay the same */
+        if (!w->min_valid) {
+                w->min = find_min(w);
+                w->min_valid = true;
+        }
+
+        return w->min;
+}
+
+static void take_list(TimerWheelNode **from, TimerWheelNode **to) {
+        TimerWheelNode *n;
+
+        while ((n = *from)) {
+                LIST_REMOVE(nodes, *from, n);
+                n->linked = false;
+                LIST_PREPEND(nodes, *to, n);
+        }
+}
+
+static void take_slot(TimerWheel *w, unsigned level, unsigned slot, TimerWheelNode **to) {
+        take_list(&w->slots[level][slot], to);
+        w->bitmap[level] &= ~(UINT64_C(1) << slot);
+}
+
+void timer_wheel_set_base(TimerWheel *w, uint64_t base) {
+        LIST_HEAD(TimerWheelNode, moved) = NULL;
+        TimerWheelNode *n;
+        unsigned level, slot;
+
+        assert(w);
+
+        if (base == w->base)
+                return;
+
+        if (base < w->base) {
+                /* Moving backwards is expected to be rare (think of the wall clock being set), hence we simply
+                 * sort in everything again */
+                for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+                        for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                                take_slot(w, level, slot, &moved);
+
+                take_list(&w->expired, &moved);
+                take_list(&w->overflow, &moved);
+                goto finish;
+        }
+
+        /* Collect all nodes whose position depends on the part of the base that changes, and sort them in again
+         * relative to the new base. On each level these are the slots between the old and the new base, or all of
+         * them if the base moved on to a different revolution of the level. */
+        for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+                unsigned from, to;
+
+                if (w->bitmap[level] == 0)
+                        continue;
+
+                if ((w->base >> LEVEL_SHIFT(level + 1)) != (base >> LEVEL_SHIFT(level + 1))) {
+                        for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                                take_slot(w, level, slot, &moved);
+                        continue;
+                }
+
+                from = (w->base >> LEVEL_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+                to = (base >> LEVEL_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+
+                /* The slot of the base itself is only used on the lowest level, as above it its contents would be
+                 * kept on the level below */
+                for (slot = level == 0 ? from : from + 1; slot <= to; slot++)
+                        take_slot(w, level, slot, &moved);
+        }
+
+        if ((w->base >> LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) != (base >> LEVEL_SHIFT(TIMER_WHEEL_LEVELS)))
+                take_list(&w->overflow, &moved);
+
+finish:
+        w->base = base;
+
+        while ((n = moved)) {
+                LIST_REMOVE(nodes, moved, n);
+                link_node(w, n);
+        }
+}
+
+TimerWheelNode *timer_wheel_pop_expired(TimerWheel *w) {
+        TimerWheelNode *n;
+
+        if (!w)
+                return NULL;
+
+        n = w->expired;
+        if (n)
+                timer_wheel_remove(w, n);
+
+        return n;
+}
+
+size_t timer_wheel_size(TimerWheel *w) {
+        if (!w)
+                return 0;
+
+        return w->n_nodes;
+}
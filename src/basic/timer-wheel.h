@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "macro.h"
+
+/* A hierarchical timing wheel, keyed by µs timestamps. Adding and removing nodes is O(1), and so is finding the node
+ * with the smallest key, except for a scan of the one slot containing it after the previous minimum was removed.
+ * Slots on the lowest level are about 1ms wide, each further level is 64 times coarser. Nodes are embedded into the
+ * objects they belong to, use container_of() to get from a node to its object. */
+
+#define TIMER_WHEEL_LEVELS 5U
+#define TIMER_WHEEL_SLOTS 64U
+
+typedef struct TimerWheelNode TimerWheelNode;
+typedef struct TimerWheel TimerWheel;
+
+struct TimerWheelNode {
+        uint64_t key;
+        uint8_t level, slot;
+        bool linked;
+        LIST_FIELDS(TimerWheelNode, nodes);
+};
+
+TimerWheel *timer_wheel_new(uint64_t base);
+TimerWheel *timer_wheel_free(TimerWheel *w);
+DEFINE_TRIVIAL_CLEANUP_FUNC(TimerWheel*, timer_wheel_free);
+
+void timer_wheel_add(TimerWheel *w, TimerWheelNode *n, uint64_t key);
+void timer_wheel_remove(TimerWheel *w, TimerWheelNode *n);
+
+static inline bool timer_wheel_node_linked(const TimerWheelNode *n) {
+        return n->linked;
+}
+
+TimerWheelNode *timer_wheel_peek(TimerWheel *w);
+
+void timer_wheel_set_base(TimerWheel *w, uint64_t base);
+TimerWheelNode *timer_wheel_pop_expired(TimerWheel *w);
+
+size_t timer_wheel_size(TimerWheel *w) _pure_;
@@ -32,6 +32,7 @@ static char* arg_listen_https = NULL;
 static char** arg_files = NULL;
 static int arg_compress = true;
 static int arg_seal = false;
+static unsigned arg_workers = 0;
 static int http_socket = -1, https_socket = -1;
 static char** arg_gnutls_log = NULL;
 
@@ -137,7 +138,39 @@ static int dispatch_http_event(sd_event_source *event,
                                uint32_t revents,
                                void *userdata);
 
-static int request_meta(void **connection_cls, int fd, char *hostname) {
+static int request_meta_worker(void **connection_cls, int fd, char *hostname, Decompressor *decompressor) {
+        RemoteWorkerStream *stream;
+        RemoteWorker *worker;
+        RemoteSource *source;
+        int r;
+
+        /* The entries are parsed here, but written by the worker the host is assigned to */
+
+        worker = journal_remote_get_worker(journal_remote_server_global, hostname);
+
+        r = remote_worker_open_stream(worker, hostname, &stream);
+        if (r < 0)
+                return log_warning_errno(r, "Failed to hand over source %s to worker: %m",
+                                         hostname);
+
+        source = source_new(fd, true, hostname, NULL);
+        if (!source) {
+                remote_worker_close_stream(worker, stream);
+                return log_oom();
+        }
+
+        source->worker = worker;
+        source->stream = stream;
+        source->decompressor = decompressor;
+
+        log_debug("Added RemoteSource as connection metadata %p", source);
+
+        *connection_cls = source;
+        return 0;
+}
+
+static int request_meta(void **connection_cls, int fd, char *hostname, int compression) {
+        _cleanup_(decompressor_freep) Decompressor *decompressor = NULL;
         RemoteSource *source;
         Writer *writer;
         int r;
@@ -146,6 +179,22 @@ static int request_meta(void **connection_cls, int fd, char *hostname) {
         if (*connection_cls)
                 return 0;
 
+        if (compression >= 0) {
+                r = decompressor_new(compression, &decompressor);
+                if (r < 0)
+                        return log_warning_errno(r, "Failed to set up decompression for source %s: %m",
+                                                 hostname);
+        }
+
+        if (journal_remote_server_global->n_workers > 0) {
+                r = request_meta_worker(connection_cls, fd, hostname, decompressor);
+                if (r < 0)
+                        return r;
+
+                decompressor = NULL;
+                return 0;
+        }
+
         r = journal_remote_get_writer(journal_remote_server_global, hostname, &writer);
         if (r < 0)
                 return log_warning_errno(r, "Failed to get writer for source %s: %m",
@@ -157,6 +206,8 @@ static int request_meta(void **connection_cls, int fd, char *hostname) {
                 return log_oom();
         }
 
+        source->decompressor = TAKE_PTR(decompressor);
+
         log_debug("Added RemoteSource as connection metadata %p", source);
 
         *connection_cls = source;
@@ -174,19 +225,29 @@ static void request_meta_free(void *cls,
 
         if (s) {
                 log_debug("Cleaning up connection metadata %p", s);
+                if (s->stream)
+                        remote_worker_close_stream(s->worker, s->stream);
                 source_free(s);
                 *connection_cls = NULL;
         }
 }
 
+static int suspend_upload(struct MHD_Connection *connection, RemoteSource *source) {
+        log_debug("Worker for %s is falling behind with %zu bytes queued, suspending connection %p",
+                  source->importer.name, remote_worker_queued_bytes(source->worker), connection);
+
+        MHD_suspend_connection(connection);
+        return MHD_YES;
+}
+
 static int process_http_upload(
                 struct MHD_Connection *connection,
                 const char *upload_data,
                 size_t *upload_data_size,
                 RemoteSource *source) {
 
-        bool finished = false;
-        size_t remaining;
+        size_t remaining, consumed;
+        bool finished;
         int r;
 
         assert(source);
@@ -194,35 +255,41 @@ static int process_http_upload(
         log_trace("%s: connection %p, %zu bytes",
                   __func__, connection, *upload_data_size);
 
-        if (*upload_data_size) {
-                log_trace("Received %zu bytes", *upload_data_size);
-
-                r = journal_importer_push_data(&source->importer,
-                                               upload_data, *upload_data_size);
-                if (r < 0)
-                        return mhd_respond_oom(connection);
+        if (*upload_data_size && source->worker &&
+            remote_worker_congested(source->worker, connection))
+                /* Leave the data where it is, we'll be called again with it once the worker caught up */
+                return suspend_upload(connection, source);
+
+        /* We are called without data once the upload is finished, which still flushes the decompressor */
+        finished = *upload_data_size == 0;
+
+        r = process_upload(source, upload_data, *upload_data_size,
+                           journal_remote_server_global->compress,
+                           journal_remote_server_global->seal,
+                           connection, &consumed);
+        if (r > 0) {
+                /* The worker fell behind while we were decompressing, keep the rest of the data for later */
+                *upload_data_size -= consumed;
+                return suspend_upload(connection, source);
+        }
 
-                *upload_data_size = 0;
-        } else
-                finished = true;
+        *upload_data_size = 0;
 
-        for (;;) {
-                r = process_source(source,
-                                   journal_remote_server_global->compress,
-                                   journal_remote_server_global->seal);
-                if (r == -EAGAIN)
-                        break;
-                else if (r < 0) {
-                        log_warning("Failed to process data for connection %p", connection);
-                        if (r == -E2BIG)
-                                return mhd_respondf(connection,
-                                                    r, MHD_HTTP_PAYLOAD_TOO_LARGE,
-                                                    "Entry is too large, maximum is " STRINGIFY(DATA_SIZE_MAX) " bytes.");
-                        else
-                                return mhd_respondf(connection,
-                                                    r, MHD_HTTP_UNPROCESSABLE_ENTITY,
-                                                    "Processing failed: %m.");
-                }
+        if (r >= 0 && finished && source->decompressor)
+                /* Make sure the upload didn't end in the middle of a compressed frame */
+                r = decompressor_finish(source->decompressor);
+        if (r == -ENOMEM)
+                return mhd_respond_oom(connection);
+        if (r < 0) {
+                log_warning("Failed to process data for connection %p", connection);
+                if (r == -E2BIG)
+                        return mhd_respondf(connection,
+                                            r, MHD_HTTP_PAYLOAD_TOO_LARGE,
+                                            "Entry is too large, maximum is " STRINGIFY(DATA_SIZE_MAX) " bytes.");
+                else
+                        return mhd_respondf(connection,
+                                            r, MHD_HTTP_UNPROCESSABLE_ENTITY,
+                                            "Processing failed: %m.");
         }
 
         if (!finished)
@@ -253,7 +320,7 @@ static int request_handler(
                 void **connection_cls) {
 
         const char *header;
-        int r, code, fd;
+        int r, code, fd, compression = -1;
         _cleanup_free_ char *hostname = NULL;
 
         assert(connection);
@@ -280,6 +347,18 @@ static int request_handler(
                 return mhd_respond(connection, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
                                    "Content-Type: application/vnd.fdo.journal is required.");
 
+        header = MHD_lookup_connection_value(connection,
+                                             MHD_HEADER_KIND, "Content-Encoding");
+        if (header && !streq(header, "identity")) {
+                if (streq(header, "zstd") && HAVE_ZSTD)
+                        compression = OBJECT_COMPRESSED_ZSTD;
+                else if (streq(header, "lz4") && HAVE_LZ4)
+                        compression = OBJECT_COMPRESSED_LZ4;
+                else
+                        return mhd_respondf(connection, 0, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                            "Content-Encoding: %s is not supported.", header);
+        }
+
         {
                 const union MHD_ConnectionInfo *ci;
 
@@ -308,7 +387,7 @@ static int request_handler(
 
         assert(hostname);
 
-        r = request_meta(connection_cls, fd, hostname);
+        r = request_meta(connection_cls, fd, hostname, compression);
         if (r == -ENOMEM)
                 return respond_oom(connection);
         else if (r < 0)
@@ -364,6 +443,10 @@ static int setup_microhttpd_server(RemoteServer *s,
         flags |= MHD_USE_PEDANTIC_CHECKS;
 #endif
 
+        /* Connections are suspended while the worker their entries go to is falling behind */
+        if (s->n_workers > 0)
+                flags |= MHD_ALLOW_SUSPEND_RESUME;
+
         if (key) {
                 assert(cert);
 
@@ -560,6 +643,10 @@ static int create_remoteserver(
         if (r < 0)
                 return r;
 
+        r = journal_remote_server_setup_workers(s, arg_workers);
+        if (r < 0)
+                return r;
+
         r = setup_signals(s);
         if (r < 0)
                 return log_error_errno(r, "Failed to set up signals: %m");
@@ -704,9 +791,13 @@ static int create_remoteserver(
                 r = journal_remote_get_writer(s, NULL, &s->_single_writer);
                 if (r < 0)
                         return r;
+
+                /* The worker writes to the file, don't keep a second writer for it open */
+                if (s->n_workers > 0)
+                        s->_single_writer = writer_unref(s->_single_writer);
         }
 
-        return 0;
+        return journal_remote_server_start_workers(s);
 }
 
 static int negative_fd(const char *spec) {
@@ -731,6 +822,7 @@ static int parse_config(void) {
                 { "Remote",  "ServerKeyFile",          config_parse_path,             0, &arg_key        },
                 { "Remote",  "ServerCertificateFile",  config_parse_path,             0, &arg_cert       },
                 { "Remote",  "TrustedCertificateFile", config_parse_path,             0, &arg_trust      },
+                { "Remote",  "Workers",                config_parse_unsigned,         0, &arg_workers    },
                 {}
         };
 
@@ -769,6 +861,7 @@ static int help(void) {
                "     --gnutls-log=CATEGORY...\n"
                "                            Specify a list of gnutls logging categories\n"
                "     --split-mode=none|host How many output files to create\n"
+               "     --workers=N            Write entries from N threads, sharded by host\n"
                "\nNote: file descriptors from sd_listen_fds() will be consumed, too.\n"
                "\nSee the %s for details.\n"
                , program_invocation_short_name
@@ -793,6 +886,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CERT,
                 ARG_TRUST,
                 ARG_GNUTLS_LOG,
+                ARG_WORKERS,
         };
 
         static const struct option options[] = {
@@ -811,6 +905,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "cert",         required_argument, NULL, ARG_CERT         },
                 { "trust",        required_argument, NULL, ARG_TRUST        },
                 { "gnutls-log",   required_argument, NULL, ARG_GNUTLS_LOG   },
+                { "workers",      required_argument, NULL, ARG_WORKERS      },
                 {}
         };
 
@@ -998,6 +1093,15 @@ static int parse_argv(int argc, char *argv[]) {
 #endif
                 }
 
+                case ARG_WORKERS:
+                        r = safe_atou(optarg, &arg_workers);
+                        if (r < 0) {
+                                log_error("Failed to parse --workers= parameter.");
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1052,8 +1156,14 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
-        log_debug("Full config: SplitMode=%s Key=%s Cert=%s Trust=%s",
+        if (arg_workers > REMOTE_WORKERS_MAX) {
+                log_error("Workers=/--workers= must be at most %u.", REMOTE_WORKERS_MAX);
+                return -EINVAL;
+        }
+
+        log_debug("Full config: SplitMode=%s Workers=%u Key=%s Cert=%s Trust=%s",
                   journal_write_split_mode_to_string(arg_split_mode),
+                  arg_workers,
                   strna(arg_key),
                   strna(arg_cert),
                   strna(arg_trust));
@@ -1153,8 +1263,9 @@ int main(int argc, char **argv) {
 
         sd_notifyf(false,
                    "STOPPING=1\n"
-                   "STATUS=Shutting down after writing %" PRIu64 " entries...", s.event_count);
-        log_info("Finishing after writing %" PRIu64 " entries", s.event_count);
+                   "STATUS=Shutting down after writing %" PRIu64 " entries...",
+                   journal_remote_server_event_count(&s));
+        log_info("Finishing after writing %" PRIu64 " entries", journal_remote_server_event_count(&s));
 
         journal_remote_server_destroy(&s);
 
@@ -12,9 +12,12 @@ void source_free(RemoteSource *source) {
                 return;
 
         journal_importer_cleanup(&source->importer);
+        decompressor_free(source->decompressor);
 
-        log_debug("Writer ref count %i", source->writer->n_ref);
-        writer_unref(source->writer);
+        if (source->writer) {
+                log_debug("Writer ref count %i", source->writer->n_ref);
+                writer_unref(source->writer);
+        }
 
         sd_event_source_unref(source->event);
         sd_event_source_unref(source->buffer_event);
@@ -51,7 +54,7 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
         int r;
 
         assert(source);
-        assert(source->writer);
+        assert(source->writer || source->stream);
 
         r = journal_importer_process_data(&source->importer);
         if (r <= 0)
@@ -68,7 +71,10 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
 
         assert(source->importer.iovw.iovec);
 
-        r = writer_write(source->writer, &source->importer.iovw, &source->importer.ts, compress, seal);
+        if (source->stream)
+                r = remote_worker_queue_entry(source->worker, source->stream, &source->importer.iovw, &source->importer.ts);
+        else
+                r = writer_write(source->writer, &source->importer.iovw, &source->importer.ts, compress, seal);
         if (r == -EBADMSG) {
                 log_error_errno(r, "Entry is invalid, ignoring.");
                 r = 0;
@@ -82,3 +88,72 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
         journal_importer_drop_iovw(&source->importer);
         return r;
 }
+
+typedef struct UploadContext {
+        RemoteSource *source;
+        bool compress;
+        bool seal;
+        void *waiter;
+} UploadContext;
+
+static int push_upload_data(const void *data, size_t size, void *userdata) {
+        UploadContext *c = userdata;
+        int r;
+
+        assert(c);
+
+        log_trace("Received %zu bytes", size);
+
+        r = journal_importer_push_data(&c->source->importer, data, size);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                r = process_source(c->source, c->compress, c->seal);
+                if (r == -EAGAIN)
+                        break;
+                if (r < 0)
+                        return r;
+        }
+
+        /* Checked after every piece of decompressed data, so that a small compressed upload can't queue up an
+         * arbitrary amount of entries at once */
+        if (c->source->worker && remote_worker_congested(c->source->worker, c->waiter))
+                return 1;
+
+        return 0;
+}
+
+int process_upload(
+                RemoteSource *source,
+                const void *data, size_t size,
+                bool compress, bool seal,
+                void *waiter,
+                size_t *ret_consumed) {
+
+        UploadContext c = {
+                .source = source,
+                .compress = compress,
+                .seal = seal,
+                .waiter = waiter,
+        };
+
+        assert(source);
+        assert(data || size == 0);
+        assert(ret_consumed);
+
+        /* Passes a piece of an upload to the source, decompressing it first if needed. If the source hands its
+         * entries over to a worker which falls behind, stops early, registers waiter with the worker and returns
+         * 1. The data following the consumed part should then be passed in again once the worker caught up.
+         * Passing no data flushes what the decompressor still holds back, which is necessary at the end of the
+         * upload. */
+
+        if (source->decompressor)
+                return decompressor_push(source->decompressor, data, size, ret_consumed, push_upload_data, &c);
+
+        *ret_consumed = size;
+        if (size == 0)
+                return 0;
+
+        return push_upload_data(data, size, &c);
+}
@@ -3,14 +3,24 @@
 
 #include "sd-event.h"
 
+#include "compress.h"
 #include "journal-importer.h"
+#include "journal-remote-worker.h"
 #include "journal-remote-write.h"
 
 typedef struct RemoteSource {
         JournalImporter importer;
 
+        RemoteServer *server;
         Writer *writer;
 
+        /* If set, entries are handed over to the worker instead of being written directly */
+        RemoteWorker *worker;
+        RemoteWorkerStream *stream;
+
+        /* If set, the uploaded data is compressed and passed through this first */
+        Decompressor *decompressor;
+
         sd_event_source *event;
         sd_event_source *buffer_event;
 } RemoteSource;
@@ -18,3 +28,4 @@ typedef struct RemoteSource {
 RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer);
 void source_free(RemoteSource *source);
 int process_source(RemoteSource *source, bool compress, bool seal);
+int process_upload(RemoteSource *source, const void *data, size_t size, bool compress, bool seal, void *waiter, size_t *ret_consumed);
@@ -0,0 +1,566 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "journal-remote-worker.h"
+#include "journal-remote.h"
+#include "list.h"
+#include "stdio-util.h"
+#include "string-util.h"
+
+typedef enum RemoteWorkerItemType {
+        REMOTE_WORKER_ITEM_SOURCE,
+        REMOTE_WORKER_ITEM_OPEN,
+        REMOTE_WORKER_ITEM_ENTRY,
+        REMOTE_WORKER_ITEM_CLOSE,
+} RemoteWorkerItemType;
+
+typedef struct RemoteWorkerItem RemoteWorkerItem;
+
+struct RemoteWorkerItem {
+        RemoteWorkerItemType type;
+
+        int fd;                          /* REMOTE_WORKER_ITEM_SOURCE */
+        char *name;                      /* REMOTE_WORKER_ITEM_SOURCE, REMOTE_WORKER_ITEM_OPEN */
+        RemoteWorkerStream *stream;      /* REMOTE_WORKER_ITEM_OPEN, REMOTE_WORKER_ITEM_ENTRY, REMOTE_WORKER_ITEM_CLOSE */
+
+        dual_timestamp ts;               /* REMOTE_WORKER_ITEM_ENTRY */
+        size_t n_iovec;
+        size_t size;
+
+        LIST_FIELDS(RemoteWorkerItem, items);
+
+        /* The iovecs and the data they point to, and the name, follow in the same allocation */
+        struct iovec iovec[];
+};
+
+struct RemoteWorkerStream {
+        Writer *writer;
+
+        /* Allocated up front, so that closing the stream can't fail */
+        RemoteWorkerItem *close_item;
+};
+
+struct RemoteWorker {
+        RemoteServer *server;
+        unsigned idx;
+
+        /* The sources and writers of this worker. Once the thread is started, only the thread may touch them. */
+        RemoteServer shard;
+        size_t n_sources_added;
+        size_t n_sources_reported;
+
+        pthread_t thread;
+        bool started;
+
+        int wakeup_fd;
+        sd_event_source *wakeup_event;
+        sd_event_source *post_event;
+
+        /* Everything below is protected by the mutex */
+        pthread_mutex_t mutex;
+
+        LIST_HEAD(RemoteWorkerItem, queue);
+        RemoteWorkerItem *queue_tail;
+        size_t queued_bytes;
+
+        /* Number of sources that were finished since the main thread looked last */
+        size_t n_done;
+
+        /* Connections waiting for the queue to drain, opaque to us */
+        void **waiters;
+        size_t n_waiters, n_waiters_allocated;
+
+        bool stopping;
+};
+
+static RemoteWorkerItem* item_new(RemoteWorkerItemType type, size_t n_iovec, size_t data_size, const char *name) {
+        RemoteWorkerItem *i;
+        size_t l;
+
+        l = name ? strlen(name) + 1 : 0;
+
+        i = malloc0(offsetof(RemoteWorkerItem, iovec) + n_iovec * sizeof(struct iovec) + data_size + l);
+        if (!i)
+                return NULL;
+
+        i->type = type;
+        i->fd = -1;
+        i->n_iovec = n_iovec;
+        i->size = data_size;
+
+        if (name)
+                i->name = memcpy((uint8_t*) (i->iovec + n_iovec) + data_size, name, l);
+
+        return i;
+}
+
+static RemoteWorkerItem* item_free(RemoteWorkerItem *i) {
+        if (!i)
+                return NULL;
+
+        /* Only called for items that were never processed */
+
+        safe_close(i->fd);
+
+        if (i->type == REMOTE_WORKER_ITEM_CLOSE) {
+                writer_unref(i->stream->writer);
+                free(i->stream);
+        }
+
+        return mfree(i);
+}
+
+static void worker_notify_server(RemoteWorker *w) {
+        assert(w);
+
+        if (eventfd_write(w->server->worker_notify_fd, 1) < 0)
+                log_warning_errno(errno, "Failed to wake up main thread, ignoring: %m");
+}
+
+static int worker_queue(RemoteWorker *w, RemoteWorkerItem *i, bool force) {
+        bool wakeup;
+
+        assert(w);
+        assert(i);
+
+        /* This takes ownership of the item, but only on success. If force is true, the item is queued even if the
+         * worker is stopping already, and released by remote_worker_free() if the worker doesn't get to it. */
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        if (w->stopping && !force) {
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+                return -ESHUTDOWN;
+        }
+
+        /* The worker takes everything that is queued when it wakes up, hence only wake it up if there was nothing
+         * queued before. */
+        wakeup = !w->queue;
+
+        LIST_INSERT_AFTER(items, w->queue, w->queue_tail, i);
+        w->queue_tail = i;
+        w->queued_bytes += i->size;
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        if (wakeup && eventfd_write(w->wakeup_fd, 1) < 0)
+                log_warning_errno(errno, "Failed to wake up worker %u, ignoring: %m", w->idx);
+
+        return 0;
+}
+
+static void worker_process_item(RemoteWorker *w, RemoteWorkerItem *i) {
+        struct iovec_wrapper iovw;
+        int r;
+
+        assert(w);
+        assert(i);
+
+        switch (i->type) {
+
+        case REMOTE_WORKER_ITEM_SOURCE:
+                /* A source that fails to be added counts as finished right away */
+                w->n_sources_added++;
+
+                (void) journal_remote_add_source(&w->shard, i->fd, i->name, false);
+                break;
+
+        case REMOTE_WORKER_ITEM_OPEN:
+                r = journal_remote_get_writer(&w->shard, i->name, &i->stream->writer);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to get writer for source %s, dropping its entries: %m", i->name);
+                break;
+
+        case REMOTE_WORKER_ITEM_ENTRY:
+                if (!i->stream->writer)
+                        break;
+
+                iovw = (struct iovec_wrapper) {
+                        .iovec = i->iovec,
+                        .count = i->n_iovec,
+                        .size_bytes = i->size,
+                };
+
+                r = writer_write(i->stream->writer, &iovw, &i->ts, w->shard.compress, w->shard.seal);
+                if (r == -EBADMSG)
+                        log_error_errno(r, "Entry is invalid, ignoring.");
+                else if (r < 0)
+                        log_error_errno(r, "Failed to write entry of %zu bytes: %m", i->size);
+                break;
+
+        case REMOTE_WORKER_ITEM_CLOSE:
+                writer_unref(i->stream->writer);
+                i->stream = mfree(i->stream);
+                break;
+
+        default:
+                assert_not_reached("Unknown item type");
+        }
+
+        free(i);
+}
+
+static int dispatch_wakeup(sd_event_source *event, int fd, uint32_t revents, void *userdata) {
+        RemoteWorker *w = userdata;
+        LIST_HEAD(RemoteWorkerItem, items);
+        RemoteWorkerItem *i;
+        bool stopping, notify;
+        eventfd_t x;
+        size_t size = 0;
+
+        assert(w);
+
+        (void) eventfd_read(fd, &x);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        items = TAKE_PTR(w->queue);
+        w->queue_tail = NULL;
+        stopping = w->stopping;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        while ((i = items)) {
+                LIST_REMOVE(items, items, i);
+
+                size += i->size;
+                worker_process_item(w, i);
+        }
+
+        /* The processed entries stay accounted until the whole batch is written, so that a worker that falls behind
+         * doesn't get more work handed over while it is busy. */
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        assert(w->queued_bytes >= size);
+        w->queued_bytes -= size;
+        notify = w->n_waiters > 0 && w->queued_bytes <= REMOTE_WORKER_QUEUE_LOW;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        if (notify)
+                worker_notify_server(w);
+
+        if (stopping)
+                return sd_event_exit(w->shard.events, 0);
+
+        return 0;
+}
+
+static int dispatch_post(sd_event_source *event, void *userdata) {
+        RemoteWorker *w = userdata;
+        size_t done;
+
+        assert(w);
+
+        /* Tell the main thread about finished sources, so that it knows when there's nothing left to do */
+
+        assert(w->n_sources_added >= w->shard.active);
+        done = w->n_sources_added - w->shard.active;
+        if (done == w->n_sources_reported)
+                return 0;
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        w->n_done += done - w->n_sources_reported;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        w->n_sources_reported = done;
+        worker_notify_server(w);
+
+        return 0;
+}
+
+int remote_worker_new(RemoteServer *s, unsigned idx, RemoteWorker **ret) {
+        _cleanup_(remote_worker_freep) RemoteWorker *w = NULL;
+        char name[STRLEN("worker-wakeup-") + DECIMAL_STR_MAX(unsigned)];
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        w = new0(RemoteWorker, 1);
+        if (!w)
+                return log_oom();
+
+        w->server = s;
+        w->idx = idx;
+        w->wakeup_fd = -1;
+        assert_se(pthread_mutex_init(&w->mutex, NULL) == 0);
+
+        r = journal_remote_server_init_shard(&w->shard, s);
+        if (r < 0)
+                return r;
+
+        w->wakeup_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (w->wakeup_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd: %m");
+
+        r = sd_event_add_io(w->shard.events, &w->wakeup_event, w->wakeup_fd, EPOLLIN, dispatch_wakeup, w);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add wakeup event source: %m");
+
+        xsprintf(name, "worker-wakeup-%u", idx);
+        (void) sd_event_source_set_description(w->wakeup_event, name);
+
+        r = sd_event_add_post(w->shard.events, &w->post_event, dispatch_post, w);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add post event source: %m");
+
+        *ret = TAKE_PTR(w);
+        return 0;
+}
+
+RemoteWorker* remote_worker_free(RemoteWorker *w) {
+        RemoteWorkerItem *i;
+
+        if (!w)
+                return NULL;
+
+        remote_worker_stop(w);
+
+        while ((i = w->queue)) {
+                LIST_REMOVE(items, w->queue, i);
+                item_free(i);
+        }
+
+        sd_event_source_unref(w->wakeup_event);
+        sd_event_source_unref(w->post_event);
+        journal_remote_server_destroy(&w->shard);
+
+        safe_close(w->wakeup_fd);
+        assert_se(pthread_mutex_destroy(&w->mutex) == 0);
+        free(w->waiters);
+
+        return mfree(w);
+}
+
+static void *worker_thread(void *p) {
+        RemoteWorker *w = p;
+        int r;
+
+        r = sd_event_loop(w->shard.events);
+        if (r < 0)
+                log_error_errno(r, "Event loop of worker %u failed: %m", w->idx);
+
+        return NULL;
+}
+
+int remote_worker_start(RemoteWorker *w) {
+        int r;
+
+        assert(w);
+        assert(!w->started);
+
+        r = pthread_create(&w->thread, NULL, worker_thread, w);
+        if (r > 0)
+                return log_error_errno(r, "Failed to start worker thread %u: %m", w->idx);
+
+        w->started = true;
+        return 0;
+}
+
+void remote_worker_stop(RemoteWorker *w) {
+        int r;
+
+        assert(w);
+
+        if (!w->started)
+                return;
+
+        /* Everything that was queued up to now is still processed before the worker exits */
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        w->stopping = true;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        if (eventfd_write(w->wakeup_fd, 1) < 0)
+                log_error_errno(errno, "Failed to wake up worker %u: %m", w->idx);
+
+        r = pthread_join(w->thread, NULL);
+        if (r > 0)
+                log_error_errno(r, "Failed to join worker thread %u: %m", w->idx);
+
+        w->started = false;
+}
+
+uint64_t remote_worker_event_count(RemoteWorker *w) {
+        assert(w);
+
+        return __atomic_load_n(&w->shard.event_count, __ATOMIC_RELAXED);
+}
+
+int remote_worker_add_source(RemoteWorker *w, int fd, const char *name) {
+        RemoteWorkerItem *i;
+        int r;
+
+        /* This takes ownership of fd, but only on success. */
+
+        assert(w);
+        assert(fd >= 0);
+        assert(name);
+
+        i = item_new(REMOTE_WORKER_ITEM_SOURCE, 0, 0, name);
+        if (!i)
+                return log_oom();
+
+        i->fd = fd;
+
+        r = worker_queue(w, i, false);
+        if (r < 0) {
+                free(i);
+                return r;
+        }
+
+        return 0;
+}
+
+int remote_worker_open_stream(RemoteWorker *w, const char *host, RemoteWorkerStream **ret) {
+        _cleanup_free_ RemoteWorkerStream *stream = NULL;
+        _cleanup_free_ RemoteWorkerItem *close_item = NULL;
+        RemoteWorkerItem *i;
+        int r;
+
+        assert(w);
+        assert(host);
+        assert(ret);
+
+        stream = new0(RemoteWorkerStream, 1);
+        if (!stream)
+                return log_oom();
+
+        close_item = item_new(REMOTE_WORKER_ITEM_CLOSE, 0, 0, NULL);
+        if (!close_item)
+                return log_oom();
+
+        i = item_new(REMOTE_WORKER_ITEM_OPEN, 0, 0, host);
+        if (!i)
+                return log_oom();
+
+        i->stream = stream;
+
+        r = worker_queue(w, i, false);
+        if (r < 0) {
+                free(i);
+                return r;
+        }
+
+        close_item->stream = stream;
+        stream->close_item = TAKE_PTR(close_item);
+
+        *ret = TAKE_PTR(stream);
+        return 0;
+}
+
+void remote_worker_close_stream(RemoteWorker *w, RemoteWorkerStream *stream) {
+        assert(w);
+        assert(stream);
+        assert(stream->close_item);
+
+        /* The worker may still be writing entries of this stream, hence the stream and its writer are released by
+         * the worker once it got to the end of it, or when the worker is freed. */
+
+        assert_se(worker_queue(w, TAKE_PTR(stream->close_item), true) >= 0);
+}
+
+int remote_worker_queue_entry(
+                RemoteWorker *w,
+                RemoteWorkerStream *stream,
+                struct iovec_wrapper *iovw,
+                const dual_timestamp *ts) {
+
+        RemoteWorkerItem *i;
+        uint8_t *p;
+        size_t j;
+        int r;
+
+        assert(w);
+        assert(stream);
+        assert(iovw);
+        assert(ts);
+
+        /* Copies the entry, the importer reuses its buffers for the next one */
+
+        i = item_new(REMOTE_WORKER_ITEM_ENTRY, iovw->count, iovw_size(iovw), NULL);
+        if (!i)
+                return log_oom();
+
+        i->stream = stream;
+        i->ts = *ts;
+
+        p = (uint8_t*) (i->iovec + i->n_iovec);
+        for (j = 0; j < iovw->count; j++) {
+                i->iovec[j] = IOVEC_MAKE(p, iovw->iovec[j].iov_len);
+                p = mempcpy(p, iovw->iovec[j].iov_base, iovw->iovec[j].iov_len);
+        }
+
+        r = worker_queue(w, i, false);
+        if (r < 0) {
+                free(i);
+                return r;
+        }
+
+        return 0;
+}
+
+size_t remote_worker_queued_bytes(RemoteWorker *w) {
+        size_t n;
+
+        assert(w);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        n = w->queued_bytes;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return n;
+}
+
+bool remote_worker_congested(RemoteWorker *w, void *waiter) {
+        bool congested;
+
+        assert(w);
+        assert(waiter);
+
+        /* Returns true if too much data is queued to the worker. In that case, the waiter is remembered and returned
+         * by remote_worker_collect() once the worker caught up. */
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        congested = w->queued_bytes >= REMOTE_WORKER_QUEUE_HIGH;
+        if (congested) {
+                if (GREEDY_REALLOC(w->waiters, w->n_waiters_allocated, w->n_waiters + 1))
+                        w->waiters[w->n_waiters++] = waiter;
+                else
+                        congested = false; /* Can't remember it, hence let it continue */
+        }
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return congested;
+}
+
+void remote_worker_collect(RemoteWorker *w, bool force, size_t *ret_done, void ***ret_waiters, size_t *ret_n_waiters) {
+        assert(w);
+        assert(ret_done);
+        assert(ret_waiters);
+        assert(ret_n_waiters);
+
+        /* Returns the number of sources finished since the last call, and the waiters that may continue now, or all
+         * of them if force is true. */
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        *ret_done = w->n_done;
+        w->n_done = 0;
+
+        if (force || w->queued_bytes <= REMOTE_WORKER_QUEUE_LOW) {
+                *ret_waiters = TAKE_PTR(w->waiters);
+                *ret_n_waiters = w->n_waiters;
+                w->n_waiters = w->n_waiters_allocated = 0;
+        } else {
+                *ret_waiters = NULL;
+                *ret_n_waiters = 0;
+        }
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+}
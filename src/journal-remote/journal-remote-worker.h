@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdbool.h>
+
+#include "journal-importer.h"
+#include "macro.h"
+#include "time-util.h"
+
+typedef struct RemoteServer RemoteServer;
+typedef struct RemoteWorker RemoteWorker;
+typedef struct RemoteWorkerStream RemoteWorkerStream;
+
+/* A worker runs a shard of the sources on its own event loop in its own thread, and owns the writers for them.
+ * Raw sources are handed over to the worker as a whole, see remote_worker_add_source(). HTTP uploads are parsed by
+ * the main thread, and the complete entries are queued to the worker as part of a stream, which keeps the writer
+ * for the host open while the upload lasts. */
+
+#define REMOTE_WORKERS_MAX 256U
+
+/* When this much entry data is queued to a worker, the main thread stops reading from the connections feeding it
+ * until the worker caught up again. */
+#define REMOTE_WORKER_QUEUE_HIGH (16U*1024U*1024U)
+#define REMOTE_WORKER_QUEUE_LOW (REMOTE_WORKER_QUEUE_HIGH / 2)
+
+int remote_worker_new(RemoteServer *s, unsigned idx, RemoteWorker **ret);
+RemoteWorker* remote_worker_free(RemoteWorker *w);
+DEFINE_TRIVIAL_CLEANUP_FUNC(RemoteWorker*, remote_worker_free);
+
+int remote_worker_start(RemoteWorker *w);
+void remote_worker_stop(RemoteWorker *w);
+
+uint64_t remote_worker_event_count(RemoteWorker *w);
+
+int remote_worker_add_source(RemoteWorker *w, int fd, const char *name);
+
+int remote_worker_open_stream(RemoteWorker *w, const char *host, RemoteWorkerStream **ret);
+void remote_worker_close_stream(RemoteWorker *w, RemoteWorkerStream *stream);
+int remote_worker_queue_entry(RemoteWorker *w, RemoteWorkerStream *stream, struct iovec_wrapper *iovw, const dual_timestamp *ts);
+
+size_t remote_worker_queued_bytes(RemoteWorker *w);
+bool remote_worker_congested(RemoteWorker *w, void *waiter);
+void remote_worker_collect(RemoteWorker *w, bool force, size_t *ret_done, void ***ret_waiters, size_t *ret_n_waiters);
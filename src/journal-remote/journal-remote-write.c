@@ -79,8 +79,9 @@ int writer_write(Writer *w,
                                       iovw->iovec, iovw->count,
                                       &w->seqnum, NULL, NULL);
         if (r >= 0) {
+                /* Read by the main thread when the writer belongs to a worker */
                 if (w->server)
-                        w->server->event_count += 1;
+                        __atomic_add_fetch(&w->server->event_count, 1, __ATOMIC_RELAXED);
                 return 0;
         } else if (r == -EBADMSG)
                 return r;
@@ -100,6 +101,6 @@ int writer_write(Writer *w,
                 return r;
 
         if (w->server)
-                w->server->event_count += 1;
+                __atomic_add_fetch(&w->server->event_count, 1, __ATOMIC_RELAXED);
         return 0;
 }
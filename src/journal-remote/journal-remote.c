@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/prctl.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <stdint.h>
 
@@ -22,6 +23,7 @@
 #include "macro.h"
 #include "parse-util.h"
 #include "process-util.h"
+#include "siphash24.h"
 #include "socket-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
@@ -187,6 +189,8 @@ static int get_source_for_fd(RemoteServer *s,
                         return log_oom();
                 }
 
+                s->sources[fd]->server = s;
+
                 s->active++;
         }
 
@@ -221,6 +225,17 @@ int journal_remote_add_source(RemoteServer *s, int fd, char* name, bool own_name
         assert(fd >= 0);
         assert(name);
 
+        if (s->n_workers > 0) {
+                r = remote_worker_add_source(journal_remote_get_worker(s, name), fd, name);
+                if (own_name)
+                        free(name);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to hand over fd:%d to worker: %m", fd);
+
+                s->active++;
+                return 1; /* work to do */
+        }
+
         if (!own_name) {
                 name = strdup(name);
                 if (!name)
@@ -313,6 +328,7 @@ int journal_remote_server_init(
         assert(journal_remote_server_global == NULL);
         journal_remote_server_global = s;
 
+        s->worker_notify_fd = -1;
         s->split_mode = split_mode;
         s->compress = compress;
         s->seal = seal;
@@ -337,6 +353,153 @@ int journal_remote_server_init(
         return 0;
 }
 
+int journal_remote_server_init_shard(RemoteServer *shard, RemoteServer *s) {
+        int r;
+
+        assert(shard);
+        assert(s);
+
+        /* A shard is a server of its own, run by a worker on its own event loop */
+
+        shard->worker_notify_fd = -1;
+        shard->split_mode = s->split_mode;
+        shard->compress = s->compress;
+        shard->seal = s->seal;
+        shard->output = s->output;
+
+        r = sd_event_new(&shard->events);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate event loop: %m");
+
+        return init_writer_hashmap(shard);
+}
+
+static void resume_waiters(void **waiters, size_t n_waiters) {
+#if HAVE_MICROHTTPD
+        size_t i;
+
+        for (i = 0; i < n_waiters; i++) {
+                log_debug("Resuming connection %p", waiters[i]);
+                MHD_resume_connection(waiters[i]);
+        }
+#endif
+}
+
+static int dispatch_worker_notify(sd_event_source *event,
+                                  int fd,
+                                  uint32_t revents,
+                                  void *userdata) {
+        RemoteServer *s = userdata;
+        eventfd_t x;
+        unsigned i;
+
+        assert(s);
+
+        (void) eventfd_read(fd, &x);
+
+        for (i = 0; i < s->n_workers; i++) {
+                _cleanup_free_ void **waiters = NULL;
+                size_t done, n_waiters;
+
+                remote_worker_collect(s->workers[i], false, &done, &waiters, &n_waiters);
+
+                assert(s->active >= done);
+                s->active -= done;
+
+                resume_waiters(waiters, n_waiters);
+        }
+
+        log_debug("%zu active sources remaining", s->active);
+        return 0;
+}
+
+int journal_remote_server_setup_workers(RemoteServer *s, unsigned n_workers) {
+        int r;
+
+        assert(s);
+        assert(s->n_workers == 0);
+
+        if (n_workers == 0)
+                return 0;
+
+        /* With a single output file there is only a single writer, and nothing to distribute */
+        if (s->split_mode == JOURNAL_WRITE_SPLIT_NONE && n_workers > 1) {
+                log_debug("Only using a single worker with SplitMode=none.");
+                n_workers = 1;
+        }
+
+        s->worker_notify_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+        if (s->worker_notify_fd < 0)
+                return log_error_errno(errno, "Failed to create eventfd: %m");
+
+        r = sd_event_add_io(s->events, &s->worker_notify_event,
+                            s->worker_notify_fd, EPOLLIN,
+                            dispatch_worker_notify, s);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add worker notification event source: %m");
+
+        (void) sd_event_source_set_description(s->worker_notify_event, "worker-notify");
+
+        s->workers = new0(RemoteWorker*, n_workers);
+        if (!s->workers)
+                return log_oom();
+
+        for (; s->n_workers < n_workers; s->n_workers++) {
+                r = remote_worker_new(s, s->n_workers, s->workers + s->n_workers);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int journal_remote_server_start_workers(RemoteServer *s) {
+        unsigned i;
+        int r;
+
+        assert(s);
+
+        for (i = 0; i < s->n_workers; i++) {
+                r = remote_worker_start(s->workers[i]);
+                if (r < 0)
+                        return r;
+        }
+
+        if (s->n_workers > 0)
+                log_debug("Started %u worker threads.", s->n_workers);
+
+        return 0;
+}
+
+RemoteWorker* journal_remote_get_worker(RemoteServer *s, const char *host) {
+        /* Fixed, so that a host always ends up with the same worker for the same number of workers */
+        static const uint8_t hash_key[16] = {
+                0x3c, 0x0b, 0x58, 0x8e, 0x53, 0x2f, 0x4d, 0x77,
+                0x9e, 0x1d, 0x6a, 0xb3, 0x45, 0xc8, 0x10, 0xe2,
+        };
+
+        assert(s);
+        assert(s->n_workers > 0);
+
+        if (s->split_mode == JOURNAL_WRITE_SPLIT_NONE || !host)
+                return s->workers[0];
+
+        return s->workers[siphash24_string(host, hash_key) % s->n_workers];
+}
+
+uint64_t journal_remote_server_event_count(RemoteServer *s) {
+        uint64_t n;
+        unsigned i;
+
+        assert(s);
+
+        n = s->event_count;
+        for (i = 0; i < s->n_workers; i++)
+                n += remote_worker_event_count(s->workers[i]);
+
+        return n;
+}
+
 #if HAVE_MICROHTTPD
 static void MHDDaemonWrapper_free(MHDDaemonWrapper *d) {
         MHD_stop_daemon(d->daemon);
@@ -349,10 +512,26 @@ static void MHDDaemonWrapper_free(MHDDaemonWrapper *d) {
 RemoteServer* journal_remote_server_destroy(RemoteServer *s) {
         size_t i;
 
+        /* µhttpd refuses to stop with suspended connections */
+        for (i = 0; i < s->n_workers; i++) {
+                _cleanup_free_ void **waiters = NULL;
+                size_t done, n_waiters;
+
+                remote_worker_collect(s->workers[i], true, &done, &waiters, &n_waiters);
+                resume_waiters(waiters, n_waiters);
+        }
+
 #if HAVE_MICROHTTPD
         hashmap_free_with_destructor(s->daemons, MHDDaemonWrapper_free);
 #endif
 
+        /* This flushes what the connections queued up before they were closed */
+        for (i = 0; i < s->n_workers; i++)
+                remote_worker_free(s->workers[i]);
+        free(s->workers);
+        sd_event_source_unref(s->worker_notify_event);
+        safe_close(s->worker_notify_fd);
+
         assert(s->sources_size == 0 || s->sources);
         for (i = 0; i < s->sources_size; i++)
                 remove_source(s, i);
@@ -428,7 +607,7 @@ static int dispatch_raw_source_until_block(sd_event_source *event,
         /* Make sure event stays around even if source is destroyed */
         sd_event_source_ref(event);
 
-        r = journal_remote_handle_raw_source(event, source->importer.fd, EPOLLIN, journal_remote_server_global);
+        r = journal_remote_handle_raw_source(event, source->importer.fd, EPOLLIN, source->server);
         if (r != 1)
                 /* No more data for now */
                 sd_event_source_set_enabled(event, SD_EVENT_OFF);
@@ -448,7 +627,7 @@ static int dispatch_raw_source_event(sd_event_source *event,
         assert(source->event);
         assert(source->buffer_event);
 
-        r = journal_remote_handle_raw_source(event, fd, EPOLLIN, journal_remote_server_global);
+        r = journal_remote_handle_raw_source(event, fd, EPOLLIN, source->server);
         if (r == 1)
                 /* Might have more data. We need to rerun the handler
                  * until we are sure the buffer is exhausted. */
@@ -461,7 +640,7 @@ static int dispatch_blocking_source_event(sd_event_source *event,
                                           void *userdata) {
         RemoteSource *source = userdata;
 
-        return journal_remote_handle_raw_source(event, source->importer.fd, EPOLLIN, journal_remote_server_global);
+        return journal_remote_handle_raw_source(event, source->importer.fd, EPOLLIN, source->server);
 }
 
 static int accept_connection(const char* type, int fd,
@@ -5,6 +5,7 @@
 
 #include "hashmap.h"
 #include "journal-remote-parse.h"
+#include "journal-remote-worker.h"
 #include "journal-remote-write.h"
 
 #if HAVE_MICROHTTPD
@@ -42,6 +43,12 @@ struct RemoteServer {
         bool compress;
         bool seal;
         bool check_trust;
+
+        /* If set, sources are sharded to worker threads by host, see Workers= */
+        RemoteWorker **workers;
+        unsigned n_workers;
+        int worker_notify_fd;
+        sd_event_source *worker_notify_event;
 };
 extern RemoteServer *journal_remote_server_global;
 
@@ -51,6 +58,12 @@ int journal_remote_server_init(
                 JournalWriteSplitMode split_mode,
                 bool compress,
                 bool seal);
+int journal_remote_server_init_shard(RemoteServer *shard, RemoteServer *s);
+int journal_remote_server_setup_workers(RemoteServer *s, unsigned n_workers);
+int journal_remote_server_start_workers(RemoteServer *s);
+
+RemoteWorker* journal_remote_get_worker(RemoteServer *s, const char *host);
+uint64_t journal_remote_server_event_count(RemoteServer *s);
 
 int journal_remote_get_writer(RemoteServer *s, const char *host, Writer **writer);
 
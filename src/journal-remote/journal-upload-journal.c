@@ -12,6 +12,22 @@
 #include "utf8.h"
 #include "util.h"
 
+void check_update_watchdog(Uploader *u) {
+        usec_t after;
+        usec_t elapsed_time;
+
+        if (u->watchdog_usec <= 0)
+                return;
+
+        after = now(CLOCK_MONOTONIC);
+        elapsed_time = usec_sub_unsigned(after, u->watchdog_timestamp);
+        if (elapsed_time > u->watchdog_usec / 2) {
+                log_debug("Update watchdog timer");
+                sd_notify(false, "WATCHDOG=1");
+                u->watchdog_timestamp = after;
+        }
+}
+
 /**
  * Write up to size bytes to buf. Return negative on error, and number of
  * bytes written otherwise. The last case is a kind of an error too.
@@ -236,43 +252,43 @@ static ssize_t write_entry(char *buf, size_t size, Uploader *u) {
         assert_not_reached("WTF?");
 }
 
-static inline void check_update_watchdog(Uploader *u) {
-        usec_t after;
-        usec_t elapsed_time;
-
-        if (u->watchdog_usec <= 0)
-                return;
+/* Chosen so that any of the lines which are written as a whole fit */
+#define BATCH_BUFFER_MIN (16U*1024U)
 
-        after = now(CLOCK_MONOTONIC);
-        elapsed_time = usec_sub_unsigned(after, u->watchdog_timestamp);
-        if (elapsed_time > u->watchdog_usec / 2) {
-                log_debug("Update watchdog timer");
-                sd_notify(false, "WATCHDOG=1");
-                u->watchdog_timestamp = after;
-        }
-}
+int read_journal_batch(Uploader *u,
+                       size_t max_entries,
+                       size_t max_size,
+                       char **ret,
+                       size_t *ret_size,
+                       size_t *ret_n_entries) {
 
-static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
-        Uploader *u = userp;
+        _cleanup_free_ char *buf = NULL;
+        size_t allocated = 0, filled = 0, n = 0;
         int r;
-        sd_journal *j;
-        size_t filled = 0;
-        ssize_t w;
 
         assert(u);
-        assert(nmemb <= SSIZE_MAX / size);
+        assert(max_entries > 0);
+        assert(ret);
+        assert(ret_size);
+        assert(ret_n_entries);
+
+        /* Serializes entries starting at the current one, until the batch has max_entries entries or is at
+         * least max_size bytes long, or we run out of entries. Entries are never split between batches. Returns
+         * 0 if there were no entries to read. */
 
         check_update_watchdog(u);
 
-        j = u->journal;
+        while (u->journal) {
+                ssize_t w;
 
-        while (j && filled < size * nmemb) {
                 if (u->entry_state == ENTRY_DONE) {
-                        r = sd_journal_next(j);
-                        if (r < 0) {
-                                log_error_errno(r, "Failed to move to next entry in journal: %m");
-                                return CURL_READFUNC_ABORT;
-                        } else if (r == 0) {
+                        if (n >= max_entries || filled >= max_size)
+                                break;
+
+                        r = sd_journal_next(u->journal);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to move to next entry in journal: %m");
+                        if (r == 0) {
                                 if (u->input_event)
                                         log_debug("No more entries, waiting for journal.");
                                 else {
@@ -288,23 +304,32 @@ static size_t journal_input_callback(void *buf, size_t size, size_t nmemb, void
                         u->entry_state = ENTRY_CURSOR;
                 }
 
-                w = write_entry((char*)buf + filled, size * nmemb - filled, u);
-                if (w < 0)
-                        return CURL_READFUNC_ABORT;
-                filled += w;
+                if (!GREEDY_REALLOC(buf, allocated, filled + BATCH_BUFFER_MIN))
+                        return log_oom();
 
-                if (filled == 0) {
+                w = write_entry(buf + filled, allocated - filled, u);
+                if (w < 0)
+                        return w;
+                if (w == 0) {
                         log_error("Buffer space is too small to write entry.");
-                        return CURL_READFUNC_ABORT;
-                } else if (u->entry_state != ENTRY_DONE)
-                        /* This means that all available space was used up */
-                        break;
+                        return -ENOBUFS;
+                }
+                filled += w;
 
-                log_debug("Entry %zu (%s) has been uploaded.",
-                          u->entries_sent, u->current_cursor);
+                if (u->entry_state == ENTRY_DONE) {
+                        log_debug("Entry %zu (%s) has been read.",
+                                  u->entries_sent, u->current_cursor);
+                        n++;
+                }
         }
 
-        return filled;
+        if (n == 0)
+                return 0;
+
+        *ret = TAKE_PTR(buf);
+        *ret_size = filled;
+        *ret_n_entries = n;
+        return 1;
 }
 
 void close_journal_input(Uploader *u) {
@@ -331,9 +356,10 @@ static int process_journal_input(Uploader *u, int skip) {
         else if (r < skip)
                 return 0;
 
-        /* have data */
+        /* have data, the batches are read from the journal as they are uploaded */
         u->entry_state = ENTRY_CURSOR;
-        return start_upload(u, journal_input_callback, u);
+        u->uploading = true;
+        return 0;
 }
 
 int check_journal_input(Uploader *u) {
@@ -9,6 +9,7 @@
 #include "sd-daemon.h"
 
 #include "alloc-util.h"
+#include "compress.h"
 #include "conf-parser.h"
 #include "def.h"
 #include "fd-util.h"
@@ -24,6 +25,7 @@
 #include "rlimit-util.h"
 #include "sigbus.h"
 #include "signal-util.h"
+#include "string-table.h"
 #include "string-util.h"
 #include "util.h"
 
@@ -32,6 +34,10 @@
 #define TRUST_FILE    CERTIFICATE_ROOT "/ca/trusted.pem"
 #define DEFAULT_PORT  19532
 
+#define DEFAULT_BATCH_ENTRIES 1024U
+#define DEFAULT_BATCH_SIZE    (1024U*1024U)
+#define MAX_IN_FLIGHT         64U
+
 static const char* arg_url = NULL;
 static const char *arg_key = NULL;
 static const char *arg_cert = NULL;
@@ -45,6 +51,10 @@ static const char *arg_machine = NULL;
 static bool arg_merge = false;
 static int arg_follow = -1;
 static const char *arg_save_state = NULL;
+static unsigned arg_batch_entries = DEFAULT_BATCH_ENTRIES;
+static size_t arg_batch_size = DEFAULT_BATCH_SIZE;
+static int arg_compression = 0;
+static unsigned arg_max_in_flight = 1;
 
 static void close_fd_input(Uploader *u);
 
@@ -52,6 +62,61 @@ static void close_fd_input(Uploader *u);
 
 #define STATE_FILE "/var/lib/systemd/journal-upload/state"
 
+/* The names used for the Content-Encoding header */
+static const char* const upload_compression_table[_OBJECT_COMPRESSED_MAX] = {
+        [0] = "none",
+        [OBJECT_COMPRESSED_LZ4] = "lz4",
+        [OBJECT_COMPRESSED_ZSTD] = "zstd",
+};
+
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP(upload_compression, int);
+static DEFINE_CONFIG_PARSE_ENUM(config_parse_upload_compression,
+                                upload_compression,
+                                int,
+                                "Failed to parse compression");
+
+struct UploadBatch {
+        Uploader *uploader;
+
+        CURL *easy;
+        char error[CURL_ERROR_SIZE];
+        char *answer;
+
+        char *data;
+        size_t size;
+        size_t n_entries;
+
+        /* The cursor of the last entry in the batch */
+        char *cursor;
+
+        /* Whether the server acknowledged the batch */
+        bool done;
+
+        LIST_FIELDS(UploadBatch, batches);
+};
+
+static UploadBatch* upload_batch_free(UploadBatch *b) {
+        if (!b)
+                return NULL;
+
+        if (b->uploader) {
+                LIST_REMOVE(batches, b->uploader->batches, b);
+                b->uploader->n_batches--;
+
+                if (b->easy)
+                        (void) curl_multi_remove_handle(b->uploader->multi, b->easy);
+        }
+
+        curl_easy_cleanup(b->easy);
+        free(b->answer);
+        free(b->data);
+        free(b->cursor);
+
+        return mfree(b);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(UploadBatch*, upload_batch_free);
+
 #define easy_setopt(curl, opt, value, level, cmd)                       \
         do {                                                            \
                 code = curl_easy_setopt(curl, opt, value);              \
@@ -63,20 +128,22 @@ static void close_fd_input(Uploader *u);
                 }                                                       \
         } while (0)
 
+DEFINE_TRIVIAL_CLEANUP_FUNC(CURL*, curl_easy_cleanup);
+
 static size_t output_callback(char *buf,
                               size_t size,
                               size_t nmemb,
                               void *userp) {
-        Uploader *u = userp;
+        char **answer = userp;
 
-        assert(u);
+        assert(answer);
 
         log_debug("The server answers (%zu bytes): %.*s",
                   size*nmemb, (int)(size*nmemb), buf);
 
-        if (nmemb && !u->answer) {
-                u->answer = strndup(buf, size*nmemb);
-                if (!u->answer)
+        if (nmemb && !*answer) {
+                *answer = strndup(buf, size*nmemb);
+                if (!*answer)
                         log_warning_errno(ENOMEM, "Failed to store server answer (%zu bytes): %m",
                                           size*nmemb);
         }
@@ -161,6 +228,74 @@ static int load_cursor_state(Uploader *u) {
         return 0;
 }
 
+static int upload_easy_new(Uploader *u,
+                           char *error,
+                           char **answer,
+                           struct curl_slist *header,
+                           CURL **ret) {
+
+        _cleanup_(curl_easy_cleanupp) CURL *curl = NULL;
+        CURLcode code;
+
+        assert(u);
+        assert(error);
+        assert(answer);
+        assert(ret);
+
+        curl = curl_easy_init();
+        if (!curl) {
+                log_error("Call to curl_easy_init failed.");
+                return -ENOSR;
+        }
+
+        /* tell it to POST to the URL */
+        easy_setopt(curl, CURLOPT_POST, 1L,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(curl, CURLOPT_ERRORBUFFER, error,
+                    LOG_ERR, return -EXFULL);
+
+        /* set where to write to */
+        easy_setopt(curl, CURLOPT_WRITEFUNCTION, output_callback,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(curl, CURLOPT_WRITEDATA, answer,
+                    LOG_ERR, return -EXFULL);
+
+        /* use our special own mime type */
+        easy_setopt(curl, CURLOPT_HTTPHEADER, header,
+                    LOG_ERR, return -EXFULL);
+
+        if (DEBUG_LOGGING)
+                /* enable verbose for easier tracing */
+                easy_setopt(curl, CURLOPT_VERBOSE, 1L, LOG_WARNING, );
+
+        easy_setopt(curl, CURLOPT_USERAGENT,
+                    "systemd-journal-upload " PACKAGE_STRING,
+                    LOG_WARNING, );
+
+        if (arg_key || startswith(u->url, "https://")) {
+                easy_setopt(curl, CURLOPT_SSLKEY, arg_key ?: PRIV_KEY_FILE,
+                            LOG_ERR, return -EXFULL);
+                easy_setopt(curl, CURLOPT_SSLCERT, arg_cert ?: CERT_FILE,
+                            LOG_ERR, return -EXFULL);
+        }
+
+        if (streq_ptr(arg_trust, "all"))
+                easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0,
+                            LOG_ERR, return -EUCLEAN);
+        else if (arg_trust || startswith(u->url, "https://"))
+                easy_setopt(curl, CURLOPT_CAINFO, arg_trust ?: TRUST_FILE,
+                            LOG_ERR, return -EXFULL);
+
+        if (arg_key || arg_trust)
+                easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1,
+                            LOG_WARNING, );
+
+        *ret = TAKE_PTR(curl);
+        return 0;
+}
+
 int start_upload(Uploader *u,
                  size_t (*input_callback)(void *ptr,
                                           size_t size,
@@ -195,27 +330,12 @@ int start_upload(Uploader *u,
         }
 
         if (!u->easy) {
-                CURL *curl;
-
-                curl = curl_easy_init();
-                if (!curl) {
-                        log_error("Call to curl_easy_init failed.");
-                        return -ENOSR;
-                }
-
-                /* tell it to POST to the URL */
-                easy_setopt(curl, CURLOPT_POST, 1L,
-                            LOG_ERR, return -EXFULL);
-
-                easy_setopt(curl, CURLOPT_ERRORBUFFER, u->error,
-                            LOG_ERR, return -EXFULL);
-
-                /* set where to write to */
-                easy_setopt(curl, CURLOPT_WRITEFUNCTION, output_callback,
-                            LOG_ERR, return -EXFULL);
+                _cleanup_(curl_easy_cleanupp) CURL *curl = NULL;
+                int r;
 
-                easy_setopt(curl, CURLOPT_WRITEDATA, data,
-                            LOG_ERR, return -EXFULL);
+                r = upload_easy_new(u, u->error, &u->answer, u->header, &curl);
+                if (r < 0)
+                        return r;
 
                 /* set where to read from */
                 easy_setopt(curl, CURLOPT_READFUNCTION, input_callback,
@@ -224,37 +344,7 @@ int start_upload(Uploader *u,
                 easy_setopt(curl, CURLOPT_READDATA, data,
                             LOG_ERR, return -EXFULL);
 
-                /* use our special own mime type and chunked transfer */
-                easy_setopt(curl, CURLOPT_HTTPHEADER, u->header,
-                            LOG_ERR, return -EXFULL);
-
-                if (DEBUG_LOGGING)
-                        /* enable verbose for easier tracing */
-                        easy_setopt(curl, CURLOPT_VERBOSE, 1L, LOG_WARNING, );
-
-                easy_setopt(curl, CURLOPT_USERAGENT,
-                            "systemd-journal-upload " PACKAGE_STRING,
-                            LOG_WARNING, );
-
-                if (arg_key || startswith(u->url, "https://")) {
-                        easy_setopt(curl, CURLOPT_SSLKEY, arg_key ?: PRIV_KEY_FILE,
-                                    LOG_ERR, return -EXFULL);
-                        easy_setopt(curl, CURLOPT_SSLCERT, arg_cert ?: CERT_FILE,
-                                    LOG_ERR, return -EXFULL);
-                }
-
-                if (streq_ptr(arg_trust, "all"))
-                        easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0,
-                                    LOG_ERR, return -EUCLEAN);
-                else if (arg_trust || startswith(u->url, "https://"))
-                        easy_setopt(curl, CURLOPT_CAINFO, arg_trust ?: TRUST_FILE,
-                                    LOG_ERR, return -EXFULL);
-
-                if (arg_key || arg_trust)
-                        easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1,
-                                    LOG_WARNING, );
-
-                u->easy = curl;
+                u->easy = TAKE_PTR(curl);
         } else {
                 /* truncate the potential old error message */
                 u->error[0] = '\0';
@@ -450,6 +540,11 @@ static int setup_uploader(Uploader *u, const char *url, const char *state_file)
 static void destroy_uploader(Uploader *u) {
         assert(u);
 
+        while (u->batches)
+                upload_batch_free(u->batches);
+        curl_multi_cleanup(u->multi);
+        curl_slist_free_all(u->batch_header);
+
         curl_easy_cleanup(u->easy);
         curl_slist_free_all(u->header);
         free(u->answer);
@@ -469,25 +564,29 @@ static void destroy_uploader(Uploader *u) {
         sd_event_unref(u->events);
 }
 
-static int perform_upload(Uploader *u) {
+static int check_upload_result(Uploader *u,
+                               CURL *easy,
+                               CURLcode result,
+                               const char *error,
+                               const char *answer) {
         CURLcode code;
         long status;
 
         assert(u);
+        assert(easy);
+        assert(error);
 
-        u->watchdog_timestamp = now(CLOCK_MONOTONIC);
-        code = curl_easy_perform(u->easy);
-        if (code) {
-                if (u->error[0])
+        if (result) {
+                if (error[0])
                         log_error("Upload to %s failed: %.*s",
-                                  u->url, (int) sizeof(u->error), u->error);
+                                  u->url, CURL_ERROR_SIZE, error);
                 else
                         log_error("Upload to %s failed: %s",
-                                  u->url, curl_easy_strerror(code));
+                                  u->url, curl_easy_strerror(result));
                 return -EIO;
         }
 
-        code = curl_easy_getinfo(u->easy, CURLINFO_RESPONSE_CODE, &status);
+        code = curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
         if (code) {
                 log_error("Failed to retrieve response code: %s",
                           curl_easy_strerror(code));
@@ -496,27 +595,261 @@ static int perform_upload(Uploader *u) {
 
         if (status >= 300) {
                 log_error("Upload to %s failed with code %ld: %s",
-                          u->url, status, strna(u->answer));
+                          u->url, status, strna(answer));
                 return -EIO;
         } else if (status < 200) {
                 log_error("Upload to %s finished with unexpected code %ld: %s",
-                          u->url, status, strna(u->answer));
+                          u->url, status, strna(answer));
                 return -EIO;
         } else
                 log_debug("Upload finished successfully with code %ld: %s",
-                          status, strna(u->answer));
+                          status, strna(answer));
+
+        return 0;
+}
+
+static int perform_upload(Uploader *u) {
+        CURLcode code;
+        int r;
+
+        assert(u);
+
+        u->watchdog_timestamp = now(CLOCK_MONOTONIC);
+        code = curl_easy_perform(u->easy);
+
+        r = check_upload_result(u, u->easy, code, u->error, u->answer);
+        if (r < 0)
+                return r;
 
         free_and_replace(u->last_cursor, u->current_cursor);
 
         return update_cursor_state(u);
 }
 
+static int setup_batch_upload(Uploader *u) {
+        const char *headers[] = {
+                "Content-Type: application/vnd.fdo.journal",
+                "Accept: text/plain",
+                /* The whole batch is sent right away, don't wait for a "100 Continue" first */
+                "Expect:",
+                NULL,
+        };
+        struct curl_slist *h = NULL;
+        CURLMcode mcode;
+        size_t i;
+
+        assert(u);
+
+        if (u->multi)
+                return 0;
+
+        if (arg_compression != 0)
+                headers[ELEMENTSOF(headers) - 1] =
+                        strjoina("Content-Encoding: ", upload_compression_to_string(arg_compression));
+
+        for (i = 0; i < ELEMENTSOF(headers) && headers[i]; i++) {
+                struct curl_slist *n;
+
+                n = curl_slist_append(h, headers[i]);
+                if (!n) {
+                        curl_slist_free_all(h);
+                        return log_oom();
+                }
+
+                h = n;
+        }
+
+        u->batch_header = h;
+
+        u->multi = curl_multi_init();
+        if (!u->multi) {
+                log_error("Call to curl_multi_init failed.");
+                return -ENOSR;
+        }
+
+        /* Batches are sent over separate connections, or multiplexed over one if the server speaks HTTP/2 */
+        mcode = curl_multi_setopt(u->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        if (mcode)
+                log_warning("curl_multi_setopt CURLMOPT_PIPELINING failed: %s",
+                            curl_multi_strerror(mcode));
+
+        mcode = curl_multi_setopt(u->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) arg_max_in_flight);
+        if (mcode)
+                log_warning("curl_multi_setopt CURLMOPT_MAX_HOST_CONNECTIONS failed: %s",
+                            curl_multi_strerror(mcode));
+
+        return 0;
+}
+
+static int queue_batch(Uploader *u) {
+        _cleanup_(upload_batch_freep) UploadBatch *b = NULL;
+        CURLMcode mcode;
+        CURLcode code;
+        int r;
+
+        assert(u);
+
+        b = new0(UploadBatch, 1);
+        if (!b)
+                return log_oom();
+
+        r = read_journal_batch(u, arg_batch_entries, arg_batch_size, &b->data, &b->size, &b->n_entries);
+        if (r <= 0)
+                return r;
+
+        b->cursor = strdup(u->current_cursor);
+        if (!b->cursor)
+                return log_oom();
+
+        if (arg_compression != 0) {
+                _cleanup_free_ void *c = NULL;
+                size_t c_size;
+
+                r = compress_frame(arg_compression, b->data, b->size, &c, &c_size);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to compress batch: %m");
+
+                log_debug("Compressed batch of %zu entries with %s, %zu → %zu bytes",
+                          b->n_entries, upload_compression_to_string(arg_compression), b->size, c_size);
+
+                free_and_replace(b->data, c);
+                b->size = c_size;
+        }
+
+        r = upload_easy_new(u, b->error, &b->answer, u->batch_header, &b->easy);
+        if (r < 0)
+                return r;
+
+        easy_setopt(b->easy, CURLOPT_URL, u->url,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(b->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) b->size,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(b->easy, CURLOPT_POSTFIELDS, b->data,
+                    LOG_ERR, return -EXFULL);
+
+        easy_setopt(b->easy, CURLOPT_PRIVATE, b,
+                    LOG_ERR, return -EXFULL);
+
+        mcode = curl_multi_add_handle(u->multi, b->easy);
+        if (mcode) {
+                log_error("curl_multi_add_handle failed: %s", curl_multi_strerror(mcode));
+                return -EXFULL;
+        }
+
+        b->uploader = u;
+        LIST_APPEND(batches, u->batches, b);
+        u->n_batches++;
+
+        log_debug("Queued batch of %zu entries (%zu bytes) up to %s, %u batches in flight.",
+                  b->n_entries, b->size, b->cursor, u->n_batches);
+
+        TAKE_PTR(b);
+        return 1;
+}
+
+static int dispatch_batches(Uploader *u) {
+        bool acknowledged = false;
+        int running, n_msgs, r;
+        UploadBatch *b;
+        CURLMcode mcode;
+        CURLMsg *msg;
+
+        assert(u);
+
+        u->watchdog_timestamp = now(CLOCK_MONOTONIC);
+
+        mcode = curl_multi_perform(u->multi, &running);
+        if (mcode) {
+                log_error("curl_multi_perform failed: %s", curl_multi_strerror(mcode));
+                return -EIO;
+        }
+
+        while ((msg = curl_multi_info_read(u->multi, &n_msgs))) {
+                char *p;
+
+                if (msg->msg != CURLMSG_DONE)
+                        continue;
+
+                assert_se(curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &p) == CURLE_OK);
+                b = (UploadBatch*) p;
+
+                r = check_upload_result(u, b->easy, msg->data.result, b->error, b->answer);
+                if (r < 0)
+                        return r;
+
+                b->done = true;
+        }
+
+        /* Batches may complete in any order, but the cursor only moves past those that were acknowledged
+         * together with all earlier ones. Should we be interrupted, the later ones are sent again. */
+        while ((b = u->batches) && b->done) {
+                log_debug("Batch of %zu entries up to %s has been uploaded.", b->n_entries, b->cursor);
+
+                free_and_replace(u->last_cursor, b->cursor);
+                upload_batch_free(b);
+                acknowledged = true;
+        }
+
+        if (acknowledged) {
+                r = update_cursor_state(u);
+                if (r < 0)
+                        return r;
+        }
+
+        if (running > 0) {
+                mcode = curl_multi_wait(u->multi, NULL, 0, 1000, NULL);
+                if (mcode) {
+                        log_error("curl_multi_wait failed: %s", curl_multi_strerror(mcode));
+                        return -EIO;
+                }
+        }
+
+        check_update_watchdog(u);
+        return 0;
+}
+
+static int upload_journal(Uploader *u) {
+        int r;
+
+        assert(u);
+
+        /* Keeps up to arg_max_in_flight batches on the way, and returns once everything that was available in the
+         * journal has been acknowledged by the server. */
+
+        r = setup_batch_upload(u);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                while (u->uploading && u->n_batches < arg_max_in_flight) {
+                        r = queue_batch(u);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                break;
+                }
+
+                if (u->n_batches == 0)
+                        return 0;
+
+                r = dispatch_batches(u);
+                if (r < 0)
+                        return r;
+        }
+}
+
 static int parse_config(void) {
         const ConfigTableItem items[] = {
                 { "Upload",  "URL",                    config_parse_string, 0, &arg_url    },
                 { "Upload",  "ServerKeyFile",          config_parse_path,   0, &arg_key    },
                 { "Upload",  "ServerCertificateFile",  config_parse_path,   0, &arg_cert   },
                 { "Upload",  "TrustedCertificateFile", config_parse_path,   0, &arg_trust  },
+                { "Upload",  "BatchEntries",           config_parse_unsigned, 0, &arg_batch_entries },
+                { "Upload",  "BatchSize",              config_parse_iec_size, 0, &arg_batch_size },
+                { "Upload",  "Compression",            config_parse_upload_compression, 0, &arg_compression },
+                { "Upload",  "MaxInFlight",            config_parse_unsigned, 0, &arg_max_in_flight },
                 {}};
 
         return config_parse_many_nulstr(PKGSYSCONFDIR "/journal-upload.conf",
@@ -556,6 +889,11 @@ static int help(void) {
                "     --follow[=BOOL]        Do [not] wait for input\n"
                "     --save-state[=FILE]    Save uploaded cursors (default \n"
                "                            " STATE_FILE ")\n"
+               "     --batch-entries=N      Upload at most this many entries per request\n"
+               "     --batch-size=BYTES     Upload at most about this much data per request\n"
+               "     --compression=none|lz4|zstd\n"
+               "                            Compress uploaded journal entries\n"
+               "     --max-in-flight=N      Number of requests to have on the way at a time\n"
                "\nSee the %s for details.\n"
                , program_invocation_short_name
                , link
@@ -577,6 +915,10 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_AFTER_CURSOR,
                 ARG_FOLLOW,
                 ARG_SAVE_STATE,
+                ARG_BATCH_ENTRIES,
+                ARG_BATCH_SIZE,
+                ARG_COMPRESSION,
+                ARG_MAX_IN_FLIGHT,
         };
 
         static const struct option options[] = {
@@ -596,6 +938,10 @@ static int parse_argv(int argc, char *argv[]) {
                 { "after-cursor", required_argument, NULL, ARG_AFTER_CURSOR   },
                 { "follow",       optional_argument, NULL, ARG_FOLLOW         },
                 { "save-state",   optional_argument, NULL, ARG_SAVE_STATE     },
+                { "batch-entries", required_argument, NULL, ARG_BATCH_ENTRIES },
+                { "batch-size",   required_argument, NULL, ARG_BATCH_SIZE     },
+                { "compression",  required_argument, NULL, ARG_COMPRESSION    },
+                { "max-in-flight", required_argument, NULL, ARG_MAX_IN_FLIGHT },
                 {}
         };
 
@@ -723,6 +1069,39 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_save_state = optarg ?: STATE_FILE;
                         break;
 
+                case ARG_BATCH_ENTRIES:
+                        r = safe_atou(optarg, &arg_batch_entries);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to parse --batch-entries= parameter: %s", optarg);
+                        break;
+
+                case ARG_BATCH_SIZE: {
+                        uint64_t sz;
+
+                        r = parse_size(optarg, 1024, &sz);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to parse --batch-size= parameter: %s", optarg);
+
+                        arg_batch_size = MIN(sz, (uint64_t) SIZE_MAX);
+                        break;
+                }
+
+                case ARG_COMPRESSION:
+                        r = upload_compression_from_string(optarg);
+                        if (r < 0) {
+                                log_error("Failed to parse --compression= parameter: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        arg_compression = r;
+                        break;
+
+                case ARG_MAX_IN_FLIGHT:
+                        r = safe_atou(optarg, &arg_max_in_flight);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to parse --max-in-flight= parameter: %s", optarg);
+                        break;
+
                 case '?':
                         log_error("Unknown option %s.", argv[optind-1]);
                         return -EINVAL;
@@ -750,6 +1129,22 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
+        if (arg_batch_entries == 0 || arg_batch_size == 0) {
+                log_error("Batches must not be empty.");
+                return -EINVAL;
+        }
+
+        if (arg_max_in_flight == 0 || arg_max_in_flight > MAX_IN_FLIGHT) {
+                log_error("The number of requests in flight must be between 1 and %u.", MAX_IN_FLIGHT);
+                return -EINVAL;
+        }
+
+        if ((arg_compression == OBJECT_COMPRESSED_LZ4 && !HAVE_LZ4) ||
+            (arg_compression == OBJECT_COMPRESSED_ZSTD && !HAVE_ZSTD)) {
+                log_error("Compression with %s is not supported.", upload_compression_to_string(arg_compression));
+                return -EOPNOTSUPP;
+        }
+
         return 1;
 }
 
@@ -845,7 +1240,10 @@ int main(int argc, char **argv) {
                         goto cleanup;
 
                 if (u.uploading) {
-                        r = perform_upload(&u);
+                        if (use_journal)
+                                r = upload_journal(&u);
+                        else
+                                r = perform_upload(&u);
                         if (r < 0)
                                 break;
                 }
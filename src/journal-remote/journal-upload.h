@@ -4,6 +4,7 @@
 
 #include "sd-event.h"
 #include "sd-journal.h"
+#include "list.h"
 #include "time-util.h"
 
 typedef enum {
@@ -20,6 +21,8 @@ typedef enum {
         ENTRY_DONE,                 /* Need to move to a new field. */
 } entry_state;
 
+typedef struct UploadBatch UploadBatch;
+
 typedef struct Uploader {
         sd_event *events;
         sd_event_source *sigint_event, *sigterm_event;
@@ -40,6 +43,13 @@ typedef struct Uploader {
         /* journal stuff */
         sd_journal* journal;
 
+        /* Journal entries are uploaded in batches, several of which may be in flight at the same time. The
+         * batches are kept in the order they were read from the journal in. */
+        CURLM *multi;
+        struct curl_slist *batch_header;
+        LIST_HEAD(UploadBatch, batches);
+        unsigned n_batches;
+
         entry_state entry_state;
         const void *field_data;
         size_t field_pos, field_length;
@@ -62,6 +72,8 @@ int start_upload(Uploader *u,
                                           void *userdata),
                  void *data);
 
+void check_update_watchdog(Uploader *u);
+
 int open_journal_for_upload(Uploader *u,
                             sd_journal *j,
                             const char *cursor,
@@ -69,3 +81,9 @@ int open_journal_for_upload(Uploader *u,
                             bool follow);
 void close_journal_input(Uploader *u);
 int check_journal_input(Uploader *u);
+int read_journal_batch(Uploader *u,
+                       size_t max_entries,
+                       size_t max_size,
+                       char **ret,
+                       size_t *ret_size,
+                       size_t *ret_n_entries);
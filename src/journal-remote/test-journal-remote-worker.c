@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "compress.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "io-util.h"
+#include "journal-remote.h"
+#include "memfd-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "util.h"
+
+#define N_ENTRIES 1000U
+
+/* Entries of an upload that decompresses to far more than a worker may have queued */
+#define N_UPLOAD_ENTRIES 10000U
+#define UPLOAD_MESSAGE_SIZE 4096U
+
+static int source_for_host(const char *host) {
+        _cleanup_free_ char *data = NULL;
+        unsigned i;
+        size_t size;
+        void *mem;
+        int fd;
+
+        /* Some entries in the export format, as journal-remote would receive them over a raw connection */
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                _cleanup_free_ char *entry = NULL;
+
+                assert_se(asprintf(&entry,
+                                   "__REALTIME_TIMESTAMP=%u\n"
+                                   "__MONOTONIC_TIMESTAMP=%u\n"
+                                   "MESSAGE=%s %u\n"
+                                   "\n",
+                                   1000000 + i, 1000 + i, host, i) >= 0);
+
+                assert_se(strextend(&data, entry, NULL));
+        }
+
+        size = strlen(data);
+        fd = memfd_new_and_map(host, size, &mem);
+        assert_se(fd >= 0);
+        memcpy(mem, data, size);
+        assert_se(munmap(mem, size) == 0);
+
+        return fd;
+}
+
+static void queue_stream_for_host(RemoteServer *s, const char *host) {
+        RemoteWorkerStream *stream;
+        RemoteWorker *w;
+        unsigned i;
+
+        /* Queue entries the way HTTP uploads do */
+
+        w = journal_remote_get_worker(s, host);
+        assert_se(remote_worker_open_stream(w, host, &stream) >= 0);
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                _cleanup_free_ char *message = NULL;
+                struct iovec_wrapper iovw = {};
+                struct iovec iovec;
+                dual_timestamp ts = {
+                        .realtime = 1000000 + i,
+                        .monotonic = 1000 + i,
+                };
+
+                assert_se(asprintf(&message, "MESSAGE=%s %u", host, i) >= 0);
+                iovec = IOVEC_MAKE_STRING(message);
+                iovw = (struct iovec_wrapper) {
+                        .iovec = &iovec,
+                        .count = 1,
+                        .size_bytes = iovec.iov_len,
+                };
+
+                assert_se(remote_worker_queue_entry(w, stream, &iovw, &ts) >= 0);
+        }
+
+        remote_worker_close_stream(w, stream);
+}
+
+static void check_host_n(const char *dir, const char *host, unsigned n_expected) {
+        _cleanup_free_ char *path = NULL, *prefix = NULL;
+        sd_journal *j;
+        unsigned n = 0;
+
+        assert_se(asprintf(&path, "%s/remote-%s.journal", dir, host) >= 0);
+        assert_se(prefix = strjoin("MESSAGE=", host, " "));
+
+        assert_se(sd_journal_open_files(&j, (const char**) STRV_MAKE(path), 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j) {
+                const void *data;
+                size_t length;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &data, &length) >= 0);
+                assert_se(length > strlen(prefix) && memcmp(data, prefix, strlen(prefix)) == 0);
+                n++;
+        }
+
+        sd_journal_close(j);
+
+        log_info("%s: %u entries", path, n);
+        assert_se(n == n_expected);
+}
+
+static void check_host(const char *dir, const char *host) {
+        check_host_n(dir, host, N_ENTRIES);
+}
+
+static void pick_hosts(RemoteServer *s, char hosts[2][STRLEN("host-") + DECIMAL_STR_MAX(unsigned)]) {
+        unsigned i;
+
+        /* Find two host names that end up with different workers */
+
+        strcpy(hosts[0], "host-0");
+        for (i = 1;; i++) {
+                xsprintf(hosts[1], "host-%u", i);
+
+                if (journal_remote_get_worker(s, hosts[0]) != journal_remote_get_worker(s, hosts[1]))
+                        break;
+        }
+}
+
+static void test_workers(bool stream) {
+        char t[] = "/tmp/test-journal-remote-worker-XXXXXX";
+        char hosts[2][STRLEN("host-") + DECIMAL_STR_MAX(unsigned)];
+        RemoteServer s = {};
+        unsigned i;
+
+        log_info("/* %s(stream=%s) */", __func__, yes_no(stream));
+
+        assert_se(mkdtemp(t));
+
+        assert_se(journal_remote_server_init(&s, t, JOURNAL_WRITE_SPLIT_HOST, false, false) >= 0);
+        assert_se(journal_remote_server_setup_workers(&s, 2) >= 0);
+        assert_se(s.n_workers == 2);
+        assert_se(journal_remote_server_start_workers(&s) >= 0);
+
+        pick_hosts(&s, hosts);
+
+        for (i = 0; i < 2; i++)
+                if (stream)
+                        queue_stream_for_host(&s, hosts[i]);
+                else
+                        assert_se(journal_remote_add_source(&s, source_for_host(hosts[i]), hosts[i], false) > 0);
+
+        while (s.active > 0)
+                assert_se(sd_event_run(s.events, (uint64_t) -1) >= 0);
+
+        /* This waits for the workers to write everything that was queued */
+        journal_remote_server_destroy(&s);
+
+        for (i = 0; i < 2; i++)
+                check_host(t, hosts[i]);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+static void test_close_stream_stopped(void) {
+        char t[] = "/tmp/test-journal-remote-worker-XXXXXX";
+        RemoteWorkerStream *stream;
+        RemoteServer s = {};
+        RemoteWorker *w;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(mkdtemp(t));
+
+        assert_se(journal_remote_server_init(&s, t, JOURNAL_WRITE_SPLIT_HOST, false, false) >= 0);
+        assert_se(journal_remote_server_setup_workers(&s, 1) >= 0);
+        assert_se(journal_remote_server_start_workers(&s) >= 0);
+
+        w = journal_remote_get_worker(&s, "host");
+        assert_se(remote_worker_open_stream(w, "host", &stream) >= 0);
+
+        /* Closing a stream must work even if the worker is gone already, the stream is then released when the
+         * worker is freed */
+        remote_worker_stop(w);
+        remote_worker_close_stream(w, stream);
+
+        journal_remote_server_destroy(&s);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+#if HAVE_ZSTD
+static void test_upload_congested(void) {
+        char t[] = "/tmp/test-journal-remote-worker-XXXXXX";
+        _cleanup_free_ char *message = NULL, *data = NULL, *compressed = NULL, *name = NULL;
+        size_t entry_size, data_size, compressed_size, pos = 0, consumed;
+        RemoteSource *source;
+        RemoteServer s = {};
+        unsigned i, n_suspended = 0;
+        RemoteWorker *w;
+        int r, waiter;
+
+        log_info("/* %s */", __func__);
+
+        /* An upload the size of a few worker queues, which compresses extremely well. The timestamps all have the
+         * same length, and keep the entries apart. */
+        assert_se(message = new(char, UPLOAD_MESSAGE_SIZE + 1));
+        memset(message, 'x', UPLOAD_MESSAGE_SIZE);
+        message[UPLOAD_MESSAGE_SIZE] = 0;
+
+        entry_size = STRLEN("__REALTIME_TIMESTAMP=1000000\nMESSAGE=host \n\n") + UPLOAD_MESSAGE_SIZE;
+        data_size = entry_size * N_UPLOAD_ENTRIES;
+        assert_se(data_size > 2 * REMOTE_WORKER_QUEUE_HIGH);
+        assert_se(data = new(char, data_size + 1));
+        for (i = 0; i < N_UPLOAD_ENTRIES; i++)
+                assert_se(snprintf(data + i * entry_size, entry_size + 1,
+                                   "__REALTIME_TIMESTAMP=%u\nMESSAGE=host %s\n\n", 1000000 + i, message) == (int) entry_size);
+
+        assert_se(compress_frame(OBJECT_COMPRESSED_ZSTD, data, data_size, (void**) &compressed, &compressed_size) == 0);
+        log_info("Upload of %zu bytes, compressed to %zu bytes", data_size, compressed_size);
+
+        assert_se(mkdtemp(t));
+
+        assert_se(journal_remote_server_init(&s, t, JOURNAL_WRITE_SPLIT_HOST, false, false) >= 0);
+        assert_se(journal_remote_server_setup_workers(&s, 1) >= 0);
+
+        /* Set up the source the way an HTTP upload with Content-Encoding: zstd is set up */
+        w = journal_remote_get_worker(&s, "host");
+        assert_se(name = strdup("host"));
+        assert_se(source = source_new(STDIN_FILENO, true, name, NULL));
+        name = NULL;
+        source->worker = w;
+        assert_se(remote_worker_open_stream(w, "host", &source->stream) >= 0);
+        assert_se(decompressor_new(OBJECT_COMPRESSED_ZSTD, &source->decompressor) >= 0);
+
+        /* The worker isn't running yet, hence decompression has to stop once its queue is full, and keep the rest
+         * of the input */
+        r = process_upload(source, compressed, compressed_size, false, false, &waiter, &consumed);
+        assert_se(r > 0);
+        assert_se(consumed < compressed_size);
+        log_info("Stopped after %zu bytes of input with %zu bytes queued", consumed, remote_worker_queued_bytes(w));
+        assert_se(remote_worker_queued_bytes(w) >= REMOTE_WORKER_QUEUE_HIGH);
+        assert_se(remote_worker_queued_bytes(w) < REMOTE_WORKER_QUEUE_HIGH + REMOTE_WORKER_QUEUE_HIGH / 8);
+        pos += consumed;
+        n_suspended++;
+
+        assert_se(journal_remote_server_start_workers(&s) >= 0);
+
+        /* Continue each time the worker lets us, including the final flush without any data */
+        for (;;) {
+                struct pollfd pollfd = {
+                        .fd = s.worker_notify_fd,
+                        .events = POLLIN,
+                };
+                _cleanup_free_ void **waiters = NULL;
+                size_t done, n_waiters;
+                eventfd_t x;
+
+                assert_se(poll(&pollfd, 1, -1) == 1);
+                (void) eventfd_read(s.worker_notify_fd, &x);
+
+                /* Collect the waiters ourselves, the main loop would resume them as µhttpd connections */
+                remote_worker_collect(w, false, &done, &waiters, &n_waiters);
+                if (n_waiters == 0)
+                        continue;
+
+                assert_se(n_waiters == 1 && waiters[0] == &waiter);
+
+                r = process_upload(source, compressed + pos, compressed_size - pos, false, false, &waiter, &consumed);
+                assert_se(r >= 0);
+                assert_se(remote_worker_queued_bytes(w) < REMOTE_WORKER_QUEUE_HIGH + REMOTE_WORKER_QUEUE_HIGH / 8);
+                pos += consumed;
+
+                if (r == 0)
+                        break;
+
+                n_suspended++;
+        }
+
+        assert_se(pos == compressed_size);
+        assert_se(decompressor_finish(source->decompressor) == 0);
+        assert_se(journal_importer_bytes_remaining(&source->importer) == 0);
+        log_info("Upload was suspended %u times", n_suspended);
+
+        remote_worker_close_stream(w, source->stream);
+        source_free(source);
+
+        journal_remote_server_destroy(&s);
+
+        check_host_n(t, "host", N_UPLOAD_ENTRIES);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        test_setup_logging(LOG_DEBUG);
+
+        test_workers(false);
+        test_workers(true);
+        test_close_stream_stopped();
+#if HAVE_ZSTD
+        test_upload_congested();
+#endif
+
+        return 0;
+}
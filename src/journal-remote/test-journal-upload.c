@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "compress.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "journal-remote.h"
+#include "journal-upload.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "tests.h"
+#include "util.h"
+
+#define N_ENTRIES 2000U
+
+/* Small batches, so that the upload consists of many of them */
+#define BATCH_ENTRIES 300U
+#define BATCH_SIZE (16U*1024U)
+
+static void write_source_journal(const char *path) {
+        JournalFile *f;
+        unsigned i;
+
+        assert_se(journal_file_open(-1, path, O_RDWR|O_CREAT, 0644, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                char message[STRLEN("MESSAGE=upload ") + DECIMAL_STR_MAX(unsigned)],
+                        binary[STRLEN("BINARY=line\nbreak ") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[2];
+                dual_timestamp ts;
+
+                /* A field with a newline is exported in the binary format */
+                xsprintf(message, "MESSAGE=upload %u", i);
+                xsprintf(binary, "BINARY=line\nbreak %u", i);
+                iovec[0] = IOVEC_MAKE_STRING(message);
+                iovec[1] = IOVEC_MAKE_STRING(binary);
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+
+        (void) journal_file_close(f);
+}
+
+static void check_uploaded(const char *path) {
+        sd_journal *j;
+        unsigned n = 0;
+
+        assert_se(sd_journal_open_files(&j, (const char**) STRV_MAKE(path), 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j) {
+                char expected[STRLEN("BINARY=line\nbreak ") + DECIMAL_STR_MAX(unsigned)];
+                const void *data;
+                size_t length;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &data, &length) >= 0);
+                xsprintf(expected, "MESSAGE=upload %u", n);
+                assert_se(length == strlen(expected) && memcmp(data, expected, length) == 0);
+
+                assert_se(sd_journal_get_data(j, "BINARY", &data, &length) >= 0);
+                xsprintf(expected, "BINARY=line\nbreak %u", n);
+                assert_se(length == strlen(expected) && memcmp(data, expected, length) == 0);
+
+                n++;
+        }
+
+        sd_journal_close(j);
+
+        log_info("%s: %u entries", path, n);
+        assert_se(n == N_ENTRIES);
+}
+
+static void test_upload(int compression) {
+        char t[] = "/tmp/test-journal-upload-XXXXXX";
+        _cleanup_free_ char *source_path = NULL, *output_path = NULL, *name = NULL;
+        Uploader u = {};
+        RemoteSource *source;
+        RemoteServer s = {};
+        RemoteWorker *w;
+        unsigned n_batches = 0;
+        size_t n_entries = 0;
+        sd_journal *j;
+        int waiter;
+
+        log_info("/* %s(%s) */", __func__, object_compressed_to_string(compression));
+
+        assert_se(mkdtemp(t));
+        assert_se(source_path = strjoin(t, "/source.journal"));
+        assert_se(output_path = strjoin(t, "/remote/remote-host.journal"));
+        assert_se(mkdir(strjoina(t, "/remote"), 0755) >= 0);
+
+        write_source_journal(source_path);
+
+        /* The receiving end, set up the way journal-remote sets up an HTTP upload with Content-Encoding */
+        assert_se(journal_remote_server_init(&s, strjoina(t, "/remote"), JOURNAL_WRITE_SPLIT_HOST, false, false) >= 0);
+        assert_se(journal_remote_server_setup_workers(&s, 1) >= 0);
+        assert_se(journal_remote_server_start_workers(&s) >= 0);
+
+        w = journal_remote_get_worker(&s, "host");
+        assert_se(name = strdup("host"));
+        assert_se(source = source_new(STDIN_FILENO, true, name, NULL));
+        name = NULL;
+        source->worker = w;
+        assert_se(remote_worker_open_stream(w, "host", &source->stream) >= 0);
+        assert_se(decompressor_new(compression, &source->decompressor) >= 0);
+
+        /* The sending end, reading batches from the journal the way journal-upload does */
+        assert_se(sd_journal_open_files(&j, (const char**) STRV_MAKE(source_path), 0) >= 0);
+        assert_se(open_journal_for_upload(&u, j, NULL, false, false) >= 0);
+
+        for (;;) {
+                _cleanup_free_ char *data = NULL;
+                _cleanup_free_ void *compressed = NULL;
+                size_t size, compressed_size, n, consumed;
+                int r;
+
+                r = read_journal_batch(&u, BATCH_ENTRIES, BATCH_SIZE, &data, &size, &n);
+                assert_se(r >= 0);
+                if (r == 0)
+                        break;
+
+                assert_se(n <= BATCH_ENTRIES);
+                n_entries += n;
+                n_batches++;
+
+                assert_se(compress_frame(compression, data, size, &compressed, &compressed_size) == 0);
+
+                /* The worker is running and the upload is small, hence it never has to wait for it */
+                assert_se(process_upload(source, compressed, compressed_size, false, false, &waiter, &consumed) == 0);
+                assert_se(consumed == compressed_size);
+        }
+
+        log_info("Uploaded %zu entries in %u batches", n_entries, n_batches);
+        assert_se(n_entries == N_ENTRIES);
+        assert_se(n_batches > 1);
+
+        /* read_journal_batch() closed the journal once it ran out of entries */
+        assert_se(!u.journal);
+        free(u.current_cursor);
+        free(u.last_cursor);
+
+        assert_se(decompressor_finish(source->decompressor) == 0);
+        assert_se(journal_importer_bytes_remaining(&source->importer) == 0);
+
+        remote_worker_close_stream(w, source->stream);
+        source_free(source);
+
+        /* This waits for the worker to write everything that was queued */
+        journal_remote_server_destroy(&s);
+
+        check_uploaded(output_path);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        test_setup_logging(LOG_DEBUG);
+
+#if !HAVE_LZ4 && !HAVE_ZSTD
+        return log_tests_skipped("LZ4 and ZSTD support are disabled");
+#endif
+
+#if HAVE_LZ4
+        test_upload(OBJECT_COMPRESSED_LZ4);
+#endif
+#if HAVE_ZSTD
+        test_upload(OBJECT_COMPRESSED_ZSTD);
+#endif
+
+        return 0;
+}
@@ -15,6 +15,11 @@
 #include <lz4frame.h>
 #endif
 
+#if HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
 #include "alloc-util.h"
 #include "compress.h"
 #include "fd-util.h"
@@ -31,11 +36,31 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_compressionContext_t, LZ4F_freeCompressionConte
 DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_decompressionContext_t, LZ4F_freeDecompressionContext);
 #endif
 
+#if HAVE_ZSTD
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_CCtx *, ZSTD_freeCCtx);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_DCtx *, ZSTD_freeDCtx);
+
+static int zstd_ret_to_errno(size_t ret) {
+        switch (ZSTD_getErrorCode(ret)) {
+        case ZSTD_error_dstSize_tooSmall:
+                return -ENOBUFS;
+        case ZSTD_error_memory_allocation:
+                return -ENOMEM;
+        case ZSTD_error_frameParameter_windowTooLarge:
+                /* The peer asks for more memory than we are willing to give it */
+                return -EBADMSG;
+        default:
+                return -EBADMSG;
+        }
+}
+#endif
+
 #define ALIGN_8(l) ALIGN_TO(l, sizeof(size_t))
 
 static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
         [OBJECT_COMPRESSED_XZ] = "XZ",
         [OBJECT_COMPRESSED_LZ4] = "LZ4",
+        [OBJECT_COMPRESSED_ZSTD] = "ZSTD",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
@@ -108,6 +133,31 @@ int compress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#if HAVE_ZSTD
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        k = ZSTD_compress(dst, dst_alloc_size, src, src_size, 0);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
 
@@ -208,6 +258,65 @@ int decompress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input;
+        ZSTD_outBuffer output;
+        uint64_t size;
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        /* ZSTD_compress() always records the uncompressed size in the frame
+         * header, hence we can size the output buffer exactly in one go. */
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (IN_SET(size, ZSTD_CONTENTSIZE_ERROR, ZSTD_CONTENTSIZE_UNKNOWN))
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(ZSTD_DStreamOutSize(), size), 1))
+                return -ENOMEM;
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        input = (ZSTD_inBuffer) {
+                .src = src,
+                .size = src_size,
+        };
+        output = (ZSTD_outBuffer) {
+                .dst = *dst,
+                .size = *dst_alloc_size,
+        };
+
+        k = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+        if (output.pos < size)
+                return -EBADMSG;
+
+        *dst_size = size;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -217,6 +326,9 @@ int decompress_blob(int compression,
         else if (compression == OBJECT_COMPRESSED_LZ4)
                 return decompress_blob_lz4(src, src_size,
                                            dst, dst_alloc_size, dst_size, dst_max);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_blob_zstd(src, src_size,
+                                            dst, dst_alloc_size, dst_size, dst_max);
         else
                 return -EBADMSG;
 }
@@ -342,6 +454,68 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra) {
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input;
+        ZSTD_outBuffer output;
+        uint64_t size;
+        size_t k;
+
+        /* Checks whether the decompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix */
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (IN_SET(size, ZSTD_CONTENTSIZE_ERROR, ZSTD_CONTENTSIZE_UNKNOWN))
+                return -EBADMSG;
+
+        if (size < prefix_len + 1)
+                return 0; /* Decompressed text too short to match the prefix and extra */
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        if (!(greedy_realloc(buffer, buffer_size, MAX(ZSTD_DStreamOutSize(), prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        input = (ZSTD_inBuffer) {
+                .src = src,
+                .size = src_size,
+        };
+        output = (ZSTD_outBuffer) {
+                .dst = *buffer,
+                .size = *buffer_size,
+        };
+
+        /* The output buffer holds at least one full block, hence a single
+         * decompression step yields enough bytes to check the prefix. */
+        k = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+        if (output.pos < prefix_len + 1)
+                return -EBADMSG;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -357,6 +531,11 @@ int decompress_startswith(int compression,
                                                  buffer, buffer_size,
                                                  prefix, prefix_len,
                                                  extra);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_startswith_zstd(src, src_size,
+                                                  buffer, buffer_size,
+                                                  prefix, prefix_len,
+                                                  extra);
         else
                 return -EBADMSG;
 }
@@ -530,6 +709,93 @@ int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeCCtxp) ZSTD_CCtx *cctx = NULL;
+        _cleanup_free_ void *in_buff = NULL, *out_buff = NULL;
+        size_t in_allocsize, out_allocsize;
+        uint64_t left = max_bytes, in_bytes = 0;
+        size_t z;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_allocsize = ZSTD_CStreamInSize();
+        out_allocsize = ZSTD_CStreamOutSize();
+        in_buff = malloc(in_allocsize);
+        out_buff = malloc(out_allocsize);
+        cctx = ZSTD_createCCtx();
+        if (!cctx || !out_buff || !in_buff)
+                return -ENOMEM;
+
+        z = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+        if (ZSTD_isError(z))
+                log_debug("Failed to enable ZSTD checksum, ignoring: %s", ZSTD_getErrorName(z));
+
+        /* Read the input file in chunks, compress each chunk and write out
+         * everything that was produced, so that the output buffer can be
+         * reused for the next iteration. */
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buff,
+                };
+                bool is_last_chunk, finished = false;
+                ssize_t n;
+
+                n = loop_read(fdf, in_buff, in_allocsize, true);
+                if (n < 0)
+                        return n;
+                is_last_chunk = n == 0;
+
+                in_bytes += (size_t) n;
+                input.size = (size_t) n;
+
+                while (!finished) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buff,
+                                .size = out_allocsize,
+                        };
+                        size_t remaining;
+                        int k;
+
+                        remaining = ZSTD_compressStream2(cctx, &output, &input,
+                                                         is_last_chunk ? ZSTD_e_end : ZSTD_e_continue);
+                        if (ZSTD_isError(remaining)) {
+                                log_debug("ZSTD encoder failed: %s", ZSTD_getErrorName(remaining));
+                                return zstd_ret_to_errno(remaining);
+                        }
+
+                        if (left < output.pos) {
+                                log_debug("Compressed stream longer than %"PRIu64" bytes", max_bytes);
+                                return -EFBIG;
+                        }
+
+                        k = loop_write(fdt, output.dst, output.pos, true);
+                        if (k < 0)
+                                return k;
+
+                        left -= output.pos;
+
+                        /* On the last chunk we are done once zstd has flushed
+                         * the end of the frame, otherwise once all input is
+                         * consumed. */
+                        finished = is_last_chunk ? remaining == 0 : input.pos == input.size;
+                }
+
+                if (is_last_chunk)
+                        break;
+        }
+
+        log_debug("ZSTD compression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  in_bytes, max_bytes - left,
+                  in_bytes > 0 ? (double) (max_bytes - left) / in_bytes * 100 : 0.0);
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_bytes) {
 
 #if HAVE_XZ
@@ -666,12 +932,369 @@ int decompress_stream_lz4(int in, int out, uint64_t max_bytes) {
 #endif
 }
 
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        _cleanup_free_ void *in_buff = NULL, *out_buff = NULL;
+        size_t in_allocsize, out_allocsize;
+        size_t last_result = 0;
+        uint64_t left = max_bytes, in_bytes = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_allocsize = ZSTD_DStreamInSize();
+        out_allocsize = ZSTD_DStreamOutSize();
+        in_buff = malloc(in_allocsize);
+        out_buff = malloc(out_allocsize);
+        dctx = ZSTD_createDCtx();
+        if (!dctx || !out_buff || !in_buff)
+                return -ENOMEM;
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buff,
+                };
+                ssize_t n;
+
+                n = loop_read(fdf, in_buff, in_allocsize, true);
+                if (n < 0)
+                        return n;
+                if (n == 0)
+                        break;
+
+                in_bytes += (size_t) n;
+                input.size = (size_t) n;
+
+                /* zstd won't consume the last byte of a frame until it has
+                 * flushed all decompressed data of that frame, hence keep
+                 * going while there is input left. */
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buff,
+                                .size = out_allocsize,
+                        };
+                        int k;
+
+                        last_result = ZSTD_decompressStream(dctx, &output, &input);
+                        if (ZSTD_isError(last_result)) {
+                                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(last_result));
+                                return zstd_ret_to_errno(last_result);
+                        }
+
+                        if (left < output.pos) {
+                                log_debug("Decompressed stream longer than %"PRIu64" bytes", max_bytes);
+                                return -EFBIG;
+                        }
+
+                        k = loop_write(fdt, output.dst, output.pos, true);
+                        if (k < 0)
+                                return k;
+
+                        left -= output.pos;
+                }
+        }
+
+        if (in_bytes == 0) {
+                log_debug("ZSTD decoder failed: no data read");
+                return -EBADMSG;
+        }
+
+        if (last_result != 0) {
+                /* The last decompression result was not 0, hence the last frame is incomplete. */
+                log_debug("ZSTD decoder failed: truncated frame");
+                return -EBADMSG;
+        }
+
+        log_debug("ZSTD decompression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  in_bytes, max_bytes - left,
+                  (double) (max_bytes - left) / in_bytes * 100);
+
+        return 0;
+#else
+        log_debug("Cannot decompress file. Compiled without ZSTD support.");
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes) {
 
         if (endswith(filename, ".lz4"))
                 return decompress_stream_lz4(fdf, fdt, max_bytes);
         else if (endswith(filename, ".xz"))
                 return decompress_stream_xz(fdf, fdt, max_bytes);
+        else if (endswith(filename, ".zst"))
+                return decompress_stream_zstd(fdf, fdt, max_bytes);
         else
                 return -EPROTONOSUPPORT;
 }
+
+int compress_frame_lz4(const void *src, size_t src_size, void **ret, size_t *ret_size) {
+#if HAVE_LZ4
+        _cleanup_free_ void *buf = NULL;
+        size_t bound, c;
+
+        assert(src || src_size == 0);
+        assert(ret);
+        assert(ret_size);
+
+        bound = LZ4F_compressFrameBound(src_size, NULL);
+        buf = malloc(bound);
+        if (!buf)
+                return -ENOMEM;
+
+        c = LZ4F_compressFrame(buf, bound, src, src_size, NULL);
+        if (LZ4F_isError(c)) {
+                log_debug("LZ4 encoder failed: %s", LZ4F_getErrorName(c));
+                return -ENOBUFS;
+        }
+
+        *ret = TAKE_PTR(buf);
+        *ret_size = c;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_frame_zstd(const void *src, size_t src_size, void **ret, size_t *ret_size) {
+#if HAVE_ZSTD
+        _cleanup_free_ void *buf = NULL;
+        size_t bound, k;
+
+        assert(src || src_size == 0);
+        assert(ret);
+        assert(ret_size);
+
+        bound = ZSTD_compressBound(src_size);
+        buf = malloc(bound);
+        if (!buf)
+                return -ENOMEM;
+
+        k = ZSTD_compress(buf, bound, src, src_size, 0);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD encoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+
+        *ret = TAKE_PTR(buf);
+        *ret_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_frame(int compression, const void *src, size_t src_size, void **ret, size_t *ret_size) {
+        if (compression == OBJECT_COMPRESSED_LZ4)
+                return compress_frame_lz4(src, src_size, ret, ret_size);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return compress_frame_zstd(src, src_size, ret, ret_size);
+        else
+                return -EPROTONOSUPPORT;
+}
+
+struct Decompressor {
+        int compression;
+
+#if HAVE_LZ4
+        LZ4F_decompressionContext_t lz4;
+#endif
+#if HAVE_ZSTD
+        ZSTD_DCtx *zstd;
+#endif
+
+        void *buffer;
+        size_t buffer_size;
+
+        /* Whether we are in the middle of a frame */
+        bool partial;
+};
+
+int decompressor_new(int compression, Decompressor **ret) {
+        _cleanup_(decompressor_freep) Decompressor *d = NULL;
+
+        assert(ret);
+
+        d = new0(Decompressor, 1);
+        if (!d)
+                return -ENOMEM;
+
+        d->compression = compression;
+
+        switch (compression) {
+
+#if HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4: {
+                size_t c;
+
+                c = LZ4F_createDecompressionContext(&d->lz4, LZ4F_VERSION);
+                if (LZ4F_isError(c))
+                        return -ENOMEM;
+
+                d->buffer_size = LZ4_BUFSIZE;
+                break;
+        }
+#endif
+
+#if HAVE_ZSTD
+        case OBJECT_COMPRESSED_ZSTD: {
+                size_t z;
+
+                d->zstd = ZSTD_createDCtx();
+                if (!d->zstd)
+                        return -ENOMEM;
+
+                /* The data comes from the network, don't let a tiny frame make us allocate a huge window. zstd
+                 * itself doesn't use a larger window than this unless its "ultra" levels are requested. */
+                z = ZSTD_DCtx_setParameter(d->zstd, ZSTD_d_windowLogMax, DECOMPRESSOR_ZSTD_WINDOW_LOG_MAX);
+                if (ZSTD_isError(z))
+                        return zstd_ret_to_errno(z);
+
+                d->buffer_size = ZSTD_DStreamOutSize();
+                break;
+        }
+#endif
+
+        default:
+                return -EPROTONOSUPPORT;
+        }
+
+        d->buffer = malloc(d->buffer_size);
+        if (!d->buffer)
+                return -ENOMEM;
+
+        *ret = TAKE_PTR(d);
+        return 0;
+}
+
+Decompressor* decompressor_free(Decompressor *d) {
+        if (!d)
+                return NULL;
+
+#if HAVE_LZ4
+        if (d->lz4)
+                LZ4F_freeDecompressionContext(d->lz4);
+#endif
+#if HAVE_ZSTD
+        ZSTD_freeDCtx(d->zstd);
+#endif
+
+        free(d->buffer);
+        return mfree(d);
+}
+
+int decompressor_push(
+                Decompressor *d,
+                const void *src, size_t src_size,
+                size_t *ret_consumed,
+                decompressor_callback_t callback,
+                void *userdata) {
+
+        int r;
+
+        assert(d);
+        assert(src || src_size == 0);
+        assert(callback);
+
+        /* Decompresses as much as possible of the data, and passes it on to the callback in pieces of at most
+         * the size of our buffer, so that a small amount of input can't make us allocate a lot of memory. Returns
+         * the first error of the callback, if any. If the callback returns a positive value, stops right away and
+         * returns that. The caller should then push the rest of the data, i.e. what follows the consumed part,
+         * later. Pushing no data flushes output that the decoder still holds back. */
+
+        if (ret_consumed)
+                *ret_consumed = 0;
+
+        switch (d->compression) {
+
+#if HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4: {
+                size_t pos = 0;
+
+                for (;;) {
+                        size_t produced = d->buffer_size, consumed = src_size - pos, c;
+
+                        c = LZ4F_decompress(d->lz4, d->buffer, &produced, (const uint8_t*) src + pos, &consumed, NULL);
+                        if (LZ4F_isError(c)) {
+                                log_debug("LZ4 decoder failed: %s", LZ4F_getErrorName(c));
+                                return -EBADMSG;
+                        }
+
+                        /* A call without any progress only tells us what's expected next, which is no news
+                         * after the end of a frame */
+                        if (consumed > 0 || produced > 0)
+                                d->partial = c != 0;
+                        pos += consumed;
+
+                        if (ret_consumed)
+                                *ret_consumed = pos;
+
+                        if (produced > 0) {
+                                r = callback(d->buffer, produced, userdata);
+                                if (r != 0)
+                                        return r;
+                        }
+
+                        /* If the output buffer was filled, there might be more to flush */
+                        if (pos >= src_size && produced < d->buffer_size)
+                                return 0;
+                }
+        }
+#endif
+
+#if HAVE_ZSTD
+        case OBJECT_COMPRESSED_ZSTD: {
+                ZSTD_inBuffer input = {
+                        .src = src,
+                        .size = src_size,
+                };
+
+                for (;;) {
+                        ZSTD_outBuffer output = {
+                                .dst = d->buffer,
+                                .size = d->buffer_size,
+                        };
+                        size_t z, in = input.pos;
+
+                        z = ZSTD_decompressStream(d->zstd, &output, &input);
+                        if (ZSTD_isError(z)) {
+                                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(z));
+                                return zstd_ret_to_errno(z);
+                        }
+
+                        if (input.pos > in || output.pos > 0)
+                                d->partial = z != 0;
+
+                        if (ret_consumed)
+                                *ret_consumed = input.pos;
+
+                        if (output.pos > 0) {
+                                r = callback(d->buffer, output.pos, userdata);
+                                if (r != 0)
+                                        return r;
+                        }
+
+                        if (input.pos >= input.size && output.pos < output.size)
+                                return 0;
+                }
+        }
+#endif
+
+        default:
+                return -EPROTONOSUPPORT;
+        }
+}
+
+int decompressor_finish(Decompressor *d) {
+        assert(d);
+
+        /* Returns -EBADMSG if the data ended in the middle of a frame */
+
+        if (d->partial) {
+                log_debug("%s decoder failed: truncated frame", object_compressed_to_string(d->compression));
+                return -EBADMSG;
+        }
+
+        return 0;
+}
@@ -1,9 +1,11 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 #pragma once
 
+#include <errno.h>
 #include <unistd.h>
 
 #include "journal-def.h"
+#include "macro.h"
 
 const char* object_compressed_to_string(int compression);
 int object_compressed_from_string(const char *compression);
@@ -12,26 +14,48 @@ int compress_blob_xz(const void *src, uint64_t src_size,
                      void *dst, size_t dst_alloc_size, size_t *dst_size);
 int compress_blob_lz4(const void *src, uint64_t src_size,
                       void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size);
 
-static inline int compress_blob(const void *src, uint64_t src_size,
-                                void *dst, size_t dst_alloc_size, size_t *dst_size) {
-        int r;
-#if HAVE_LZ4
-        r = compress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size);
-        if (r == 0)
-                return OBJECT_COMPRESSED_LZ4;
+/* The algorithm used for newly created journal files and other blobs we compress */
+#if HAVE_ZSTD
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_ZSTD
+#elif HAVE_LZ4
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_LZ4
 #else
-        r = compress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size);
-        if (r == 0)
-                return OBJECT_COMPRESSED_XZ;
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_XZ
 #endif
-        return r;
+
+static inline int compress_blob(int compression,
+                                const void *src, uint64_t src_size,
+                                void *dst, size_t dst_alloc_size, size_t *dst_size) {
+        int r;
+
+        switch (compression) {
+        case OBJECT_COMPRESSED_ZSTD:
+                r = compress_blob_zstd(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        case OBJECT_COMPRESSED_LZ4:
+                r = compress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        case OBJECT_COMPRESSED_XZ:
+                r = compress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        default:
+                return -EPROTONOSUPPORT;
+        }
+        if (r < 0)
+                return r;
+
+        return compression;
 }
 
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
@@ -44,6 +68,10 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
                               void **buffer, size_t *buffer_size,
                               const void *prefix, size_t prefix_len,
                               uint8_t extra);
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra);
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -52,11 +80,16 @@ int decompress_startswith(int compression,
 
 int compress_stream_xz(int fdf, int fdt, uint64_t max_bytes);
 int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes);
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes);
 
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_size);
 int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_size);
 
-#if HAVE_LZ4
+#if HAVE_ZSTD
+#  define compress_stream compress_stream_zstd
+#  define COMPRESSED_EXT ".zst"
+#elif HAVE_LZ4
 #  define compress_stream compress_stream_lz4
 #  define COMPRESSED_EXT ".lz4"
 #else
@@ -65,3 +98,22 @@ int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
 #endif
 
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes);
+
+/* Complete LZ4 and ZSTD frames, as understood by the lz4 and zstd tools, rather than the blobs stored in journal
+ * files. Several of them may be concatenated, and are decompressed incrementally as the data arrives. */
+int compress_frame_lz4(const void *src, size_t src_size, void **ret, size_t *ret_size);
+int compress_frame_zstd(const void *src, size_t src_size, void **ret, size_t *ret_size);
+int compress_frame(int compression, const void *src, size_t src_size, void **ret, size_t *ret_size);
+
+/* Frames that need a larger window than 8 MiB to be decompressed are refused */
+#define DECOMPRESSOR_ZSTD_WINDOW_LOG_MAX 23
+
+typedef struct Decompressor Decompressor;
+typedef int (*decompressor_callback_t)(const void *data, size_t size, void *userdata);
+
+int decompressor_new(int compression, Decompressor **ret);
+Decompressor* decompressor_free(Decompressor *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(Decompressor*, decompressor_free);
+
+int decompressor_push(Decompressor *d, const void *src, size_t src_size, size_t *ret_consumed, decompressor_callback_t callback, void *userdata);
+int decompressor_finish(Decompressor *d);
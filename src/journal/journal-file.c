@@ -8,6 +8,7 @@
 #include <sys/mman.h>
 #include <sys/statvfs.h>
 #include <sys/uio.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 
 #include "sd-event.h"
@@ -17,10 +18,12 @@
 #include "chattr-util.h"
 #include "compress.h"
 #include "fd-util.h"
+#include "fileio.h"
 #include "fs-util.h"
 #include "journal-authenticate.h"
 #include "journal-def.h"
 #include "journal-file.h"
+#include "journal-verify.h"
 #include "lookup3.h"
 #include "parse-util.h"
 #include "path-util.h"
@@ -68,9 +71,21 @@
 /* How many entries to keep in the entry array chain cache at max */
 #define CHAIN_CACHE_MAX 20
 
+/* DATA objects referenced by fewer entries than this are cheap enough to bisect directly */
+#define POSTING_LIST_MIN_ENTRIES 64
+
+/* How many entry offsets to keep in memory per file at max (8 MiB) */
+#define POSTING_LISTS_MAX_ENTRIES (1024U*1024U)
+
 /* How much to increase the journal file size at once each time we allocate something new. */
 #define FILE_SIZE_INCREASE (8ULL*1024ULL*1024ULL)              /* 8MB */
 
+/* Size of the Bloom filter of archived files, for about 1% false positives. The number of bits is rounded up to a
+ * power of two, hence we end up with 10 to 20 bits per item. */
+#define BLOOM_FILTER_BITS_PER_ITEM 10U
+#define BLOOM_FILTER_HASH_FUNCTIONS 7U
+#define BLOOM_FILTER_HASH_FUNCTIONS_MAX 32U
+
 /* Reread fstat() of the file for detecting deletions at least this often */
 #define LAST_STAT_REFRESH_USEC (5*USEC_PER_SEC)
 
@@ -81,10 +96,14 @@
 #  pragma GCC diagnostic ignored "-Waddress-of-packed-member"
 #endif
 
-/* This may be called from a separate thread to prevent blocking the caller for the duration of fsync().
- * As a result we use atomic operations on f->offline_state for inter-thread communications with
+static bool journal_file_bloom_filter_pending(JournalFile *f);
+static int journal_file_fill_bloom_filter(JournalFile *f);
+
+/* Moves the offline state machine forward after the file was fsync()ed, returns true if it needs to be fsync()ed
+ * once more. This may be called from a separate thread to prevent blocking the caller for the duration of
+ * fsync(). As a result we use atomic operations on f->offline_state for inter-thread communications with
  * journal_file_set_offline() and journal_file_set_online(). */
-static void journal_file_set_offline_internal(JournalFile *f) {
+bool journal_file_offline_synced(JournalFile *f) {
         assert(f);
         assert(f->fd >= 0);
         assert(f->header);
@@ -94,42 +113,56 @@ static void journal_file_set_offline_internal(JournalFile *f) {
                 case OFFLINE_CANCEL:
                         if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_DONE))
                                 continue;
-                        return;
+                        return false;
 
                 case OFFLINE_AGAIN_FROM_SYNCING:
                         if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_SYNCING, OFFLINE_SYNCING))
                                 continue;
-                        break;
+                        return true;
 
                 case OFFLINE_AGAIN_FROM_OFFLINING:
                         if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_OFFLINING, OFFLINE_SYNCING))
                                 continue;
-                        break;
+                        return true;
 
                 case OFFLINE_SYNCING:
-                        (void) fsync(f->fd);
-
                         if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_OFFLINING))
                                 continue;
 
                         f->header->state = f->archive ? STATE_ARCHIVED : STATE_OFFLINE;
-                        (void) fsync(f->fd);
-                        break;
+                        return true;
 
                 case OFFLINE_OFFLINING:
                         if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_OFFLINING, OFFLINE_DONE))
                                 continue;
                         _fallthrough_;
                 case OFFLINE_DONE:
-                        return;
+                        return false;
 
                 case OFFLINE_JOINED:
-                        log_debug("OFFLINE_JOINED unexpected offline state for journal_file_set_offline_internal()");
-                        return;
+                        log_debug("OFFLINE_JOINED unexpected offline state for journal_file_offline_synced()");
+                        return false;
                 }
         }
 }
 
+static void journal_file_set_offline_internal(JournalFile *f) {
+        int r;
+
+        assert(f);
+
+        /* The file was archived, this is the time to complete its Bloom filter, before it is synced to disk */
+        if (journal_file_bloom_filter_pending(f)) {
+                r = journal_file_fill_bloom_filter(f);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to fill in Bloom filter of %s, ignoring: %m", f->path);
+        }
+
+        do
+                (void) fsync(f->fd);
+        while (journal_file_offline_synced(f));
+}
+
 static void * journal_file_set_offline_thread(void *arg) {
         JournalFile *f = arg;
 
@@ -148,9 +181,20 @@ static int journal_file_set_offline_thread_join(JournalFile *f) {
         if (f->offline_state == OFFLINE_JOINED)
                 return 0;
 
-        r = pthread_join(f->offline_thread, NULL);
-        if (r)
-                return -r;
+        if (f->offline_async) {
+                r = f->offline_ops->wait(f, f->offline_userdata);
+                if (r < 0)
+                        return r;
+        }
+
+        /* The offline ops might have handed the file over to a thread meanwhile */
+        if (f->offline_async)
+                f->offline_async = false;
+        else {
+                r = pthread_join(f->offline_thread, NULL);
+                if (r)
+                        return -r;
+        }
 
         f->offline_state = OFFLINE_JOINED;
 
@@ -189,11 +233,46 @@ static bool journal_file_set_offline_try_restart(JournalFile *f) {
         }
 }
 
+static int journal_file_start_offline_thread(JournalFile *f) {
+        sigset_t ss, saved_ss;
+        int r;
+
+        assert(f);
+
+        if (sigfillset(&ss) < 0)
+                return -errno;
+
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        r = pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f);
+
+        assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+
+        return -r;
+}
+
+/* Continues an offline started through the offline ops in a thread, for when the ops can't carry on with it. The
+ * file is fsync()ed first, and journal_file_offline_synced() called after that. If no thread can be started, this
+ * is done synchronously. */
+void journal_file_offline_continue_in_thread(JournalFile *f) {
+        assert(f);
+        assert(f->offline_async);
+
+        f->offline_async = false;
+        if (journal_file_start_offline_thread(f) >= 0)
+                return;
+
+        f->offline_async = true;
+        journal_file_set_offline_internal(f);
+}
+
 /* Sets a journal offline.
  *
- * If wait is false then an offline is dispatched in a separate thread for a
- * subsequent journal_file_set_offline() or journal_file_set_online() of the
- * same journal to synchronize with.
+ * If wait is false then an offline is dispatched in a separate thread, or
+ * through the offline ops if set, for a subsequent journal_file_set_offline()
+ * or journal_file_set_online() of the same journal to synchronize with.
  *
  * If wait is true, then either an existing offline thread will be restarted
  * and joined, or if none exists the offline is simply performed in this
@@ -232,26 +311,15 @@ int journal_file_set_offline(JournalFile *f, bool wait) {
 
         if (wait) /* Without using a thread if waiting. */
                 journal_file_set_offline_internal(f);
+        else if (f->offline_ops && !journal_file_bloom_filter_pending(f) &&
+                 f->offline_ops->start_sync(f, f->offline_userdata) >= 0)
+                f->offline_async = true;
         else {
-                sigset_t ss, saved_ss;
-                int k;
-
-                if (sigfillset(&ss) < 0)
-                        return -errno;
-
-                r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
-                if (r > 0)
-                        return -r;
-
-                r = pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f);
-
-                k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
-                if (r > 0) {
+                r = journal_file_start_offline_thread(f);
+                if (r < 0) {
                         f->offline_state = OFFLINE_JOINED;
-                        return -r;
+                        return r;
                 }
-                if (k > 0)
-                        return -k;
         }
 
         return 0;
@@ -335,6 +403,14 @@ bool journal_file_is_offlining(JournalFile *f) {
         return true;
 }
 
+void journal_file_set_offline_ops(JournalFile *f, const JournalFileOfflineOps *ops, void *userdata) {
+        assert(f);
+        assert(!f->offline_async);
+
+        f->offline_ops = ops;
+        f->offline_userdata = userdata;
+}
+
 JournalFile* journal_file_close(JournalFile *f) {
         assert(f);
 
@@ -382,7 +458,13 @@ JournalFile* journal_file_close(JournalFile *f) {
 
         ordered_hashmap_free_free(f->chain_cache);
 
-#if HAVE_XZ || HAVE_LZ4
+        /* Give our share of the posting list budget back to the other files */
+        if (f->posting_list_budget)
+                *f->posting_list_budget += f->n_posting_list_entries;
+        hashmap_free_free(f->posting_lists);
+        free(f->boots);
+
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
         free(f->compress_buffer);
 #endif
 
@@ -413,7 +495,8 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
 
         h.incompatible_flags |= htole32(
                 f->compress_xz * HEADER_INCOMPATIBLE_COMPRESSED_XZ |
-                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4 |
+                f->compress_zstd * HEADER_INCOMPATIBLE_COMPRESSED_ZSTD);
 
         h.compatible_flags = htole32(
                 f->seal * HEADER_COMPATIBLE_SEALED);
@@ -483,7 +566,7 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                   f->path, type, flags & ~any);
                 flags = (flags & any) & ~supported;
                 if (flags) {
-                        const char* strv[3];
+                        const char* strv[4];
                         unsigned n = 0;
                         _cleanup_free_ char *t = NULL;
 
@@ -493,6 +576,8 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                 strv[n++] = "xz-compressed";
                         if (!compatible && (flags & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
                                 strv[n++] = "lz4-compressed";
+                        if (!compatible && (flags & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+                                strv[n++] = "zstd-compressed";
                         strv[n] = NULL;
                         assert(n < ELEMENTSOF(strv));
 
@@ -588,6 +673,7 @@ static int journal_file_verify_header(JournalFile *f) {
 
         f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
         f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
+        f->compress_zstd = JOURNAL_HEADER_COMPRESSED_ZSTD(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -730,6 +816,7 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_BLOOM_FILTER] = sizeof(BloomFilterObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -895,8 +982,32 @@ static int journal_file_check_object(JournalFile *f, uint64_t offset, Object *o)
                         return -EBADMSG;
                 }
 
+                break;
+
+        case OBJECT_BLOOM_FILTER: {
+                uint64_t sz;
+
+                sz = le64toh(o->object.size) - offsetof(BloomFilterObject, bits);
+                if (sz < 8 || (sz & (sz - 1)) != 0 || sz > UINT64_MAX / 8) {
+                        log_debug(
+                              "Invalid object bloom filter size: %"PRIu64": %"PRIu64,
+                              le64toh(o->object.size),
+                              offset);
+                        return -EBADMSG;
+                }
+
+                if (le64toh(o->bloom_filter.n_hash_functions) <= 0 ||
+                    le64toh(o->bloom_filter.n_hash_functions) > BLOOM_FILTER_HASH_FUNCTIONS_MAX) {
+                        log_debug(
+                              "Invalid object bloom filter hash function number: %"PRIu64": %"PRIu64,
+                              le64toh(o->bloom_filter.n_hash_functions),
+                              offset);
+                        return -EBADMSG;
+                }
+
                 break;
         }
+        }
 
         return 0;
 }
@@ -1048,7 +1159,7 @@ int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, O
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static int journal_file_setup_data_hash_table(JournalFile *f, uint64_t n_data) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -1056,14 +1167,21 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         assert(f);
         assert(f->header);
 
-        /* We estimate that we need 1 hash table entry per 768 bytes
-           of journal file and we want to make sure we never get
-           beyond 75% fill level. Calculate the hash table size for
-           the maximum file size based on these metrics. */
-
-        s = (f->metrics.max_size * 4 / 768 / 3) * sizeof(HashItem);
-        if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
-                s = DEFAULT_DATA_HASH_TABLE_SIZE;
+        if (n_data > 0)
+                /* The caller knows how many data objects will be
+                 * added, hence size the table for exactly that at 75%
+                 * fill level. */
+                s = DIV_ROUND_UP(n_data * 4, 3) * sizeof(HashItem);
+        else {
+                /* We estimate that we need 1 hash table entry per 768 bytes
+                   of journal file and we want to make sure we never get
+                   beyond 75% fill level. Calculate the hash table size for
+                   the maximum file size based on these metrics. */
+
+                s = (f->metrics.max_size * 4 / 768 / 3) * sizeof(HashItem);
+                if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
+                        s = DEFAULT_DATA_HASH_TABLE_SIZE;
+        }
 
         log_debug("Reserving %"PRIu64" entries in hash table.", s / sizeof(HashItem));
 
@@ -1082,7 +1200,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, uint64_t n_fields) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -1091,9 +1209,13 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         assert(f->header);
 
         /* We use a fixed size hash table for the fields as this
-         * number should grow very slowly only */
+         * number should grow very slowly only, unless the caller
+         * knows the exact number of fields in advance */
 
-        s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+        if (n_fields > 0)
+                s = DIV_ROUND_UP(n_fields * 4, 3) * sizeof(HashItem);
+        else
+                s = DEFAULT_FIELD_HASH_TABLE_SIZE;
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -1370,7 +1492,7 @@ int journal_file_find_data_object_with_hash(
                         goto next;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
                         uint64_t l;
                         size_t rsize = 0;
 
@@ -1435,6 +1557,281 @@ int journal_file_find_data_object(
                                                        ret, offset);
 }
 
+static uint64_t bloom_filter_bit(uint64_t hash, uint64_t i, uint64_t n_bits) {
+        /* The two halves of the Jenkins hash are independent of each other, derive all bit positions from
+         * them by double hashing. */
+        return ((hash & UINT32_MAX) + i * ((hash >> 32) | 1)) & (n_bits - 1);
+}
+
+static int bloom_filter_can_append(JournalFile *f) {
+        assert(f);
+        assert(f->header);
+
+        if (!f->writable)
+                return -EPERM;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, n_data))
+                return false;
+
+        /* The filter would have to be covered by a tag, too, and it's not worth it */
+        if (JOURNAL_HEADER_SEALED(f->header))
+                return false;
+
+        /* Already there, or at least reserved */
+        if (JOURNAL_HEADER_BLOOM_FILTER(f->header) || f->header->bloom_filter_offset != 0)
+                return false;
+
+        return le64toh(f->header->n_data) > 0;
+}
+
+static uint64_t bloom_filter_n_bits(uint64_t n_data) {
+        return ALIGN_POWER2(MAX(n_data * BLOOM_FILTER_BITS_PER_ITEM, 64U));
+}
+
+static int bloom_filter_build(JournalFile *f, uint64_t n_bits, uint8_t **ret_bits, uint64_t *ret_n) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        uint64_t n_data, n_buckets, n = 0, i, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+        assert(ret_bits);
+        assert(ret_n);
+
+        /* Sets the bits for the hashes of all DATA objects of the file, by walking its data hash table */
+
+        n_data = le64toh(f->header->n_data);
+
+        r = journal_file_map_data_hash_table(f);
+        if (r < 0)
+                return r;
+
+        bits = malloc0(n_bits / 8);
+        if (!bits)
+                return -ENOMEM;
+
+        n_buckets = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+        for (i = 0; i < n_buckets; i++)
+                for (p = le64toh(f->data_hash_table[i].head_hash_offset); p > 0; p = le64toh(o->data.next_hash_offset)) {
+                        uint64_t hash, k;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        /* Don't loop forever on a corrupted hash chain */
+                        if (++n > n_data)
+                                return -EBADMSG;
+
+                        hash = le64toh(o->data.hash);
+                        for (k = 0; k < BLOOM_FILTER_HASH_FUNCTIONS; k++) {
+                                uint64_t b = bloom_filter_bit(hash, k, n_bits);
+
+                                bits[b / 8] |= 1U << (b % 8);
+                        }
+                }
+
+        *ret_bits = TAKE_PTR(bits);
+        *ret_n = n;
+        return 0;
+}
+
+int journal_file_append_bloom_filter(JournalFile *f) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        uint64_t n_data, n_bits, n, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+
+        /* Adds a Bloom filter of the hashes of all DATA objects to a file that no further entries will be added
+         * to. Returns 0 if the file can't carry one. This walks all DATA objects of the file, see
+         * journal_file_reserve_bloom_filter() for files that are archived by a long running writer. */
+
+        r = bloom_filter_can_append(f);
+        if (r <= 0)
+                return r;
+
+        n_data = le64toh(f->header->n_data);
+        if (n_data > UINT64_MAX / 8 / BLOOM_FILTER_BITS_PER_ITEM / 2)
+                return -EFBIG;
+
+        n_bits = bloom_filter_n_bits(n_data);
+
+        r = bloom_filter_build(f, n_bits, &bits, &n);
+        if (r < 0)
+                return r;
+
+        r = journal_file_append_object(f, OBJECT_BLOOM_FILTER, offsetof(Object, bloom_filter.bits) + n_bits / 8, &o, &p);
+        if (r < 0)
+                return r;
+
+        o->bloom_filter.n_items = htole64(n);
+        o->bloom_filter.n_hash_functions = htole64(BLOOM_FILTER_HASH_FUNCTIONS);
+        memcpy(o->bloom_filter.bits, bits, n_bits / 8);
+
+        f->header->bloom_filter_offset = htole64(p);
+        f->header->compatible_flags = htole32(le32toh(f->header->compatible_flags) | HEADER_COMPATIBLE_BLOOM_FILTER);
+
+        return 1;
+}
+
+int journal_file_reserve_bloom_filter(JournalFile *f) {
+        uint64_t n_data, n_bits, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+
+        /* Like journal_file_append_bloom_filter(), but only appends an empty filter, which isn't flagged in the
+         * header yet. The bits are filled in when the file is taken offline, which usually happens in a separate
+         * thread, hence archiving a file doesn't have to walk all of its DATA objects. */
+
+        r = bloom_filter_can_append(f);
+        if (r <= 0)
+                return r;
+
+        n_data = le64toh(f->header->n_data);
+        if (n_data > UINT64_MAX / 8 / BLOOM_FILTER_BITS_PER_ITEM / 2)
+                return -EFBIG;
+
+        n_bits = bloom_filter_n_bits(n_data);
+
+        r = journal_file_append_object(f, OBJECT_BLOOM_FILTER, offsetof(Object, bloom_filter.bits) + n_bits / 8, &o, &p);
+        if (r < 0)
+                return r;
+
+        o->bloom_filter.n_items = htole64(n_data);
+        o->bloom_filter.n_hash_functions = htole64(BLOOM_FILTER_HASH_FUNCTIONS);
+        memzero(o->bloom_filter.bits, n_bits / 8);
+
+        f->header->bloom_filter_offset = htole64(p);
+
+        return 1;
+}
+
+static bool journal_file_bloom_filter_pending(JournalFile *f) {
+        assert(f);
+        assert(f->header);
+
+        return f->archive &&
+                JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) &&
+                f->header->bloom_filter_offset != 0 &&
+                !JOURNAL_HEADER_BLOOM_FILTER(f->header);
+}
+
+static int bloom_filter_build_reserved(JournalFile *f, uint64_t *ret_offset, uint8_t **ret_bits, uint64_t *ret_n_bits) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        uint64_t n_bits, n, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+        assert(ret_offset);
+        assert(ret_bits);
+        assert(ret_n_bits);
+
+        p = le64toh(f->header->bloom_filter_offset);
+
+        r = journal_file_move_to_object(f, OBJECT_BLOOM_FILTER, p, &o);
+        if (r < 0)
+                return r;
+
+        n_bits = (le64toh(o->object.size) - offsetof(Object, bloom_filter.bits)) * 8;
+        if (n_bits != bloom_filter_n_bits(le64toh(o->bloom_filter.n_items)))
+                return -EBADMSG;
+
+        r = bloom_filter_build(f, n_bits, &bits, &n);
+        if (r < 0)
+                return r;
+
+        /* The object might have been moved out of the mmap window by now */
+        r = journal_file_move_to_object(f, OBJECT_BLOOM_FILTER, p, &o);
+        if (r < 0)
+                return r;
+
+        if (n != le64toh(o->bloom_filter.n_items))
+                return -EBADMSG;
+
+        *ret_offset = p;
+        *ret_bits = TAKE_PTR(bits);
+        *ret_n_bits = n_bits;
+        return 0;
+}
+
+static int journal_file_fill_bloom_filter(JournalFile *f) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        uint64_t n_bits, p;
+        JournalFile *copy;
+        ssize_t l;
+        int r;
+
+        assert(f);
+        assert(f->header);
+
+        /* Fills in the filter reserved by journal_file_reserve_bloom_filter(). This may run in the offline thread,
+         * where the mmap cache of the file must not be used, as it might be shared with other files. Hence the
+         * DATA objects are read through a copy of the file with its own cache, and the bits are written with
+         * pwrite(). The filter is flagged in the header only once it is complete. */
+
+        r = journal_file_reopen(f, &copy);
+        if (r < 0)
+                return r;
+
+        r = bloom_filter_build_reserved(copy, &p, &bits, &n_bits);
+        (void) journal_file_close(copy);
+        if (r < 0)
+                return r;
+
+        l = pwrite(f->fd, bits, n_bits / 8, p + offsetof(Object, bloom_filter.bits));
+        if (l < 0)
+                return -errno;
+        if ((size_t) l != n_bits / 8)
+                return -EIO;
+
+        f->header->compatible_flags = htole32(le32toh(f->header->compatible_flags) | HEADER_COMPATIBLE_BLOOM_FILTER);
+
+        return 0;
+}
+
+int journal_file_bloom_filter_test(JournalFile *f, uint64_t hash) {
+        uint64_t n_bits, n_hash_functions, k;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+
+        /* Returns 0 if the file definitely has no DATA object with the specified hash, and > 0 if it might have
+         * one, or doesn't have a Bloom filter. Only archived files are trusted to have a complete filter. */
+
+        if (!JOURNAL_HEADER_BLOOM_FILTER(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) ||
+            f->header->state != STATE_ARCHIVED)
+                return 1;
+
+        r = journal_file_move_to_object(f, OBJECT_BLOOM_FILTER, le64toh(f->header->bloom_filter_offset), &o);
+        if (r < 0)
+                return r;
+
+        n_bits = (le64toh(o->object.size) - offsetof(Object, bloom_filter.bits)) * 8;
+        n_hash_functions = le64toh(o->bloom_filter.n_hash_functions);
+
+        for (k = 0; k < n_hash_functions; k++) {
+                uint64_t b = bloom_filter_bit(hash, k, n_bits);
+
+                if (!(o->bloom_filter.bits[b / 8] & (1U << (b % 8))))
+                        return 0;
+        }
+
+        return 1;
+}
+
 static int journal_file_append_field(
                 JournalFile *f,
                 const void *field, uint64_t size,
@@ -1497,12 +1894,12 @@ static int journal_file_append_field(
         return 0;
 }
 
-static int journal_file_append_data(
+static int journal_file_append_data_with_hash(
                 JournalFile *f,
-                const void *data, uint64_t size,
+                const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t hash, p;
+        uint64_t p;
         uint64_t osize;
         Object *o;
         int r, compression = 0;
@@ -1511,8 +1908,6 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
-
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
@@ -1534,11 +1929,11 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
         if (JOURNAL_FILE_COMPRESS(f) && size >= f->compress_threshold_bytes) {
                 size_t rsize = 0;
 
-                compression = compress_blob(data, size, o->data.payload, size - 1, &rsize);
+                compression = compress_blob(JOURNAL_FILE_COMPRESSION(f), data, size, o->data.payload, size - 1, &rsize);
 
                 if (compression >= 0) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
@@ -1598,9 +1993,20 @@ static int journal_file_append_data(
         return 0;
 }
 
-uint64_t journal_file_entry_n_items(Object *o) {
-        assert(o);
-
+static int journal_file_append_data(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                Object **ret, uint64_t *offset) {
+
+        assert(f);
+        assert(data || size == 0);
+
+        return journal_file_append_data_with_hash(f, data, size, hash64(data, size), ret, offset);
+}
+
+uint64_t journal_file_entry_n_items(Object *o) {
+        assert(o);
+
         if (o->object.type != OBJECT_ENTRY)
                 return 0;
 
@@ -1625,6 +2031,39 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
 }
 
+static int journal_file_append_entry_array(JournalFile *f, uint64_t n, Object **ret, uint64_t *offset) {
+        Object *o;
+        uint64_t q;
+        int r;
+
+        assert(f);
+        assert(f->header);
+        assert(n > 0);
+
+        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
+                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                       &o, &q);
+        if (r < 0)
+                return r;
+
+#if HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
+        if (r < 0)
+                return r;
+#endif
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
+                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+
+        if (ret)
+                *ret = o;
+
+        if (offset)
+                *offset = q;
+
+        return 0;
+}
+
 static int link_entry_into_array(JournalFile *f,
                                  le64_t *first,
                                  le64_t *idx,
@@ -1667,17 +2106,9 @@ static int link_entry_into_array(JournalFile *f,
         if (n < 4)
                 n = 4;
 
-        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
-                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
-                                       &o, &q);
-        if (r < 0)
-                return r;
-
-#if HAVE_GCRYPT
-        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
+        r = journal_file_append_entry_array(f, n, &o, &q);
         if (r < 0)
                 return r;
-#endif
 
         o->entry_array.items[i] = htole64(p);
 
@@ -1691,9 +2122,6 @@ static int link_entry_into_array(JournalFile *f,
                 o->entry_array.next_entry_array_offset = htole64(q);
         }
 
-        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
-                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
-
         *idx = htole64(hidx + 1);
 
         return 0;
@@ -1859,9 +2287,12 @@ void journal_file_post_change(JournalFile *f) {
 }
 
 static int post_change_thunk(sd_event_source *timer, uint64_t usec, void *userdata) {
-        assert(userdata);
+        JournalFile *f = userdata;
+
+        assert(f);
 
-        journal_file_post_change(userdata);
+        journal_file_post_change(f);
+        f->post_change_last = usec;
 
         return 1;
 }
@@ -1887,7 +2318,16 @@ static void schedule_post_change(JournalFile *f) {
                 goto fail;
         }
 
-        r = sd_event_source_set_time(f->post_change_timer, now + f->post_change_timer_period);
+        /* If we didn't post a change for a full period, then post this one right-away, so that followers see
+         * entries on a quiet system immediately. Only if changes come in faster than that we delay them, so
+         * that busy systems don't trigger an inotify event for each entry. */
+        if (now >= usec_add(f->post_change_last, f->post_change_timer_period)) {
+                journal_file_post_change(f);
+                f->post_change_last = now;
+                return;
+        }
+
+        r = sd_event_source_set_time(f->post_change_timer, usec_add(f->post_change_last, f->post_change_timer_period));
         if (r < 0) {
                 log_debug_errno(r, "Failed to set time for scheduling ftruncate: %m");
                 goto fail;
@@ -1934,11 +2374,36 @@ static int entry_item_cmp(const EntryItem *a, const EntryItem *b) {
         return CMP(le64toh(a->object_offset), le64toh(b->object_offset));
 }
 
-int journal_file_append_entry(
+static int validate_timestamp(const dual_timestamp *ts) {
+        assert(ts);
+
+        if (!VALID_REALTIME(ts->realtime)) {
+                log_debug("Invalid realtime timestamp %"PRIu64", refusing entry.", ts->realtime);
+                return -EBADMSG;
+        }
+        if (!VALID_MONOTONIC(ts->monotonic)) {
+                log_debug("Invalid monotomic timestamp %"PRIu64", refusing entry.", ts->monotonic);
+                return -EBADMSG;
+        }
+
+        return 0;
+}
+
+/* Remembers the DATA objects appended within one batch of entries, so that payloads repeated across the
+ * entries of a batch (_BOOT_ID=, _HOSTNAME=, _SYSTEMD_UNIT=, …) are resolved without looking them up in
+ * the hash table again. DATA objects never move, hence the offsets stay valid for the whole batch. */
+typedef struct BatchDataItem {
+        uint64_t hash;
+        const struct iovec *iovec;
+        uint64_t offset;
+} BatchDataItem;
+
+static int journal_file_append_entry_items(
                 JournalFile *f,
                 const dual_timestamp *ts,
                 const sd_id128_t *boot_id,
                 const struct iovec iovec[], unsigned n_iovec,
+                Hashmap *data_cache, BatchDataItem *data_cache_items, size_t *n_data_cache_items,
                 uint64_t *seqnum,
                 Object **ret, uint64_t *offset) {
 
@@ -1946,25 +2411,12 @@ int journal_file_append_entry(
         EntryItem *items;
         int r;
         uint64_t xor_hash = 0;
-        struct dual_timestamp _ts;
 
         assert(f);
         assert(f->header);
+        assert(ts);
         assert(iovec || n_iovec == 0);
-
-        if (ts) {
-                if (!VALID_REALTIME(ts->realtime)) {
-                        log_debug("Invalid realtime timestamp %"PRIu64", refusing entry.", ts->realtime);
-                        return -EBADMSG;
-                }
-                if (!VALID_MONOTONIC(ts->monotonic)) {
-                        log_debug("Invalid monotomic timestamp %"PRIu64", refusing entry.", ts->monotonic);
-                        return -EBADMSG;
-                }
-        } else {
-                dual_timestamp_get(&_ts);
-                ts = &_ts;
-        }
+        assert(!data_cache || (data_cache_items && n_data_cache_items));
 
 #if HAVE_GCRYPT
         r = journal_file_maybe_append_tag(f, ts->realtime);
@@ -1976,23 +2428,58 @@ int journal_file_append_entry(
         items = newa(EntryItem, MAX(1u, n_iovec));
 
         for (i = 0; i < n_iovec; i++) {
-                uint64_t p;
+                BatchDataItem *cached = NULL;
+                uint64_t h, p;
                 Object *o;
 
-                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, &o, &p);
+                h = hash64(iovec[i].iov_base, iovec[i].iov_len);
+
+                if (data_cache) {
+                        cached = hashmap_get(data_cache, &h);
+                        if (cached &&
+                            cached->iovec->iov_len == iovec[i].iov_len &&
+                            memcmp_safe(cached->iovec->iov_base, iovec[i].iov_base, iovec[i].iov_len) == 0) {
+
+                                xor_hash ^= h;
+                                items[i].object_offset = htole64(cached->offset);
+                                items[i].hash = htole64(h);
+                                continue;
+                        }
+                }
+
+                r = journal_file_append_data_with_hash(f, iovec[i].iov_base, iovec[i].iov_len, h, &o, &p);
                 if (r < 0)
                         return r;
 
                 xor_hash ^= le64toh(o->data.hash);
                 items[i].object_offset = htole64(p);
                 items[i].hash = o->data.hash;
+
+                /* On a hash collision with a different payload we simply keep the first one cached */
+                if (data_cache && !cached) {
+                        BatchDataItem *c = data_cache_items + (*n_data_cache_items)++;
+
+                        *c = (BatchDataItem) {
+                                .hash = h,
+                                .iovec = iovec + i,
+                                .offset = p,
+                        };
+
+                        r = hashmap_put(data_cache, &c->hash, c);
+                        if (r < 0)
+                                return r;
+                }
         }
 
         /* Order by the position on disk, in order to improve seek
          * times for rotating media. */
         typesafe_qsort(items, n_iovec, entry_item_cmp);
 
-        r = journal_file_append_entry_internal(f, ts, boot_id, xor_hash, items, n_iovec, seqnum, ret, offset);
+        return journal_file_append_entry_internal(f, ts, boot_id, xor_hash, items, n_iovec, seqnum, ret, offset);
+}
+
+static int journal_file_append_finish(JournalFile *f, int r) {
+        assert(f);
 
         /* If the memory mapping triggered a SIGBUS then we return an
          * IO error and ignore the error code passed down to us, since
@@ -2010,6 +2497,93 @@ int journal_file_append_entry(
         return r;
 }
 
+int journal_file_append_entry(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                const sd_id128_t *boot_id,
+                const struct iovec iovec[], unsigned n_iovec,
+                uint64_t *seqnum,
+                Object **ret, uint64_t *offset) {
+
+        struct dual_timestamp _ts;
+        int r;
+
+        assert(f);
+        assert(f->header);
+        assert(iovec || n_iovec == 0);
+
+        if (ts) {
+                r = validate_timestamp(ts);
+                if (r < 0)
+                        return r;
+        } else {
+                dual_timestamp_get(&_ts);
+                ts = &_ts;
+        }
+
+        r = journal_file_append_entry_items(f, ts, boot_id, iovec, n_iovec, NULL, NULL, NULL, seqnum, ret, offset);
+
+        return journal_file_append_finish(f, r);
+}
+
+int journal_file_append_entries(
+                JournalFile *f,
+                const JournalEntryBatchItem entries[], unsigned n_entries,
+                const sd_id128_t *boot_id,
+                uint64_t *seqnum,
+                unsigned *ret_n_appended) {
+
+        _cleanup_hashmap_free_ Hashmap *data_cache = NULL;
+        _cleanup_free_ BatchDataItem *data_cache_items = NULL;
+        size_t n_data_cache_items = 0, n_total = 0;
+        unsigned i;
+        int r = 0;
+
+        assert(f);
+        assert(f->header);
+        assert(entries || n_entries == 0);
+
+        /* Appends a batch of entries to the file. Identical DATA payloads within the batch are looked up only
+         * once, and readers are notified once for the whole batch. Entries are written in order; on failure
+         * the number of entries that made it into the file is returned in ret_n_appended, so that the caller
+         * may rotate and retry with the rest. */
+
+        if (ret_n_appended)
+                *ret_n_appended = 0;
+
+        for (i = 0; i < n_entries; i++) {
+                r = validate_timestamp(&entries[i].ts);
+                if (r < 0)
+                        return r;
+
+                n_total += entries[i].n_iovec;
+        }
+
+        if (n_entries > 1 && n_total > 0) {
+                data_cache = hashmap_new(&uint64_hash_ops);
+                data_cache_items = new(BatchDataItem, n_total);
+                if (!data_cache || !data_cache_items)
+                        return -ENOMEM;
+        }
+
+        for (i = 0; i < n_entries; i++) {
+                r = journal_file_append_entry_items(f, &entries[i].ts, boot_id,
+                                                    entries[i].iovec, entries[i].n_iovec,
+                                                    data_cache, data_cache_items, &n_data_cache_items,
+                                                    seqnum, NULL, NULL);
+                if (r < 0)
+                        break;
+        }
+
+        r = journal_file_append_finish(f, r);
+
+        /* After a SIGBUS nothing written in this batch can be trusted, let the caller retry all of it */
+        if (ret_n_appended && !mmap_cache_got_sigbus(f->mmap, f->cache_fd))
+                *ret_n_appended = i;
+
+        return r;
+}
+
 typedef struct ChainCacheItem {
         uint64_t first; /* the array at the beginning of the chain */
         uint64_t array; /* the cached array */
@@ -2831,6 +3405,185 @@ int journal_file_next_entry_for_data(
         return 1;
 }
 
+typedef struct PostingList {
+        uint64_t data_offset;
+        uint64_t n_entries; /* 0 if the entry arrays of this DATA object couldn't be flattened */
+        uint64_t entries[];
+} PostingList;
+
+static int posting_list_build(JournalFile *f, uint64_t n, uint64_t extra, uint64_t a, PostingList *pl) {
+        uint64_t i = 0;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(pl);
+
+        if (extra == 0)
+                return -EBADMSG;
+
+        pl->entries[i++] = extra;
+
+        while (a > 0 && i < n) {
+                uint64_t k, j;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
+
+                k = journal_file_entry_array_n_items(o);
+                for (j = 0; j < k && i < n; j++) {
+                        uint64_t q;
+
+                        q = le64toh(o->entry_array.items[j]);
+                        if (q <= pl->entries[i-1])
+                                return -EBADMSG;
+
+                        pl->entries[i++] = q;
+                }
+
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        }
+
+        if (i < n)
+                return -EBADMSG;
+
+        return 0;
+}
+
+static int journal_file_get_posting_list(JournalFile *f, uint64_t data_offset, PostingList **ret) {
+        PostingList *pl;
+        uint64_t n;
+        Object *d;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        /* For archived files, which are never written to again, flatten the entry array chain of a DATA object
+         * into a single sorted array the first time it is looked at, so that repeated seeks for the same match
+         * can be bisected in memory instead of walking the chain through the mmap cache each time. Returns 0
+         * if the caller should walk the entry arrays itself. */
+
+        if (f->writable || f->header->state != STATE_ARCHIVED)
+                return 0;
+
+        pl = hashmap_get(f->posting_lists, &data_offset);
+        if (pl) {
+                if (pl->n_entries == 0)
+                        return 0;
+
+                *ret = pl;
+                return 1;
+        }
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        n = le64toh(d->data.n_entries);
+        if (n < POSTING_LIST_MIN_ENTRIES)
+                return 0;
+        if (n > POSTING_LISTS_MAX_ENTRIES - f->n_posting_list_entries)
+                return 0;
+        if (f->posting_list_budget && n > *f->posting_list_budget)
+                return 0; /* Once the budget is used up, fall back to bisecting the arrays on disk */
+
+        r = hashmap_ensure_allocated(&f->posting_lists, &uint64_hash_ops);
+        if (r < 0)
+                return r;
+
+        pl = malloc(offsetof(PostingList, entries) + n * sizeof(uint64_t));
+        if (!pl)
+                return -ENOMEM;
+
+        pl->data_offset = data_offset;
+
+        r = posting_list_build(f, n, le64toh(d->data.entry_offset), le64toh(d->data.entry_array_offset), pl);
+        if (r == -EBADMSG) {
+                /* Let the regular code deal with (and skip over) the broken bits, and remember not to try again */
+                log_debug_errno(r, "%s: entry array chain of data object at %" PRIu64 " is not properly ordered, not flattening it.",
+                                f->path, data_offset);
+                free(pl);
+
+                pl = new0(PostingList, 1);
+                if (!pl)
+                        return -ENOMEM;
+
+                pl->data_offset = data_offset;
+        } else if (r < 0) {
+                free(pl);
+                return r;
+        } else
+                pl->n_entries = n;
+
+        r = hashmap_put(f->posting_lists, &pl->data_offset, pl);
+        if (r < 0) {
+                free(pl);
+                return r;
+        }
+
+        f->n_posting_list_entries += pl->n_entries;
+        if (f->posting_list_budget)
+                *f->posting_list_budget -= pl->n_entries;
+
+        if (pl->n_entries == 0)
+                return 0;
+
+        *ret = pl;
+        return 1;
+}
+
+static int posting_list_bisect(
+                JournalFile *f,
+                const PostingList *pl,
+                uint64_t p,
+                direction_t direction,
+                Object **ret, uint64_t *offset) {
+
+        uint64_t left = 0, right, q;
+        int r;
+
+        assert(f);
+        assert(pl);
+        assert(pl->n_entries > 0);
+
+        /* Find the first entry at or after p, the same way generic_array_bisect_plus_one() does with
+         * test_object_offset() */
+        right = pl->n_entries;
+        while (left < right) {
+                uint64_t m = left + (right - left) / 2;
+
+                if (pl->entries[m] < p)
+                        left = m + 1;
+                else
+                        right = m;
+        }
+
+        if (direction == DIRECTION_DOWN) {
+                if (left >= pl->n_entries)
+                        return 0;
+        } else if (left >= pl->n_entries || pl->entries[left] != p) {
+                if (left == 0)
+                        return 0;
+
+                left--;
+        }
+
+        q = pl->entries[left];
+
+        if (ret) {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, q, ret);
+                if (r < 0)
+                        return r;
+        }
+
+        if (offset)
+                *offset = q;
+
+        return 1;
+}
+
 int journal_file_move_to_entry_by_offset_for_data(
                 JournalFile *f,
                 uint64_t data_offset,
@@ -2838,11 +3591,18 @@ int journal_file_move_to_entry_by_offset_for_data(
                 direction_t direction,
                 Object **ret, uint64_t *offset) {
 
+        PostingList *pl;
         int r;
         Object *d;
 
         assert(f);
 
+        r = journal_file_get_posting_list(f, data_offset, &pl);
+        if (r < 0)
+                return r;
+        if (r > 0)
+                return posting_list_bisect(f, pl, p, direction, ret, offset);
+
         r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
         if (r < 0)
                 return r;
@@ -3047,6 +3807,12 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_BLOOM_FILTER:
+                        printf("Type: OBJECT_BLOOM_FILTER items=%"PRIu64" hash functions=%"PRIu64"\n",
+                               le64toh(o->bloom_filter.n_items),
+                               le64toh(o->bloom_filter.n_hash_functions));
+                        break;
+
                 default:
                         printf("Type: unknown (%i)\n", o->object.type);
                         break;
@@ -3076,6 +3842,44 @@ static const char* format_timestamp_safe(char *buf, size_t l, usec_t t) {
         return " --- ";
 }
 
+void journal_file_print_mmap_statistics(MMapCache *m) {
+        static const char * const context_table[MMAP_CACHE_MAX_CONTEXTS] = {
+                [0]                       = "other",
+                [OBJECT_DATA]             = "data",
+                [OBJECT_FIELD]            = "field",
+                [OBJECT_ENTRY]            = "entry",
+                [OBJECT_DATA_HASH_TABLE]  = "data hash table",
+                [OBJECT_FIELD_HASH_TABLE] = "field hash table",
+                [OBJECT_ENTRY_ARRAY]      = "entry array",
+                [OBJECT_TAG]              = "tag",
+                [OBJECT_BLOOM_FILTER]     = "bloom filter",
+                [CONTEXT_HEADER]          = "header",
+        };
+        unsigned i;
+
+        assert(m);
+
+        fprintf(stderr,
+                "mmap cache: %u hit, %u missed, %u windows evicted\n"
+                "%-17s %10s %10s %10s %10s %10s\n",
+                mmap_cache_get_hit(m), mmap_cache_get_missed(m), mmap_cache_get_evicted(m),
+                "CONTEXT", "HIT", "OTHER WIN", "MISSED", "SEQUENTIAL", "WINDOW");
+
+        for (i = 0; i < MMAP_CACHE_MAX_CONTEXTS; i++) {
+                MMapCacheContextStatistics stats;
+                char bytes[FORMAT_BYTES_MAX];
+
+                mmap_cache_get_context_statistics(m, i, &stats);
+                if (stats.n_context_hit + stats.n_window_hit + stats.n_missed == 0)
+                        continue;
+
+                fprintf(stderr, "%-17s %10u %10u %10u %10u %10s\n",
+                        strna(context_table[i]),
+                        stats.n_context_hit, stats.n_window_hit, stats.n_missed, stats.n_sequential,
+                        format_bytes(bytes, sizeof(bytes), stats.window_size));
+        }
+}
+
 void journal_file_print_header(JournalFile *f) {
         char a[33], b[33], c[33], d[33];
         char x[FORMAT_TIMESTAMP_MAX], y[FORMAT_TIMESTAMP_MAX], z[FORMAT_TIMESTAMP_MAX];
@@ -3091,8 +3895,8 @@ void journal_file_print_header(JournalFile *f) {
                "Boot ID: %s\n"
                "Sequential Number ID: %s\n"
                "State: %s\n"
-               "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s%s\n"
+               "Compatible Flags:%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -3114,9 +3918,11 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ONLINE ? "ONLINE" :
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
+               JOURNAL_HEADER_BLOOM_FILTER(f->header) ? " BLOOM-FILTER" : "",
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
@@ -3149,6 +3955,10 @@ void journal_file_print_header(JournalFile *f) {
         if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
                 printf("Entry Array Objects: %"PRIu64"\n",
                        le64toh(f->header->n_entry_arrays));
+        if (JOURNAL_HEADER_BLOOM_FILTER(f->header) &&
+            JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset))
+                printf("Bloom Filter Offset: %"PRIu64"\n",
+                       le64toh(f->header->bloom_filter_offset));
 
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (uint64_t) st.st_blocks * 512ULL));
@@ -3189,7 +3999,7 @@ static int journal_file_warn_btrfs(JournalFile *f) {
         return 1;
 }
 
-int journal_file_open(
+static int journal_file_open_internal(
                 int fd,
                 const char *fname,
                 int flags,
@@ -3201,6 +4011,8 @@ int journal_file_open(
                 MMapCache *mmap_cache,
                 Set *deferred_closes,
                 JournalFile *template,
+                uint64_t n_data,
+                uint64_t n_fields,
                 JournalFile **ret) {
 
         bool newly_created = false;
@@ -3230,7 +4042,9 @@ int journal_file_open(
                 .prot = prot_from_flags(flags),
                 .writable = (flags & O_ACCMODE) != O_RDONLY,
 
-#if HAVE_LZ4
+#if HAVE_ZSTD
+                .compress_zstd = compress,
+#elif HAVE_LZ4
                 .compress_lz4 = compress,
 #elif HAVE_XZ
                 .compress_xz = compress,
@@ -3386,11 +4200,11 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, n_fields);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_data_hash_table(f, n_data);
                 if (r < 0)
                         goto fail;
 
@@ -3416,6 +4230,9 @@ int journal_file_open(
                         goto fail;
         }
 
+        if (template)
+                journal_file_set_offline_ops(f, template->offline_ops, template->offline_userdata);
+
         /* The file is opened now successfully, thus we take possession of any passed in fd. */
         f->close_fd = true;
 
@@ -3431,8 +4248,27 @@ fail:
         return r;
 }
 
+int journal_file_open(
+                int fd,
+                const char *fname,
+                int flags,
+                mode_t mode,
+                bool compress,
+                uint64_t compress_threshold_bytes,
+                bool seal,
+                JournalMetrics *metrics,
+                MMapCache *mmap_cache,
+                Set *deferred_closes,
+                JournalFile *template,
+                JournalFile **ret) {
+
+        return journal_file_open_internal(fd, fname, flags, mode, compress, compress_threshold_bytes, seal,
+                                          metrics, mmap_cache, deferred_closes, template, 0, 0, ret);
+}
+
 int journal_file_archive(JournalFile *f) {
         _cleanup_free_ char *p = NULL;
+        int r;
 
         assert(f);
 
@@ -3462,6 +4298,9 @@ int journal_file_archive(JournalFile *f) {
         /* Sync the rename to disk */
         (void) fsync_directory_of_file(f->fd);
 
+        /* From now on, refer to the file under its new name */
+        free_and_replace(f->path, p);
+
         /* Set as archive so offlining commits w/state=STATE_ARCHIVED. Previously we would set old_file->header->state
          * to STATE_ARCHIVED directly here, but journal_file_set_offline() short-circuits when state != STATE_ONLINE,
          * which would result in the rotated journal never getting fsync() called before closing.  Now we simply queue
@@ -3469,6 +4308,12 @@ int journal_file_archive(JournalFile *f) {
          * occurs. */
         f->archive = true;
 
+        /* No further entries will be added to the file, hence now is the time to summarize its data. The actual
+         * work is done when the file is taken offline, see journal_file_set_offline_internal(). */
+        r = journal_file_reserve_bloom_filter(f);
+        if (r < 0)
+                log_debug_errno(r, "Failed to reserve Bloom filter in %s, ignoring: %m", f->path);
+
         /* Currently, btrfs is not very good with out write patterns and fragments heavily. Let's defrag our journal
          * files when we archive them */
         f->defrag_on_close = true;
@@ -3505,19 +4350,25 @@ int journal_file_rotate(
                 bool seal,
                 Set *deferred_closes) {
 
+        _cleanup_free_ char *path = NULL;
         JournalFile *new_file = NULL;
         int r;
 
         assert(f);
         assert(*f);
 
+        /* The new file takes the name the old one had before it was archived */
+        path = strdup((*f)->path);
+        if (!path)
+                return -ENOMEM;
+
         r = journal_file_archive(*f);
         if (r < 0)
                 return r;
 
         r = journal_file_open(
                         -1,
-                        (*f)->path,
+                        path,
                         (*f)->flags,
                         (*f)->mode,
                         compress,
@@ -3619,9 +4470,29 @@ int journal_file_open_reliably(
                                  deferred_closes, template, ret);
 }
 
-int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p) {
+int journal_file_reopen(JournalFile *f, JournalFile **ret) {
+        int fd, r;
+
+        assert(f);
+        assert(ret);
+
+        /* Opens the file a second time, read-only and with its own mmap cache, so that the new object may be
+         * used by a different thread than the original one. */
+
+        fd = fcntl(f->fd, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
+                return -errno;
+
+        r = journal_file_open(fd, f->path, O_RDONLY, 0, false, 0, false, NULL, NULL, NULL, NULL, ret);
+        if (r < 0)
+                safe_close(fd);
+
+        return r;
+}
+
+static int journal_file_copy_entry_internal(JournalFile *from, JournalFile *to, Object *o, uint64_t p, bool compact) {
         uint64_t i, n;
-        uint64_t q, xor_hash = 0;
+        uint64_t q, xor_hash = 0, seqnum;
         int r;
         EntryItem *items;
         dual_timestamp ts;
@@ -3639,12 +4510,15 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         ts.realtime = le64toh(o->entry.realtime);
         boot_id = &o->entry.boot_id;
 
+        /* When compacting, keep the seqnum of the entry, which makes it take the seqnum we pass in below */
+        seqnum = le64toh(o->entry.seqnum) - 1;
+
         n = journal_file_entry_n_items(o);
         /* alloca() can't take 0, hence let's allocate at least one */
         items = newa(EntryItem, MAX(1u, n));
 
         for (i = 0; i < n; i++) {
-                uint64_t l, h;
+                uint64_t l, h, a, n_entries;
                 le64_t le_hash;
                 size_t t;
                 void *data;
@@ -3660,6 +4534,8 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 if (le_hash != o->data.hash)
                         return -EBADMSG;
 
+                n_entries = le64toh(o->data.n_entries);
+
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
                 t = (size_t) l;
 
@@ -3668,7 +4544,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                         return -E2BIG;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
                         size_t rsize = 0;
 
                         r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
@@ -3692,13 +4568,29 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 items[i].object_offset = htole64(h);
                 items[i].hash = u->data.hash;
 
+                if (compact && n_entries > 1 && u->data.n_entries == 0 && u->data.entry_array_offset == 0) {
+                        /* A new data object in the compacted file: we know how many entries will reference
+                         * it, hence allocate a single entry array of the right size right-away, instead of
+                         * letting it grow in a chain of arrays. The first entry is stored in the data
+                         * object itself. */
+                        r = journal_file_append_entry_array(to, n_entries - 1, NULL, &a);
+                        if (r < 0)
+                                return r;
+
+                        r = journal_file_move_to_object(to, OBJECT_DATA, h, &u);
+                        if (r < 0)
+                                return r;
+
+                        u->data.entry_array_offset = htole64(a);
+                }
+
                 r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
                 if (r < 0)
                         return r;
         }
 
         r = journal_file_append_entry_internal(to, &ts, boot_id, xor_hash, items, n,
-                                               NULL, NULL, NULL);
+                                               compact ? &seqnum : NULL, NULL, NULL);
 
         if (mmap_cache_got_sigbus(to->mmap, to->cache_fd))
                 return -EIO;
@@ -3706,6 +4598,150 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         return r;
 }
 
+int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p) {
+        return journal_file_copy_entry_internal(from, to, o, p, false);
+}
+
+static void journal_file_copy_attributes(JournalFile *from, int fd) {
+        _cleanup_free_ char *acl = NULL;
+        usec_t crtime;
+        int n;
+
+        assert(from);
+        assert(fd >= 0);
+
+        /* Carry over ownership, access mode and ACLs, so that whoever could read the old file can read the new
+         * one, as well as the creation time the vacuuming logic might look at. */
+
+        (void) fchmod(fd, from->last_stat.st_mode & 07777);
+        (void) fchown(fd, from->last_stat.st_uid, from->last_stat.st_gid);
+
+        n = fgetxattr_malloc(from->fd, "system.posix_acl_access", &acl);
+        if (n > 0)
+                (void) fsetxattr(fd, "system.posix_acl_access", acl, n, 0);
+
+        if (fd_getcrtime(from->fd, &crtime) >= 0)
+                (void) fd_setcrtime(fd, crtime);
+}
+
+int journal_file_compact(JournalFile *from, MMapCache *mmap_cache, uint64_t *ret_size) {
+        _cleanup_free_ char *t = NULL;
+        _cleanup_close_ int fd = -1;
+        JournalFile *to = NULL;
+        uint64_t n, i, n_data, n_fields, q;
+        Object *o;
+        int r;
+
+        assert(from);
+        assert(from->header);
+
+        /* Rewrites an archived journal file, and atomically replaces it with the result. Archived files still
+         * carry the layout they were written with while online: hash tables sized for the maximum file size,
+         * and entry arrays that grew in exponentially sized chunks, chained per data object. The rewritten
+         * file has hash tables sized for exactly the objects it contains, a single entry array per data
+         * object and for the file as a whole, and data objects compressed with the current settings. */
+
+        if (from->header->state != STATE_ARCHIVED)
+                return -EBUSY;
+
+        /* We have no sealing key, and rewriting the file would invalidate the seal */
+        if (JOURNAL_HEADER_SEALED(from->header))
+                return -EOPNOTSUPP;
+
+        if (path_startswith(from->path, "/proc/self/fd"))
+                return -EINVAL;
+
+        n = le64toh(from->header->n_entries);
+        n_data = JOURNAL_HEADER_CONTAINS(from->header, n_data) ? le64toh(from->header->n_data) : 0;
+        n_fields = JOURNAL_HEADER_CONTAINS(from->header, n_fields) ? le64toh(from->header->n_fields) : 0;
+
+        r = tempfn_random(from->path, NULL, &t);
+        if (r < 0)
+                return r;
+
+        fd = open(t, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC|O_NOCTTY, 0600);
+        if (fd < 0)
+                return -errno;
+
+        journal_file_copy_attributes(from, fd);
+
+        r = journal_file_open_internal(fd, t, O_RDWR, 0600, true, (uint64_t) -1, false, NULL, mmap_cache,
+                                       NULL, NULL, n_data, n_fields, &to);
+        if (r < 0)
+                goto fail;
+
+        fd = -1; /* now owned by 'to' */
+
+        /* Keep the identity of the original file, so that the entries keep their cursors */
+        to->header->seqnum_id = from->header->seqnum_id;
+        to->header->machine_id = from->header->machine_id;
+
+        if (n > 0) {
+                r = journal_file_append_entry_array(to, n, NULL, &q);
+                if (r < 0)
+                        goto fail;
+
+                to->header->entry_array_offset = htole64(q);
+        }
+
+        for (i = 0; i < n; i++) {
+                uint64_t p;
+
+                r = generic_array_get(from, le64toh(from->header->entry_array_offset), i, &o, &p);
+                if (r < 0)
+                        goto fail;
+                if (r == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                r = journal_file_copy_entry_internal(from, to, o, p, true);
+                if (r < 0)
+                        goto fail;
+        }
+
+        to->archive = true;
+
+        r = journal_file_append_bloom_filter(to);
+        if (r < 0)
+                goto fail;
+
+        r = journal_file_set_offline(to, true);
+        if (r < 0)
+                goto fail;
+
+        r = journal_file_verify(to, NULL, NULL, NULL, NULL, 0);
+        if (r < 0)
+                goto fail;
+
+        if (rename(t, from->path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        (void) fsync_directory_of_file(to->fd);
+
+        if (ret_size) {
+                r = journal_file_fstat(to);
+                if (r < 0) {
+                        (void) journal_file_close(to);
+                        return r;
+                }
+
+                *ret_size = (uint64_t) to->last_stat.st_blocks * 512ULL;
+        }
+
+        (void) journal_file_close(to);
+        return 0;
+
+fail:
+        if (to)
+                (void) journal_file_close(to);
+
+        (void) unlink(t);
+        return r;
+}
+
 void journal_reset_metrics(JournalMetrics *m) {
         assert(m);
 
@@ -3838,11 +4874,26 @@ int journal_file_get_cutoff_realtime_usec(JournalFile *f, usec_t *from, usec_t *
 int journal_file_get_cutoff_monotonic_usec(JournalFile *f, sd_id128_t boot_id, usec_t *from, usec_t *to) {
         Object *o;
         uint64_t p;
+        size_t i;
         int r;
 
         assert(f);
         assert(from || to);
 
+        if (f->boots_cached) {
+                for (i = 0; i < f->n_boots; i++)
+                        if (sd_id128_equal(f->boots[i].boot_id, boot_id)) {
+                                if (from)
+                                        *from = f->boots[i].first_monotonic;
+                                if (to)
+                                        *to = f->boots[i].last_monotonic;
+
+                                return 1;
+                        }
+
+                return 0;
+        }
+
         r = find_data_object_by_boot_id(f, boot_id, &o, &p);
         if (r <= 0)
                 return r;
@@ -3877,6 +4928,90 @@ int journal_file_get_cutoff_monotonic_usec(JournalFile *f, sd_id128_t boot_id, u
         return 1;
 }
 
+static void boot_from_entry(Object *o, uint64_t *seqnum, uint64_t *realtime, uint64_t *monotonic) {
+        *seqnum = le64toh(o->entry.seqnum);
+        *realtime = le64toh(o->entry.realtime);
+        *monotonic = le64toh(o->entry.monotonic);
+}
+
+int journal_file_get_boots(JournalFile *f, const JournalFileBoot **ret, size_t *ret_n) {
+        _cleanup_free_ JournalFileBoot *boots = NULL;
+        size_t n_boots = 0, n_allocated = 0;
+        uint64_t p, n_data, k;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ret);
+        assert(ret_n);
+
+        /* Summarizes the boots this file has entries of by looking only at the first and the last entry
+         * referencing each _BOOT_ID= data object, so that the number of objects we need to look at grows with the
+         * number of boots, not the number of entries. Archived files never change, hence we calculate this only
+         * once for them. */
+
+        if (f->boots_cached)
+                goto finish;
+
+        r = journal_file_find_field_object(f, "_BOOT_ID", STRLEN("_BOOT_ID"), &o, NULL);
+        if (r < 0)
+                return r;
+
+        p = r > 0 ? le64toh(o->field.head_data_offset) : 0;
+        n_data = le64toh(f->header->n_data);
+
+        for (k = 0; p > 0; k++) {
+                JournalFileBoot *b;
+                uint64_t next;
+
+                /* Don't loop forever on a corrupted file */
+                if (k >= n_data)
+                        return -EBADMSG;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                next = le64toh(o->data.next_field_offset);
+
+                if (!GREEDY_REALLOC(boots, n_allocated, n_boots + 1))
+                        return -ENOMEM;
+
+                b = boots + n_boots;
+                *b = (JournalFileBoot) {
+                        .n_entries = le64toh(o->data.n_entries),
+                };
+
+                r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &o, NULL);
+                if (r < 0)
+                        return r;
+                if (r > 0) {
+                        b->boot_id = o->entry.boot_id;
+                        boot_from_entry(o, &b->first_seqnum, &b->first_realtime, &b->first_monotonic);
+
+                        r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &o, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r > 0) {
+                                boot_from_entry(o, &b->last_seqnum, &b->last_realtime, &b->last_monotonic);
+                                n_boots++;
+                        }
+                }
+
+                p = next;
+        }
+
+        free_and_replace(f->boots, boots);
+        f->n_boots = n_boots;
+        f->boots_cached = !f->writable && f->header->state == STATE_ARCHIVED;
+
+finish:
+        *ret = f->boots;
+        *ret_n = f->n_boots;
+
+        return 0;
+}
+
 bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec) {
         assert(f);
         assert(f->header);
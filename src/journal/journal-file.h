@@ -12,6 +12,7 @@
 
 #include "hashmap.h"
 #include "journal-def.h"
+#include "list.h"
 #include "macro.h"
 #include "mmap-cache.h"
 #include "sparse-endian.h"
@@ -55,6 +56,27 @@ typedef enum OfflineState {
         OFFLINE_DONE
 } OfflineState;
 
+struct JournalFile;
+
+typedef struct JournalFileOfflineOps {
+        /* Starts an fsync() of the file in the background. Returns a negative errno if that's not possible,
+         * in which case a thread is used instead. Once the fsync() completed, journal_file_offline_synced()
+         * needs to be called, and the file fsync()ed again for as long as that returns true. If the next fsync()
+         * can't be started, journal_file_offline_continue_in_thread() hands the file over to a thread. */
+        int (*start_sync)(struct JournalFile *f, void *userdata);
+
+        /* Blocks until the offline started with start_sync() is done, or was handed over to a thread */
+        int (*wait)(struct JournalFile *f, void *userdata);
+} JournalFileOfflineOps;
+
+typedef struct JournalFileBoot {
+        sd_id128_t boot_id;
+        uint64_t n_entries;
+        uint64_t first_seqnum, last_seqnum;
+        uint64_t first_realtime, last_realtime;
+        uint64_t first_monotonic, last_monotonic;
+} JournalFileBoot;
+
 typedef struct JournalFile {
         int fd;
         MMapFileDescriptor *cache_fd;
@@ -66,14 +88,19 @@ typedef struct JournalFile {
         bool writable:1;
         bool compress_xz:1;
         bool compress_lz4:1;
+        bool compress_zstd:1;
         bool seal:1;
         bool defrag_on_close:1;
         bool close_fd:1;
         bool archive:1;
+        bool boots_cached:1;
+        bool offline_async:1;
 
         direction_t last_direction;
         LocationType location_type;
         uint64_t last_n_entries;
+        unsigned merge_queue_idx;
+        LIST_FIELDS(struct JournalFile, merge_drained);
 
         char *path;
         struct stat last_stat;
@@ -95,16 +122,29 @@ typedef struct JournalFile {
 
         sd_event_source *post_change_timer;
         usec_t post_change_timer_period;
+        usec_t post_change_last;
 
         OrderedHashmap *chain_cache;
 
+        /* Flattened entry arrays of DATA objects, only used for archived files. If set, the entries are also
+         * accounted against *posting_list_budget, which is shared by all files of an sd_journal object. */
+        Hashmap *posting_lists;
+        uint64_t n_posting_list_entries;
+        uint64_t *posting_list_budget;
+
+        /* The boots this file has entries of, see journal_file_get_boots() */
+        JournalFileBoot *boots;
+        size_t n_boots;
+
         pthread_t offline_thread;
         volatile OfflineState offline_state;
+        const JournalFileOfflineOps *offline_ops;
+        void *offline_userdata;
 
         unsigned last_seen_generation;
 
         uint64_t compress_threshold_bytes;
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
         void *compress_buffer;
         size_t compress_buffer_size;
 #endif
@@ -143,6 +183,9 @@ int journal_file_open(
 
 int journal_file_set_offline(JournalFile *f, bool wait);
 bool journal_file_is_offlining(JournalFile *f);
+bool journal_file_offline_synced(JournalFile *f);
+void journal_file_offline_continue_in_thread(JournalFile *f);
+void journal_file_set_offline_ops(JournalFile *f, const JournalFileOfflineOps *ops, void *userdata);
 JournalFile* journal_file_close(JournalFile *j);
 
 int journal_file_open_reliably(
@@ -158,6 +201,8 @@ int journal_file_open_reliably(
                 JournalFile *template,
                 JournalFile **ret);
 
+int journal_file_reopen(JournalFile *f, JournalFile **ret);
+
 #define ALIGN64(x) (((x) + 7ULL) & ~7ULL)
 #define VALID64(x) (((x) & 7ULL) == 0ULL)
 
@@ -186,18 +231,30 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
+#define JOURNAL_HEADER_BLOOM_FILTER(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_BLOOM_FILTER))
+
 #define JOURNAL_HEADER_COMPRESSED_XZ(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
 
 #define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
+#define JOURNAL_HEADER_COMPRESSED_ZSTD(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
 uint64_t journal_file_entry_array_n_items(Object *o) _pure_;
 uint64_t journal_file_hash_table_n_items(Object *o) _pure_;
 
+typedef struct JournalEntryBatchItem {
+        dual_timestamp ts;
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalEntryBatchItem;
+
 int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(
                 JournalFile *f,
@@ -207,10 +264,20 @@ int journal_file_append_entry(
                 uint64_t *seqno,
                 Object **ret,
                 uint64_t *offset);
+int journal_file_append_entries(
+                JournalFile *f,
+                const JournalEntryBatchItem entries[], unsigned n_entries,
+                const sd_id128_t *boot_id,
+                uint64_t *seqno,
+                unsigned *ret_n_appended);
 
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
+int journal_file_append_bloom_filter(JournalFile *f);
+int journal_file_reserve_bloom_filter(JournalFile *f);
+int journal_file_bloom_filter_test(JournalFile *f, uint64_t hash);
+
 int journal_file_find_field_object(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_field_object_with_hash(JournalFile *f, const void *field, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
@@ -231,9 +298,11 @@ int journal_file_move_to_entry_by_realtime_for_data(JournalFile *f, uint64_t dat
 int journal_file_move_to_entry_by_monotonic_for_data(JournalFile *f, uint64_t data_offset, sd_id128_t boot_id, uint64_t monotonic, direction_t direction, Object **ret, uint64_t *offset);
 
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p);
+int journal_file_compact(JournalFile *from, MMapCache *mmap_cache, uint64_t *ret_size);
 
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
+void journal_file_print_mmap_statistics(MMapCache *m);
 
 int journal_file_archive(JournalFile *f);
 JournalFile* journal_initiate_close(JournalFile *f, Set *deferred_closes);
@@ -249,6 +318,7 @@ void journal_default_metrics(JournalMetrics *m, int fd);
 
 int journal_file_get_cutoff_realtime_usec(JournalFile *f, usec_t *from, usec_t *to);
 int journal_file_get_cutoff_monotonic_usec(JournalFile *f, sd_id128_t boot, usec_t *from, usec_t *to);
+int journal_file_get_boots(JournalFile *f, const JournalFileBoot **ret, size_t *ret_n);
 
 bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec);
 
@@ -257,5 +327,19 @@ int journal_file_map_field_hash_table(JournalFile *f);
 
 static inline bool JOURNAL_FILE_COMPRESS(JournalFile *f) {
         assert(f);
-        return f->compress_xz || f->compress_lz4;
+        return f->compress_xz || f->compress_lz4 || f->compress_zstd;
+}
+
+static inline int JOURNAL_FILE_COMPRESSION(JournalFile *f) {
+        assert(f);
+
+        /* The algorithm the header of this file announces, which is not necessarily the one we'd pick for
+         * a new file */
+        if (f->compress_zstd)
+                return OBJECT_COMPRESSED_ZSTD;
+        if (f->compress_lz4)
+                return OBJECT_COMPRESSED_LZ4;
+        if (f->compress_xz)
+                return OBJECT_COMPRESSED_XZ;
+        return 0;
 }
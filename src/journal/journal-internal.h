@@ -12,6 +12,7 @@
 #include "journal-def.h"
 #include "journal-file.h"
 #include "list.h"
+#include "prioq.h"
 #include "set.h"
 
 typedef struct Match Match;
@@ -79,6 +80,14 @@ struct sd_journal {
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* Files with a candidate entry beyond the current location, ordered by that entry, valid as long as we
+         * keep iterating in merge_direction and no file is added or removed */
+        Prioq *merge_queue;
+        direction_t merge_direction;
+        unsigned merge_invalidate_counter;
+        /* Files that ran out of entries but might still grow, probed again on each step */
+        LIST_HEAD(JournalFile, merge_drained);
+
         Match *level0, *level1, *level2;
 
         pid_t original_pid;
@@ -112,9 +121,13 @@ struct sd_journal {
         bool fields_file_lost:1;
         bool has_runtime_files:1;
         bool has_persistent_files:1;
+        bool merge_queue_valid:1;
 
         size_t data_threshold;
 
+        /* How many more entry offsets the archived files may keep in memory, see journal_file_get_posting_list() */
+        uint64_t posting_list_budget;
+
         Hashmap *directories_by_path;
         Hashmap *directories_by_wd;
 
@@ -123,6 +136,7 @@ struct sd_journal {
 
 char *journal_make_match_string(sd_journal *j);
 void journal_print_header(sd_journal *j);
+int journal_get_boots(sd_journal *j, JournalFileBoot **ret, size_t *ret_n);
 
 #define JOURNAL_FOREACH_DATA_RETVAL(j, data, l, retval)                     \
         for (sd_journal_restart_data(j); ((retval) = sd_journal_enumerate_data((j), &(data), &(l))) > 0; )
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -19,6 +20,10 @@
 #include "terminal-util.h"
 #include "util.h"
 
+/* Whether this thread drew a progress bar that still needs to be cleared. Files may be verified in parallel,
+ * and only the thread that draws the bar may clear it again, hence keep track of this per thread. */
+static thread_local bool progress_shown = false;
+
 static void draw_progress(uint64_t p, usec_t *last_usec) {
         unsigned n, i, j, k;
         usec_t z, x;
@@ -57,6 +62,8 @@ static void draw_progress(uint64_t p, usec_t *last_usec) {
                 fputs("\x1B[?25h", stdout);
 
         fflush(stdout);
+
+        progress_shown = true;
 }
 
 static uint64_t scale_progress(uint64_t scale, uint64_t p, uint64_t m) {
@@ -70,12 +77,40 @@ static uint64_t scale_progress(uint64_t scale, uint64_t p, uint64_t m) {
         return scale * p / m;
 }
 
+typedef struct VerifyProgress {
+        bool show;
+        usec_t last_usec;
+
+        /* Updated atomically, since the entry array and the hash table are verified in parallel */
+        uint64_t entries_done, n_entries;
+        uint64_t buckets_done, n_buckets;
+} VerifyProgress;
+
+static void draw_second_pass_progress(VerifyProgress *progress) {
+        uint64_t entries_done, buckets_done;
+
+        assert(progress);
+
+        if (!progress->show)
+                return;
+
+        entries_done = __atomic_load_n(&progress->entries_done, __ATOMIC_RELAXED);
+        buckets_done = __atomic_load_n(&progress->buckets_done, __ATOMIC_RELAXED);
+
+        draw_progress(0x8000 +
+                      scale_progress(0x3FFF, entries_done, progress->n_entries) +
+                      scale_progress(0x3FFF, buckets_done, progress->n_buckets),
+                      &progress->last_usec);
+}
+
 static void flush_progress(void) {
         unsigned n, i;
 
-        if (!on_tty())
+        if (!progress_shown)
                 return;
 
+        progress_shown = false;
+
         n = (3 * columns()) / 4;
 
         putchar('\r');
@@ -89,22 +124,22 @@ static void flush_progress(void) {
 
 #define debug(_offset, _fmt, ...) do {                                  \
                 flush_progress();                                       \
-                log_debug(OFSfmt": " _fmt, _offset, ##__VA_ARGS__);     \
+                log_debug("%s:"OFSfmt": " _fmt, f->path, _offset, ##__VA_ARGS__); \
         } while (0)
 
 #define warning(_offset, _fmt, ...) do {                                \
                 flush_progress();                                       \
-                log_warning(OFSfmt": " _fmt, _offset, ##__VA_ARGS__);   \
+                log_warning("%s:"OFSfmt": " _fmt, f->path, _offset, ##__VA_ARGS__); \
         } while (0)
 
 #define error(_offset, _fmt, ...) do {                                  \
                 flush_progress();                                       \
-                log_error(OFSfmt": " _fmt, (uint64_t)_offset, ##__VA_ARGS__); \
+                log_error("%s:"OFSfmt": " _fmt, f->path, (uint64_t)_offset, ##__VA_ARGS__); \
         } while (0)
 
 #define error_errno(_offset, error, _fmt, ...) do {               \
                 flush_progress();                                       \
-                log_error_errno(error, OFSfmt": " _fmt, (uint64_t)_offset, ##__VA_ARGS__); \
+                log_error_errno(error, "%s:"OFSfmt": " _fmt, f->path, (uint64_t)_offset, ##__VA_ARGS__); \
         } while (0)
 
 static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o) {
@@ -118,7 +153,7 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
          * possible field values. It does not follow any references to
          * other objects. */
 
-        if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
             o->object.type != OBJECT_DATA) {
                 error(offset, "Found compressed object that isn't of type DATA, which is not allowed.");
                 return -EBADMSG;
@@ -344,61 +379,91 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                 }
 
                 break;
+
+        case OBJECT_BLOOM_FILTER: {
+                uint64_t sz;
+
+                sz = le64toh(o->object.size) - offsetof(BloomFilterObject, bits);
+                if (sz < 8 || (sz & (sz - 1)) != 0) {
+                        error(offset,
+                              "Invalid object bloom filter size: %"PRIu64,
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (le64toh(o->bloom_filter.n_hash_functions) <= 0) {
+                        error(offset, "Invalid object bloom filter without hash functions");
+                        return -EBADMSG;
+                }
+
+                break;
+        }
         }
 
         return 0;
 }
 
-static int write_uint64(int fd, uint64_t p) {
-        ssize_t k;
+typedef struct OffsetList {
+        uint64_t *offsets;
+        size_t n_offsets, n_allocated;
+} OffsetList;
 
-        k = write(fd, &p, sizeof(p));
-        if (k < 0)
-                return -errno;
-        if (k != sizeof(p))
-                return -EIO;
+/* The offsets of all objects of the types referenced by other objects, collected in the first pass */
+typedef struct VerifyOffsets {
+        OffsetList data;
+        OffsetList entries;
+        OffsetList entry_arrays;
+} VerifyOffsets;
+
+static void verify_offsets_done(VerifyOffsets *v) {
+        assert(v);
+
+        free(v->data.offsets);
+        free(v->entries.offsets);
+        free(v->entry_arrays.offsets);
+}
 
+static int offset_list_add(OffsetList *l, uint64_t p) {
+        assert(l);
+
+        /* We go through the file front to back, hence the list is sorted without further ado */
+        assert(l->n_offsets == 0 || l->offsets[l->n_offsets - 1] < p);
+
+        if (!GREEDY_REALLOC(l->offsets, l->n_allocated, l->n_offsets + 1))
+                return -ENOMEM;
+
+        l->offsets[l->n_offsets++] = p;
         return 0;
 }
 
-static int contains_uint64(MMapCache *m, MMapFileDescriptor *f, uint64_t n, uint64_t p) {
-        uint64_t a, b;
-        int r;
+static bool offset_list_contains(const OffsetList *l, uint64_t p) {
+        size_t a, b;
 
-        assert(m);
-        assert(f);
+        assert(l);
 
         /* Bisection ... */
 
-        a = 0; b = n;
+        a = 0; b = l->n_offsets;
         while (a < b) {
-                uint64_t c, *z;
+                size_t c;
 
                 c = (a + b) / 2;
 
-                r = mmap_cache_get(m, f, PROT_READ|PROT_WRITE, 0, false, c * sizeof(uint64_t), sizeof(uint64_t), NULL, (void **) &z, NULL);
-                if (r < 0)
-                        return r;
-
-                if (*z == p)
-                        return 1;
-
-                if (a + 1 >= b)
-                        return 0;
+                if (l->offsets[c] == p)
+                        return true;
 
-                if (p < *z)
+                if (p < l->offsets[c])
                         b = c;
                 else
-                        a = c;
+                        a = c + 1;
         }
 
-        return 0;
+        return false;
 }
 
 static int entry_points_to_data(
                 JournalFile *f,
-                MMapFileDescriptor *cache_entry_fd,
-                uint64_t n_entries,
+                const VerifyOffsets *offsets,
                 uint64_t entry_p,
                 uint64_t data_p) {
 
@@ -408,9 +473,9 @@ static int entry_points_to_data(
         bool found = false;
 
         assert(f);
-        assert(cache_entry_fd);
+        assert(offsets);
 
-        if (!contains_uint64(f->mmap, cache_entry_fd, n_entries, entry_p)) {
+        if (!offset_list_contains(&offsets->entries, entry_p)) {
                 error(data_p, "Data object references invalid entry at "OFSfmt, entry_p);
                 return -EBADMSG;
         }
@@ -484,16 +549,14 @@ static int entry_points_to_data(
 static int verify_data(
                 JournalFile *f,
                 Object *o, uint64_t p,
-                MMapFileDescriptor *cache_entry_fd, uint64_t n_entries,
-                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays) {
+                const VerifyOffsets *offsets) {
 
         uint64_t i, n, a, last, q;
         int r;
 
         assert(f);
         assert(o);
-        assert(cache_entry_fd);
-        assert(cache_entry_array_fd);
+        assert(offsets);
 
         n = le64toh(o->data.n_entries);
         a = le64toh(o->data.entry_array_offset);
@@ -511,7 +574,7 @@ static int verify_data(
         assert(o->data.entry_offset);
 
         last = q = le64toh(o->data.entry_offset);
-        r = entry_points_to_data(f, cache_entry_fd, n_entries, q, p);
+        r = entry_points_to_data(f, offsets, q, p);
         if (r < 0)
                 return r;
 
@@ -524,7 +587,7 @@ static int verify_data(
                         return -EBADMSG;
                 }
 
-                if (!contains_uint64(f->mmap, cache_entry_array_fd, n_entry_arrays, a)) {
+                if (!offset_list_contains(&offsets->entry_arrays, a)) {
                         error(p, "Invalid array offset "OFSfmt, a);
                         return -EBADMSG;
                 }
@@ -549,7 +612,7 @@ static int verify_data(
                         }
                         last = q;
 
-                        r = entry_points_to_data(f, cache_entry_fd, n_entries, q, p);
+                        r = entry_points_to_data(f, offsets, q, p);
                         if (r < 0)
                                 return r;
 
@@ -567,20 +630,16 @@ static int verify_data(
 
 static int verify_hash_table(
                 JournalFile *f,
-                MMapFileDescriptor *cache_data_fd, uint64_t n_data,
-                MMapFileDescriptor *cache_entry_fd, uint64_t n_entries,
-                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays,
-                usec_t *last_usec,
-                bool show_progress) {
+                const VerifyOffsets *offsets,
+                VerifyProgress *progress,
+                bool draw) {
 
         uint64_t i, n;
         int r;
 
         assert(f);
-        assert(cache_data_fd);
-        assert(cache_entry_fd);
-        assert(cache_entry_array_fd);
-        assert(last_usec);
+        assert(offsets);
+        assert(progress);
 
         n = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
         if (n <= 0)
@@ -593,15 +652,16 @@ static int verify_hash_table(
         for (i = 0; i < n; i++) {
                 uint64_t last = 0, p;
 
-                if (show_progress)
-                        draw_progress(0xC000 + scale_progress(0x3FFF, i, n), last_usec);
+                __atomic_store_n(&progress->buckets_done, i, __ATOMIC_RELAXED);
+                if (draw)
+                        draw_second_pass_progress(progress);
 
                 p = le64toh(f->data_hash_table[i].head_hash_offset);
                 while (p != 0) {
                         Object *o;
-                        uint64_t next;
+                        uint64_t next, hash;
 
-                        if (!contains_uint64(f->mmap, cache_data_fd, n_data, p)) {
+                        if (!offset_list_contains(&offsets->data, p)) {
                                 error(p, "Invalid data object at hash entry %"PRIu64" of %"PRIu64, i, n);
                                 return -EBADMSG;
                         }
@@ -616,15 +676,24 @@ static int verify_hash_table(
                                 return -EBADMSG;
                         }
 
-                        if (le64toh(o->data.hash) % n != i) {
+                        hash = le64toh(o->data.hash);
+                        if (hash % n != i) {
                                 error(p, "Hash value mismatch in hash entry %"PRIu64" of %"PRIu64, i, n);
                                 return -EBADMSG;
                         }
 
-                        r = verify_data(f, o, p, cache_entry_fd, n_entries, cache_entry_array_fd, n_entry_arrays);
+                        r = verify_data(f, o, p, offsets);
                         if (r < 0)
                                 return r;
 
+                        r = journal_file_bloom_filter_test(f, hash);
+                        if (r < 0)
+                                return r;
+                        if (r == 0) {
+                                error(p, "Data object missing in Bloom filter");
+                                return -EBADMSG;
+                        }
+
                         last = p;
                         p = next;
                 }
@@ -673,14 +742,14 @@ static int data_object_in_hash_table(JournalFile *f, uint64_t hash, uint64_t p)
 static int verify_entry(
                 JournalFile *f,
                 Object *o, uint64_t p,
-                MMapFileDescriptor *cache_data_fd, uint64_t n_data) {
+                const VerifyOffsets *offsets) {
 
         uint64_t i, n;
         int r;
 
         assert(f);
         assert(o);
-        assert(cache_data_fd);
+        assert(offsets);
 
         n = journal_file_entry_n_items(o);
         for (i = 0; i < n; i++) {
@@ -690,7 +759,7 @@ static int verify_entry(
                 q = le64toh(o->entry.items[i].object_offset);
                 h = le64toh(o->entry.items[i].hash);
 
-                if (!contains_uint64(f->mmap, cache_data_fd, n_data, q)) {
+                if (!offset_list_contains(&offsets->data, q)) {
                         error(p, "Invalid data object of entry");
                         return -EBADMSG;
                 }
@@ -718,20 +787,15 @@ static int verify_entry(
 
 static int verify_entry_array(
                 JournalFile *f,
-                MMapFileDescriptor *cache_data_fd, uint64_t n_data,
-                MMapFileDescriptor *cache_entry_fd, uint64_t n_entries,
-                MMapFileDescriptor *cache_entry_array_fd, uint64_t n_entry_arrays,
-                usec_t *last_usec,
-                bool show_progress) {
+                const VerifyOffsets *offsets,
+                VerifyProgress *progress) {
 
         uint64_t i = 0, a, n, last = 0;
         int r;
 
         assert(f);
-        assert(cache_data_fd);
-        assert(cache_entry_fd);
-        assert(cache_entry_array_fd);
-        assert(last_usec);
+        assert(offsets);
+        assert(progress);
 
         n = le64toh(f->header->n_entries);
         a = le64toh(f->header->entry_array_offset);
@@ -739,15 +803,15 @@ static int verify_entry_array(
                 uint64_t next, m, j;
                 Object *o;
 
-                if (show_progress)
-                        draw_progress(0x8000 + scale_progress(0x3FFF, i, n), last_usec);
+                __atomic_store_n(&progress->entries_done, i, __ATOMIC_RELAXED);
+                draw_second_pass_progress(progress);
 
                 if (a == 0) {
                         error(a, "Array chain too short at %"PRIu64" of %"PRIu64, i, n);
                         return -EBADMSG;
                 }
 
-                if (!contains_uint64(f->mmap, cache_entry_array_fd, n_entry_arrays, a)) {
+                if (!offset_list_contains(&offsets->entry_arrays, a)) {
                         error(a, "Invalid array %"PRIu64" of %"PRIu64, i, n);
                         return -EBADMSG;
                 }
@@ -773,7 +837,7 @@ static int verify_entry_array(
                         }
                         last = p;
 
-                        if (!contains_uint64(f->mmap, cache_entry_fd, n_entries, p)) {
+                        if (!offset_list_contains(&offsets->entries, p)) {
                                 error(a, "Invalid array entry at %"PRIu64" of %"PRIu64, i, n);
                                 return -EBADMSG;
                         }
@@ -782,7 +846,7 @@ static int verify_entry_array(
                         if (r < 0)
                                 return r;
 
-                        r = verify_entry(f, o, p, cache_data_fd, n_data);
+                        r = verify_entry(f, o, p, offsets);
                         if (r < 0)
                                 return r;
 
@@ -795,14 +859,90 @@ static int verify_entry_array(
                 a = next;
         }
 
+        __atomic_store_n(&progress->entries_done, n, __ATOMIC_RELAXED);
         return 0;
 }
 
+typedef struct HashTableVerifier {
+        JournalFile *f;
+        const VerifyOffsets *offsets;
+        VerifyProgress *progress;
+
+        bool done;
+        int result;
+} HashTableVerifier;
+
+static void *verify_hash_table_thread(void *p) {
+        HashTableVerifier *h = p;
+
+        h->result = verify_hash_table(h->f, h->offsets, h->progress, false);
+        __atomic_store_n(&h->done, true, __ATOMIC_RELEASE);
+
+        return NULL;
+}
+
+static int verify_second_pass(JournalFile *f, const VerifyOffsets *offsets, VerifyProgress *progress, bool threaded) {
+        HashTableVerifier h = {
+                .offsets = offsets,
+                .progress = progress,
+        };
+        pthread_t t;
+        int r, k;
+
+        assert(f);
+        assert(offsets);
+        assert(progress);
+
+        /* The entry array and the hash table may be checked independently of each other, hence verify the hash
+         * table in a second thread. JournalFile objects may not be shared between threads, hence that thread gets
+         * its own instance of the file. If we can't set that up, or the caller verifies other files in parallel
+         * already, do everything in this thread. */
+
+        if (threaded) {
+                r = journal_file_reopen(f, &h.f);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to reopen %s, verifying hash table in the same thread: %m", f->path);
+                else {
+                        r = pthread_create(&t, NULL, verify_hash_table_thread, &h);
+                        if (r != 0) {
+                                log_debug_errno(r, "Failed to start thread, verifying hash table in the same thread: %m");
+                                h.f = journal_file_close(h.f);
+                        }
+                }
+        }
+
+        if (!h.f) {
+                r = verify_entry_array(f, offsets, progress);
+                if (r < 0)
+                        return r;
+
+                return verify_hash_table(f, offsets, progress, true);
+        }
+
+        r = verify_entry_array(f, offsets, progress);
+
+        while (progress->show && !__atomic_load_n(&h.done, __ATOMIC_ACQUIRE)) {
+                draw_second_pass_progress(progress);
+                (void) usleep(40 * USEC_PER_MSEC);
+        }
+
+        k = pthread_join(t, NULL);
+        assert(k == 0);
+
+        (void) journal_file_close(h.f);
+
+        if (r < 0)
+                return r;
+
+        return h.result;
+}
+
 int journal_file_verify(
                 JournalFile *f,
                 const char *key,
                 usec_t *first_contained, usec_t *last_validated, usec_t *last_contained,
-                bool show_progress) {
+                JournalVerifyFlags flags) {
+        bool show_progress = flags & JOURNAL_VERIFY_SHOW_PROGRESS;
         int r;
         Object *o;
         uint64_t p = 0, last_epoch = 0, last_tag_realtime = 0, last_sealed_realtime = 0;
@@ -810,13 +950,14 @@ int journal_file_verify(
         uint64_t entry_seqnum = 0, entry_monotonic = 0, entry_realtime = 0;
         sd_id128_t entry_boot_id;
         bool entry_seqnum_set = false, entry_monotonic_set = false, entry_realtime_set = false, found_main_entry_array = false;
-        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
+        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0, n_bloom_filters = 0;
         usec_t last_usec = 0;
-        int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
-        MMapFileDescriptor *cache_data_fd = NULL, *cache_entry_fd = NULL, *cache_entry_array_fd = NULL;
+        _cleanup_(verify_offsets_done) VerifyOffsets offsets = {};
+        VerifyProgress progress = {
+                .show = show_progress,
+        };
         unsigned i;
         bool found_last = false;
-        const char *tmp_dir = NULL;
 
 #if HAVE_GCRYPT
         uint64_t last_tag = 0;
@@ -836,49 +977,6 @@ int journal_file_verify(
         } else if (f->seal)
                 return -ENOKEY;
 
-        r = var_tmp_dir(&tmp_dir);
-        if (r < 0) {
-                log_error_errno(r, "Failed to determine temporary directory: %m");
-                goto fail;
-        }
-
-        data_fd = open_tmpfile_unlinkable(tmp_dir, O_RDWR | O_CLOEXEC);
-        if (data_fd < 0) {
-                r = log_error_errno(data_fd, "Failed to create data file: %m");
-                goto fail;
-        }
-
-        entry_fd = open_tmpfile_unlinkable(tmp_dir, O_RDWR | O_CLOEXEC);
-        if (entry_fd < 0) {
-                r = log_error_errno(entry_fd, "Failed to create entry file: %m");
-                goto fail;
-        }
-
-        entry_array_fd = open_tmpfile_unlinkable(tmp_dir, O_RDWR | O_CLOEXEC);
-        if (entry_array_fd < 0) {
-                r = log_error_errno(entry_array_fd,
-                                    "Failed to create entry array file: %m");
-                goto fail;
-        }
-
-        cache_data_fd = mmap_cache_add_fd(f->mmap, data_fd);
-        if (!cache_data_fd) {
-                r = log_oom();
-                goto fail;
-        }
-
-        cache_entry_fd = mmap_cache_add_fd(f->mmap, entry_fd);
-        if (!cache_entry_fd) {
-                r = log_oom();
-                goto fail;
-        }
-
-        cache_entry_array_fd = mmap_cache_add_fd(f->mmap, entry_array_fd);
-        if (!cache_entry_array_fd) {
-                r = log_oom();
-                goto fail;
-        }
-
         if (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SUPPORTED) {
                 log_error("Cannot verify file with unknown extensions.");
                 r = -EOPNOTSUPP;
@@ -924,8 +1022,8 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
-                    (o->object.flags & OBJECT_COMPRESSED_LZ4)) {
+                if (!IN_SET(o->object.flags & OBJECT_COMPRESSION_MASK,
+                            0, OBJECT_COMPRESSED_XZ, OBJECT_COMPRESSED_LZ4, OBJECT_COMPRESSED_ZSTD)) {
                         error(p, "Objected with double compression");
                         r = -EINVAL;
                         goto fail;
@@ -943,12 +1041,20 @@ int journal_file_verify(
                         goto fail;
                 }
 
+                if ((o->object.flags & OBJECT_COMPRESSED_ZSTD) && !JOURNAL_HEADER_COMPRESSED_ZSTD(f->header)) {
+                        error(p, "ZSTD compressed object in file without ZSTD compression");
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
                 switch (o->object.type) {
 
                 case OBJECT_DATA:
-                        r = write_uint64(data_fd, p);
-                        if (r < 0)
+                        r = offset_list_add(&offsets.data, p);
+                        if (r < 0) {
+                                log_oom();
                                 goto fail;
+                        }
 
                         n_data++;
                         break;
@@ -964,9 +1070,11 @@ int journal_file_verify(
                                 goto fail;
                         }
 
-                        r = write_uint64(entry_fd, p);
-                        if (r < 0)
+                        r = offset_list_add(&offsets.entries, p);
+                        if (r < 0) {
+                                log_oom();
                                 goto fail;
+                        }
 
                         if (le64toh(o->entry.realtime) < last_tag_realtime) {
                                 error(p, "Older entry after newer tag");
@@ -1051,9 +1159,11 @@ int journal_file_verify(
                         break;
 
                 case OBJECT_ENTRY_ARRAY:
-                        r = write_uint64(entry_array_fd, p);
-                        if (r < 0)
+                        r = offset_list_add(&offsets.entry_arrays, p);
+                        if (r < 0) {
+                                log_oom();
                                 goto fail;
+                        }
 
                         if (p == le64toh(f->header->entry_array_offset)) {
                                 if (found_main_entry_array) {
@@ -1156,6 +1266,26 @@ int journal_file_verify(
                         n_tags++;
                         break;
 
+                case OBJECT_BLOOM_FILTER:
+                        /* The filter isn't flagged in the header if the file wasn't taken offline properly after
+                         * it was archived, it is ignored then */
+                        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) ||
+                            le64toh(f->header->bloom_filter_offset) != p) {
+                                error(p, "Bloom filter object not referenced from header");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
+                            le64toh(o->bloom_filter.n_items) != le64toh(f->header->n_data)) {
+                                error(p, "Bloom filter item number mismatch");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_bloom_filters++;
+                        break;
+
                 default:
                         n_weird++;
                 }
@@ -1214,6 +1344,12 @@ int journal_file_verify(
                 goto fail;
         }
 
+        if (JOURNAL_HEADER_BLOOM_FILTER(f->header) && n_bloom_filters != 1) {
+                error(offsetof(Header, compatible_flags), "Bloom filter missing");
+                r = -EBADMSG;
+                goto fail;
+        }
+
         if (!found_main_entry_array && le64toh(f->header->entry_array_offset) != 0) {
                 error(0, "Missing entry array");
                 r = -EBADMSG;
@@ -1249,35 +1385,17 @@ int journal_file_verify(
          * unreferenced objects. We only care that everything that is
          * referenced is consistent. */
 
-        r = verify_entry_array(f,
-                               cache_data_fd, n_data,
-                               cache_entry_fd, n_entries,
-                               cache_entry_array_fd, n_entry_arrays,
-                               &last_usec,
-                               show_progress);
-        if (r < 0)
-                goto fail;
+        progress.last_usec = last_usec;
+        progress.n_entries = n_entries;
+        progress.n_buckets = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
 
-        r = verify_hash_table(f,
-                              cache_data_fd, n_data,
-                              cache_entry_fd, n_entries,
-                              cache_entry_array_fd, n_entry_arrays,
-                              &last_usec,
-                              show_progress);
+        r = verify_second_pass(f, &offsets, &progress, !(flags & JOURNAL_VERIFY_ONE_THREAD));
         if (r < 0)
                 goto fail;
 
         if (show_progress)
                 flush_progress();
 
-        mmap_cache_free_fd(f->mmap, cache_data_fd);
-        mmap_cache_free_fd(f->mmap, cache_entry_fd);
-        mmap_cache_free_fd(f->mmap, cache_entry_array_fd);
-
-        safe_close(data_fd);
-        safe_close(entry_fd);
-        safe_close(entry_array_fd);
-
         if (first_contained)
                 *first_contained = le64toh(f->header->head_entry_realtime);
         if (last_validated)
@@ -1297,23 +1415,157 @@ fail:
                   (unsigned long long) f->last_stat.st_size,
                   100 * p / f->last_stat.st_size);
 
-        if (data_fd >= 0)
-                safe_close(data_fd);
+        return r;
+}
+
+typedef struct VerifyJob {
+        JournalFile *f;
+        usec_t first, validated, last;
+        int result;
+        bool done;
+        bool reported;
+} VerifyJob;
+
+typedef struct VerifyQueue {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        const char *key;
+
+        VerifyJob *jobs;
+        size_t n_jobs;
+        size_t n_started;
+
+        bool cancel;
+} VerifyQueue;
+
+static void *verify_thread(void *userdata) {
+        VerifyQueue *q = userdata;
+
+        for (;;) {
+                JournalFile *copy;
+                VerifyJob *job;
+                int k;
+
+                assert_se(pthread_mutex_lock(&q->mutex) == 0);
+                if (q->cancel || q->n_started >= q->n_jobs) {
+                        assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+                        return NULL;
+                }
+                job = q->jobs + q->n_started++;
+                assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+
+                /* The JournalFile objects passed in might share one mmap cache, hence use our own instance of the
+                 * file. We are one of many threads already, don't start another one for the hash table. */
+                k = journal_file_reopen(job->f, &copy);
+                if (k >= 0) {
+                        k = journal_file_verify(copy, q->key, &job->first, &job->validated, &job->last,
+                                                JOURNAL_VERIFY_ONE_THREAD);
+                        (void) journal_file_close(copy);
+                }
+
+                assert_se(pthread_mutex_lock(&q->mutex) == 0);
+                job->result = k;
+                job->done = true;
+                if (k == -EINVAL)
+                        q->cancel = true;
+                assert_se(pthread_cond_signal(&q->cond) == 0);
+                assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+        }
+}
+
+int journal_files_verify_parallel(
+                JournalFile **files, size_t n_files,
+                const char *key,
+                size_t n_threads,
+                journal_verify_report_t report,
+                void *userdata) {
+
+        VerifyQueue q = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+                .key = key,
+        };
+        _cleanup_free_ VerifyJob *jobs = NULL;
+        _cleanup_free_ pthread_t *threads = NULL;
+        size_t n_threads_started = 0, n_reported = 0, i;
+        int r = 0;
+
+        assert(files || n_files == 0);
+        assert(n_threads > 0);
+        assert(report);
 
-        if (entry_fd >= 0)
-                safe_close(entry_fd);
+        /* Verifies the files with n_threads worker threads, each checking one file at a time, and calls report()
+         * for each file in the calling thread as soon as it is done. If the key turns out to be invalid, gives up
+         * right-away and returns -EINVAL. Returns -EAGAIN if no thread could be started at all. Otherwise returns
+         * the last error report() returned, or 0. */
 
-        if (entry_array_fd >= 0)
-                safe_close(entry_array_fd);
+        jobs = new0(VerifyJob, n_files);
+        threads = new(pthread_t, n_threads);
+        if (!jobs || !threads)
+                return -ENOMEM;
 
-        if (cache_data_fd)
-                mmap_cache_free_fd(f->mmap, cache_data_fd);
+        for (i = 0; i < n_files; i++)
+                jobs[i].f = files[i];
 
-        if (cache_entry_fd)
-                mmap_cache_free_fd(f->mmap, cache_entry_fd);
+        q.jobs = jobs;
+        q.n_jobs = n_files;
+
+        for (i = 0; i < n_threads; i++) {
+                int k;
+
+                k = pthread_create(threads + n_threads_started, NULL, verify_thread, &q);
+                if (k != 0) {
+                        log_debug_errno(k, "Failed to start verification thread, continuing with %zu threads: %m", n_threads_started);
+                        break;
+                }
+
+                n_threads_started++;
+        }
+
+        if (n_threads_started == 0)
+                return -EAGAIN;
+
+        /* Report the results in the order the files are done, so that the caller can show progress */
+        assert_se(pthread_mutex_lock(&q.mutex) == 0);
+        for (;;) {
+                VerifyJob *job = NULL;
+                int k;
+
+                for (i = 0; i < q.n_started; i++)
+                        if (jobs[i].done && !jobs[i].reported) {
+                                job = jobs + i;
+                                break;
+                        }
+
+                if (!job) {
+                        if (n_reported >= q.n_started && (q.cancel || q.n_started >= q.n_jobs))
+                                break;
+
+                        assert_se(pthread_cond_wait(&q.cond, &q.mutex) == 0);
+                        continue;
+                }
+
+                job->reported = true;
+                n_reported++;
+
+                assert_se(pthread_mutex_unlock(&q.mutex) == 0);
+
+                if (job->result == -EINVAL)
+                        /* If the key was invalid give up right-away. */
+                        r = -EINVAL;
+                else if (r != -EINVAL) {
+                        k = report(job->f, job->result, job->first, job->validated, job->last, userdata);
+                        if (k < 0)
+                                r = k;
+                }
+
+                assert_se(pthread_mutex_lock(&q.mutex) == 0);
+        }
+        assert_se(pthread_mutex_unlock(&q.mutex) == 0);
 
-        if (cache_entry_array_fd)
-                mmap_cache_free_fd(f->mmap, cache_entry_array_fd);
+        for (i = 0; i < n_threads_started; i++)
+                assert_se(pthread_join(threads[i], NULL) == 0);
 
         return r;
 }
@@ -3,4 +3,13 @@
 
 #include "journal-file.h"
 
-int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, bool show_progress);
+typedef enum JournalVerifyFlags {
+        JOURNAL_VERIFY_SHOW_PROGRESS = 1 << 0,
+        JOURNAL_VERIFY_ONE_THREAD    = 1 << 1, /* Don't check the hash table in a second thread */
+} JournalVerifyFlags;
+
+int journal_file_verify(JournalFile *f, const char *key, usec_t *first_contained, usec_t *last_validated, usec_t *last_contained, JournalVerifyFlags flags);
+
+typedef int (*journal_verify_report_t)(JournalFile *f, int result, usec_t first_contained, usec_t last_validated, usec_t last_contained, void *userdata);
+
+int journal_files_verify_parallel(JournalFile **files, size_t n_files, const char *key, size_t n_threads, journal_verify_report_t report, void *userdata);
@@ -41,6 +41,7 @@
 #include "hostname-util.h"
 #include "id128-print.h"
 #include "io-util.h"
+#include "journal-columnar.h"
 #include "journal-def.h"
 #include "journal-internal.h"
 #include "journal-qrcode.h"
@@ -69,6 +70,8 @@
 
 #define PROCESS_INOTIFY_INTERVAL 1024   /* Every 1,024 messages processed */
 
+#define JSON_OUTPUT_BUFFER_SIZE (64U*1024U)
+
 #if HAVE_PCRE2
 DEFINE_TRIVIAL_CLEANUP_FUNC(pcre2_match_data*, pcre2_match_data_free);
 DEFINE_TRIVIAL_CLEANUP_FUNC(pcre2_code*, pcre2_code_free);
@@ -138,6 +141,7 @@ static char **arg_user_units = NULL;
 static const char *arg_field = NULL;
 static bool arg_catalog = false;
 static bool arg_reverse = false;
+static bool arg_debug_stats = false;
 static int arg_journal_type = 0;
 static char *arg_root = NULL;
 static const char *arg_machine = NULL;
@@ -158,6 +162,7 @@ static enum {
         ACTION_PRINT_HEADER,
         ACTION_SETUP_KEYS,
         ACTION_VERIFY,
+        ACTION_COMPACT,
         ACTION_DISK_USAGE,
         ACTION_LIST_CATALOG,
         ACTION_DUMP_CATALOG,
@@ -172,13 +177,6 @@ static enum {
         ACTION_LIST_FIELD_NAMES,
 } arg_action = ACTION_SHOW;
 
-typedef struct BootId {
-        sd_id128_t id;
-        uint64_t first;
-        uint64_t last;
-        LIST_FIELDS(struct BootId, boot_list);
-} BootId;
-
 static int add_matches_for_device(sd_journal *j, const char *devpath) {
         _cleanup_(sd_device_unrefp) sd_device *device = NULL;
         sd_device *d = NULL;
@@ -349,6 +347,7 @@ static int help(void) {
                "     --interval=TIME         Time interval for changing the FSS sealing key\n"
                "     --verify-key=KEY        Specify FSS verification key\n"
                "     --force                 Override of the FSS key pair with --setup-keys\n"
+               "     --debug-stats           Show mmap cache statistics when done\n"
                "\nCommands:\n"
                "  -h --help                  Show this help text\n"
                "     --version               Show package version\n"
@@ -359,6 +358,7 @@ static int help(void) {
                "     --vacuum-files=INT      Leave only the specified number of journal files\n"
                "     --vacuum-time=TIME      Remove journal files older than specified time\n"
                "     --verify                Verify journal file consistency\n"
+               "     --compact               Rewrite archived journal files for faster access\n"
                "     --sync                  Synchronize unwritten journal messages to disk\n"
                "     --flush                 Flush all journal data from /run into /var\n"
                "     --rotate                Request immediate rotation of the journal files\n"
@@ -393,6 +393,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_FILE,
                 ARG_INTERVAL,
                 ARG_VERIFY,
+                ARG_COMPACT,
                 ARG_VERIFY_KEY,
                 ARG_DISK_USAGE,
                 ARG_AFTER_CURSOR,
@@ -412,6 +413,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_VACUUM_TIME,
                 ARG_NO_HOSTNAME,
                 ARG_OUTPUT_FIELDS,
+                ARG_DEBUG_STATS,
         };
 
         static const struct option options[] = {
@@ -447,6 +449,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "setup-keys",     no_argument,       NULL, ARG_SETUP_KEYS     },
                 { "interval",       required_argument, NULL, ARG_INTERVAL       },
                 { "verify",         no_argument,       NULL, ARG_VERIFY         },
+                { "compact",        no_argument,       NULL, ARG_COMPACT        },
                 { "verify-key",     required_argument, NULL, ARG_VERIFY_KEY     },
                 { "disk-usage",     no_argument,       NULL, ARG_DISK_USAGE     },
                 { "cursor",         required_argument, NULL, 'c'                },
@@ -473,6 +476,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "vacuum-time",    required_argument, NULL, ARG_VACUUM_TIME    },
                 { "no-hostname",    no_argument,       NULL, ARG_NO_HOSTNAME    },
                 { "output-fields",  required_argument, NULL, ARG_OUTPUT_FIELDS  },
+                { "debug-stats",    no_argument,       NULL, ARG_DEBUG_STATS    },
                 {}
         };
 
@@ -519,7 +523,7 @@ static int parse_argv(int argc, char *argv[]) {
                                 return -EINVAL;
                         }
 
-                        if (IN_SET(arg_output, OUTPUT_EXPORT, OUTPUT_JSON, OUTPUT_JSON_PRETTY, OUTPUT_JSON_SSE, OUTPUT_JSON_SEQ, OUTPUT_CAT))
+                        if (IN_SET(arg_output, OUTPUT_EXPORT, OUTPUT_JSON, OUTPUT_JSON_PRETTY, OUTPUT_JSON_SSE, OUTPUT_JSON_SEQ, OUTPUT_CAT, OUTPUT_COLUMNAR))
                                 arg_quiet = true;
 
                         break;
@@ -677,6 +681,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_VERIFY;
                         break;
 
+                case ARG_COMPACT:
+                        arg_action = ACTION_COMPACT;
+                        break;
+
                 case ARG_DISK_USAGE:
                         arg_action = ACTION_DISK_USAGE;
                         break;
@@ -921,6 +929,10 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_DEBUG_STATS:
+                        arg_debug_stats = true;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1093,258 +1105,74 @@ static int add_matches(sd_journal *j, char **args) {
         return 0;
 }
 
-static void boot_id_free_all(BootId *l) {
-
-        while (l) {
-                BootId *i = l;
-                LIST_REMOVE(boot_list, l, i);
-                free(i);
-        }
-}
-
-static int discover_next_boot(sd_journal *j,
-                sd_id128_t previous_boot_id,
-                bool advance_older,
-                BootId **ret) {
-
-        _cleanup_free_ BootId *next_boot = NULL;
-        char match[9+32+1] = "_BOOT_ID=";
-        sd_id128_t boot_id;
-        int r;
-
-        assert(j);
-        assert(ret);
-
-        /* We expect the journal to be on the last position of a boot
-         * (in relation to the direction we are going), so that the next
-         * invocation of sd_journal_next/previous will be from a different
-         * boot. We then collect any information we desire and then jump
-         * to the last location of the new boot by using a _BOOT_ID match
-         * coming from the other journal direction. */
-
-        /* Make sure we aren't restricted by any _BOOT_ID matches, so that
-         * we can actually advance to a *different* boot. */
-        sd_journal_flush_matches(j);
-
-        do {
-                if (advance_older)
-                        r = sd_journal_previous(j);
-                else
-                        r = sd_journal_next(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        return 0; /* End of journal, yay. */
-
-                r = sd_journal_get_monotonic_usec(j, NULL, &boot_id);
-                if (r < 0)
-                        return r;
-
-                /* We iterate through this in a loop, until the boot ID differs from the previous one. Note that
-                 * normally, this will only require a single iteration, as we seeked to the last entry of the previous
-                 * boot entry already. However, it might happen that the per-journal-field entry arrays are less
-                 * complete than the main entry array, and hence might reference an entry that's not actually the last
-                 * one of the boot ID as last one. Let's hence use the per-field array is initial seek position to
-                 * speed things up, but let's not trust that it is complete, and hence, manually advance as
-                 * necessary. */
-
-        } while (sd_id128_equal(boot_id, previous_boot_id));
-
-        next_boot = new0(BootId, 1);
-        if (!next_boot)
-                return -ENOMEM;
-
-        next_boot->id = boot_id;
-
-        r = sd_journal_get_realtime_usec(j, &next_boot->first);
-        if (r < 0)
-                return r;
-
-        /* Now seek to the last occurrence of this boot ID. */
-        sd_id128_to_string(next_boot->id, match + 9);
-        r = sd_journal_add_match(j, match, sizeof(match) - 1);
-        if (r < 0)
-                return r;
-
-        if (advance_older)
-                r = sd_journal_seek_head(j);
-        else
-                r = sd_journal_seek_tail(j);
-        if (r < 0)
-                return r;
-
-        if (advance_older)
-                r = sd_journal_next(j);
-        else
-                r = sd_journal_previous(j);
-        if (r < 0)
-                return r;
-        else if (r == 0) {
-                log_debug("Whoopsie! We found a boot ID but can't read its last entry.");
-                return -ENODATA; /* This shouldn't happen. We just came from this very boot ID. */
-        }
-
-        r = sd_journal_get_realtime_usec(j, &next_boot->last);
-        if (r < 0)
-                return r;
-
-        *ret = TAKE_PTR(next_boot);
-
-        return 0;
-}
-
 static int get_boots(
                 sd_journal *j,
-                BootId **boots,
                 sd_id128_t *boot_id,
                 int offset) {
 
-        bool skip_once;
-        int r, count = 0;
-        BootId *head = NULL, *tail = NULL, *id;
-        const bool advance_older = boot_id && offset <= 0;
-        sd_id128_t previous_boot_id;
+        _cleanup_free_ JournalFileBoot *boots = NULL;
+        size_t n_boots, i;
+        ssize_t k;
+        int r;
 
         assert(j);
+        assert(boot_id);
 
-        /* Adjust for the asymmetry that offset 0 is
-         * the last (and current) boot, while 1 is considered the
-         * (chronological) first boot in the journal. */
-        skip_once = boot_id && sd_id128_is_null(*boot_id) && offset <= 0;
-
-        /* Advance to the earliest/latest occurrence of our reference
-         * boot ID (taking our lookup direction into account), so that
-         * discover_next_boot() can do its job.
-         * If no reference is given, the journal head/tail will do,
-         * they're "virtual" boots after all. */
-        if (boot_id && !sd_id128_is_null(*boot_id)) {
-                char match[9+32+1] = "_BOOT_ID=";
-
-                sd_journal_flush_matches(j);
-
-                sd_id128_to_string(*boot_id, match + 9);
-                r = sd_journal_add_match(j, match, sizeof(match) - 1);
-                if (r < 0)
-                        return r;
-
-                if (advance_older)
-                        r = sd_journal_seek_head(j); /* seek to oldest */
-                else
-                        r = sd_journal_seek_tail(j); /* seek to newest */
-                if (r < 0)
-                        return r;
-
-                if (advance_older)
-                        r = sd_journal_next(j);     /* read the oldest entry */
-                else
-                        r = sd_journal_previous(j); /* read the most recently added entry */
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto finish;
-                else if (offset == 0) {
-                        count = 1;
-                        goto finish;
-                }
-
-                /* At this point the read pointer is positioned at the oldest/newest occurence of the reference boot
-                 * ID. After flushing the matches, one more invocation of _previous()/_next() will hence place us at
-                 * the following entry, which must then have an older/newer boot ID */
-        } else {
-
-                if (advance_older)
-                        r = sd_journal_seek_tail(j); /* seek to newest */
-                else
-                        r = sd_journal_seek_head(j); /* seek to oldest */
-                if (r < 0)
-                        return r;
-
-                /* No sd_journal_next()/_previous() here.
-                 *
-                 * At this point the read pointer is positioned after the newest/before the oldest entry in the whole
-                 * journal. The next invocation of _previous()/_next() will hence position us at the newest/oldest
-                 * entry we have. */
-        }
-
-        previous_boot_id = SD_ID128_NULL;
-        for (;;) {
-                _cleanup_free_ BootId *current = NULL;
-
-                r = discover_next_boot(j, previous_boot_id, advance_older, &current);
-                if (r < 0) {
-                        boot_id_free_all(head);
-                        return r;
-                }
-
-                if (!current)
-                        break;
+        /* Resolves the boot that is offset boots away from *boot_id. If *boot_id is null, 0 and negative
+         * offsets count backwards from the most recent boot, positive offsets count forwards from the first
+         * boot in the journal. */
 
-                previous_boot_id = current->id;
-
-                if (boot_id) {
-                        if (!skip_once)
-                                offset += advance_older ? 1 : -1;
-                        skip_once = false;
+        r = journal_get_boots(j, &boots, &n_boots);
+        if (r < 0)
+                return r;
 
-                        if (offset == 0) {
-                                count = 1;
-                                *boot_id = current->id;
+        if (sd_id128_is_null(*boot_id))
+                k = offset <= 0 ? (ssize_t) n_boots - 1 + offset : offset - 1;
+        else {
+                for (i = 0; i < n_boots; i++)
+                        if (sd_id128_equal(boots[i].boot_id, *boot_id))
                                 break;
-                        }
-                } else {
-                        LIST_FOREACH(boot_list, id, head) {
-                                if (sd_id128_equal(id->id, current->id)) {
-                                        /* boot id already stored, something wrong with the journal files */
-                                        /* exiting as otherwise this problem would cause forever loop */
-                                        goto finish;
-                                }
-                        }
-                        LIST_INSERT_AFTER(boot_list, head, tail, current);
-                        tail = TAKE_PTR(current);
-                        count++;
-                }
-        }
+                if (i >= n_boots)
+                        return 0;
 
-finish:
-        if (boots)
-                *boots = head;
+                k = (ssize_t) i + offset;
+        }
 
-        sd_journal_flush_matches(j);
+        if (k < 0 || (size_t) k >= n_boots)
+                return 0;
 
-        return count;
+        *boot_id = boots[k].boot_id;
+        return 1;
 }
 
 static int list_boots(sd_journal *j) {
-        int w, i, count;
-        BootId *id, *all_ids;
+        _cleanup_free_ JournalFileBoot *boots = NULL;
+        size_t n_boots, i;
+        int w, r;
 
         assert(j);
 
-        count = get_boots(j, &all_ids, NULL, 0);
-        if (count < 0)
-                return log_error_errno(count, "Failed to determine boots: %m");
-        if (count == 0)
-                return count;
+        r = journal_get_boots(j, &boots, &n_boots);
+        if (r < 0)
+                return log_error_errno(r, "Failed to determine boots: %m");
+        if (n_boots == 0)
+                return 0;
 
         (void) pager_open(arg_pager_flags);
 
         /* numbers are one less, but we need an extra char for the sign */
-        w = DECIMAL_STR_WIDTH(count - 1) + 1;
+        w = DECIMAL_STR_WIDTH(n_boots - 1) + 1;
 
-        i = 0;
-        LIST_FOREACH(boot_list, id, all_ids) {
+        for (i = 0; i < n_boots; i++) {
                 char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX];
 
                 printf("% *i " SD_ID128_FORMAT_STR " %s—%s\n",
-                       w, i - count + 1,
-                       SD_ID128_FORMAT_VAL(id->id),
-                       format_timestamp_maybe_utc(a, sizeof(a), id->first),
-                       format_timestamp_maybe_utc(b, sizeof(b), id->last));
-                i++;
+                       w, (int) i - (int) n_boots + 1,
+                       SD_ID128_FORMAT_VAL(boots[i].boot_id),
+                       format_timestamp_maybe_utc(a, sizeof(a), boots[i].first_realtime),
+                       format_timestamp_maybe_utc(b, sizeof(b), boots[i].last_realtime));
         }
 
-        boot_id_free_all(all_ids);
-
         return 0;
 }
 
@@ -1367,7 +1195,7 @@ static int add_boot(sd_journal *j) {
                 return add_match_this_boot(j, arg_machine);
 
         boot_id = arg_boot_id;
-        r = get_boots(j, NULL, &boot_id, arg_boot_offset);
+        r = get_boots(j, &boot_id, arg_boot_offset);
         assert(r <= 1);
         if (r <= 0) {
                 const char *reason = (r == 0) ? "No such boot ID in journal" : strerror(-r);
@@ -1838,50 +1666,135 @@ finish:
 #endif
 }
 
+static int verify_report(JournalFile *f, int k, usec_t first, usec_t validated, usec_t last, void *userdata) {
+        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
+
+        assert(f);
+
+        if (k < 0)
+                return log_warning_errno(k, "FAIL: %s (%m)", f->path);
+
+        log_info("PASS: %s", f->path);
+
+        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
+                if (validated > 0) {
+                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                 format_timestamp_maybe_utc(a, sizeof(a), first),
+                                 format_timestamp_maybe_utc(b, sizeof(b), validated),
+                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
+                } else if (last > 0)
+                        log_info("=> No sealing yet, %s of entries not sealed.",
+                                 format_timespan(c, sizeof(c), last - first, 0));
+                else
+                        log_info("=> No sealing yet, no entries in file.");
+        }
+
+        return 0;
+}
+
 static int verify(sd_journal *j) {
-        int r = 0;
+        size_t n_threads;
         Iterator i;
         JournalFile *f;
+        long n_cpus;
+        int r = 0;
 
         assert(j);
 
         log_show_color(true);
 
-        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first = 0, validated = 0, last = 0;
-
 #if HAVE_GCRYPT
+        ORDERED_HASHMAP_FOREACH(f, j->files, i)
                 if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
                         log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
 #endif
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
+        /* Verify multiple files in parallel, one per CPU. We only show a progress bar when verifying files one
+         * by one, otherwise the results of the individual files are shown as they are done. */
+
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = MIN(ordered_hashmap_size(j->files), (size_t) MAX(n_cpus, 1L));
+        if (n_threads > 1) {
+                _cleanup_free_ JournalFile **files = NULL;
+                size_t n_files = 0;
+
+                files = new(JournalFile*, ordered_hashmap_size(j->files));
+                if (!files)
+                        return log_oom();
+
+                ORDERED_HASHMAP_FOREACH(f, j->files, i)
+                        files[n_files++] = f;
+
+                r = journal_files_verify_parallel(files, n_files, arg_verify_key, n_threads, verify_report, NULL);
+                if (r == -ENOMEM)
+                        return log_oom();
+                if (r != -EAGAIN)
+                        return r;
+
+                r = 0;
+        }
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                int k;
+                usec_t first = 0, validated = 0, last = 0;
+
+                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, JOURNAL_VERIFY_SHOW_PROGRESS);
+                if (k == -EINVAL)
                         /* If the key was invalid give up right-away. */
                         return k;
-                } else if (k < 0) {
-                        log_warning_errno(k, "FAIL: %s (%m)", f->path);
+
+                k = verify_report(f, k, first, validated, last, NULL);
+                if (k < 0)
                         r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp_maybe_utc(a, sizeof(a), first),
-                                                 format_timestamp_maybe_utc(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
+        }
+
+        return r;
+}
+
+static int compact(sd_journal *j) {
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX];
+        uint64_t before = 0, after = 0;
+        unsigned n = 0;
+        Iterator i;
+        JournalFile *f;
+        int r = 0;
+
+        assert(j);
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                uint64_t size;
+                int k;
+
+                /* Only archived files are immutable, leave the active ones alone */
+                if (f->header->state != STATE_ARCHIVED)
+                        continue;
+
+                if (JOURNAL_HEADER_SEALED(f->header)) {
+                        log_notice("Journal file %s has sealing enabled, not compacting.", f->path);
+                        continue;
+                }
+
+                k = journal_file_compact(f, j->mmap, &size);
+                if (k < 0) {
+                        log_warning_errno(k, "Failed to compact %s: %m", f->path);
+                        r = k;
+                        continue;
                 }
+
+                log_debug("Compacted %s from %s to %s.", f->path,
+                          format_bytes(a, sizeof(a), (uint64_t) f->last_stat.st_blocks * 512ULL),
+                          format_bytes(b, sizeof(b), size));
+
+                before += (uint64_t) f->last_stat.st_blocks * 512ULL;
+                after += size;
+                n++;
         }
 
+        if (!arg_quiet)
+                log_info("Compacted %u archived journal files from %s to %s.", n,
+                         format_bytes(a, sizeof(a), before),
+                         format_bytes(b, sizeof(b), after));
+
         return r;
 }
 
@@ -2081,6 +1994,8 @@ static int wait_for_change(sd_journal *j, int poll_fd) {
 int main(int argc, char *argv[]) {
         bool previous_boot_id_valid = false, first_line = true, ellipsized = false, need_seek = false;
         _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        _cleanup_set_free_free_ Set *columnar_fields = NULL;
+        _cleanup_(columnar_writer_freep) ColumnarWriter *columnar = NULL;
         sd_id128_t previous_boot_id;
         int n_shown = 0, r, poll_fd = -1;
 
@@ -2096,6 +2011,12 @@ int main(int argc, char *argv[]) {
         if (r <= 0)
                 goto finish;
 
+        /* JSON output is formatted one entry at a time into a buffer, which is then copied into the stdio buffer.
+         * Make the latter large, so that the output is written in few large blocks rather than one write() per
+         * page. We flush it explicitly whenever we are about to wait for more entries. */
+        if (IN_SET(arg_output, OUTPUT_JSON, OUTPUT_JSON_PRETTY, OUTPUT_JSON_SSE, OUTPUT_JSON_SEQ))
+                (void) setvbuf(stdout, NULL, _IOFBF, JSON_OUTPUT_BUFFER_SIZE);
+
         signal(SIGWINCH, columns_lines_cache_reset);
         sigbus_install();
 
@@ -2155,6 +2076,7 @@ int main(int argc, char *argv[]) {
         case ACTION_SHOW:
         case ACTION_PRINT_HEADER:
         case ACTION_VERIFY:
+        case ACTION_COMPACT:
         case ACTION_DISK_USAGE:
         case ACTION_LIST_BOOTS:
         case ACTION_VACUUM:
@@ -2259,6 +2181,10 @@ int main(int argc, char *argv[]) {
                 r = verify(j);
                 goto finish;
 
+        case ACTION_COMPACT:
+                r = compact(j);
+                goto finish;
+
         case ACTION_DISK_USAGE: {
                 uint64_t bytes = 0;
                 char sbytes[FORMAT_BYTES_MAX];
@@ -2497,6 +2423,29 @@ int main(int argc, char *argv[]) {
         if (!arg_follow)
                 (void) pager_open(arg_pager_flags);
 
+        if (arg_output == OUTPUT_COLUMNAR) {
+                /* Collect entries into blocks, instead of writing each one as a block of its own */
+                if (arg_output_fields) {
+                        columnar_fields = set_new(&string_hash_ops);
+                        if (!columnar_fields) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        r = set_put_strdupv(columnar_fields, arg_output_fields);
+                        if (r < 0) {
+                                log_oom();
+                                goto finish;
+                        }
+                }
+
+                r = columnar_writer_new(stdout, columnar_fields, 0, &columnar);
+                if (r < 0) {
+                        log_oom();
+                        goto finish;
+                }
+        }
+
         if (!arg_quiet && (arg_lines != 0 || arg_follow)) {
                 usec_t start, end;
                 char start_buf[FORMAT_TIMESTAMP_MAX], end_buf[FORMAT_TIMESTAMP_MAX];
@@ -2635,8 +2584,11 @@ int main(int argc, char *argv[]) {
                                 arg_utc * OUTPUT_UTC |
                                 arg_no_hostname * OUTPUT_NO_HOSTNAME;
 
-                        r = show_journal_entry(stdout, j, arg_output, 0, flags,
-                                               arg_output_fields, highlight, &ellipsized);
+                        if (columnar)
+                                r = columnar_writer_add_entry(columnar, j);
+                        else
+                                r = show_journal_entry(stdout, j, arg_output, 0, flags,
+                                                       arg_output_fields, highlight, &ellipsized);
                         need_seek = true;
                         if (r == -EADDRNOTAVAIL)
                                 break;
@@ -2677,6 +2629,12 @@ int main(int argc, char *argv[]) {
                         break;
                 }
 
+                if (columnar) {
+                        r = columnar_writer_flush(columnar);
+                        if (r < 0)
+                                goto finish;
+                }
+
                 fflush(stdout);
 
                 r = wait_for_change(j, poll_fd);
@@ -2687,9 +2645,20 @@ int main(int argc, char *argv[]) {
         }
 
 finish:
+        if (columnar) {
+                int k;
+
+                k = columnar_writer_flush(columnar);
+                if (k < 0 && r >= 0)
+                        r = k;
+        }
+
         fflush(stdout);
         pager_close();
 
+        if (arg_debug_stats && j)
+                journal_file_print_mmap_statistics(j->mmap);
+
         strv_free(arg_file);
 
         strv_free(arg_syslog_identifier);
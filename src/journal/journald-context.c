@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <sys/inotify.h>
+
 #if HAVE_SELINUX
 #include <selinux/selinux.h>
 #endif
@@ -13,7 +15,9 @@
 #include "io-util.h"
 #include "journal-util.h"
 #include "journald-context.h"
+#include "list.h"
 #include "parse-util.h"
+#include "path-util.h"
 #include "process-util.h"
 #include "string-util.h"
 #include "syslog-util.h"
@@ -35,6 +39,17 @@
  * as long as their socket is connected. Note that cache entries are shared between different transports. That means a
  * cache entry pinned for the stream connection logic may be reused for the syslog or native protocols.
  *
+ * For pinned entries we watch the cgroup.events file of their cgroup (on the unified hierarchy) and the per-unit
+ * files PID 1 maintains in /run/systemd/units/ with inotify. As long as these watches are in place, everything we
+ * derive from the cgroup and the unit is only reread when a notification says it changed (or every 30s, just in
+ * case), and only the per-process data is refreshed every 1s. That includes the cgroup path of the process, as a
+ * process may be moved to another cgroup without its old one telling us. Watched entries are indexed by their
+ * watch descriptor and unit, so that a notification only touches the entries it concerns.
+ *
+ * Unpinned entries that are older than 5s are useless, hence they are dropped before new entries are created. This
+ * way the size of the cache follows the number of different PIDs logging within 5s, and it only hits its upper limit
+ * if there really are that many.
+ *
  * Caching metadata like this has two major benefits:
  *
  * 1. Reading metadata is expensive, and we can thus substantially speed up log processing under flood.
@@ -53,6 +68,9 @@
 /* We refresh every 1s */
 #define REFRESH_USEC (1*USEC_PER_SEC)
 
+/* Cgroup and unit data we get change notifications for we refresh every 30s */
+#define REFRESH_WATCHED_USEC (30*USEC_PER_SEC)
+
 /* Data older than 5s we flush out */
 #define MAX_USEC (5*USEC_PER_SEC)
 
@@ -61,6 +79,19 @@
  * clients itself is limited.) */
 #define CACHE_MAX (16*1024)
 
+struct ClientContextWatcher {
+        int fd;
+        sd_event_source *event_source;
+
+        /* The watch on /run/systemd/units/, or -1 */
+        int units_wd;
+
+        /* The watched contexts, by the watch descriptor of their cgroup.events file and by their unit. Both map to
+         * the first of the contexts with that key, the others are linked to it. */
+        Hashmap *cgroup_watches;
+        Hashmap *units;
+};
+
 static int client_context_compare(const void *a, const void *b) {
         const ClientContext *x = a, *y = b;
         int r;
@@ -101,6 +132,8 @@ static int client_context_new(Server *s, pid_t pid, ClientContext **ret) {
         c->owner_uid = UID_INVALID;
         c->lru_index = PRIOQ_IDX_NULL;
         c->timestamp = USEC_INFINITY;
+        c->cgroup_timestamp = USEC_INFINITY;
+        c->cgroup_wd = -1;
         c->extra_fields_mtime = NSEC_INFINITY;
         c->log_level_max = -1;
         c->log_rate_limit_interval = s->rate_limit_interval;
@@ -116,11 +149,367 @@ static int client_context_new(Server *s, pid_t pid, ClientContext **ret) {
         return 0;
 }
 
+static void client_context_watcher_free(Server *s) {
+        ClientContextWatcher *w;
+
+        assert(s);
+
+        w = TAKE_PTR(s->client_context_watcher);
+        if (!w)
+                return;
+
+        sd_event_source_unref(w->event_source);
+        safe_close(w->fd);
+        hashmap_free(w->cgroup_watches);
+        hashmap_free(w->units);
+        free(w);
+}
+
+static bool client_context_unindex(ClientContextWatcher *w, ClientContext *c) {
+        ClientContext *first, *head;
+        bool last;
+
+        assert(w);
+        assert(c);
+        assert(c->cgroup_wd >= 0);
+
+        /* Returns true if no other context uses the cgroup watch of this one */
+
+        first = head = hashmap_get(w->cgroup_watches, INT_TO_PTR(c->cgroup_wd));
+        assert(first);
+
+        LIST_REMOVE(by_cgroup_wd, head, c);
+        if (!head)
+                assert_se(hashmap_remove(w->cgroup_watches, INT_TO_PTR(c->cgroup_wd)) == c);
+        else if (head != first)
+                assert_se(hashmap_update(w->cgroup_watches, INT_TO_PTR(c->cgroup_wd), head) >= 0);
+
+        last = !head;
+        c->cgroup_wd = -1;
+
+        if (!c->watched_unit)
+                return last;
+
+        first = head = hashmap_get(w->units, c->watched_unit);
+        assert(first);
+
+        LIST_REMOVE(by_unit, head, c);
+        if (!head)
+                assert_se(hashmap_remove(w->units, c->watched_unit) == c);
+        else if (head != first)
+                /* The key is the copy of the unit name of the first context, hence switch to the new one's */
+                assert_se(hashmap_remove_and_replace(w->units, c->watched_unit, head->watched_unit, head) >= 0);
+
+        c->watched_unit = mfree(c->watched_unit);
+
+        return last;
+}
+
+static int client_context_index(ClientContextWatcher *w, ClientContext *c, int wd) {
+        _cleanup_free_ char *unit = NULL;
+        ClientContext *first;
+        int r;
+
+        assert(w);
+        assert(c);
+        assert(c->cgroup_wd < 0);
+        assert(wd >= 0);
+
+        r = hashmap_ensure_allocated(&w->cgroup_watches, NULL);
+        if (r < 0)
+                return r;
+
+        first = hashmap_get(w->cgroup_watches, INT_TO_PTR(wd));
+        if (first)
+                LIST_INSERT_AFTER(by_cgroup_wd, first, first, c);
+        else {
+                r = hashmap_put(w->cgroup_watches, INT_TO_PTR(wd), c);
+                if (r < 0)
+                        return r;
+        }
+
+        c->cgroup_wd = wd;
+
+        if (!c->unit)
+                return 0;
+
+        r = hashmap_ensure_allocated(&w->units, &string_hash_ops);
+        if (r < 0)
+                goto fail;
+
+        unit = strdup(c->unit);
+        if (!unit) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        first = hashmap_get(w->units, unit);
+        if (first)
+                LIST_INSERT_AFTER(by_unit, first, first, c);
+        else {
+                r = hashmap_put(w->units, unit, c);
+                if (r < 0)
+                        goto fail;
+        }
+
+        c->watched_unit = TAKE_PTR(unit);
+        return 0;
+
+fail:
+        (void) client_context_unindex(w, c);
+        return r;
+}
+
+static void client_context_unwatch(Server *s, ClientContext *c) {
+        ClientContextWatcher *w;
+        int wd;
+
+        assert(s);
+        assert(c);
+
+        if (c->cgroup_wd < 0)
+                return;
+
+        w = s->client_context_watcher;
+        assert(w);
+
+        wd = c->cgroup_wd;
+        if (client_context_unindex(w, c))
+                (void) inotify_rm_watch(w->fd, wd);
+}
+
+static void client_context_mark_all_dirty(Server *s, bool forget_watches) {
+        ClientContext *c;
+        Iterator i;
+
+        assert(s);
+
+        /* This is for when we lost track of changes, hence it's fine to look at every context */
+
+        HASHMAP_FOREACH(c, s->client_contexts, i) {
+                c->cgroup_dirty = true;
+
+                if (forget_watches) {
+                        c->cgroup_wd = -1;
+                        c->watched_unit = mfree(c->watched_unit);
+                        LIST_INIT(by_cgroup_wd, c);
+                        LIST_INIT(by_unit, c);
+                }
+        }
+}
+
+static void client_context_mark_cgroup_dirty(Server *s, int wd, bool gone) {
+        ClientContextWatcher *w;
+        ClientContext *c;
+
+        assert(s);
+
+        w = s->client_context_watcher;
+        assert(w);
+
+        if (!gone) {
+                c = hashmap_get(w->cgroup_watches, INT_TO_PTR(wd));
+                LIST_FOREACH(by_cgroup_wd, c, c)
+                        c->cgroup_dirty = true;
+
+                return;
+        }
+
+        /* The cgroup is gone, and the kernel dropped the watch along with it */
+        while ((c = hashmap_get(w->cgroup_watches, INT_TO_PTR(wd)))) {
+                c->cgroup_dirty = true;
+                (void) client_context_unindex(w, c);
+        }
+}
+
+void client_context_mark_unit_dirty(Server *s, const char *unit) {
+        ClientContext *c;
+
+        assert(s);
+        assert(unit);
+
+        if (!s->client_context_watcher)
+                return;
+
+        /* Contexts that are not watched are refreshed every 1s anyway */
+        c = hashmap_get(s->client_context_watcher->units, unit);
+        LIST_FOREACH(by_unit, c, c)
+                c->cgroup_dirty = true;
+}
+
+static int client_context_dispatch_inotify(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        union inotify_event_buffer buffer;
+        Server *s = userdata;
+        ClientContextWatcher *w;
+        struct inotify_event *e;
+        ssize_t l;
+
+        assert(s);
+
+        w = s->client_context_watcher;
+        assert(w);
+
+        l = read(fd, &buffer, sizeof(buffer));
+        if (l < 0) {
+                if (IN_SET(errno, EAGAIN, EINTR))
+                        return 0;
+
+                log_warning_errno(errno, "Failed to read client context inotify events, refreshing client contexts periodically: %m");
+
+                /* Fall back to time-based refreshing for everything */
+                client_context_mark_all_dirty(s, true);
+                client_context_watcher_free(s);
+                return 0;
+        }
+
+        FOREACH_INOTIFY_EVENT(e, buffer, l) {
+
+                if (e->mask & IN_Q_OVERFLOW) {
+                        /* We lost track, hence refresh everything */
+                        client_context_mark_all_dirty(s, false);
+                        continue;
+                }
+
+                if (e->wd == w->units_wd) {
+                        const char *unit;
+
+                        if (e->mask & IN_IGNORED) {
+                                /* The directory is gone, we'll try to watch it again later */
+                                w->units_wd = -1;
+                                client_context_mark_all_dirty(s, false);
+                                continue;
+                        }
+
+                        /* Files are named <type>:<unit> */
+                        unit = e->len > 0 ? strchr(e->name, ':') : NULL;
+                        if (unit)
+                                client_context_mark_unit_dirty(s, unit + 1);
+
+                        continue;
+                }
+
+                client_context_mark_cgroup_dirty(s, e->wd, e->mask & IN_IGNORED);
+        }
+
+        return 0;
+}
+
+static int client_context_watcher_new(Server *s) {
+        _cleanup_free_ ClientContextWatcher *w = NULL;
+        int r;
+
+        assert(s);
+
+        if (s->client_context_watcher)
+                return 0;
+
+        if (!s->event)
+                return -EOPNOTSUPP;
+
+        w = new(ClientContextWatcher, 1);
+        if (!w)
+                return -ENOMEM;
+
+        *w = (ClientContextWatcher) {
+                .units_wd = -1,
+        };
+
+        w->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (w->fd < 0)
+                return -errno;
+
+        r = sd_event_add_io(s->event, &w->event_source, w->fd, EPOLLIN, client_context_dispatch_inotify, s);
+        if (r < 0) {
+                safe_close(w->fd);
+                return r;
+        }
+
+        /* Process change notifications before any log messages, so that we don't use stale data for them */
+        r = sd_event_source_set_priority(w->event_source, SD_EVENT_PRIORITY_NORMAL-5);
+        if (r < 0) {
+                sd_event_source_unref(w->event_source);
+                safe_close(w->fd);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(w->event_source, "client-context-inotify");
+
+        s->client_context_watcher = TAKE_PTR(w);
+        return 0;
+}
+
+static void client_context_watch(Server *s, ClientContext *c) {
+        _cleanup_free_ char *p = NULL;
+        ClientContextWatcher *w;
+        const char *cgroup;
+        int wd, old_wd, r;
+
+        assert(s);
+        assert(c);
+
+        /* Only pinned entries are long-lived enough to be worth watching */
+        if (c->n_ref == 0 || !c->cgroup) {
+                client_context_unwatch(s, c);
+                return;
+        }
+
+        /* Only on the unified hierarchy there's a cgroup.events file */
+        if (cg_all_unified() <= 0)
+                return;
+
+        r = client_context_watcher_new(s);
+        if (r < 0)
+                return;
+
+        w = s->client_context_watcher;
+
+        if (w->units_wd < 0)
+                w->units_wd = inotify_add_watch(w->fd, "/run/systemd/units",
+                                                IN_CREATE|IN_DELETE|IN_MOVED_TO|IN_MOVED_FROM|IN_CLOSE_WRITE|IN_ONLYDIR);
+
+        cgroup = prefix_roota(s->cgroup_root, c->cgroup);
+        if (cg_get_path(SYSTEMD_CGROUP_CONTROLLER, cgroup, "cgroup.events", &p) < 0)
+                return;
+
+        /* Watching the same file again gets us the same watch descriptor */
+        wd = inotify_add_watch(w->fd, p, IN_MODIFY);
+        if (wd < 0) {
+                client_context_unwatch(s, c);
+                return;
+        }
+
+        if (wd == c->cgroup_wd && streq_ptr(c->unit, c->watched_unit))
+                return;
+
+        /* Move the context over to the new watch, but don't drop the watch if it's the same one */
+        old_wd = c->cgroup_wd;
+        if (old_wd >= 0 && client_context_unindex(w, c) && old_wd != wd)
+                (void) inotify_rm_watch(w->fd, old_wd);
+
+        r = client_context_index(w, c, wd);
+        if (r < 0 && !hashmap_contains(w->cgroup_watches, INT_TO_PTR(wd)))
+                (void) inotify_rm_watch(w->fd, wd);
+}
+
+static bool client_context_is_watched(Server *s, ClientContext *c) {
+        assert(s);
+        assert(c);
+
+        return c->n_ref > 0 &&
+                c->cgroup_wd >= 0 &&
+                s->client_context_watcher &&
+                s->client_context_watcher->units_wd >= 0;
+}
+
 static void client_context_reset(Server *s, ClientContext *c) {
         assert(s);
         assert(c);
 
+        client_context_unwatch(s, c);
+
         c->timestamp = USEC_INFINITY;
+        c->cgroup_timestamp = USEC_INFINITY;
+        c->cgroup_dirty = false;
 
         c->uid = UID_INVALID;
         c->gid = GID_INVALID;
@@ -250,6 +639,8 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
 
         assert(c);
 
+        /* Returns > 0 if the cgroup path, and hence what we derive from it, changed */
+
         /* Try to acquire the current cgroup path */
         r = cg_pid_get_path_shifted(c->pid, s->cgroup_root, &t);
         if (r < 0) {
@@ -258,7 +649,7 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
                 if (unit_id && !c->unit) {
                         c->unit = strdup(unit_id);
                         if (c->unit)
-                                return 0;
+                                return 1;
                 }
 
                 return r;
@@ -290,7 +681,7 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
         (void) cg_path_get_user_slice(c->cgroup, &t);
         free_and_replace(c->user_slice, t);
 
-        return 0;
+        return 1;
 }
 
 static int client_context_read_invocation_id(
@@ -473,7 +864,8 @@ static void client_context_really_refresh(
                 const struct ucred *ucred,
                 const char *label, size_t label_size,
                 const char *unit_id,
-                usec_t timestamp) {
+                usec_t timestamp,
+                bool refresh_cgroup) {
 
         assert(s);
         assert(c);
@@ -489,12 +881,23 @@ static void client_context_really_refresh(
         (void) audit_session_from_pid(c->pid, &c->auditid);
         (void) audit_loginuid_from_pid(c->pid, &c->loginuid);
 
-        (void) client_context_read_cgroup(s, c, unit_id);
-        (void) client_context_read_invocation_id(s, c);
-        (void) client_context_read_log_level_max(s, c);
-        (void) client_context_read_extra_fields(s, c);
-        (void) client_context_read_log_rate_limit_interval(c);
-        (void) client_context_read_log_rate_limit_burst(c);
+        /* A process may be moved to another cgroup without any notification for its old one, hence always check
+         * where it is, and reread everything we derive from the cgroup if that changed */
+        if (client_context_read_cgroup(s, c, unit_id) > 0)
+                refresh_cgroup = true;
+
+        if (refresh_cgroup) {
+                (void) client_context_read_invocation_id(s, c);
+                (void) client_context_read_log_level_max(s, c);
+                (void) client_context_read_extra_fields(s, c);
+                (void) client_context_read_log_rate_limit_interval(c);
+                (void) client_context_read_log_rate_limit_burst(c);
+
+                client_context_watch(s, c);
+
+                c->cgroup_timestamp = timestamp;
+                c->cgroup_dirty = false;
+        }
 
         c->timestamp = timestamp;
 
@@ -529,9 +932,22 @@ void client_context_maybe_refresh(
                 goto refresh;
         }
 
-        /* If the data is older than the lower limit, we refresh, but keep the old data for all we can't update */
-        if (c->timestamp + REFRESH_USEC < timestamp)
+        /* If we have been notified that the cgroup or the unit changed, we refresh everything */
+        if (c->cgroup_dirty)
+                goto refresh;
+
+        /* If the data is older than the lower limit, we refresh, but keep the old data for all we can't update. If we
+         * are notified about changes of the cgroup and the unit, we don't need to reread what we derive from them,
+         * though, except every now and then. */
+        if (c->timestamp + REFRESH_USEC < timestamp) {
+                if (client_context_is_watched(s, c) &&
+                    c->cgroup_timestamp + REFRESH_WATCHED_USEC >= timestamp) {
+                        client_context_really_refresh(s, c, ucred, label, label_size, unit_id, timestamp, false);
+                        return;
+                }
+
                 goto refresh;
+        }
 
         /* If the data passed along doesn't match the cached data we also do a refresh */
         if (ucred && uid_is_valid(ucred->uid) && c->uid != ucred->uid)
@@ -546,7 +962,7 @@ void client_context_maybe_refresh(
         return;
 
 refresh:
-        client_context_really_refresh(s, c, ucred, label, label_size, unit_id, timestamp);
+        client_context_really_refresh(s, c, ucred, label, label_size, unit_id, timestamp, true);
 }
 
 static void client_context_try_shrink_to(Server *s, size_t limit) {
@@ -572,6 +988,28 @@ static void client_context_try_shrink_to(Server *s, size_t limit) {
         }
 }
 
+static void client_context_drop_expired(Server *s, usec_t timestamp) {
+        ClientContext *c;
+
+        assert(s);
+
+        /* Unpinned entries older than the upper limit would be flushed out before being used anyway, hence drop
+         * them right-away. The LRU is ordered by age, hence we only need to look at its head. */
+
+        while ((c = prioq_peek(s->client_contexts_lru))) {
+                assert(c->in_lru);
+                assert(c->n_ref == 0);
+
+                if (c->timestamp != USEC_INFINITY && c->timestamp + MAX_USEC >= timestamp)
+                        break;
+
+                assert_se(prioq_pop(s->client_contexts_lru) == c);
+                c->in_lru = false;
+
+                client_context_free(s, c);
+        }
+}
+
 void client_context_flush_all(Server *s) {
         assert(s);
 
@@ -587,6 +1025,8 @@ void client_context_flush_all(Server *s) {
 
         s->client_contexts_lru = prioq_free(s->client_contexts_lru);
         s->client_contexts = hashmap_free(s->client_contexts);
+
+        client_context_watcher_free(s);
 }
 
 static int client_context_get_internal(
@@ -627,6 +1067,7 @@ static int client_context_get_internal(
                 return 0;
         }
 
+        client_context_drop_expired(s, now(CLOCK_MONOTONIC));
         client_context_try_shrink_to(s, CACHE_MAX-1);
 
         r = client_context_new(s, pid, &c);
@@ -645,7 +1086,7 @@ static int client_context_get_internal(
                 c->in_lru = true;
         }
 
-        client_context_really_refresh(s, c, ucred, label, label_len, unit_id, USEC_INFINITY);
+        client_context_really_refresh(s, c, ucred, label, label_len, unit_id, USEC_INFINITY, true);
 
         *ret = c;
         return 0;
@@ -686,6 +1127,8 @@ ClientContext *client_context_release(Server *s, ClientContext *c) {
         if (c->n_ref > 0)
                 return NULL;
 
+        client_context_unwatch(s, c);
+
         /* The entry is not pinned anymore, let's add it to the LRU prioq if we can. If we can't we'll drop it
          * right-away */
 
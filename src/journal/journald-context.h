@@ -6,7 +6,10 @@
 
 #include "sd-id128.h"
 
+#include "list.h"
+
 typedef struct ClientContext ClientContext;
+typedef struct ClientContextWatcher ClientContextWatcher;
 
 #include "journald-server.h"
 
@@ -16,6 +19,15 @@ struct ClientContext {
         usec_t timestamp;
         bool in_lru;
 
+        /* When we get change notifications for the cgroup and unit of this context, the data derived from them is
+         * only reread when they changed, see client_context_maybe_refresh() */
+        usec_t cgroup_timestamp;
+        int cgroup_wd;
+        bool cgroup_dirty;
+        char *watched_unit;
+        LIST_FIELDS(ClientContext, by_cgroup_wd);
+        LIST_FIELDS(ClientContext, by_unit);
+
         pid_t pid;
         uid_t uid;
         gid_t gid;
@@ -80,6 +92,8 @@ void client_context_maybe_refresh(
                 const char *unit_id,
                 usec_t tstamp);
 
+void client_context_mark_unit_dirty(Server *s, const char *unit);
+
 void client_context_acquire_default(Server *s);
 void client_context_flush_all(Server *s);
 
@@ -4,17 +4,26 @@
 #include <string.h>
 
 #include "alloc-util.h"
+#include "fileio.h"
 #include "hashmap.h"
 #include "journald-rate-limit.h"
 #include "list.h"
-#include "random-util.h"
 #include "string-util.h"
 #include "util.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
 #define GROUPS_MAX 2047
 
+/* How many levels of the cgroup hierarchy (the unit itself plus the slices it is in) we look at */
+#define LEVELS_MAX 16
+
+/* How often to look for expired groups */
+#define VACUUM_INTERVAL_USEC (1*USEC_PER_SEC)
+
+/* Groups are kept at least this long after their last use, even if they have no or a shorter interval, so that
+ * their counters can be reported */
+#define GROUP_KEEP_USEC (30*USEC_PER_SEC)
+
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
         [LOG_ALERT]   = 0,
@@ -29,45 +38,62 @@ static const int priority_map[] = {
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
 
+/* Each pool is a token bucket that holds up to 'burst' messages and refills in 'interval'. It is implemented as
+ * virtual scheduling: instead of a token count we only store the time at which the bucket would be full again if
+ * nothing was logged in between. Every message moves that time interval/burst into the future, and a message is
+ * permitted as long as that doesn't put it more than an interval ahead of now. */
 struct JournalRateLimitPool {
-        usec_t begin;
-        unsigned num;
+        usec_t full;
+
+        /* Messages dropped since 'suppressed_begin', we report them at most once per interval */
         unsigned suppressed;
+        usec_t suppressed_begin;
 };
 
 struct JournalRateLimitGroup {
         JournalRateLimit *parent;
 
+        /* The cgroup path of the unit or slice, or the unit name if the cgroup is not known */
         char *id;
 
-        /* Interval is stored to keep track of when the group expires */
+        /* Interval and last use are stored to keep track of when the group expires */
         usec_t interval;
+        usec_t last_used;
 
         JournalRateLimitPool pools[POOLS_MAX];
-        uint64_t hash;
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
+        uint64_t n_passed;
+        uint64_t n_dropped;
+
         LIST_FIELDS(JournalRateLimitGroup, lru);
 };
 
 struct JournalRateLimit {
+        Hashmap *groups;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
+        /* Most recently used first */
         JournalRateLimitGroup *lru, *lru_tail;
 
-        unsigned n_groups;
+        /* The budget shared by all units in a slice */
+        usec_t slice_interval;
+        unsigned slice_burst;
 
-        uint8_t hash_key[16];
+        usec_t last_vacuum;
 };
 
-JournalRateLimit *journal_rate_limit_new(void) {
+JournalRateLimit *journal_rate_limit_new(usec_t slice_interval, unsigned slice_burst) {
         JournalRateLimit *r;
 
         r = new0(JournalRateLimit, 1);
         if (!r)
                 return NULL;
 
-        random_bytes(r->hash_key, sizeof(r->hash_key));
+        r->groups = hashmap_new(&string_hash_ops);
+        if (!r->groups)
+                return mfree(r);
+
+        r->slice_interval = slice_interval;
+        r->slice_burst = slice_burst;
 
         return r;
 }
@@ -76,15 +102,11 @@ static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
         assert(g);
 
         if (g->parent) {
-                assert(g->parent->n_groups > 0);
-
                 if (g->parent->lru_tail == g)
                         g->parent->lru_tail = g->lru_prev;
 
                 LIST_REMOVE(lru, g->parent->lru, g);
-                LIST_REMOVE(bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
-
-                g->parent->n_groups--;
+                assert_se(hashmap_remove(g->parent->groups, g->id) == g);
         }
 
         free(g->id);
@@ -97,16 +119,25 @@ void journal_rate_limit_free(JournalRateLimit *r) {
         while (r->lru)
                 journal_rate_limit_group_free(r->lru);
 
+        hashmap_free(r->groups);
         free(r);
 }
 
 _pure_ static bool journal_rate_limit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
+        usec_t keep;
         unsigned i;
 
         assert(g);
 
+        /* A group expires once it hasn't been used for an interval, and all its buckets have been full for an
+         * interval */
+        keep = MAX(g->interval, GROUP_KEEP_USEC);
+
+        if (g->last_used + keep >= ts)
+                return false;
+
         for (i = 0; i < POOLS_MAX; i++)
-                if (g->pools[i].begin + g->interval >= ts)
+                if (g->pools[i].full + keep >= ts)
                         return false;
 
         return true;
@@ -115,39 +146,64 @@ _pure_ static bool journal_rate_limit_group_expired(JournalRateLimitGroup *g, us
 static void journal_rate_limit_vacuum(JournalRateLimit *r, usec_t ts) {
         assert(r);
 
-        /* Makes room for at least one new item, but drop all
-         * expored items too. */
+        /* Drops all expired groups. Since the list is ordered by last use, we only need to look at its end. */
 
-        while (r->n_groups >= GROUPS_MAX ||
-               (r->lru_tail && journal_rate_limit_group_expired(r->lru_tail, ts)))
+        if (r->last_vacuum + VACUUM_INTERVAL_USEC > ts)
+                return;
+
+        r->last_vacuum = ts;
+
+        while (r->lru_tail && journal_rate_limit_group_expired(r->lru_tail, ts))
                 journal_rate_limit_group_free(r->lru_tail);
 }
 
-static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, usec_t interval, usec_t ts) {
+static JournalRateLimitGroup* journal_rate_limit_get_group(JournalRateLimit *r, const char *id, size_t id_len, usec_t interval, usec_t ts) {
         JournalRateLimitGroup *g;
+        char *k;
 
         assert(r);
         assert(id);
 
+        k = strndupa(id, id_len);
+
+        g = hashmap_get(r->groups, k);
+        if (g) {
+                g->interval = interval;
+                g->last_used = ts;
+
+                /* Move to the front of the LRU list */
+                if (r->lru != g) {
+                        if (r->lru_tail == g)
+                                r->lru_tail = g->lru_prev;
+
+                        LIST_REMOVE(lru, r->lru, g);
+                        LIST_PREPEND(lru, r->lru, g);
+                }
+
+                return g;
+        }
+
+        /* Make room for a new item */
+        while (hashmap_size(r->groups) >= GROUPS_MAX)
+                journal_rate_limit_group_free(r->lru_tail);
+
         g = new0(JournalRateLimitGroup, 1);
         if (!g)
                 return NULL;
 
-        g->id = strdup(id);
+        g->id = strdup(k);
         if (!g->id)
                 goto fail;
 
-        g->hash = siphash24_string(g->id, r->hash_key);
-
         g->interval = interval;
+        g->last_used = ts;
 
-        journal_rate_limit_vacuum(r, ts);
+        if (hashmap_put(r->groups, g->id, g) < 0)
+                goto fail;
 
-        LIST_PREPEND(bucket, r->buckets[g->hash % BUCKETS_MAX], g);
         LIST_PREPEND(lru, r->lru, g);
         if (!g->lru_next)
                 r->lru_tail = g;
-        r->n_groups++;
 
         g->parent = r;
         return g;
@@ -185,12 +241,79 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
         return burst;
 }
 
+static usec_t pool_next(JournalRateLimitPool *p, usec_t interval, unsigned burst, usec_t ts) {
+        usec_t increment;
+
+        assert(p);
+        assert(burst > 0);
+
+        /* Returns the new time the bucket is full again if we let another message pass, or USEC_INFINITY if the
+         * bucket is empty. */
+
+        increment = MAX(interval / burst, (usec_t) 1);
+
+        if (MAX(p->full, ts) + increment > ts + interval)
+                return USEC_INFINITY;
+
+        return MAX(p->full, ts) + increment;
+}
+
+static size_t find_levels(const char *id, size_t levels[static LEVELS_MAX]) {
+        const char *e, *unit_end;
+        size_t n = 0;
+
+        assert(id);
+
+        /* Determines the prefixes of the specified cgroup path identifying the unit and the slices it is in, and
+         * returns their lengths, starting with the unit. The unit is the first component that is not a slice, we
+         * don't distinguish anything below it (such as the cgroups a service manager running inside a unit
+         * creates), so that the unit's budget can't be escaped by creating more cgroups. */
+
+        if (id[0] != '/') {
+                /* Just a unit name, no hierarchy */
+                levels[n++] = strlen(id);
+                return n;
+        }
+
+        unit_end = NULL;
+        for (e = id; *e == '/'; ) {
+                const char *c = e + 1;
+
+                e = c + strcspn(c, "/");
+                if (e == c)
+                        break;
+
+                if (e - c < (ptrdiff_t) STRLEN(".slice") || memcmp(e - STRLEN(".slice"), ".slice", STRLEN(".slice")) != 0) {
+                        unit_end = e;
+                        break;
+                }
+        }
+
+        levels[n++] = unit_end ? (size_t) (unit_end - id) : strlen(id);
+
+        /* Add the slices, innermost first */
+        for (e = id + levels[0]; e > id && n < LEVELS_MAX; ) {
+                do
+                        e--;
+                while (e > id && *e != '/');
+
+                if (e == id)
+                        break;
+
+                levels[n++] = e - id;
+        }
+
+        return n;
+}
+
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, uint64_t available) {
-        uint64_t h;
-        JournalRateLimitGroup *g;
+        JournalRateLimitGroup *groups[LEVELS_MAX];
+        usec_t next[LEVELS_MAX];
+        size_t levels[LEVELS_MAX], n_levels, i;
         JournalRateLimitPool *p;
-        unsigned burst;
-        usec_t ts;
+        bool drop = false;
+        unsigned pool;
+        usec_t ts, report_interval;
 
         assert(id);
 
@@ -199,57 +322,90 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_inter
          * 0     → the log message shall be suppressed,
          * 1 + n → the log message shall be permitted, and n messages were dropped from the peer before
          * < 0   → error
+         *
+         * If 'id' is a cgroup path, the message is counted against the unit's budget as configured by
+         * rl_interval and rl_burst, and against the budget of each slice the unit is in, if one is configured.
+         * The message is only permitted if none of them is exceeded.
          */
 
         if (!r)
                 return 1;
 
         ts = now(CLOCK_MONOTONIC);
+        pool = priority_map[priority];
 
-        h = siphash24_string(id, r->hash_key);
-        g = r->buckets[h % BUCKETS_MAX];
+        journal_rate_limit_vacuum(r, ts);
 
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
+        n_levels = find_levels(id, levels);
+        if (r->slice_interval == 0 || r->slice_burst == 0)
+                n_levels = 1;
+
+        for (i = 0; i < n_levels; i++) {
+                usec_t interval;
+                unsigned burst;
+
+                interval = i == 0 ? rl_interval : r->slice_interval;
+                burst = i == 0 ? rl_burst : r->slice_burst;
 
-        if (!g) {
-                g = journal_rate_limit_group_new(r, id, rl_interval, ts);
-                if (!g)
+                groups[i] = journal_rate_limit_get_group(r, id, levels[i], interval, ts);
+                if (!groups[i])
                         return -ENOMEM;
-        } else
-                g->interval = rl_interval;
 
-        if (rl_interval == 0 || rl_burst == 0)
-                return 1;
+                if (interval == 0 || burst == 0) {
+                        next[i] = USEC_INFINITY;
+                        continue;
+                }
 
-        burst = burst_modulate(rl_burst, available);
+                next[i] = pool_next(&groups[i]->pools[pool], interval, burst_modulate(burst, available), ts);
+                if (next[i] == USEC_INFINITY)
+                        drop = true;
+        }
 
-        p = &g->pools[priority_map[priority]];
+        p = &groups[0]->pools[pool];
 
-        if (p->begin <= 0) {
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
-                return 1;
+        if (drop) {
+                for (i = 0; i < n_levels; i++)
+                        groups[i]->n_dropped++;
+
+                if (p->suppressed++ == 0)
+                        p->suppressed_begin = ts;
+
+                return 0;
+        }
+
+        for (i = 0; i < n_levels; i++) {
+                groups[i]->n_passed++;
+
+                if (next[i] != USEC_INFINITY)
+                        groups[i]->pools[pool].full = next[i];
         }
 
-        if (p->begin + rl_interval < ts) {
+        /* Report what we dropped, but not more often than once per interval. Only take the slice interval into
+         * account if slice budgets were checked at all. */
+        report_interval = n_levels > 1 ? MAX(rl_interval, r->slice_interval) : rl_interval;
+        if (p->suppressed > 0 && p->suppressed_begin + report_interval <= ts) {
                 unsigned s;
 
                 s = p->suppressed;
                 p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
 
                 return 1 + s;
         }
 
-        if (p->num < burst) {
-                p->num++;
-                return 1;
-        }
+        return 1;
+}
+
+int journal_rate_limit_dump(JournalRateLimit *r, FILE *f) {
+        JournalRateLimitGroup *g;
+
+        assert(r);
+        assert(f);
+
+        /* Writes one line per unit and slice we have seen recently: the number of permitted and dropped messages,
+         * followed by the cgroup path or unit name */
+
+        LIST_FOREACH(lru, g, r->lru)
+                fprintf(f, "%" PRIu64 " %" PRIu64 " %s\n", g->n_passed, g->n_dropped, g->id);
 
-        p->suppressed++;
-        return 0;
+        return fflush_and_check(f);
 }
@@ -1,10 +1,13 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 #pragma once
 
+#include <stdio.h>
+
 #include "util.h"
 
 typedef struct JournalRateLimit JournalRateLimit;
 
-JournalRateLimit *journal_rate_limit_new(void);
+JournalRateLimit *journal_rate_limit_new(usec_t slice_interval, unsigned slice_burst);
 void journal_rate_limit_free(JournalRateLimit *r);
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, uint64_t available);
+int journal_rate_limit_dump(JournalRateLimit *r, FILE *f);
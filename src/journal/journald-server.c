@@ -46,6 +46,7 @@
 #include "parse-util.h"
 #include "proc-cmdline.h"
 #include "process-util.h"
+#include "ratelimit.h"
 #include "rm-rf.h"
 #include "selinux-util.h"
 #include "signal-util.h"
@@ -76,6 +77,46 @@
 
 #define DEFERRED_CLOSES_MAX (4096)
 
+/* How many syslog and audit datagrams to receive with a single recvmmsg(), and how much space we reserve for each of
+ * them. An AF_UNIX datagram can't be larger than the send buffer of its sender, which unprivileged senders can't
+ * raise beyond net.core.wmem_max, 208K by default, hence this is enough for all but exotic setups. Larger syslog
+ * datagrams are truncated, unless they are the first of a batch. */
+#define DATAGRAM_BATCH_MAX 16U
+#define DATAGRAM_SLOT_SIZE (256U*1024U)
+
+/* How often to complain about truncated datagrams */
+#define DATAGRAM_TRUNCATED_RATELIMIT_INTERVAL_USEC (30*USEC_PER_SEC)
+#define DATAGRAM_TRUNCATED_RATELIMIT_BURST 1
+
+typedef union DatagramControl {
+        struct cmsghdr cmsghdr;
+
+        /* We use NAME_MAX space for the SELinux label
+         * here. The kernel currently enforces no
+         * limit, but according to suggestions from
+         * the SELinux people this will change and it
+         * will probably be identical to NAME_MAX. For
+         * now we use that, but this should be updated
+         * one day when the final limit is known. */
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(struct timeval)) +
+                    CMSG_SPACE(sizeof(int)) + /* fd */
+                    CMSG_SPACE(NAME_MAX)]; /* selinux label */
+} DatagramControl;
+
+struct DatagramBatch {
+        struct mmsghdr messages[DATAGRAM_BATCH_MAX];
+        struct iovec iovec[DATAGRAM_BATCH_MAX];
+        DatagramControl control[DATAGRAM_BATCH_MAX];
+        union sockaddr_union sa[DATAGRAM_BATCH_MAX];
+
+        /* DATAGRAM_BATCH_MAX slots of DATAGRAM_SLOT_SIZE bytes */
+        char *buffer;
+
+        RateLimit truncated_ratelimit;
+        unsigned n_truncated;
+};
+
 static int determine_path_usage(Server *s, const char *path, uint64_t *ret_used, uint64_t *ret_free) {
         _cleanup_closedir_ DIR *d = NULL;
         struct dirent *de;
@@ -272,6 +313,8 @@ static int open_journal(
         if (r < 0)
                 return r;
 
+        sync_ring_attach(s->sync_ring, f);
+
         r = journal_file_enable_post_change_timer(f, s->event, POST_CHANGE_TIMER_INTERVAL_USEC);
         if (r < 0) {
                 (void) journal_file_close(f);
@@ -536,6 +579,9 @@ void server_rotate(Server *s) {
 
         log_debug("Rotating...");
 
+        /* Queued entries belong into the files we are about to archive */
+        server_flush_write_queue(s);
+
         /* First, rotate the system journal (either in its runtime flavour or in its runtime flavour) */
         (void) do_rotate(s, &s->runtime_journal, "runtime", false, 0);
         (void) do_rotate(s, &s->system_journal, "system", s->seal, 0);
@@ -643,6 +689,8 @@ void server_sync(Server *s) {
         Iterator i;
         int r;
 
+        server_flush_write_queue(s);
+
         if (s->system_journal) {
                 r = journal_file_set_offline(s->system_journal, false);
                 if (r < 0)
@@ -789,78 +837,281 @@ static bool shall_try_append_again(JournalFile *f, int r) {
         }
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
-        bool vacuumed = false, rotate = false;
-        struct dual_timestamp ts;
+static void write_entries_to_journal(
+                Server *s,
+                uid_t uid,
+                const JournalEntryBatchItem *entries, unsigned n,
+                int priority) {
+
+        bool vacuumed = false;
         JournalFile *f;
+        unsigned k;
         int r;
 
         assert(s);
-        assert(iovec);
+        assert(entries);
         assert(n > 0);
 
-        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
-         * the source time, and not even the time the event was originally seen, but instead simply the time we started
-         * processing it, as we want strictly linear ordering in what we write out.) */
-        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
-        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+        /* Writes the specified entries, which all belong to the same journal file and are ordered by time, and
+         * schedules a sync according to the most important priority among them. */
 
-        if (ts.realtime < s->last_realtime_clock) {
-                /* When the time jumps backwards, let's immediately rotate. Of course, this should not happen during
-                 * regular operation. However, when it does happen, then we should make sure that we start fresh files
-                 * to ensure that the entries in the journal files are strictly ordered by time, in order to ensure
-                 * bisection works correctly. */
+        while (n > 0) {
+                bool rotate = false;
 
-                log_debug("Time jumped backwards, rotating.");
-                rotate = true;
-        } else {
+                if (entries[0].ts.realtime < s->last_realtime_clock) {
+                        /* When the time jumps backwards, let's immediately rotate. Of course, this should not happen
+                         * during regular operation. However, when it does happen, then we should make sure that we
+                         * start fresh files to ensure that the entries in the journal files are strictly ordered by
+                         * time, in order to ensure bisection works correctly. */
+
+                        log_debug("Time jumped backwards, rotating.");
+                        rotate = true;
+                } else {
+
+                        f = find_journal(s, uid);
+                        if (!f)
+                                return;
+
+                        if (journal_file_rotate_suggested(f, s->max_file_usec)) {
+                                log_debug("%s: Journal header limits reached or header out-of-date, rotating.", f->path);
+                                rotate = true;
+                        }
+                }
 
-                f = find_journal(s, uid);
-                if (!f)
+                if (rotate) {
+                        if (!vacuumed) {
+                                server_rotate(s);
+                                server_vacuum(s, false);
+                                vacuumed = true;
+                        }
+
+                        f = find_journal(s, uid);
+                        if (!f)
+                                return;
+                }
+
+                s->last_realtime_clock = entries[0].ts.realtime;
+
+                r = journal_file_append_entries(f, entries, n, NULL, &s->seqnum, &k);
+                if (k > 0)
+                        s->last_realtime_clock = entries[k-1].ts.realtime;
+                if (r >= 0) {
+                        server_schedule_sync(s, priority);
                         return;
+                }
 
-                if (journal_file_rotate_suggested(f, s->max_file_usec)) {
-                        log_debug("%s: Journal header limits reached or header out-of-date, rotating.", f->path);
-                        rotate = true;
+                /* Skip over whatever made it into the file before the failure */
+                if (k > 0) {
+                        server_schedule_sync(s, priority);
+                        entries += k;
+                        n -= k;
+                }
+
+                if (vacuumed || !shall_try_append_again(f, r)) {
+                        unsigned i;
+
+                        /* If nothing of the batch made it into the file, we can't tell which entry the error is
+                         * about. Write them one by one then, so that only the offending one is dropped. */
+                        if (k == 0 && n > 1) {
+                                for (i = 0; i < n; i++)
+                                        write_entries_to_journal(s, uid, entries + i, 1, priority);
+                                return;
+                        }
+
+                        log_error_errno(r, "Failed to write entry (%u items, %zu bytes)%s, ignoring: %m",
+                                        entries[0].n_iovec, IOVEC_TOTAL_SIZE(entries[0].iovec, entries[0].n_iovec),
+                                        vacuumed ? " despite vacuuming" : "");
+                        entries++;
+                        n--;
+                        vacuumed = false;
+                        continue;
                 }
-        }
 
-        if (rotate) {
                 server_rotate(s);
                 server_vacuum(s, false);
                 vacuumed = true;
 
-                f = find_journal(s, uid);
-                if (!f)
-                        return;
+                log_debug("Retrying write.");
         }
+}
 
-        s->last_realtime_clock = ts.realtime;
+/* When WriteQueueSize= is larger than 1, entries are not written right away but copied into a queue, which is
+ * drained in one go once it is full, or once the event loop has no more input to process. Consecutive entries
+ * for the same journal file are then written as one batch. The same is done for the entries resulting from a
+ * batch of received datagrams, see server_process_datagram_batch(). */
+struct QueuedEntry {
+        uid_t uid;
+        int priority;
+        dual_timestamp ts;
+        size_t n_iovec;
+        struct iovec iovec[];
+};
 
-        r = journal_file_append_entry(f, &ts, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
-                server_schedule_sync(s, priority);
+void server_flush_write_queue(Server *s) {
+        assert(s);
+
+        /* Writing might rotate or sync, which in turn flush the queue. Entries queued meanwhile are picked up by
+         * the loop below, after the ones we are writing already. */
+        if (s->write_queue_flushing)
                 return;
+
+        s->write_queue_flushing = true;
+
+        while (s->n_write_queue > 0) {
+                QueuedEntry **queue;
+                size_t n_queue, n_allocated, i, j;
+                bool batching;
+
+                /* Detach the queue first, so that entries queued while writing don't move it under our feet */
+                queue = TAKE_PTR(s->write_queue);
+                n_queue = s->n_write_queue;
+                n_allocated = s->n_write_queue_allocated;
+                s->n_write_queue = s->n_write_queue_allocated = 0;
+
+                /* If we can't allocate the batch, write the entries one by one */
+                batching = GREEDY_REALLOC(s->write_batch, s->n_write_batch_allocated, n_queue);
+
+                for (i = 0; i < n_queue; i = j) {
+                        JournalEntryBatchItem single, *batch = batching ? s->write_batch : &single;
+                        int priority = queue[i]->priority;
+
+                        /* Find the run of entries that go to the same file, in non-decreasing time order */
+                        for (j = i; j < n_queue; j++) {
+                                if (j > i &&
+                                    (!batching ||
+                                     queue[j]->uid != queue[i]->uid ||
+                                     queue[j]->ts.realtime < queue[j-1]->ts.realtime))
+                                        break;
+
+                                batch[j - i] = (JournalEntryBatchItem) {
+                                        .ts = queue[j]->ts,
+                                        .iovec = queue[j]->iovec,
+                                        .n_iovec = queue[j]->n_iovec,
+                                };
+                                priority = MIN(priority, queue[j]->priority);
+                        }
+
+                        write_entries_to_journal(s, queue[i]->uid, batch, j - i, priority);
+                }
+
+                for (i = 0; i < n_queue; i++)
+                        free(queue[i]);
+
+                /* Keep the array around for the next round of entries, unless a new one was started meanwhile */
+                if (s->write_queue)
+                        free(queue);
+                else {
+                        s->write_queue = queue;
+                        s->n_write_queue_allocated = n_allocated;
+                }
         }
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
-                log_error_errno(r, "Failed to write entry (%zu items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-                return;
+        s->write_queue_flushing = false;
+}
+
+static int dispatch_write_queue(sd_event_source *es, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        server_flush_write_queue(s);
+        return 0;
+}
+
+static int server_queue_entry(
+                Server *s,
+                uid_t uid,
+                const dual_timestamp *ts,
+                const struct iovec *iovec, size_t n,
+                int priority) {
+
+        QueuedEntry *q;
+        uint8_t *p;
+        size_t i;
+        int r;
+
+        assert(s);
+        assert(ts);
+        assert(iovec);
+
+        if (!GREEDY_REALLOC(s->write_queue, s->n_write_queue_allocated, s->n_write_queue + 1))
+                return -ENOMEM;
+
+        /* Copy the entry into a single allocation, as the iovecs usually point to stack memory */
+        q = malloc(offsetof(QueuedEntry, iovec) + n * sizeof(struct iovec) + IOVEC_TOTAL_SIZE(iovec, n));
+        if (!q)
+                return -ENOMEM;
+
+        *q = (QueuedEntry) {
+                .uid = uid,
+                .priority = priority,
+                .ts = *ts,
+                .n_iovec = n,
+        };
+
+        p = (uint8_t*) (q->iovec + n);
+        for (i = 0; i < n; i++) {
+                q->iovec[i] = IOVEC_MAKE(p, iovec[i].iov_len);
+                p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
         }
 
-        server_rotate(s);
-        server_vacuum(s, false);
+        s->write_queue[s->n_write_queue++] = q;
 
-        f = find_journal(s, uid);
-        if (!f)
-                return;
+        /* Don't keep important messages in memory, and don't let the queue grow beyond its size */
+        if (priority <= LOG_CRIT || (!s->write_queue_hold && s->n_write_queue >= s->write_queue_size))
+                goto flush;
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(f, &ts, NULL, iovec, n, &s->seqnum, NULL, NULL);
+        if (!s->write_queue_event_source) {
+                r = sd_event_add_defer(s->event, &s->write_queue_event_source, dispatch_write_queue, s);
+                if (r < 0)
+                        goto flush;
+
+                /* Run after the input sources, so that we drain as much input as possible into one batch */
+                r = sd_event_source_set_priority(s->write_queue_event_source, SD_EVENT_PRIORITY_NORMAL+10);
+                if (r < 0)
+                        goto flush;
+        }
+
+        r = sd_event_source_set_enabled(s->write_queue_event_source, SD_EVENT_ONESHOT);
         if (r < 0)
-                log_error_errno(r, "Failed to write entry (%zu items, %zu bytes) despite vacuuming, ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-        else
-                server_schedule_sync(s, priority);
+                goto flush;
+
+        return 0;
+
+flush:
+        server_flush_write_queue(s);
+        return 0;
+}
+
+static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
+        JournalEntryBatchItem entry;
+        int r;
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
+         * the source time, and not even the time the event was originally seen, but instead simply the time we started
+         * processing it, as we want strictly linear ordering in what we write out.) */
+        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &entry.ts.realtime) >= 0);
+        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &entry.ts.monotonic) >= 0);
+
+        if (s->write_queue_size > 1 || s->write_queue_hold) {
+                r = server_queue_entry(s, uid, &entry.ts, iovec, n, priority);
+                if (r >= 0)
+                        return;
+
+                log_debug_errno(r, "Failed to queue entry, writing it directly: %m");
+
+                /* Keep the order of entries */
+                server_flush_write_queue(s);
+        }
+
+        entry.iovec = iovec;
+        entry.n_iovec = n;
+
+        write_entries_to_journal(s, uid, &entry, 1, priority);
 }
 
 #define IOVEC_ADD_NUMERIC_FIELD(iovec, n, value, type, isset, format, field)  \
@@ -894,25 +1145,66 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n
                 iovec[n++] = IOVEC_MAKE_STRING(k);                      \
         }                                                               \
 
-static void dispatch_message_real(
+static void write_messages_to_journal(Server *s, uid_t uid, const ServerMessage *messages, size_t n) {
+        _cleanup_free_ JournalEntryBatchItem *entries = NULL;
+        dual_timestamp ts;
+        int priority;
+        size_t i;
+
+        assert(s);
+        assert(messages);
+        assert(n > 0);
+
+        entries = new(JournalEntryBatchItem, n);
+        if (!entries) {
+                for (i = 0; i < n; i++)
+                        write_to_journal(s, uid, messages[i].iovec, messages[i].n, messages[i].priority);
+                return;
+        }
+
+        /* All messages of a batch were received at the same time, hence they get the same timestamp */
+        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
+        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+
+        priority = messages[0].priority;
+        for (i = 0; i < n; i++) {
+                entries[i] = (JournalEntryBatchItem) {
+                        .ts = ts,
+                        .iovec = messages[i].iovec,
+                        .n_iovec = messages[i].n,
+                };
+                priority = MIN(priority, messages[i].priority);
+        }
+
+        /* The batch is written right-away, hence keep the order of entries */
+        server_flush_write_queue(s);
+
+        write_entries_to_journal(s, uid, entries, n, priority);
+}
+
+static void dispatch_messages_real(
                 Server *s,
-                struct iovec *iovec, size_t n, size_t m,
+                ServerMessage *messages, size_t n_messages, size_t m,
                 const ClientContext *c,
                 const struct timeval *tv,
-                int priority,
                 pid_t object_pid) {
 
         char source_time[sizeof("_SOURCE_REALTIME_TIMESTAMP=") + DECIMAL_STR_MAX(usec_t)];
+        struct iovec *iovec;
+        size_t n = 0, n_max, i;
         uid_t journal_uid;
         ClientContext *o;
 
         assert(s);
-        assert(iovec);
-        assert(n > 0);
-        assert(n +
-               N_IOVEC_META_FIELDS +
-               (pid_is_valid(object_pid) ? N_IOVEC_OBJECT_FIELDS : 0) +
-               client_context_extra_fields_n_iovec(c) <= m);
+        assert(messages);
+        assert(n_messages > 0);
+
+        /* The meta fields are the same for all messages, hence collect them only once, and then append them to
+         * the fields of each message. */
+        n_max = N_IOVEC_META_FIELDS +
+                (pid_is_valid(object_pid) ? N_IOVEC_OBJECT_FIELDS : 0) +
+                client_context_extra_fields_n_iovec(c);
+        iovec = newa(struct iovec, n_max);
 
         if (c) {
                 IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->pid, pid_t, pid_is_valid, PID_FMT, "_PID");
@@ -945,7 +1237,7 @@ static void dispatch_message_real(
                 }
         }
 
-        assert(n <= m);
+        assert(n <= n_max);
 
         if (pid_is_valid(object_pid) && client_context_get(s, object_pid, NULL, NULL, 0, NULL, &o) >= 0) {
 
@@ -974,7 +1266,7 @@ static void dispatch_message_real(
                 IOVEC_ADD_ID128_FIELD(iovec, n, o->invocation_id, "OBJECT_SYSTEMD_INVOCATION_ID=");
         }
 
-        assert(n <= m);
+        assert(n <= n_max);
 
         if (tv) {
                 sprintf(source_time, "_SOURCE_REALTIME_TIMESTAMP=" USEC_FMT, timeval_load(tv));
@@ -993,7 +1285,7 @@ static void dispatch_message_real(
         if (!isempty(s->hostname_field))
                 iovec[n++] = IOVEC_MAKE_STRING(s->hostname_field);
 
-        assert(n <= m);
+        assert(n <= n_max);
 
         if (s->split_mode == SPLIT_UID && c && uid_is_valid(c->uid))
                 /* Split up strictly by (non-root) UID */
@@ -1008,7 +1300,35 @@ static void dispatch_message_real(
         else
                 journal_uid = 0;
 
-        write_to_journal(s, journal_uid, iovec, n, priority);
+        for (i = 0; i < n_messages; i++) {
+                assert(messages[i].n > 0);
+                assert(messages[i].n + n <= m);
+
+                memcpy(messages[i].iovec + messages[i].n, iovec, n * sizeof(struct iovec));
+                messages[i].n += n;
+        }
+
+        if (n_messages == 1)
+                write_to_journal(s, journal_uid, messages[0].iovec, messages[0].n, messages[0].priority);
+        else
+                write_messages_to_journal(s, journal_uid, messages, n_messages);
+}
+
+static void dispatch_message_real(
+                Server *s,
+                struct iovec *iovec, size_t n, size_t m,
+                const ClientContext *c,
+                const struct timeval *tv,
+                int priority,
+                pid_t object_pid) {
+
+        ServerMessage message = {
+                .iovec = iovec,
+                .n = n,
+                .priority = priority,
+        };
+
+        dispatch_messages_real(s, &message, 1, m, c, tv, object_pid);
 }
 
 void server_driver_message(Server *s, pid_t object_pid, const char *message_id, const char *format, ...) {
@@ -1060,37 +1380,26 @@ void server_driver_message(Server *s, pid_t object_pid, const char *message_id,
         }
 }
 
-void server_dispatch_message(
-                Server *s,
-                struct iovec *iovec, size_t n, size_t m,
-                ClientContext *c,
-                const struct timeval *tv,
-                int priority,
-                pid_t object_pid) {
-
+static bool server_message_allowed(Server *s, ClientContext *c, int priority) {
         uint64_t available = 0;
         int rl;
 
         assert(s);
-        assert(iovec || n == 0);
-
-        if (n == 0)
-                return;
 
         if (LOG_PRI(priority) > s->max_level_store)
-                return;
+                return false;
 
         /* Stop early in case the information will not be stored
          * in a journal. */
         if (s->storage == STORAGE_NONE)
-                return;
+                return false;
 
         if (c && c->unit) {
                 (void) determine_space(s, &available, NULL);
 
-                rl = journal_rate_limit_test(s->rate_limit, c->unit, c->log_rate_limit_interval, c->log_rate_limit_burst, priority & LOG_PRIMASK, available);
+                rl = journal_rate_limit_test(s->rate_limit, c->cgroup ?: c->unit, c->log_rate_limit_interval, c->log_rate_limit_burst, priority & LOG_PRIMASK, available);
                 if (rl == 0)
-                        return;
+                        return false;
 
                 /* Write a suppression message if we suppressed something */
                 if (rl > 1)
@@ -1101,9 +1410,58 @@ void server_dispatch_message(
                                               NULL);
         }
 
+        return true;
+}
+
+void server_dispatch_message(
+                Server *s,
+                struct iovec *iovec, size_t n, size_t m,
+                ClientContext *c,
+                const struct timeval *tv,
+                int priority,
+                pid_t object_pid) {
+
+        assert(s);
+        assert(iovec || n == 0);
+
+        if (n == 0)
+                return;
+
+        if (!server_message_allowed(s, c, priority))
+                return;
+
         dispatch_message_real(s, iovec, n, m, c, tv, priority, object_pid);
 }
 
+void server_dispatch_messages(
+                Server *s,
+                ServerMessage *messages, size_t n_messages, size_t m,
+                ClientContext *c) {
+
+        size_t i, k = 0;
+
+        assert(s);
+        assert(messages || n_messages == 0);
+
+        /* Like server_dispatch_message(), but for a batch of messages from the same client, which are written
+         * together. Each iovec array needs to have room for m fields. */
+
+        for (i = 0; i < n_messages; i++) {
+                if (messages[i].n == 0)
+                        continue;
+
+                if (!server_message_allowed(s, c, messages[i].priority))
+                        continue;
+
+                messages[k++] = messages[i];
+        }
+
+        if (k == 0)
+                return;
+
+        dispatch_messages_real(s, messages, k, m, c, NULL, 0);
+}
+
 int server_flush_to_var(Server *s, bool require_flag_file) {
         sd_id128_t machine;
         sd_journal *j = NULL;
@@ -1117,6 +1475,9 @@ int server_flush_to_var(Server *s, bool require_flag_file) {
         if (!IN_SET(s->storage, STORAGE_AUTO, STORAGE_PERSISTENT))
                 return 0;
 
+        /* Entries still queued belong into the runtime journal before it is flushed */
+        server_flush_write_queue(s);
+
         if (!s->runtime_journal)
                 return 0;
 
@@ -1205,77 +1566,26 @@ finish:
         return r;
 }
 
-int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
-        Server *s = userdata;
+static void server_process_datagram_one(
+                Server *s,
+                int fd,
+                struct msghdr *msghdr,
+                char *buffer,
+                size_t n) {
+
         struct ucred *ucred = NULL;
         struct timeval *tv = NULL;
         struct cmsghdr *cmsg;
         char *label = NULL;
-        size_t label_len = 0, m;
-        struct iovec iovec;
-        ssize_t n;
-        int *fds = NULL, v = 0;
+        size_t label_len = 0;
+        int *fds = NULL;
         size_t n_fds = 0;
 
-        union {
-                struct cmsghdr cmsghdr;
-
-                /* We use NAME_MAX space for the SELinux label
-                 * here. The kernel currently enforces no
-                 * limit, but according to suggestions from
-                 * the SELinux people this will change and it
-                 * will probably be identical to NAME_MAX. For
-                 * now we use that, but this should be updated
-                 * one day when the final limit is known. */
-                uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                            CMSG_SPACE(sizeof(struct timeval)) +
-                            CMSG_SPACE(sizeof(int)) + /* fd */
-                            CMSG_SPACE(NAME_MAX)]; /* selinux label */
-        } control = {};
-
-        union sockaddr_union sa = {};
-
-        struct msghdr msghdr = {
-                .msg_iov = &iovec,
-                .msg_iovlen = 1,
-                .msg_control = &control,
-                .msg_controllen = sizeof(control),
-                .msg_name = &sa,
-                .msg_namelen = sizeof(sa),
-        };
-
         assert(s);
-        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+        assert(msghdr);
+        assert(buffer);
 
-        if (revents != EPOLLIN) {
-                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
-                return -EIO;
-        }
-
-        /* Try to get the right size, if we can. (Not all sockets support SIOCINQ, hence we just try, but don't rely on
-         * it.) */
-        (void) ioctl(fd, SIOCINQ, &v);
-
-        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
-        m = PAGE_ALIGN(MAX3((size_t) v + 1,
-                            (size_t) LINE_MAX,
-                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
-
-        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m))
-                return log_oom();
-
-        iovec.iov_base = s->buffer;
-        iovec.iov_len = s->buffer_size - 1; /* Leave room for trailing NUL we add later */
-
-        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-        if (n < 0) {
-                if (IN_SET(errno, EINTR, EAGAIN))
-                        return 0;
-
-                return log_error_errno(errno, "recvmsg() failed: %m");
-        }
-
-        CMSG_FOREACH(cmsg, &msghdr) {
+        CMSG_FOREACH(cmsg, msghdr) {
 
                 if (cmsg->cmsg_level == SOL_SOCKET &&
                     cmsg->cmsg_type == SCM_CREDENTIALS &&
@@ -1297,17 +1607,17 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         }
 
         /* And a trailing NUL, just in case */
-        s->buffer[n] = 0;
+        buffer[n] = 0;
 
         if (fd == s->syslog_fd) {
                 if (n > 0 && n_fds == 0)
-                        server_process_syslog_message(s, s->buffer, n, ucred, tv, label, label_len);
+                        server_process_syslog_message(s, buffer, n, ucred, tv, label, label_len);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via syslog socket. Ignoring.");
 
         } else if (fd == s->native_fd) {
                 if (n > 0 && n_fds == 0)
-                        server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
+                        server_process_native_message(s, buffer, n, ucred, tv, label, label_len);
                 else if (n == 0 && n_fds == 1)
                         server_process_native_file(s, fds[0], ucred, tv, label, label_len);
                 else if (n_fds > 0)
@@ -1317,12 +1627,163 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
                 assert(fd == s->audit_fd);
 
                 if (n > 0 && n_fds == 0)
-                        server_process_audit_message(s, s->buffer, n, ucred, &sa, msghdr.msg_namelen);
+                        server_process_audit_message(s, buffer, n, ucred, msghdr->msg_name, msghdr->msg_namelen);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via audit socket. Ignoring.");
         }
 
         close_many(fds, n_fds);
+}
+
+static DatagramBatch* datagram_batch_free(DatagramBatch *b) {
+        if (!b)
+                return NULL;
+
+        free(b->buffer);
+        return mfree(b);
+}
+
+static int server_process_datagram_batch(Server *s, int fd) {
+        DatagramBatch *b;
+        unsigned i;
+        int n;
+
+        assert(s);
+
+        if (!s->datagram_batch) {
+                _cleanup_free_ DatagramBatch *nb = NULL;
+
+                nb = new0(DatagramBatch, 1);
+                if (!nb)
+                        return -ENOMEM;
+
+                /* The slots are only touched as far as datagrams fill them, hence this is mostly address space */
+                nb->buffer = malloc(DATAGRAM_BATCH_MAX * DATAGRAM_SLOT_SIZE);
+                if (!nb->buffer)
+                        return -ENOMEM;
+
+                for (i = 0; i < DATAGRAM_BATCH_MAX; i++)
+                        nb->iovec[i] = IOVEC_MAKE(nb->buffer + i * DATAGRAM_SLOT_SIZE,
+                                                  DATAGRAM_SLOT_SIZE - 1); /* Leave room for trailing NUL we add later */
+
+                RATELIMIT_INIT(nb->truncated_ratelimit,
+                               DATAGRAM_TRUNCATED_RATELIMIT_INTERVAL_USEC,
+                               DATAGRAM_TRUNCATED_RATELIMIT_BURST);
+
+                s->datagram_batch = TAKE_PTR(nb);
+        }
+
+        b = s->datagram_batch;
+
+        /* The kernel updates the lengths, hence reset them for each call */
+        for (i = 0; i < DATAGRAM_BATCH_MAX; i++)
+                b->messages[i] = (struct mmsghdr) {
+                        .msg_hdr = {
+                                .msg_iov = b->iovec + i,
+                                .msg_iovlen = 1,
+                                .msg_control = b->control + i,
+                                .msg_controllen = sizeof(DatagramControl),
+                                .msg_name = b->sa + i,
+                                .msg_namelen = sizeof(union sockaddr_union),
+                        },
+                };
+
+        n = recvmmsg(fd, b->messages, DATAGRAM_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+        if (n < 0) {
+                if (IN_SET(errno, EINTR, EAGAIN))
+                        return 0;
+
+                return log_error_errno(errno, "recvmmsg() failed: %m");
+        }
+
+        /* Collect all resulting entries in the write queue, so that they are written to the journal in one go */
+        s->write_queue_hold = true;
+
+        for (i = 0; i < (unsigned) n; i++) {
+                if (b->messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                        /* The rest of the datagram is gone, all we can do is let the admin know */
+                        b->n_truncated++;
+
+                        if (ratelimit_below(&b->truncated_ratelimit)) {
+                                log_warning("%u datagram(s) exceeded %u bytes and were truncated.",
+                                            b->n_truncated, DATAGRAM_SLOT_SIZE - 1);
+                                b->n_truncated = 0;
+                        }
+                }
+
+                server_process_datagram_one(s, fd, &b->messages[i].msg_hdr,
+                                            b->iovec[i].iov_base, b->messages[i].msg_len);
+        }
+
+        s->write_queue_hold = false;
+
+        if (s->n_write_queue >= s->write_queue_size)
+                server_flush_write_queue(s);
+
+        return 0;
+}
+
+int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        DatagramControl control = {};
+        union sockaddr_union sa = {};
+        struct iovec iovec;
+        ssize_t n;
+        int v = 0, r;
+        size_t m;
+
+        struct msghdr msghdr = {
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+                .msg_name = &sa,
+                .msg_namelen = sizeof(sa),
+        };
+
+        assert(s);
+        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+
+        if (revents != EPOLLIN) {
+                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
+                return -EIO;
+        }
+
+        /* Try to get the right size, if we can. (Not all sockets support SIOCINQ, hence we just try, but don't rely on
+         * it.) */
+        (void) ioctl(fd, SIOCINQ, &v);
+
+        /* Syslog and audit messages are usually short and come in bursts, hence receive as many as we can with a
+         * single call. Native messages may be large enough that we need to size the buffer for each of them, hence
+         * we don't batch those. */
+        if (fd != s->native_fd && (size_t) v < DATAGRAM_SLOT_SIZE) {
+                r = server_process_datagram_batch(s, fd);
+                if (r != -ENOMEM)
+                        return r;
+
+                /* If we can't allocate the batch buffers, try with the smaller single buffer below */
+        }
+
+        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
+        m = PAGE_ALIGN(MAX3((size_t) v + 1,
+                            (size_t) LINE_MAX,
+                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
+
+        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m))
+                return log_oom();
+
+        iovec.iov_base = s->buffer;
+        iovec.iov_len = s->buffer_size - 1; /* Leave room for trailing NUL we add later */
+
+        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+                if (IN_SET(errno, EINTR, EAGAIN))
+                        return 0;
+
+                return log_error_errno(errno, "recvmsg() failed: %m");
+        }
+
+        server_process_datagram_one(s, fd, &msghdr, s->buffer, n);
         return 0;
 }
 
@@ -1380,6 +1841,30 @@ static int dispatch_sigterm(sd_event_source *es, const struct signalfd_siginfo *
         return 0;
 }
 
+static int server_write_rate_limits(Server *s) {
+        _cleanup_(unlink_and_freep) char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        int r;
+
+        assert(s);
+
+        r = fopen_temporary("/run/systemd/journal/rate-limits", &f, &temp_path);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0644);
+
+        r = journal_rate_limit_dump(s->rate_limit, f);
+        if (r < 0)
+                return r;
+
+        if (rename(temp_path, "/run/systemd/journal/rate-limits") < 0)
+                return -errno;
+
+        temp_path = mfree(temp_path);
+        return 0;
+}
+
 static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
         Server *s = userdata;
         int r;
@@ -1395,6 +1880,11 @@ static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo
         if (r < 0)
                 log_warning_errno(r, "Failed to write /run/systemd/journal/synced, ignoring: %m");
 
+        /* And while we are at it, let them know who is being rate limited. */
+        r = server_write_rate_limits(s);
+        if (r < 0)
+                log_warning_errno(r, "Failed to write /run/systemd/journal/rate-limits, ignoring: %m");
+
         return 0;
 }
 
@@ -1843,6 +2333,8 @@ int server_init(Server *s) {
 
         s->line_max = DEFAULT_LINE_MAX;
 
+        s->write_queue_size = 1;
+
         journal_reset_metrics(&s->system_storage.metrics);
         journal_reset_metrics(&s->runtime_storage.metrics);
 
@@ -1876,6 +2368,12 @@ int server_init(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to create event loop: %m");
 
+        r = sync_ring_new(s->event, &s->sync_ring);
+        if (r == -EOPNOTSUPP)
+                log_debug("Built without io_uring support, syncing journal files in threads.");
+        else if (r < 0)
+                log_info_errno(r, "Failed to set up io_uring for syncing journal files, using threads: %m");
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -1984,7 +2482,7 @@ int server_init(Server *s) {
         if (r < 0)
                 return r;
 
-        s->rate_limit = journal_rate_limit_new();
+        s->rate_limit = journal_rate_limit_new(s->rate_limit_interval, s->rate_limit_slice_burst);
         if (!s->rate_limit)
                 return -ENOMEM;
 
@@ -2030,6 +2528,8 @@ void server_maybe_append_tags(Server *s) {
 void server_done(Server *s) {
         assert(s);
 
+        server_flush_write_queue(s);
+
         set_free_with_destructor(s->deferred_closes, journal_file_close);
 
         while (s->stdout_streams)
@@ -2059,6 +2559,13 @@ void server_done(Server *s) {
         sd_event_source_unref(s->hostname_event_source);
         sd_event_source_unref(s->notify_event_source);
         sd_event_source_unref(s->watchdog_event_source);
+        sd_event_source_unref(s->write_queue_event_source);
+        free(s->write_queue);
+        free(s->write_batch);
+
+        /* Only after all journal files are closed, as closing them waits for their syncs */
+        sync_ring_free(s->sync_ring);
+
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
@@ -2076,6 +2583,7 @@ void server_done(Server *s) {
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
         free(s->buffer);
+        datagram_batch_free(s->datagram_batch);
         free(s->tty_path);
         free(s->cgroup_root);
         free(s->hostname_field);
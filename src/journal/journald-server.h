@@ -7,6 +7,8 @@
 #include "sd-event.h"
 
 typedef struct Server Server;
+typedef struct QueuedEntry QueuedEntry;
+typedef struct DatagramBatch DatagramBatch;
 
 #include "conf-parser.h"
 #include "hashmap.h"
@@ -14,6 +16,7 @@ typedef struct Server Server;
 #include "journald-context.h"
 #include "journald-rate-limit.h"
 #include "journald-stream.h"
+#include "journald-sync-ring.h"
 #include "list.h"
 #include "prioq.h"
 
@@ -68,6 +71,8 @@ struct Server {
 
         sd_event *event;
 
+        SyncRing *sync_ring;
+
         sd_event_source *syslog_event_source;
         sd_event_source *native_event_source;
         sd_event_source *stdout_event_source;
@@ -82,6 +87,7 @@ struct Server {
         sd_event_source *hostname_event_source;
         sd_event_source *notify_event_source;
         sd_event_source *watchdog_event_source;
+        sd_event_source *write_queue_event_source;
 
         JournalFile *runtime_journal;
         JournalFile *system_journal;
@@ -92,10 +98,14 @@ struct Server {
         char *buffer;
         size_t buffer_size;
 
+        /* Buffers for receiving syslog and audit datagrams in batches */
+        DatagramBatch *datagram_batch;
+
         JournalRateLimit *rate_limit;
         usec_t sync_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
+        unsigned rate_limit_slice_burst;
 
         JournalStorage runtime_storage;
         JournalStorage system_storage;
@@ -157,9 +167,19 @@ struct Server {
 
         size_t line_max;
 
+        /* Entries not written yet, see WriteQueueSize= */
+        QueuedEntry **write_queue;
+        size_t n_write_queue, n_write_queue_allocated;
+        JournalEntryBatchItem *write_batch;
+        size_t n_write_batch_allocated;
+        unsigned write_queue_size;
+        bool write_queue_hold;
+        bool write_queue_flushing;
+
         /* Caching of client metadata */
         Hashmap *client_contexts;
         Prioq *client_contexts_lru;
+        ClientContextWatcher *client_context_watcher;
 
         ClientContext *my_context; /* the context of journald itself */
         ClientContext *pid1_context; /* the context of PID 1 */
@@ -183,6 +203,14 @@ struct Server {
 #define N_IOVEC_UDEV_FIELDS 32
 
 void server_dispatch_message(Server *s, struct iovec *iovec, size_t n, size_t m, ClientContext *c, const struct timeval *tv, int priority, pid_t object_pid);
+
+typedef struct ServerMessage {
+        struct iovec *iovec;
+        size_t n;
+        int priority;
+} ServerMessage;
+
+void server_dispatch_messages(Server *s, ServerMessage *messages, size_t n_messages, size_t m, ClientContext *c);
 void server_driver_message(Server *s, pid_t object_pid, const char *message_id, const char *format, ...) _sentinel_ _printf_(4,0);
 
 /* gperf lookup function */
@@ -203,6 +231,7 @@ SplitMode split_mode_from_string(const char *s) _pure_;
 int server_init(Server *s);
 void server_done(Server *s);
 void server_sync(Server *s);
+void server_flush_write_queue(Server *s);
 int server_vacuum(Server *s, bool verbose);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
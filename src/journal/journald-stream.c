@@ -35,6 +35,17 @@
 
 #define STDOUT_STREAMS_MAX 4096
 
+/* The read buffer of a stream grows up to this size (or LineMax=, whatever is larger), so that chatty streams are
+ * drained with few read() calls, and many lines can be logged in one batch */
+#define STDOUT_STREAM_BUFFER_MAX (256U*1024U)
+
+/* Once a stream is drained, its read buffer is shrunk back to this size, so that thousands of mostly idle streams
+ * don't keep their peak buffer size around */
+#define STDOUT_STREAM_BUFFER_IDLE (4U*1024U)
+
+/* The maximum number of lines we write to the journal in one batch */
+#define STDOUT_STREAM_BATCH_MAX 64U
+
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -46,15 +57,13 @@ typedef enum StdoutStreamState {
         STDOUT_STREAM_RUNNING
 } StdoutStreamState;
 
-/* The different types of log record terminators: a real \n was read, a NUL character was read, the maximum line length
- * was reached, or the end of the stream was reached */
-
-typedef enum LineBreak {
-        LINE_BREAK_NEWLINE,
-        LINE_BREAK_NUL,
-        LINE_BREAK_LINE_MAX,
-        LINE_BREAK_EOF,
-} LineBreak;
+/* A log line found in the read buffer of a stream. Not NUL terminated, and only valid until the buffer is
+ * compacted at the end of stdout_stream_scan(). */
+typedef struct StdoutLine {
+        const char *p;
+        size_t length;
+        LineBreak line_break;
+} StdoutLine;
 
 struct StdoutStream {
         Server *server;
@@ -65,6 +74,7 @@ struct StdoutStream {
         struct ucred ucred;
         char *label;
         char *identifier;
+        char *syslog_identifier; /* "SYSLOG_IDENTIFIER=" followed by the identifier, logged with every line */
         char *unit_id;
         int priority;
         bool level_prefix:1;
@@ -116,6 +126,7 @@ void stdout_stream_free(StdoutStream *s) {
         safe_close(s->fd);
         free(s->label);
         free(s->identifier);
+        free(s->syslog_identifier);
         free(s->unit_id);
         free(s->state_file);
         free(s->buffer);
@@ -233,17 +244,39 @@ fail:
         return log_error_errno(r, "Failed to save stream data %s: %m", s->state_file);
 }
 
-static int stdout_stream_log(StdoutStream *s, const char *p, LineBreak line_break) {
-        struct iovec *iovec;
-        int priority;
-        char syslog_priority[] = "PRIORITY=\0";
-        char syslog_facility[STRLEN("SYSLOG_FACILITY=") + DECIMAL_STR_MAX(int) + 1];
-        _cleanup_free_ char *message = NULL, *syslog_identifier = NULL;
-        size_t n = 0, m;
+static int stdout_stream_set_identifier(StdoutStream *s, const char *identifier) {
+        _cleanup_free_ char *copy = NULL, *field = NULL;
+
+        assert(s);
+
+        if (isempty(identifier))
+                return 0;
+
+        /* The field is the same for every line the stream logs, hence build it once */
+        copy = strdup(identifier);
+        field = strappend("SYSLOG_IDENTIFIER=", identifier);
+        if (!copy || !field)
+                return -ENOMEM;
+
+        free_and_replace(s->identifier, copy);
+        free_and_replace(s->syslog_identifier, field);
+
+        return 0;
+}
+
+static void stdout_stream_log(StdoutStream *s, const StdoutLine *lines, size_t n_lines) {
+        _cleanup_free_ struct iovec *iovecs = NULL;
+        _cleanup_free_ char *buffer = NULL;
+        ServerMessage *messages;
+        size_t n_messages = 0, m, i, size = 0;
+        char *q;
         int r;
 
         assert(s);
-        assert(p);
+        assert(lines || n_lines == 0);
+
+        if (n_lines == 0)
+                return;
 
         if (s->context)
                 (void) client_context_maybe_refresh(s->server, s->context, NULL, NULL, 0, NULL, USEC_INFINITY);
@@ -253,93 +286,129 @@ static int stdout_stream_log(StdoutStream *s, const char *p, LineBreak line_brea
                         log_warning_errno(r, "Failed to acquire client context, ignoring: %m");
         }
 
-        priority = s->priority;
+        /* All fields specific to a line are put into one buffer for the whole batch, which we size up-front so
+         * that it is never reallocated while we point into it. */
+        for (i = 0; i < n_lines; i++)
+                size += STRLEN("PRIORITY=") + 2 +
+                        STRLEN("SYSLOG_FACILITY=") + DECIMAL_STR_MAX(int) + 1 +
+                        STRLEN("MESSAGE=") + lines[i].length + 1;
 
-        if (s->level_prefix)
-                syslog_parse_priority(&p, &priority, false);
+        m = N_IOVEC_META_FIELDS + 7 + client_context_extra_fields_n_iovec(s->context);
 
-        if (!client_context_test_priority(s->context, priority))
-                return 0;
+        buffer = malloc(size);
+        iovecs = new(struct iovec, n_lines * m);
+        if (!buffer || !iovecs) {
+                log_oom();
+                return;
+        }
 
-        if (isempty(p))
-                return 0;
+        messages = newa(ServerMessage, n_lines);
+        q = buffer;
 
-        if (s->forward_to_syslog || s->server->forward_to_syslog)
-                server_forward_syslog(s->server, syslog_fixup_facility(priority), s->identifier, p, &s->ucred, NULL);
+        for (i = 0; i < n_lines; i++) {
+                struct iovec *iovec = iovecs + n_messages * m;
+                const char *p;
+                char *message;
+                int priority;
+                size_t n = 0;
 
-        if (s->forward_to_kmsg || s->server->forward_to_kmsg)
-                server_forward_kmsg(s->server, priority, s->identifier, p, &s->ucred);
+                /* Copy the line right behind the field name: this gives us a NUL terminated string to parse and
+                 * forward, and the MESSAGE= field of the entry, without copying the line another time. */
+                message = q;
+                q = stpcpy(q, "MESSAGE=");
+                p = q;
+                q = mempcpy(q, lines[i].p, lines[i].length);
+                *(q++) = 0;
 
-        if (s->forward_to_console || s->server->forward_to_console)
-                server_forward_console(s->server, priority, s->identifier, p, &s->ucred);
+                priority = s->priority;
 
-        if (s->server->forward_to_wall)
-                server_forward_wall(s->server, priority, s->identifier, p, &s->ucred);
+                if (s->level_prefix)
+                        syslog_parse_priority(&p, &priority, false);
 
-        m = N_IOVEC_META_FIELDS + 7 + client_context_extra_fields_n_iovec(s->context);
-        iovec = newa(struct iovec, m);
+                if (!client_context_test_priority(s->context, priority))
+                        continue;
 
-        iovec[n++] = IOVEC_MAKE_STRING("_TRANSPORT=stdout");
-        iovec[n++] = IOVEC_MAKE_STRING(s->id_field);
+                if (isempty(p))
+                        continue;
 
-        syslog_priority[STRLEN("PRIORITY=")] = '0' + LOG_PRI(priority);
-        iovec[n++] = IOVEC_MAKE_STRING(syslog_priority);
+                if (s->forward_to_syslog || s->server->forward_to_syslog)
+                        server_forward_syslog(s->server, syslog_fixup_facility(priority), s->identifier, p, &s->ucred, NULL);
 
-        if (priority & LOG_FACMASK) {
-                xsprintf(syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
-                iovec[n++] = IOVEC_MAKE_STRING(syslog_facility);
-        }
+                if (s->forward_to_kmsg || s->server->forward_to_kmsg)
+                        server_forward_kmsg(s->server, priority, s->identifier, p, &s->ucred);
 
-        if (s->identifier) {
-                syslog_identifier = strappend("SYSLOG_IDENTIFIER=", s->identifier);
-                if (syslog_identifier)
-                        iovec[n++] = IOVEC_MAKE_STRING(syslog_identifier);
-        }
+                if (s->forward_to_console || s->server->forward_to_console)
+                        server_forward_console(s->server, priority, s->identifier, p, &s->ucred);
 
-        if (line_break != LINE_BREAK_NEWLINE) {
-                const char *c;
+                if (s->server->forward_to_wall)
+                        server_forward_wall(s->server, priority, s->identifier, p, &s->ucred);
 
-                /* If this log message was generated due to an uncommon line break then mention this in the log
-                 * entry */
+                iovec[n++] = IOVEC_MAKE_STRING("_TRANSPORT=stdout");
+                iovec[n++] = IOVEC_MAKE_STRING(s->id_field);
 
-                c =     line_break == LINE_BREAK_NUL ?      "_LINE_BREAK=nul" :
-                        line_break == LINE_BREAK_LINE_MAX ? "_LINE_BREAK=line-max" :
-                                                            "_LINE_BREAK=eof";
-                iovec[n++] = IOVEC_MAKE_STRING(c);
-        }
+                iovec[n++] = IOVEC_MAKE_STRING(q);
+                q += sprintf(q, "PRIORITY=%i", LOG_PRI(priority)) + 1;
+
+                if (priority & LOG_FACMASK) {
+                        iovec[n++] = IOVEC_MAKE_STRING(q);
+                        q += sprintf(q, "SYSLOG_FACILITY=%i", LOG_FAC(priority)) + 1;
+                }
+
+                if (s->syslog_identifier)
+                        iovec[n++] = IOVEC_MAKE_STRING(s->syslog_identifier);
+
+                if (lines[i].line_break != LINE_BREAK_NEWLINE) {
+                        const char *c;
+
+                        /* If this log message was generated due to an uncommon line break then mention this in the log
+                         * entry */
+
+                        c =     lines[i].line_break == LINE_BREAK_NUL ?      "_LINE_BREAK=nul" :
+                                lines[i].line_break == LINE_BREAK_LINE_MAX ? "_LINE_BREAK=line-max" :
+                                                                             "_LINE_BREAK=eof";
+                        iovec[n++] = IOVEC_MAKE_STRING(c);
+                }
+
+                /* If a level prefix was stripped, move the field name up to the remaining message */
+                if (p > message + STRLEN("MESSAGE=")) {
+                        message = (char*) p - STRLEN("MESSAGE=");
+                        memcpy(message, "MESSAGE=", STRLEN("MESSAGE="));
+                }
 
-        message = strappend("MESSAGE=", p);
-        if (message)
                 iovec[n++] = IOVEC_MAKE_STRING(message);
 
-        server_dispatch_message(s->server, iovec, n, m, s->context, NULL, priority, 0);
-        return 0;
+                messages[n_messages++] = (ServerMessage) {
+                        .iovec = iovec,
+                        .n = n,
+                        .priority = priority,
+                };
+        }
+
+        assert(q <= buffer + size);
+
+        server_dispatch_messages(s->server, messages, n_messages, m, s->context);
 }
 
 static int stdout_stream_line(StdoutStream *s, char *p, LineBreak line_break) {
         int r;
-        char *orig;
 
         assert(s);
         assert(p);
-
-        orig = p;
-        p = strstrip(p);
+        assert(s->state != STDOUT_STREAM_RUNNING);
 
         /* line breaks by NUL, line max length or EOF are not permissible during the negotiation part of the protocol */
-        if (line_break != LINE_BREAK_NEWLINE && s->state != STDOUT_STREAM_RUNNING) {
+        if (line_break != LINE_BREAK_NEWLINE) {
                 log_warning("Control protocol line not properly terminated.");
                 return -EINVAL;
         }
 
+        p = strstrip(p);
+
         switch (s->state) {
 
         case STDOUT_STREAM_IDENTIFIER:
-                if (!isempty(p)) {
-                        s->identifier = strdup(p);
-                        if (!s->identifier)
-                                return log_oom();
-                }
+                if (stdout_stream_set_identifier(s, p) < 0)
+                        return log_oom();
 
                 s->state = STDOUT_STREAM_UNIT_ID;
                 return 0;
@@ -414,16 +483,57 @@ static int stdout_stream_line(StdoutStream *s, char *p, LineBreak line_break) {
                 return 0;
 
         case STDOUT_STREAM_RUNNING:
-                return stdout_stream_log(s, orig, line_break);
+                /* Log lines are collected by stdout_stream_scan() */
+                break;
         }
 
         assert_not_reached("Unknown stream state");
 }
 
+/* Looks for the end of the first log record in the buffer, returns false if it doesn't hold a complete one yet. A
+ * \n terminator is replaced by NUL, so that the record may be parsed as a string. */
+bool stdout_stream_find_line(char *p, size_t size, size_t line_max, size_t *ret_length, size_t *ret_skip, LineBreak *ret_line_break) {
+        size_t window;
+        char *end1, *end2;
+
+        assert(p || size == 0);
+        assert(line_max > 0);
+        assert(ret_length);
+        assert(ret_skip);
+        assert(ret_line_break);
+
+        /* The buffer might be larger than the maximum line length, never look further than that */
+        window = MIN(size, line_max);
+
+        end1 = memchr(p, '\n', window);
+        end2 = memchr(p, 0, end1 ? (size_t) (end1 - p) : window);
+
+        if (end2) {
+                /* We found a NUL terminator */
+                *ret_length = end2 - p;
+                *ret_skip = *ret_length + 1;
+                *ret_line_break = LINE_BREAK_NUL;
+        } else if (end1) {
+                /* We found a \n terminator */
+                *end1 = 0;
+                *ret_length = end1 - p;
+                *ret_skip = *ret_length + 1;
+                *ret_line_break = LINE_BREAK_NEWLINE;
+        } else if (size >= line_max) {
+                /* Force a line break after the maximum line length */
+                *ret_length = *ret_skip = line_max;
+                *ret_line_break = LINE_BREAK_LINE_MAX;
+        } else
+                return false;
+
+        return true;
+}
+
 static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
+        StdoutLine lines[STDOUT_STREAM_BATCH_MAX];
+        size_t remaining, n_lines = 0;
         char *p;
-        size_t remaining;
-        int r;
+        int r = 0;
 
         assert(s);
 
@@ -434,58 +544,86 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
 
         for (;;) {
                 LineBreak line_break;
-                size_t skip;
-                char *end1, *end2;
-
-                end1 = memchr(p, '\n', remaining);
-                end2 = memchr(p, 0, end1 ? (size_t) (end1 - p) : remaining);
-
-                if (end2) {
-                        /* We found a NUL terminator */
-                        skip = end2 - p + 1;
-                        line_break = LINE_BREAK_NUL;
-                } else if (end1) {
-                        /* We found a \n terminator */
-                        *end1 = 0;
-                        skip = end1 - p + 1;
-                        line_break = LINE_BREAK_NEWLINE;
-                } else if (remaining >= s->server->line_max) {
-                        /* Force a line break after the maximum line length */
-                        *(p + s->server->line_max) = 0;
-                        skip = remaining;
-                        line_break = LINE_BREAK_LINE_MAX;
-                } else
+                size_t skip, length;
+
+                if (!stdout_stream_find_line(p, remaining, s->server->line_max, &length, &skip, &line_break))
                         break;
 
-                r = stdout_stream_line(s, p, line_break);
-                if (r < 0)
-                        return r;
+                if (s->state == STDOUT_STREAM_RUNNING) {
+                        lines[n_lines++] = (StdoutLine) {
+                                .p = p,
+                                .length = length,
+                                .line_break = line_break,
+                        };
+
+                        if (n_lines >= ELEMENTSOF(lines)) {
+                                stdout_stream_log(s, lines, n_lines);
+                                n_lines = 0;
+                        }
+                } else {
+                        r = stdout_stream_line(s, p, line_break);
+                        if (r < 0)
+                                return r;
+                }
 
                 remaining -= skip;
                 p += skip;
         }
 
         if (force_flush && remaining > 0) {
-                p[remaining] = 0;
-                r = stdout_stream_line(s, p, LINE_BREAK_EOF);
-                if (r < 0)
-                        return r;
+                if (s->state == STDOUT_STREAM_RUNNING) {
+                        if (n_lines >= ELEMENTSOF(lines)) {
+                                stdout_stream_log(s, lines, n_lines);
+                                n_lines = 0;
+                        }
+
+                        lines[n_lines++] = (StdoutLine) {
+                                .p = p,
+                                .length = remaining,
+                                .line_break = LINE_BREAK_EOF,
+                        };
+                } else {
+                        p[remaining] = 0;
+                        r = stdout_stream_line(s, p, LINE_BREAK_EOF);
+                }
 
                 p += remaining;
                 remaining = 0;
         }
 
+        /* Log the lines we collected before they are moved around in the buffer */
+        stdout_stream_log(s, lines, n_lines);
+
         if (p > s->buffer) {
                 memmove(s->buffer, p, remaining);
                 s->length = remaining;
         }
 
-        return 0;
+        return r;
+}
+
+static void stdout_stream_shrink_buffer(StdoutStream *s) {
+        size_t size;
+        char *p;
+
+        assert(s);
+
+        size = MAX(s->length + 1, STDOUT_STREAM_BUFFER_IDLE);
+        if (size >= s->allocated)
+                return;
+
+        /* If this fails, we simply keep the larger buffer */
+        p = realloc(s->buffer, size);
+        if (!p)
+                return;
+
+        s->buffer = p;
+        s->allocated = size;
 }
 
 static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         StdoutStream *s = userdata;
-        size_t limit;
+        size_t limit, max, n;
         ssize_t l;
         int r;
 
@@ -496,19 +634,24 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
                 goto terminate;
         }
 
-        /* If the buffer is full already (discounting the extra NUL we need), add room for another 1K */
-        if (s->length + 1 >= s->allocated) {
+        /* Never buffer more than the larger of the maximum line length and our batch buffer size */
+        max = MAX(s->server->line_max, STDOUT_STREAM_BUFFER_MAX);
+
+        /* If the buffer is full already (discounting the extra NUL we need), add room for another 1K, which
+         * grows the buffer exponentially for streams that keep it busy */
+        if (s->length + 1 >= s->allocated && s->length < max) {
                 if (!GREEDY_REALLOC(s->buffer, s->allocated, s->length + 1 + 1024)) {
                         log_oom();
                         goto terminate;
                 }
         }
 
-        /* Try to make use of the allocated buffer in full, but never read more than the configured line size. Also,
-         * always leave room for a terminating NUL we might need to add. */
-        limit = MIN(s->allocated - 1, s->server->line_max);
+        /* Try to make use of the allocated buffer in full, but never read more than the maximum size. Also, always
+         * leave room for a terminating NUL we might need to add. */
+        limit = MIN(s->allocated - 1, max);
 
-        l = read(s->fd, s->buffer + s->length, limit - s->length);
+        n = limit - s->length;
+        l = read(s->fd, s->buffer + s->length, n);
         if (l < 0) {
                 if (errno == EAGAIN)
                         return 0;
@@ -527,6 +670,10 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
         if (r < 0)
                 goto terminate;
 
+        /* A short read means we drained the stream */
+        if ((size_t) l < n)
+                stdout_stream_shrink_buffer(s);
+
         return 1;
 
 terminate:
@@ -639,6 +786,7 @@ static int stdout_stream_load(StdoutStream *stream, const char *fname) {
                 *forward_to_syslog = NULL,
                 *forward_to_kmsg = NULL,
                 *forward_to_console = NULL,
+                *identifier = NULL,
                 *stream_id = NULL;
         int r;
 
@@ -657,12 +805,15 @@ static int stdout_stream_load(StdoutStream *stream, const char *fname) {
                            "FORWARD_TO_SYSLOG", &forward_to_syslog,
                            "FORWARD_TO_KMSG", &forward_to_kmsg,
                            "FORWARD_TO_CONSOLE", &forward_to_console,
-                           "IDENTIFIER", &stream->identifier,
+                           "IDENTIFIER", &identifier,
                            "UNIT", &stream->unit_id,
                            "STREAM_ID", &stream_id);
         if (r < 0)
                 return log_error_errno(r, "Failed to read: %s", stream->state_file);
 
+        if (stdout_stream_set_identifier(stream, identifier) < 0)
+                return log_oom();
+
         if (priority) {
                 int p;
 
@@ -6,6 +6,16 @@ typedef struct StdoutStream StdoutStream;
 #include "fdset.h"
 #include "journald-server.h"
 
+/* The different types of log record terminators: a real \n was read, a NUL character was read, the maximum line length
+ * was reached, or the end of the stream was reached */
+
+typedef enum LineBreak {
+        LINE_BREAK_NEWLINE,
+        LINE_BREAK_NUL,
+        LINE_BREAK_LINE_MAX,
+        LINE_BREAK_EOF,
+} LineBreak;
+
 int server_open_stdout_socket(Server *s);
 int server_restore_streams(Server *s, FDSet *fds);
 
@@ -13,3 +23,5 @@ void stdout_stream_free(StdoutStream *s);
 int stdout_stream_install(Server *s, int fd, StdoutStream **ret);
 void stdout_stream_destroy(StdoutStream *s);
 void stdout_stream_send_notify(StdoutStream *s);
+
+bool stdout_stream_find_line(char *p, size_t size, size_t line_max, size_t *ret_length, size_t *ret_skip, LineBreak *ret_line_break);
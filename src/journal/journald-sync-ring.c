@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#if HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "journald-sync-ring.h"
+#include "log.h"
+#include "time-util.h"
+
+#if HAVE_LIBURING
+
+/* Bounds the number of files we sync in parallel through the ring, anything beyond that uses a thread */
+#define SYNC_RING_ENTRIES 64U
+
+typedef struct SyncRequest {
+        JournalFile *file;
+        usec_t begin;
+} SyncRequest;
+
+struct SyncRing {
+        struct io_uring ring;
+        bool broken;
+
+        sd_event_source *io_event_source;
+        sd_event_source *submit_event_source;
+
+        /* Prepared in the ring, but not submitted yet */
+        SyncRequest *queued[SYNC_RING_ENTRIES];
+        unsigned n_queued;
+        unsigned n_inflight;
+
+        /* Sync latency of the current burst of requests */
+        unsigned n_synced;
+        usec_t latency_sum, latency_max;
+};
+
+static void sync_ring_continue(SyncRing *r, JournalFile *f);
+
+static void sync_ring_account(SyncRing *r, usec_t begin) {
+        usec_t latency;
+
+        assert(r);
+
+        latency = usec_sub_unsigned(now(CLOCK_MONOTONIC), begin);
+
+        r->n_synced++;
+        r->latency_sum += latency;
+        r->latency_max = MAX(r->latency_max, latency);
+
+        if (r->n_queued > 0 || r->n_inflight > 0)
+                return;
+
+        if (r->n_synced > 0) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX];
+
+                log_debug("Completed %u journal file syncs, average latency %s, maximum latency %s.",
+                          r->n_synced,
+                          format_timespan(a, sizeof(a), r->latency_sum / r->n_synced, 1),
+                          format_timespan(b, sizeof(b), r->latency_max, 1));
+        }
+
+        r->n_synced = 0;
+        r->latency_sum = r->latency_max = 0;
+}
+
+static void sync_ring_hand_over(SyncRing *r, JournalFile *f) {
+        assert(r);
+        assert(f);
+
+        /* Don't block the event loop with fsync(), let a thread carry on with offlining the file */
+        journal_file_offline_continue_in_thread(f);
+}
+
+static int sync_ring_submit(SyncRing *r) {
+        SyncRequest *queued[SYNC_RING_ENTRIES];
+        unsigned i, n;
+        int k;
+
+        assert(r);
+
+        if (r->n_queued == 0)
+                return 0;
+
+        k = io_uring_submit(&r->ring);
+        if (k >= 0) {
+                r->n_inflight += r->n_queued;
+                r->n_queued = 0;
+                return 0;
+        }
+
+        /* The queued requests are stuck in the ring now. Never submit anything again, so that they are never
+         * completed either, and sync their files in threads. */
+        log_warning_errno(k, "Failed to submit journal file syncs, falling back to threads: %m");
+        r->broken = true;
+
+        n = r->n_queued;
+        memcpy(queued, r->queued, n * sizeof(SyncRequest*));
+        r->n_queued = 0;
+
+        for (i = 0; i < n; i++) {
+                JournalFile *f = queued[i]->file;
+
+                free(queued[i]);
+                sync_ring_hand_over(r, f);
+        }
+
+        return k;
+}
+
+static int sync_ring_queue(SyncRing *r, JournalFile *f) {
+        struct io_uring_sqe *sqe;
+        SyncRequest *req;
+
+        assert(r);
+        assert(f);
+
+        if (r->broken)
+                return -EIO;
+        if (r->n_queued + r->n_inflight >= SYNC_RING_ENTRIES)
+                return -EBUSY;
+
+        req = new(SyncRequest, 1);
+        if (!req)
+                return -ENOMEM;
+
+        sqe = io_uring_get_sqe(&r->ring);
+        if (!sqe) {
+                free(req);
+                return -EBUSY;
+        }
+
+        *req = (SyncRequest) {
+                .file = f,
+                .begin = now(CLOCK_MONOTONIC),
+        };
+
+        io_uring_prep_fsync(sqe, f->fd, 0);
+        io_uring_sqe_set_data(sqe, req);
+        r->queued[r->n_queued++] = req;
+
+        /* Submit everything queued in this event loop iteration at once */
+        (void) sd_event_source_set_enabled(r->submit_event_source, SD_EVENT_ONESHOT);
+
+        return 0;
+}
+
+static void sync_ring_continue(SyncRing *r, JournalFile *f) {
+        assert(r);
+        assert(f);
+
+        /* Move on with offlining the file, and sync it once more if it needs that */
+        if (journal_file_offline_synced(f) && sync_ring_queue(r, f) < 0)
+                sync_ring_hand_over(r, f);
+}
+
+static void sync_ring_complete(SyncRing *r, struct io_uring_cqe *cqe) {
+        SyncRequest *req;
+        JournalFile *f;
+        int res;
+
+        assert(r);
+        assert(cqe);
+
+        req = io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&r->ring, cqe);
+
+        assert(r->n_inflight > 0);
+        r->n_inflight--;
+
+        f = req->file;
+        sync_ring_account(r, req->begin);
+        free(req);
+
+        if (res < 0)
+                log_debug_errno(res, "Failed to sync %s, ignoring: %m", f->path);
+
+        sync_ring_continue(r, f);
+}
+
+static int on_ring_event(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        SyncRing *r = userdata;
+        struct io_uring_cqe *cqe;
+
+        assert(r);
+
+        while (io_uring_peek_cqe(&r->ring, &cqe) == 0)
+                sync_ring_complete(r, cqe);
+
+        return 0;
+}
+
+static int on_submit_event(sd_event_source *es, void *userdata) {
+        (void) sync_ring_submit(userdata);
+        return 0;
+}
+
+static int sync_ring_start_sync(JournalFile *f, void *userdata) {
+        return sync_ring_queue(userdata, f);
+}
+
+static int sync_ring_wait(JournalFile *f, void *userdata) {
+        SyncRing *r = userdata;
+        struct io_uring_cqe *cqe;
+        int k;
+
+        assert(f);
+        assert(r);
+
+        while (f->offline_async && f->offline_state != OFFLINE_DONE) {
+                (void) sync_ring_submit(r);
+
+                /* If the ring broke, sync_ring_submit() handed all files that were queued over to threads, and
+                 * nothing that is still in flight will ever complete */
+                if (!f->offline_async || f->offline_state == OFFLINE_DONE)
+                        break;
+                if (r->broken && r->n_inflight == 0)
+                        return -EIO;
+
+                k = io_uring_wait_cqe(&r->ring, &cqe);
+                if (k == -EINTR)
+                        continue;
+                if (k < 0)
+                        return log_error_errno(k, "Failed to wait for sync of %s: %m", f->path);
+
+                sync_ring_complete(r, cqe);
+        }
+
+        return 0;
+}
+
+static const JournalFileOfflineOps sync_ring_ops = {
+        .start_sync = sync_ring_start_sync,
+        .wait = sync_ring_wait,
+};
+
+int sync_ring_new(sd_event *e, SyncRing **ret) {
+        _cleanup_(sync_ring_freep) SyncRing *r = NULL;
+        int k;
+
+        assert(e);
+        assert(ret);
+
+        r = new0(SyncRing, 1);
+        if (!r)
+                return -ENOMEM;
+
+        r->ring.ring_fd = -1;
+
+        k = io_uring_queue_init(SYNC_RING_ENTRIES, &r->ring, 0);
+        if (k < 0) {
+                r->ring.ring_fd = -1;
+                return k;
+        }
+
+        k = sd_event_add_io(e, &r->io_event_source, r->ring.ring_fd, EPOLLIN, on_ring_event, r);
+        if (k < 0)
+                return k;
+
+        (void) sd_event_source_set_description(r->io_event_source, "sync-ring-io");
+
+        k = sd_event_add_defer(e, &r->submit_event_source, on_submit_event, r);
+        if (k < 0)
+                return k;
+
+        (void) sd_event_source_set_description(r->submit_event_source, "sync-ring-submit");
+
+        k = sd_event_source_set_enabled(r->submit_event_source, SD_EVENT_OFF);
+        if (k < 0)
+                return k;
+
+        *ret = TAKE_PTR(r);
+        return 0;
+}
+
+SyncRing* sync_ring_free(SyncRing *r) {
+        if (!r)
+                return NULL;
+
+        /* All files need to be closed first, which waits for their syncs to complete */
+        assert(r->n_inflight == 0 || r->broken);
+
+        sd_event_source_unref(r->io_event_source);
+        sd_event_source_unref(r->submit_event_source);
+
+        if (r->ring.ring_fd >= 0)
+                io_uring_queue_exit(&r->ring);
+
+        return mfree(r);
+}
+
+void sync_ring_attach(SyncRing *r, JournalFile *f) {
+        assert(f);
+
+        if (r)
+                journal_file_set_offline_ops(f, &sync_ring_ops, r);
+}
+
+#else
+
+int sync_ring_new(sd_event *e, SyncRing **ret) {
+        return -EOPNOTSUPP;
+}
+
+SyncRing* sync_ring_free(SyncRing *r) {
+        assert(!r);
+        return NULL;
+}
+
+void sync_ring_attach(SyncRing *r, JournalFile *f) {
+        assert(!r);
+}
+
+#endif
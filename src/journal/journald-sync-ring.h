@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include "sd-event.h"
+
+#include "journal-file.h"
+#include "macro.h"
+
+typedef struct SyncRing SyncRing;
+
+int sync_ring_new(sd_event *e, SyncRing **ret);
+SyncRing* sync_ring_free(SyncRing *r);
+DEFINE_TRIVIAL_CLEANUP_FUNC(SyncRing*, sync_ring_free);
+
+void sync_ring_attach(SyncRing *r, JournalFile *f);
@@ -42,6 +42,16 @@ struct Context {
         unsigned id;
         Window *window;
 
+        /* The last window this context had to map, to detect sequential access */
+        int last_fd;
+        uint64_t last_offset;
+        uint64_t last_size;
+
+        /* The size of the next window to map, grows while the context moves through a file sequentially */
+        uint64_t window_size;
+
+        MMapCacheContextStatistics statistics;
+
         LIST_FIELDS(Context, by_window);
 };
 
@@ -56,7 +66,7 @@ struct MMapCache {
         unsigned n_ref;
         unsigned n_windows;
 
-        unsigned n_hit, n_missed;
+        unsigned n_hit, n_missed, n_evicted;
 
         Hashmap *fds;
         Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
@@ -70,10 +80,17 @@ struct MMapCache {
 #if ENABLE_DEBUG_MMAP_CACHE
 /* Tiny windows increase mmap activity and the chance of exposing unsafe use. */
 # define WINDOW_SIZE (page_size())
+# define WHOLE_FILE_SIZE_MAX 0
 #else
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+/* Files up to this size are mapped in one window */
+# define WHOLE_FILE_SIZE_MAX (16ULL*1024ULL*1024ULL)
 #endif
 
+/* Windows of contexts that move through a file sequentially grow up to this size, but let's not waste the
+ * address space of 32bit archs on that */
+#define WINDOW_SIZE_MAX ((sizeof(void*) > 4 ? 8ULL : 2ULL) * WINDOW_SIZE)
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -171,6 +188,7 @@ static Window *window_add(MMapCache *m, MMapFileDescriptor *f, int prot, bool ke
                 w = m->last_unused;
                 window_unlink(w);
                 zero(*w);
+                m->n_evicted++;
         }
 
         w->cache = m;
@@ -250,6 +268,8 @@ static Context *context_add(MMapCache *m, unsigned id) {
 
         c->cache = m;
         c->id = id;
+        c->last_fd = -1;
+        c->window_size = WINDOW_SIZE;
 
         assert(!m->contexts[id]);
         m->contexts[id] = c;
@@ -296,6 +316,7 @@ static int make_room(MMapCache *m) {
                 return 0;
 
         window_free(m->last_unused);
+        m->n_evicted++;
         return 1;
 }
 
@@ -337,6 +358,7 @@ static int try_context(
         if (c->window->fd->sigbus)
                 return -EIO;
 
+        c->statistics.n_context_hit++;
         c->window->keep_always = c->window->keep_always || keep_always;
 
         *ret = (uint8_t*) c->window->ptr + (offset - c->window->offset);
@@ -381,6 +403,7 @@ static int find_mmap(
 
         context_attach_window(c, w);
         w->keep_always = w->keep_always || keep_always;
+        c->statistics.n_window_hit++;
 
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         if (ret_size)
@@ -429,6 +452,7 @@ static int add_mmap(
                 size_t *ret_size) {
 
         uint64_t woffset, wsize;
+        bool forward = false, backward = false;
         Context *c;
         Window *w;
         void *d;
@@ -440,21 +464,58 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
+
+        /* If this context needs a new window right after (or right before) the last one it mapped, it is
+         * scanning the file. Double the window size each time then, so that long scans need fewer mmap()
+         * calls, and fall back to the default as soon as the context jumps elsewhere. */
+        if (c->last_fd == f->fd) {
+                forward = offset >= c->last_offset &&
+                        offset + size > c->last_offset + c->last_size &&
+                        offset < c->last_offset + c->last_size + c->window_size;
+                backward = offset < c->last_offset &&
+                        offset + c->window_size >= c->last_offset;
+        }
+
+        if (forward || backward) {
+                c->window_size = MIN(c->window_size * 2, WINDOW_SIZE_MAX);
+                c->statistics.n_sequential++;
+        } else
+                c->window_size = WINDOW_SIZE;
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (st && st->st_size > 0 && (uint64_t) st->st_size <= WHOLE_FILE_SIZE_MAX) {
+                /* Small files are mapped as a whole, there's no point in splitting them up */
+                wsize = MAX(woffset + wsize, PAGE_ALIGN((uint64_t) st->st_size));
+                woffset = 0;
+
+        } else if (forward && wsize < c->window_size)
+                /* Place the window at the object, as we'll likely need what's after it next */
+                wsize = c->window_size;
+
+        else if (backward && wsize < c->window_size) {
+                /* Place the window so that it ends with the object, as we'll likely need what's before it next */
+                uint64_t end = woffset + wsize;
+
+                woffset = end > c->window_size ? end - c->window_size : 0;
+                wsize = end - woffset;
+
+        } else if (wsize < c->window_size) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                delta = PAGE_ALIGN((c->window_size - wsize) / 2);
 
                 if (delta > offset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = c->window_size;
         }
 
         if (st) {
@@ -473,9 +534,9 @@ static int add_mmap(
         if (r < 0)
                 return r;
 
-        c = context_add(m, context);
-        if (!c)
-                goto outofmem;
+        /* Have the kernel read in the rest of the window in the background while we look at the first object */
+        if (forward || backward)
+                (void) madvise(d, wsize, MADV_WILLNEED);
 
         w = window_add(m, f, prot, keep_always, woffset, wsize, d);
         if (!w)
@@ -483,6 +544,11 @@ static int add_mmap(
 
         context_attach_window(c, w);
 
+        c->last_fd = f->fd;
+        c->last_offset = woffset;
+        c->last_size = wsize;
+        c->statistics.n_missed++;
+
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         if (ret_size)
                 *ret_size = w->size - (offset - w->offset);
@@ -547,6 +613,31 @@ unsigned mmap_cache_get_missed(MMapCache *m) {
         return m->n_missed;
 }
 
+unsigned mmap_cache_get_evicted(MMapCache *m) {
+        assert(m);
+
+        return m->n_evicted;
+}
+
+void mmap_cache_get_context_statistics(MMapCache *m, unsigned context, MMapCacheContextStatistics *ret) {
+        Context *c;
+
+        assert(m);
+        assert(context < MMAP_CACHE_MAX_CONTEXTS);
+        assert(ret);
+
+        c = m->contexts[context];
+        if (!c) {
+                *ret = (MMapCacheContextStatistics) {
+                        .window_size = WINDOW_SIZE,
+                };
+                return;
+        }
+
+        *ret = c->statistics;
+        ret->window_size = c->window_size;
+}
+
 static void mmap_cache_process_sigbus(MMapCache *m) {
         bool found = false;
         MMapFileDescriptor *f;
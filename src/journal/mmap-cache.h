@@ -5,11 +5,19 @@
 #include <sys/stat.h>
 
 /* One context per object type, plus one of the header, plus one "additional" one */
-#define MMAP_CACHE_MAX_CONTEXTS 9
+#define MMAP_CACHE_MAX_CONTEXTS 10
 
 typedef struct MMapCache MMapCache;
 typedef struct MMapFileDescriptor MMapFileDescriptor;
 
+typedef struct MMapCacheContextStatistics {
+        unsigned n_context_hit;  /* served from the window the context was already looking at */
+        unsigned n_window_hit;   /* served from another window that was already mapped */
+        unsigned n_missed;       /* a new window had to be mapped */
+        unsigned n_sequential;   /* ... right next to the previous one, so the window size was increased */
+        uint64_t window_size;    /* the size of the next window the context will map */
+} MMapCacheContextStatistics;
+
 MMapCache* mmap_cache_new(void);
 MMapCache* mmap_cache_ref(MMapCache *m);
 MMapCache* mmap_cache_unref(MMapCache *m);
@@ -30,5 +38,7 @@ void mmap_cache_free_fd(MMapCache *m, MMapFileDescriptor *f);
 
 unsigned mmap_cache_get_hit(MMapCache *m);
 unsigned mmap_cache_get_missed(MMapCache *m);
+unsigned mmap_cache_get_evicted(MMapCache *m);
+void mmap_cache_get_context_statistics(MMapCache *m, unsigned context, MMapCacheContextStatistics *ret);
 
 bool mmap_cache_got_sigbus(MMapCache *m, MMapFileDescriptor *f);
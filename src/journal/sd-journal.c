@@ -48,6 +48,9 @@
 
 #define DEFAULT_DATA_THRESHOLD (64*1024)
 
+/* How many entry offsets to keep in memory for all files together at max (32 MiB) */
+#define POSTING_LISTS_BUDGET (4U*1024U*1024U)
+
 static void remove_file_real(sd_journal *j, JournalFile *f);
 
 static bool journal_pid_changed(sd_journal *j) {
@@ -109,6 +112,7 @@ static void detach_location(sd_journal *j) {
 
         j->current_file = NULL;
         j->current_field = 0;
+        j->merge_queue_valid = false;
 
         ORDERED_HASHMAP_FOREACH(f, j->files, i)
                 journal_file_reset_location(f);
@@ -734,6 +738,40 @@ static int next_with_matches(
                               direction, ret, offset);
 }
 
+static bool match_may_be_in_file(Match *m, JournalFile *f) {
+        Match *i;
+
+        assert(f);
+
+        /* Consults the Bloom filter of the file, if it has one, to rule out files that cannot possibly contain
+         * entries matching, without looking at their hash tables. Errors are treated as "maybe". */
+
+        if (!m)
+                return true;
+
+        if (m->type == MATCH_DISCRETE)
+                return journal_file_bloom_filter_test(f, le64toh(m->le_hash)) != 0;
+
+        if (!m->matches)
+                return true;
+
+        if (m->type == MATCH_OR_TERM) {
+                LIST_FOREACH(matches, i, m->matches)
+                        if (match_may_be_in_file(i, f))
+                                return true;
+
+                return false;
+        }
+
+        assert(m->type == MATCH_AND_TERM);
+
+        LIST_FOREACH(matches, i, m->matches)
+                if (!match_may_be_in_file(i, f))
+                        return false;
+
+        return true;
+}
+
 static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction) {
         Object *c;
         uint64_t cp, n_entries;
@@ -766,6 +804,9 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         } else {
                 f->last_direction = direction;
 
+                if (!match_may_be_in_file(j->level0, f))
+                        return 0;
+
                 r = find_location_with_matches(j, f, direction, &c, &cp);
                 if (r <= 0)
                         return r;
@@ -802,23 +843,62 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *new_file = NULL;
+static int compare_files_down(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) a, (JournalFile*) b);
+}
+
+static int compare_files_up(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) b, (JournalFile*) a);
+}
+
+static void merge_queue_drained(sd_journal *j, JournalFile *f, direction_t direction) {
+        assert(j);
+        assert(f);
+
+        f->location_type = LOCATION_TAIL;
+
+        /* Entries are only ever appended, hence a file that ran out going backwards stays that way, and so
+         * does an archived file. Other files are probed again on each step, so that entries appended to
+         * them are returned in order with the rest. */
+        if (direction == DIRECTION_UP || f->header->state == STATE_ARCHIVED)
+                return;
+
+        LIST_PREPEND(merge_drained, j->merge_drained, f);
+}
+
+static bool merge_queue_is_drained(sd_journal *j, JournalFile *f) {
+        assert(j);
+        assert(f);
+
+        return f->merge_drained_prev || j->merge_drained == f;
+}
+
+static int merge_queue_rebuild(sd_journal *j, direction_t direction) {
         unsigned i, n_files;
         const void **files;
-        Object *o;
         int r;
 
-        assert_return(j, -EINVAL);
-        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert(j);
+
+        /* Look at every file, and queue up those that have an entry beyond the current location */
+
+        j->merge_queue_valid = false;
+        j->merge_queue = prioq_free(j->merge_queue);
+        LIST_HEAD_INIT(j->merge_drained);
 
         r = iterated_cache_get(j->files_cache, NULL, &files, &n_files);
         if (r < 0)
                 return r;
 
+        j->merge_queue = prioq_new(direction == DIRECTION_DOWN ? compare_files_down : compare_files_up);
+        if (!j->merge_queue)
+                return -ENOMEM;
+
         for (i = 0; i < n_files; i++) {
                 JournalFile *f = (JournalFile *)files[i];
-                bool found;
+
+                f->merge_queue_idx = PRIOQ_IDX_NULL;
+                LIST_INIT(merge_drained, f);
 
                 r = next_beyond_location(j, f, direction);
                 if (r < 0) {
@@ -826,24 +906,95 @@ static int real_journal_next(sd_journal *j, direction_t direction) {
                         remove_file_real(j, f);
                         continue;
                 } else if (r == 0) {
-                        f->location_type = LOCATION_TAIL;
+                        merge_queue_drained(j, f, direction);
                         continue;
                 }
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                r = prioq_put(j->merge_queue, f, &f->merge_queue_idx);
+                if (r < 0)
+                        return r;
+        }
+
+        j->merge_direction = direction;
+        j->merge_invalidate_counter = j->current_invalidate_counter;
+        j->merge_queue_valid = true;
+
+        return 0;
+}
+
+static int merge_queue_advance(sd_journal *j, direction_t direction) {
+        JournalFile *f, *n;
+        int r;
+
+        assert(j);
+
+        /* The file we picked last time is at the top of the queue, together with any other files that contain
+         * the very same entry. Move them beyond the current location until the top of the queue is an entry we
+         * haven't returned yet. All other files stay where they are. */
 
-                        k = journal_file_compare_locations(f, new_file);
+        while ((f = prioq_peek(j->merge_queue))) {
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                r = next_beyond_location(j, f, direction);
+                if (r < 0) {
+                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                        remove_file_real(j, f);
+                        continue;
+                } else if (r == 0) {
+                        (void) prioq_remove(j->merge_queue, f, &f->merge_queue_idx);
+                        merge_queue_drained(j, f, direction);
+                        continue;
                 }
 
-                if (found)
-                        new_file = f;
+                (void) prioq_reshuffle(j->merge_queue, f, &f->merge_queue_idx);
+                if (prioq_peek(j->merge_queue) == f)
+                        break;
         }
 
+        /* Files that ran out before but got new entries since go back into the queue, now that everything
+         * in it is positioned beyond the current location again. This is cheap for the others,
+         * next_beyond_location() just compares the number of entries in their header. */
+        LIST_FOREACH_SAFE(merge_drained, f, n, j->merge_drained) {
+
+                r = next_beyond_location(j, f, direction);
+                if (r < 0) {
+                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                        remove_file_real(j, f);
+                        continue;
+                } else if (r == 0) {
+                        f->location_type = LOCATION_TAIL;
+                        continue;
+                }
+
+                LIST_REMOVE(merge_drained, j->merge_drained, f);
+
+                r = prioq_put(j->merge_queue, f, &f->merge_queue_idx);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *new_file;
+        Object *o;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+
+        if (j->merge_queue_valid &&
+            j->merge_direction == direction &&
+            j->merge_invalidate_counter == j->current_invalidate_counter &&
+            j->current_location.type == LOCATION_DISCRETE &&
+            !prioq_isempty(j->merge_queue))
+                r = merge_queue_advance(j, direction);
+        else
+                r = merge_queue_rebuild(j, direction);
+        if (r < 0)
+                return r;
+
+        new_file = prioq_peek(j->merge_queue);
         if (!new_file)
                 return 0;
 
@@ -1335,7 +1486,9 @@ static int add_any_file(
 
         close_fd = false; /* the fd is now owned by the JournalFile object */
 
+        f->merge_queue_idx = PRIOQ_IDX_NULL;
         f->last_seen_generation = j->generation;
+        f->posting_list_budget = &j->posting_list_budget;
 
         track_file_disposition(j, f);
         check_network(j, f->fd);
@@ -1405,6 +1558,9 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
         assert(f);
 
         (void) ordered_hashmap_remove(j->files, f->path);
+        (void) prioq_remove(j->merge_queue, f, &f->merge_queue_idx);
+        if (merge_queue_is_drained(j, f))
+                LIST_REMOVE(merge_drained, j->merge_drained, f);
 
         log_debug("File %s removed.", f->path);
 
@@ -1819,6 +1975,7 @@ static sd_journal *journal_new(int flags, const char *path) {
         j->inotify_fd = -1;
         j->flags = flags;
         j->data_threshold = DEFAULT_DATA_THRESHOLD;
+        j->posting_list_budget = POSTING_LISTS_BUDGET;
 
         if (path) {
                 char *t;
@@ -2060,6 +2217,7 @@ _public_ void sd_journal_close(sd_journal *j) {
 
         sd_journal_flush_matches(j);
 
+        prioq_free(j->merge_queue);
         ordered_hashmap_free_with_destructor(j->files, journal_file_close);
         iterated_cache_free(j->files_cache);
 
@@ -2224,7 +2382,7 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
                         r = decompress_startswith(compression,
                                                   o->data.payload, l,
                                                   &f->compress_buffer, &f->compress_buffer_size,
@@ -2288,7 +2446,7 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
 
         compression = o->object.flags & OBJECT_COMPRESSION_MASK;
         if (compression) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
                 size_t rsize;
                 int r;
 
@@ -2702,6 +2860,93 @@ _public_ int sd_journal_get_cutoff_monotonic_usec(sd_journal *j, sd_id128_t boot
         return found;
 }
 
+static int boot_compare_id(const void *_a, const void *_b) {
+        const JournalFileBoot *a = _a, *b = _b;
+
+        return memcmp(&a->boot_id, &b->boot_id, sizeof(sd_id128_t));
+}
+
+static int boot_compare_realtime(const void *_a, const void *_b) {
+        const JournalFileBoot *a = _a, *b = _b;
+        int r;
+
+        r = CMP(a->first_realtime, b->first_realtime);
+        if (r != 0)
+                return r;
+
+        return CMP(a->last_realtime, b->last_realtime);
+}
+
+int journal_get_boots(sd_journal *j, JournalFileBoot **ret, size_t *ret_n) {
+        _cleanup_free_ JournalFileBoot *boots = NULL;
+        size_t n_boots = 0, n_allocated = 0, k, l;
+        JournalFile *f;
+        Iterator i;
+        int r;
+
+        assert(j);
+        assert(ret);
+        assert(ret_n);
+
+        /* Returns all boots of all files, ordered by their first entry. */
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                const JournalFileBoot *b;
+                size_t n;
+
+                r = journal_file_get_boots(f, &b, &n);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to determine boots of %s, ignoring: %m", f->path);
+                        continue;
+                }
+
+                if (!GREEDY_REALLOC(boots, n_allocated, n_boots + n))
+                        return -ENOMEM;
+
+                memcpy_safe(boots + n_boots, b, n * sizeof(JournalFileBoot));
+                n_boots += n;
+        }
+
+        /* Merge the parts of each boot that ended up in different files */
+        qsort_safe(boots, n_boots, sizeof(JournalFileBoot), boot_compare_id);
+
+        for (k = 0, l = 0; k < n_boots; k++) {
+                JournalFileBoot *a = boots + l, *b = boots + k;
+
+                if (k == 0)
+                        continue;
+
+                if (!sd_id128_equal(a->boot_id, b->boot_id)) {
+                        boots[++l] = *b;
+                        continue;
+                }
+
+                a->n_entries += b->n_entries;
+
+                if (b->first_realtime < a->first_realtime) {
+                        a->first_seqnum = b->first_seqnum;
+                        a->first_realtime = b->first_realtime;
+                }
+                if (b->last_realtime > a->last_realtime) {
+                        a->last_seqnum = b->last_seqnum;
+                        a->last_realtime = b->last_realtime;
+                }
+
+                a->first_monotonic = MIN(a->first_monotonic, b->first_monotonic);
+                a->last_monotonic = MAX(a->last_monotonic, b->last_monotonic);
+        }
+
+        if (n_boots > 0)
+                n_boots = l + 1;
+
+        qsort_safe(boots, n_boots, sizeof(JournalFileBoot), boot_compare_realtime);
+
+        *ret = TAKE_PTR(boots);
+        *ret_n = n_boots;
+
+        return 0;
+}
+
 void journal_print_header(sd_journal *j) {
         Iterator i;
         JournalFile *f;
@@ -40,7 +40,7 @@ typedef int (decompress_sw_t)(const void *src, uint64_t src_size,
 typedef int (compress_stream_t)(int fdf, int fdt, uint64_t max_bytes);
 typedef int (decompress_stream_t)(int fdf, int fdt, uint64_t max_size);
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
 static void test_compress_decompress(int compression,
                                      compress_blob_t compress,
                                      decompress_blob_t decompress,
@@ -222,6 +222,143 @@ static void test_compress_stream(int compression,
 }
 #endif
 
+#if HAVE_LZ4 || HAVE_ZSTD
+static int append_callback(const void *data, size_t size, void *userdata) {
+        struct iovec *iov = userdata;
+
+        assert_se(iov->iov_base = realloc(iov->iov_base, iov->iov_len + size));
+        memcpy((uint8_t*) iov->iov_base + iov->iov_len, data, size);
+        iov->iov_len += size;
+
+        return 0;
+}
+
+static int append_and_stop_callback(const void *data, size_t size, void *userdata) {
+        assert_se(append_callback(data, size, userdata) == 0);
+
+        return 1;
+}
+
+static void test_compress_frame(int compression, const char *data, size_t data_len) {
+        _cleanup_free_ char *compressed = NULL, *doubled = NULL;
+        size_t compressed_len, chunk;
+        int r;
+
+        log_info("/* testing %s frame compression */", object_compressed_to_string(compression));
+
+        r = compress_frame(compression, data, data_len, (void**) &compressed, &compressed_len);
+        assert_se(r == 0);
+        log_info("compressed frame %zu → %zu", data_len, compressed_len);
+
+        /* Two concatenated frames, fed in pieces of varying size, must decompress to the data twice */
+        assert_se(doubled = malloc(compressed_len * 2));
+        memcpy(doubled, compressed, compressed_len);
+        memcpy(doubled + compressed_len, compressed, compressed_len);
+
+        for (chunk = 1; chunk <= compressed_len * 2; chunk = chunk * 3 + 1) {
+                _cleanup_(decompressor_freep) Decompressor *d = NULL;
+                struct iovec out = {};
+                size_t pos;
+
+                assert_se(decompressor_new(compression, &d) == 0);
+
+                for (pos = 0; pos < compressed_len * 2; pos += chunk)
+                        assert_se(decompressor_push(d, doubled + pos, MIN(chunk, compressed_len * 2 - pos),
+                                                    NULL, append_callback, &out) == 0);
+                assert_se(decompressor_finish(d) == 0);
+
+                assert_se(out.iov_len == data_len * 2);
+                assert_se(memcmp(out.iov_base, data, data_len) == 0);
+                assert_se(memcmp((uint8_t*) out.iov_base + data_len, data, data_len) == 0);
+                free(out.iov_base);
+        }
+
+        /* The callback may stop decompression after every piece, the rest of the input is pushed later, and what
+         * the decoder still holds is flushed by pushing nothing */
+        {
+                _cleanup_(decompressor_freep) Decompressor *d = NULL;
+                struct iovec out = {};
+                size_t pos = 0, consumed;
+                unsigned n = 0;
+
+                assert_se(decompressor_new(compression, &d) == 0);
+
+                for (;;) {
+                        r = decompressor_push(d, compressed + pos, compressed_len - pos, &consumed,
+                                              append_and_stop_callback, &out);
+                        assert_se(r >= 0);
+                        assert_se(consumed <= compressed_len - pos);
+                        pos += consumed;
+                        n++;
+
+                        if (r == 0)
+                                break;
+                }
+                assert_se(pos == compressed_len);
+                assert_se(decompressor_finish(d) == 0);
+
+                log_info("decompressed frame in %u steps", n);
+                assert_se(out.iov_len == data_len);
+                assert_se(memcmp(out.iov_base, data, data_len) == 0);
+                free(out.iov_base);
+        }
+
+        /* A truncated frame is noticed at the end */
+        {
+                _cleanup_(decompressor_freep) Decompressor *d = NULL;
+                struct iovec out = {};
+
+                assert_se(decompressor_new(compression, &d) == 0);
+                assert_se(decompressor_push(d, compressed, compressed_len - 1, NULL, append_callback, &out) == 0);
+                assert_se(decompressor_finish(d) == -EBADMSG);
+                free(out.iov_base);
+        }
+
+        /* Garbage is refused */
+        {
+                _cleanup_(decompressor_freep) Decompressor *d = NULL;
+                struct iovec out = {};
+
+                assert_se(decompressor_new(compression, &d) == 0);
+                assert_se(decompressor_push(d, data, data_len, NULL, append_callback, &out) < 0);
+                free(out.iov_base);
+        }
+}
+#endif
+
+#if HAVE_ZSTD
+static int zstd_frame_with_window(unsigned window_log, struct iovec *ret) {
+        _cleanup_(decompressor_freep) Decompressor *d = NULL;
+        const uint8_t frame[] = {
+                0x28, 0xb5, 0x2f, 0xfd,         /* Magic number */
+                0x00,                           /* No content size, not a single segment, no checksum */
+                (window_log - 10) << 3,         /* Window descriptor: exponent only */
+                0x09, 0x00, 0x00,               /* Last block, raw, 1 byte */
+                'x',
+        };
+
+        assert_se(decompressor_new(OBJECT_COMPRESSED_ZSTD, &d) == 0);
+        return decompressor_push(d, frame, sizeof(frame), NULL, append_callback, ret);
+}
+
+static void test_zstd_window_limit(void) {
+        struct iovec out = {};
+
+        log_info("/* %s */", __func__);
+
+        /* A frame may claim to need a window that is much larger than the frame itself, don't go along with
+         * that */
+        assert_se(zstd_frame_with_window(DECOMPRESSOR_ZSTD_WINDOW_LOG_MAX, &out) == 0);
+        assert_se(out.iov_len == 1 && ((char*) out.iov_base)[0] == 'x');
+        out.iov_base = mfree(out.iov_base);
+        out.iov_len = 0;
+
+        assert_se(zstd_frame_with_window(DECOMPRESSOR_ZSTD_WINDOW_LOG_MAX + 1, &out) == -EBADMSG);
+        assert_se(zstd_frame_with_window(27, &out) == -EBADMSG);
+        assert_se(out.iov_len == 0);
+}
+#endif
+
 #if HAVE_LZ4
 static void test_lz4_decompress_partial(void) {
         char buf[20000], buf2[100];
@@ -262,7 +399,7 @@ static void test_lz4_decompress_partial(void) {
 #endif
 
 int main(int argc, char *argv[]) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
         const char text[] =
                 "text\0foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF"
                 "foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF";
@@ -329,13 +466,44 @@ int main(int argc, char *argv[]) {
 
         test_decompress_startswith_short(OBJECT_COMPRESSED_LZ4, compress_blob_lz4, decompress_startswith_lz4);
 
+        test_compress_frame(OBJECT_COMPRESSED_LZ4, text, sizeof(text));
+        test_compress_frame(OBJECT_COMPRESSED_LZ4, huge, sizeof(huge));
+
 #else
         log_info("/* LZ4 test skipped */");
 #endif
 
+#if HAVE_ZSTD
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 text, sizeof(text), false);
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 data, sizeof(data), true);
+
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   text, sizeof(text), false);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   data, sizeof(data), true);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   huge, sizeof(huge), true);
+
+        test_compress_stream(OBJECT_COMPRESSED_ZSTD, "zstdcat",
+                             compress_stream_zstd, decompress_stream_zstd, srcfile);
+
+        test_decompress_startswith_short(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_startswith_zstd);
+
+        test_compress_frame(OBJECT_COMPRESSED_ZSTD, text, sizeof(text));
+        test_compress_frame(OBJECT_COMPRESSED_ZSTD, huge, sizeof(huge));
+        test_zstd_window_limit();
+#else
+        log_info("/* ZSTD test skipped */");
+#endif
+
         return 0;
 #else
-        log_info("/* XZ and LZ4 tests skipped */");
+        log_info("/* XZ, LZ4 and ZSTD tests skipped */");
         return EXIT_TEST_SKIP;
 #endif
 }
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "log.h"
+#include "parse-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "tests.h"
+#include "util.h"
+
+/* Compares writing entries one by one with writing them in batches, using entries that look like what
+ * journald writes for a chatty service: a varying MESSAGE= and a bunch of metadata fields that are the same
+ * for each entry. Then shows how the aggregate throughput scales with the number of writer threads, up to
+ * the number of CPUs. */
+
+#define N_FIELDS 8
+#define MAX_BATCH 256u
+#define MAX_THREADS 64u
+
+static usec_t arg_duration;
+
+static void make_entry(struct iovec iovec[N_FIELDS], char *message, size_t message_size, unsigned i) {
+        unsigned k = 0;
+
+        assert_se(snprintf(message, message_size, "MESSAGE=Processed request %u in %ums", i, i % 997) > 0);
+
+        iovec[k++] = IOVEC_MAKE_STRING(message);
+        iovec[k++] = IOVEC_MAKE_STRING("PRIORITY=6");
+        iovec[k++] = IOVEC_MAKE_STRING("SYSLOG_IDENTIFIER=benchmark");
+        iovec[k++] = IOVEC_MAKE_STRING("_TRANSPORT=stdout");
+        iovec[k++] = IOVEC_MAKE_STRING("_PID=4711");
+        iovec[k++] = IOVEC_MAKE_STRING("_COMM=benchmark");
+        iovec[k++] = IOVEC_MAKE_STRING("_SYSTEMD_UNIT=benchmark.service");
+        iovec[k++] = IOVEC_MAKE_STRING("_HOSTNAME=localhost");
+        assert_se(k == N_FIELDS);
+}
+
+static unsigned append_entries(const char *path, unsigned batch_size, usec_t *ret_elapsed) {
+        char messages[MAX_BATCH][64];
+        struct iovec iovec[MAX_BATCH][N_FIELDS];
+        JournalEntryBatchItem entries[MAX_BATCH];
+        JournalFile *f;
+        unsigned total = 0, i, n_appended;
+        usec_t n, n2;
+
+        assert_se(batch_size > 0 && batch_size <= MAX_BATCH);
+
+        assert_se(journal_file_open(-1, path, O_RDWR|O_CREAT, 0644, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        n = n2 = now(CLOCK_MONOTONIC);
+
+        while (n2 - n < arg_duration) {
+                for (i = 0; i < batch_size; i++) {
+                        make_entry(iovec[i], messages[i], sizeof(messages[i]), total + i);
+
+                        assert_se(dual_timestamp_get(&entries[i].ts));
+                        entries[i].iovec = iovec[i];
+                        entries[i].n_iovec = N_FIELDS;
+                }
+
+                if (batch_size == 1)
+                        assert_se(journal_file_append_entry(f, &entries[0].ts, NULL, iovec[0], N_FIELDS, NULL, NULL, NULL) == 0);
+                else {
+                        assert_se(journal_file_append_entries(f, entries, batch_size, NULL, NULL, &n_appended) == 0);
+                        assert_se(n_appended == batch_size);
+                }
+
+                total += batch_size;
+                n2 = now(CLOCK_MONOTONIC);
+        }
+
+        assert_se(le64toh(f->header->n_entries) == total);
+
+        (void) journal_file_close(f);
+
+        *ret_elapsed = n2 - n;
+        return total;
+}
+
+static void test_append(unsigned batch_size) {
+        char t[] = "/tmp/journal-append-XXXXXX";
+        unsigned total;
+        usec_t elapsed;
+        float dt;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        total = append_entries("test.journal", batch_size, &elapsed);
+        dt = elapsed / 1e6;
+
+        log_info("batch size %3u: appended %u entries in %.2fs (%.0f entries/s)",
+                 batch_size, total, dt, total / dt);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+typedef struct Writer {
+        char path[STRLEN("writer-") + DECIMAL_STR_MAX(unsigned) + STRLEN(".journal")];
+        unsigned batch_size;
+        unsigned total;
+        usec_t elapsed;
+} Writer;
+
+static void *writer_thread(void *p) {
+        Writer *w = p;
+
+        w->total = append_entries(w->path, w->batch_size, &w->elapsed);
+        return NULL;
+}
+
+static void test_append_threads(unsigned n_threads, unsigned batch_size) {
+        char t[] = "/tmp/journal-append-XXXXXX";
+        _cleanup_free_ Writer *writers = NULL;
+        _cleanup_free_ pthread_t *threads = NULL;
+        unsigned total = 0, i;
+        usec_t elapsed = 0;
+        float dt;
+
+        /* journald never appends to the same file from more than one thread, hence each writer gets a file of
+         * its own, the way each user or remote host gets its own journal file */
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(writers = new0(Writer, n_threads));
+        assert_se(threads = new(pthread_t, n_threads));
+
+        for (i = 0; i < n_threads; i++) {
+                xsprintf(writers[i].path, "writer-%u.journal", i);
+                writers[i].batch_size = batch_size;
+
+                assert_se(pthread_create(threads + i, NULL, writer_thread, writers + i) == 0);
+        }
+
+        for (i = 0; i < n_threads; i++) {
+                assert_se(pthread_join(threads[i], NULL) == 0);
+
+                total += writers[i].total;
+                elapsed = MAX(elapsed, writers[i].elapsed);
+        }
+
+        dt = elapsed / 1e6;
+
+        log_info("%2u writers, batch size %3u: appended %u entries in %.2fs (%.0f entries/s)",
+                 n_threads, batch_size, total, dt, total / dt);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        unsigned batch_size, n_threads;
+        long n_cpus;
+
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2) {
+                unsigned x;
+
+                assert_se(safe_atou(argv[1], &x) >= 0);
+                arg_duration = x * USEC_PER_SEC;
+        } else
+                arg_duration = slow_tests_enabled() ?
+                        2 * USEC_PER_SEC : USEC_PER_SEC / 50;
+
+        for (batch_size = 1; batch_size <= MAX_BATCH; batch_size *= 4)
+                test_append(batch_size);
+
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        assert_se(n_cpus > 0);
+
+        for (n_threads = 1; n_threads <= MIN((unsigned) n_cpus, MAX_THREADS); n_threads *= 2)
+                test_append_threads(n_threads, 64);
+
+        return 0;
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "compress.h"
+#include "io-util.h"
+#include "journal-columnar.h"
+#include "journal-file.h"
+#include "log.h"
+#include "macro.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "unaligned.h"
+
+#define N_ENTRIES 10
+#define BLOCK_ENTRIES 4
+
+static void make_journal(const char *dn) {
+        _cleanup_free_ char *fn = NULL;
+        JournalFile *f;
+        unsigned i;
+
+        fn = strappend(dn, "/test.journal");
+        assert_se(fn);
+
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                char message[STRLEN("MESSAGE=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[3];
+                dual_timestamp ts;
+
+                xsprintf(message, "MESSAGE=%u", i % 2);
+
+                iovec[0] = IOVEC_MAKE_STRING(message);
+                iovec[1] = IOVEC_MAKE_STRING("PRIORITY=6");
+                iovec[2] = IOVEC_MAKE_STRING("FOO=bar");
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+
+        (void) journal_file_close(f);
+}
+
+static const uint8_t *check_column(const uint8_t *p, unsigned n_entries) {
+        _cleanup_free_ void *buffer = NULL;
+        const ColumnarColumnHeader *h = (const ColumnarColumnHeader*) p;
+        size_t buffer_size = 0, size;
+        const uint8_t *payload;
+        const char *name;
+        unsigned i;
+
+        name = strndupa((const char*) p + sizeof(*h), le32toh(h->name_size));
+        payload = p + sizeof(*h) + le32toh(h->name_size);
+        size = le64toh(h->size);
+
+        log_debug("Column %s: type %u, compression %u, %" PRIu64 " bytes, %" PRIu64 " uncompressed",
+                 name, h->type, h->compression, le64toh(h->size), le64toh(h->uncompressed_size));
+
+        p = payload + size;
+
+        if (h->compression != 0) {
+                assert_se(decompress_blob(h->compression, payload, size, &buffer, &buffer_size, &size, 0) >= 0);
+                payload = buffer;
+        }
+
+        assert_se(size == le64toh(h->uncompressed_size));
+
+        switch (h->type) {
+
+        case COLUMNAR_U64:
+                assert_se(size == n_entries * sizeof(le64_t));
+                break;
+
+        case COLUMNAR_DICTIONARY: {
+                const uint8_t *q = payload;
+                uint32_t n_values;
+
+                n_values = unaligned_read_le32(q);
+                q += sizeof(le32_t);
+
+                for (i = 0; i < n_values; i++)
+                        q += sizeof(le32_t) + unaligned_read_le32(q);
+
+                assert_se((size_t) (q - payload) + n_entries * sizeof(le32_t) == size);
+
+                for (i = 0; i < n_entries; i++)
+                        assert_se(unaligned_read_le32(q + i * sizeof(le32_t)) <= n_values);
+
+                if (streq(name, "MESSAGE")) {
+                        assert_se(n_values == MIN(n_entries, 2u));
+
+                        /* The values alternate */
+                        for (i = 0; i < n_entries; i++)
+                                assert_se(unaligned_read_le32(q + i * sizeof(le32_t)) == i % 2 + 1);
+                }
+
+                if (streq(name, "PRIORITY"))
+                        assert_se(n_values == 1);
+
+                if (streq(name, "_PID")) {
+                        assert_se(n_values == 0);
+
+                        for (i = 0; i < n_entries; i++)
+                                assert_se(unaligned_read_le32(q + i * sizeof(le32_t)) == 0);
+                }
+
+                break;
+        }
+
+        case COLUMNAR_FIELDS: {
+                const uint8_t *q = payload;
+
+                for (i = 0; i < n_entries; i++) {
+                        uint32_t n_fields, l;
+
+                        n_fields = unaligned_read_le32(q);
+                        q += sizeof(le32_t);
+                        assert_se(n_fields == 1);
+
+                        l = unaligned_read_le32(q);
+                        q += sizeof(le32_t);
+                        assert_se(l == STRLEN("FOO=bar"));
+                        assert_se(memcmp(q, "FOO=bar", l) == 0);
+                        q += l;
+                }
+
+                assert_se((size_t) (q - payload) == size);
+                break;
+        }
+
+        default:
+                assert_not_reached("Unknown column type");
+        }
+
+        return p;
+}
+
+static void test_columnar(void) {
+        _cleanup_(columnar_writer_freep) ColumnarWriter *w = NULL;
+        char dn[] = "/var/tmp/test-journal-columnar.XXXXXX";
+        _cleanup_free_ char *buf = NULL;
+        unsigned n_blocks = 0, n_entries = 0, i;
+        sd_journal *j;
+        const uint8_t *p;
+        size_t size;
+        FILE *f;
+
+        assert_se(mkdtemp(dn));
+        make_journal(dn);
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+
+        assert_se(f = open_memstream(&buf, &size));
+        assert_se(columnar_writer_new(f, NULL, BLOCK_ENTRIES, &w) >= 0);
+
+        SD_JOURNAL_FOREACH(j)
+                assert_se(columnar_writer_add_entry(w, j) >= 0);
+
+        assert_se(columnar_writer_flush(w) >= 0);
+        assert_se(fclose(f) == 0);
+
+        sd_journal_close(j);
+
+        for (p = (const uint8_t*) buf; p < (const uint8_t*) buf + size; ) {
+                const ColumnarBlockHeader *h = (const ColumnarBlockHeader*) p;
+
+                assert_se(memcmp(h->signature, COLUMNAR_SIGNATURE, sizeof(h->signature)) == 0);
+                assert_se(le32toh(h->n_entries) == MIN(N_ENTRIES - n_entries, (unsigned) BLOCK_ENTRIES));
+
+                p += sizeof(*h);
+                for (i = 0; i < le32toh(h->n_columns); i++)
+                        p = check_column(p, le32toh(h->n_entries));
+
+                n_entries += le32toh(h->n_entries);
+                n_blocks++;
+        }
+
+        assert_se(p == (const uint8_t*) buf + size);
+        assert_se(n_entries == N_ENTRIES);
+        assert_se(n_blocks == DIV_ROUND_UP(N_ENTRIES, BLOCK_ENTRIES));
+
+        assert_se(rm_rf(dn, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        test_columnar();
+
+        return 0;
+}
@@ -11,6 +11,7 @@
 #include "log.h"
 #include "parse-util.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
 #include "util.h"
 #include "tests.h"
 
@@ -130,7 +131,26 @@ static void setup_interleaved(void) {
         test_close(two);
 }
 
-static void test_skip(void (*setup)(void)) {
+static void setup_many(void) {
+        JournalFile *files[16];
+        char name[sizeof("file-16.journal")];
+        unsigned i;
+
+        /* Spread the numbers over more files than there are numbers in any of them, in an order that is
+         * neither sequential nor round robin */
+        for (i = 0; i < ELEMENTSOF(files); i++) {
+                xsprintf(name, "file-%u.journal", i);
+                files[i] = test_open(name);
+        }
+
+        for (i = 0; i < 64; i++)
+                append_number(files[(i * 7 + i / 16) % ELEMENTSOF(files)], i + 1, NULL);
+
+        for (i = 0; i < ELEMENTSOF(files); i++)
+                test_close(files[i]);
+}
+
+static void test_skip(void (*setup)(void), int count) {
         char t[] = "/tmp/journal-skip-XXXXXX";
         sd_journal *j;
         int r;
@@ -145,7 +165,7 @@ static void test_skip(void (*setup)(void)) {
         assert_ret(sd_journal_open_directory(&j, t, 0));
         assert_ret(sd_journal_seek_head(j));
         assert_ret(sd_journal_next(j));
-        test_check_numbers_down(j, 4);
+        test_check_numbers_down(j, count);
         sd_journal_close(j);
 
         /* Seek to tail, iterate up.
@@ -153,26 +173,89 @@ static void test_skip(void (*setup)(void)) {
         assert_ret(sd_journal_open_directory(&j, t, 0));
         assert_ret(sd_journal_seek_tail(j));
         assert_ret(sd_journal_previous(j));
-        test_check_numbers_up(j, 4);
+        test_check_numbers_up(j, count);
         sd_journal_close(j);
 
         /* Seek to tail, skip to head, iterate down.
          */
         assert_ret(sd_journal_open_directory(&j, t, 0));
         assert_ret(sd_journal_seek_tail(j));
-        assert_ret(r = sd_journal_previous_skip(j, 4));
-        assert_se(r == 4);
-        test_check_numbers_down(j, 4);
+        assert_ret(r = sd_journal_previous_skip(j, count));
+        assert_se(r == count);
+        test_check_numbers_down(j, count);
         sd_journal_close(j);
 
         /* Seek to head, skip to tail, iterate up.
          */
         assert_ret(sd_journal_open_directory(&j, t, 0));
         assert_ret(sd_journal_seek_head(j));
-        assert_ret(r = sd_journal_next_skip(j, 4));
-        assert_se(r == 4);
-        test_check_numbers_up(j, 4);
+        assert_ret(r = sd_journal_next_skip(j, count));
+        assert_se(r == count);
+        test_check_numbers_up(j, count);
+        sd_journal_close(j);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL, true);
+
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_next_number(sd_journal *j, int n) {
+        int r;
+
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, n);
+}
+
+static void test_append_while_iterating(void) {
+        char t[] = "/tmp/journal-append-XXXXXX";
+        JournalFile *one, *two;
+        sd_journal *j;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        one = test_open("one.journal");
+        two = test_open("two.journal");
+        append_number(one, 1, NULL);
+        append_number(two, 2, NULL);
+        append_number(two, 3, NULL);
+
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+
+        test_next_number(j, 1);
+        test_next_number(j, 2);
+
+        /* One ran out of entries while two still has one. Now both grow, and what was appended to one has to
+         * come before what was appended to two. */
+        append_number(one, 4, NULL);
+        append_number(two, 5, NULL);
+
+        test_next_number(j, 3);
+        test_next_number(j, 4);
+        test_next_number(j, 5);
+        assert_se(sd_journal_next(j) == 0);
+
+        /* And the same once both ran out */
+        append_number(two, 6, NULL);
+        append_number(one, 7, NULL);
+
+        test_next_number(j, 6);
+        test_next_number(j, 7);
+        assert_se(sd_journal_next(j) == 0);
+
         sd_journal_close(j);
+        test_close(one);
+        test_close(two);
 
         log_info("Done...");
 
@@ -279,8 +362,11 @@ int main(int argc, char *argv[]) {
 
         arg_keep = argc > 1;
 
-        test_skip(setup_sequential);
-        test_skip(setup_interleaved);
+        test_skip(setup_sequential, 4);
+        test_skip(setup_interleaved, 4);
+        test_skip(setup_many, 64);
+
+        test_append_while_iterating();
 
         test_sequence_numbers();
 
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "json.h"
+#include "log.h"
+#include "logs-show.h"
+#include "macro.h"
+#include "output-mode.h"
+#include "parse-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+
+/* Checks that the JSON output modes produce the same output as formatting the entries with json_variant_dump(),
+ * and compares the speed of the direct formatting with the JsonVariant based one, which is still used for colored
+ * output. Both write uncolored output to /dev/null, through a stdio buffer as large as the one journalctl uses. */
+
+#define N_ENTRIES 1000U
+
+#define OUTPUT_BUFFER_SIZE (64U*1024U)
+
+static usec_t arg_duration;
+
+static const OutputMode json_modes[] = {
+        OUTPUT_JSON,
+        OUTPUT_JSON_PRETTY,
+        OUTPUT_JSON_SSE,
+        OUTPUT_JSON_SEQ,
+};
+
+static void make_journal(const char *dn) {
+        _cleanup_free_ char *fn = NULL;
+        JournalFile *f;
+        unsigned i;
+
+        fn = strappend(dn, "/test.journal");
+        assert_se(fn);
+
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                char message[STRLEN("MESSAGE=") + 64];
+                struct iovec iovec[9];
+                dual_timestamp ts;
+                unsigned k = 0;
+
+                if (i % 10 == 0)
+                        xsprintf(message, "MESSAGE=\"Quoted\" \\ /path/%u\nsecond line", i);
+                else if (i % 10 == 1)
+                        xsprintf(message, "MESSAGE=Tab\tseparated %u", i);
+                else
+                        xsprintf(message, "MESSAGE=Processed request %u in %ums", i, i % 997);
+
+                iovec[k++] = IOVEC_MAKE_STRING(message);
+                iovec[k++] = IOVEC_MAKE_STRING("PRIORITY=6");
+                iovec[k++] = IOVEC_MAKE_STRING("SYSLOG_IDENTIFIER=benchmark");
+                iovec[k++] = IOVEC_MAKE_STRING("_PID=4711");
+                iovec[k++] = IOVEC_MAKE_STRING("_COMM=benchmark");
+                iovec[k++] = IOVEC_MAKE_STRING("_SYSTEMD_UNIT=benchmark.service");
+                iovec[k++] = IOVEC_MAKE_STRING("_HOSTNAME=localhost");
+
+                if (i % 7 == 0) {
+                        /* A field with multiple values, one of which isn't UTF-8 */
+                        iovec[k++] = IOVEC_MAKE_STRING("FOO=bär");
+                        iovec[k++] = IOVEC_MAKE("FOO=\xff\x01", STRLEN("FOO=") + 2);
+                }
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, k, NULL, NULL, NULL) == 0);
+        }
+
+        (void) journal_file_close(f);
+}
+
+static unsigned json_format_flags(OutputMode mode) {
+        switch (mode) {
+
+        case OUTPUT_JSON_PRETTY:
+                return JSON_FORMAT_PRETTY;
+
+        case OUTPUT_JSON_SSE:
+                return JSON_FORMAT_SSE;
+
+        case OUTPUT_JSON_SEQ:
+                return JSON_FORMAT_SEQ;
+
+        default:
+                return JSON_FORMAT_NEWLINE;
+        }
+}
+
+static char *format_entry(sd_journal *j, OutputMode mode, OutputFlags flags) {
+        char *s = NULL;
+        size_t sz = 0;
+        FILE *f;
+
+        f = open_memstream(&s, &sz);
+        assert_se(f);
+
+        sd_journal_restart_data(j);
+        assert_se(show_journal_entry(f, j, mode, 0, flags, NULL, NULL, NULL) >= 0);
+        assert_se(fflush_and_check(f) >= 0);
+        fclose(f);
+
+        return s;
+}
+
+static void test_equivalence(const char *dn) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        unsigned n = 0, i;
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+
+        SD_JOURNAL_FOREACH(j) {
+                _cleanup_(json_variant_unrefp) JsonVariant *v = NULL;
+                _cleanup_free_ char *compact = NULL, *cursor = NULL;
+                JsonVariant *e;
+
+                compact = format_entry(j, OUTPUT_JSON, 0);
+                assert_se(json_parse(compact, &v, NULL, NULL) >= 0);
+
+                assert_se(sd_journal_get_cursor(j, &cursor) >= 0);
+                assert_se(e = json_variant_by_key(v, "__CURSOR"));
+                assert_se(streq(json_variant_string(e), cursor));
+
+                if (n % 7 == 0) {
+                        assert_se(e = json_variant_by_key(v, "FOO"));
+                        assert_se(json_variant_elements(e) == 2);
+                } else
+                        assert_se(!json_variant_by_key(v, "FOO"));
+
+                for (i = 0; i < ELEMENTSOF(json_modes); i++) {
+                        _cleanup_free_ char *s = NULL, *t = NULL;
+
+                        s = format_entry(j, json_modes[i], 0);
+                        assert_se(json_variant_format(v, json_format_flags(json_modes[i]), &t) >= 0);
+
+                        if (!streq(s, t)) {
+                                log_error("%s output differs:\n%s\nvs.\n%s", output_mode_to_string(json_modes[i]), s, t);
+                                assert_not_reached("Unexpected JSON output");
+                        }
+                }
+
+                n++;
+        }
+
+        assert_se(n == N_ENTRIES);
+        log_info("JSON output of %u entries matches json_variant_dump()", n);
+}
+
+static float benchmark(const char *dn, OutputMode mode, bool direct) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        unsigned total = 0;
+        usec_t n, n2;
+        float dt;
+
+        f = fopen("/dev/null", "we");
+        assert_se(f);
+        assert_se(setvbuf(f, NULL, _IOFBF, OUTPUT_BUFFER_SIZE) == 0);
+
+        assert_se(sd_journal_open_directory(&j, dn, 0) >= 0);
+
+        n = n2 = now(CLOCK_MONOTONIC);
+
+        while (n2 - n < arg_duration) {
+                SD_JOURNAL_FOREACH(j) {
+                        if (direct)
+                                assert_se(show_journal_entry(f, j, mode, 0, 0, NULL, NULL, NULL) >= 0);
+                        else
+                                assert_se(output_json_variant(f, j, mode, 0, NULL) >= 0);
+                        total++;
+                }
+
+                n2 = now(CLOCK_MONOTONIC);
+        }
+
+        assert_se(fflush_and_check(f) >= 0);
+
+        dt = (n2 - n) / 1e6;
+
+        log_info("%-11s %-11s: formatted %u entries in %.2fs (%.0f entries/s)",
+                 output_mode_to_string(mode), direct ? "direct" : "JsonVariant",
+                 total, dt, total / dt);
+
+        return total / dt;
+}
+
+static void test_benchmark(const char *dn, OutputMode mode) {
+        float direct, variant;
+
+        variant = benchmark(dn, mode, false);
+        direct = benchmark(dn, mode, true);
+
+        log_info("%-11s: direct formatting is %.1fx as fast", output_mode_to_string(mode), direct / variant);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-json-XXXXXX";
+        unsigned i;
+
+        test_setup_logging(LOG_INFO);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return log_tests_skipped("/etc/machine-id not found");
+
+        if (argc >= 2) {
+                unsigned x;
+
+                assert_se(safe_atou(argv[1], &x) >= 0);
+                arg_duration = x * USEC_PER_SEC;
+        } else
+                arg_duration = slow_tests_enabled() ?
+                        2 * USEC_PER_SEC : USEC_PER_SEC / 50;
+
+        assert_se(mkdtemp(t));
+        make_journal(t);
+
+        test_equivalence(t);
+
+        for (i = 0; i < ELEMENTSOF(json_modes); i++)
+                test_benchmark(t, json_modes[i]);
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return 0;
+}
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "journald-rate-limit.h"
+#include "macro.h"
+#include "string-util.h"
+
+static unsigned count_passed(JournalRateLimit *r, const char *id, unsigned burst, int priority, unsigned n) {
+        unsigned i, passed = 0;
+        int k;
+
+        for (i = 0; i < n; i++) {
+                k = journal_rate_limit_test(r, id, USEC_PER_HOUR, burst, priority, 0);
+                assert_se(k >= 0);
+                if (k > 0)
+                        passed++;
+        }
+
+        return passed;
+}
+
+static void test_unit(void) {
+        JournalRateLimit *r;
+
+        r = journal_rate_limit_new(0, 0);
+        assert_se(r);
+
+        /* Each unit and priority gets its own budget */
+        assert_se(count_passed(r, "/system.slice/a.service", 10, LOG_INFO, 20) == 10);
+        assert_se(count_passed(r, "/system.slice/a.service", 10, LOG_ERR, 20) == 10);
+        assert_se(count_passed(r, "/system.slice/b.service", 10, LOG_INFO, 20) == 10);
+        assert_se(count_passed(r, "c.service", 10, LOG_INFO, 20) == 10);
+
+        /* Cgroups below the unit share its budget */
+        assert_se(count_passed(r, "/system.slice/a.service/payload", 10, LOG_INFO, 20) == 0);
+
+        /* No limit */
+        assert_se(count_passed(r, "/system.slice/d.service", 0, LOG_INFO, 20) == 20);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_slice(void) {
+        JournalRateLimit *r;
+
+        r = journal_rate_limit_new(USEC_PER_HOUR, 15);
+        assert_se(r);
+
+        assert_se(count_passed(r, "/noisy.slice/a.service", 10, LOG_INFO, 20) == 10);
+        assert_se(count_passed(r, "/noisy.slice/b.service", 10, LOG_INFO, 20) == 5);
+        assert_se(count_passed(r, "/noisy.slice/inner.slice/c.service", 10, LOG_INFO, 20) == 0);
+
+        /* Other slices are not affected */
+        assert_se(count_passed(r, "/quiet.slice/a.service", 10, LOG_INFO, 20) == 10);
+        assert_se(count_passed(r, "/quiet.slice/inner.slice/b.service", 10, LOG_INFO, 20) == 5);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_dump(void) {
+        _cleanup_free_ char *buf = NULL;
+        JournalRateLimit *r;
+        size_t size;
+        FILE *f;
+
+        r = journal_rate_limit_new(USEC_PER_HOUR, 15);
+        assert_se(r);
+
+        assert_se(count_passed(r, "/noisy.slice/a.service", 10, LOG_INFO, 20) == 10);
+
+        assert_se(f = open_memstream(&buf, &size));
+        assert_se(journal_rate_limit_dump(r, f) >= 0);
+        fclose(f);
+
+        assert_se(streq(buf,
+                        "10 10 /noisy.slice\n"
+                        "10 10 /noisy.slice/a.service\n"));
+
+        journal_rate_limit_free(r);
+}
+
+static void test_no_limit(void) {
+        _cleanup_free_ char *buf = NULL;
+        JournalRateLimit *r;
+        size_t size;
+        FILE *f;
+
+        r = journal_rate_limit_new(0, 0);
+        assert_se(r);
+
+        /* Units without a limit are counted too, and don't expire right away */
+        assert_se(count_passed(r, "/system.slice/a.service", 0, LOG_INFO, 20) == 20);
+        assert_se(count_passed(r, "/system.slice/b.service", 10, LOG_INFO, 20) == 10);
+
+        assert_se(f = open_memstream(&buf, &size));
+        assert_se(journal_rate_limit_dump(r, f) >= 0);
+        fclose(f);
+
+        assert_se(streq(buf,
+                        "10 10 /system.slice/b.service\n"
+                        "20 0 /system.slice/a.service\n"));
+
+        journal_rate_limit_free(r);
+}
+
+static void test_report(void) {
+        JournalRateLimit *r;
+
+        /* Slice budgets are disabled, hence their interval must not delay reporting dropped messages */
+        r = journal_rate_limit_new(USEC_PER_HOUR, 0);
+        assert_se(r);
+
+        assert_se(journal_rate_limit_test(r, "/system.slice/a.service", 100 * USEC_PER_MSEC, 2, LOG_INFO, 0) == 1);
+        assert_se(journal_rate_limit_test(r, "/system.slice/a.service", 100 * USEC_PER_MSEC, 2, LOG_INFO, 0) == 1);
+        assert_se(journal_rate_limit_test(r, "/system.slice/a.service", 100 * USEC_PER_MSEC, 2, LOG_INFO, 0) == 0);
+
+        assert_se(usleep(150 * USEC_PER_MSEC) >= 0);
+
+        /* One message was dropped */
+        assert_se(journal_rate_limit_test(r, "/system.slice/a.service", 100 * USEC_PER_MSEC, 2, LOG_INFO, 0) == 2);
+
+        journal_rate_limit_free(r);
+}
+
+int main(int argc, char *argv[]) {
+        test_unit();
+        test_slice();
+        test_dump();
+        test_no_limit();
+        test_report();
+
+        return 0;
+}
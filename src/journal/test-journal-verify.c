@@ -4,17 +4,23 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include "alloc-util.h"
 #include "fd-util.h"
+#include "io-util.h"
 #include "journal-file.h"
 #include "journal-verify.h"
 #include "log.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
 #include "terminal-util.h"
 #include "tests.h"
 #include "util.h"
 
 #define N_ENTRIES 6000
 #define RANDOM_RANGE 77
+#define N_PARALLEL_FILES 4
+#define CORRUPT_FILE 2
 
 static void bit_toggle(const char *fn, uint64_t p) {
         uint8_t b;
@@ -43,12 +49,89 @@ static int raw_verify(const char *fn, const char *verification_key) {
         if (r < 0)
                 return r;
 
-        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, false);
+        r = journal_file_verify(f, verification_key, NULL, NULL, NULL, 0);
         (void) journal_file_close(f);
 
         return r;
 }
 
+static int parallel_report(JournalFile *f, int result, usec_t first, usec_t validated, usec_t last, void *userdata) {
+        unsigned *reported = userdata;
+        unsigned i;
+
+        assert_se(sscanf(f->path, "parallel-%u.journal", &i) == 1);
+        assert_se(i < N_PARALLEL_FILES);
+
+        log_info("%s: %s", f->path, result < 0 ? strerror(-result) : "PASS");
+
+        /* Only the file we corrupted may fail */
+        assert_se((result < 0) == (i == CORRUPT_FILE));
+
+        reported[i]++;
+        return result;
+}
+
+static void test_parallel(void) {
+        JournalFile *files[N_PARALLEL_FILES] = {};
+        unsigned reported[N_PARALLEL_FILES] = {};
+        uint64_t corrupt_offset = 0;
+        unsigned i, n;
+
+        log_info("Verifying in parallel...");
+
+        for (i = 0; i < N_PARALLEL_FILES; i++) {
+                _cleanup_free_ char *fn = NULL;
+                JournalFile *f;
+
+                assert_se(asprintf(&fn, "parallel-%u.journal", i) >= 0);
+                assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+                for (n = 0; n < N_ENTRIES / 10; n++) {
+                        char test[STRLEN("RANDOM=") + DECIMAL_STR_MAX(long)];
+                        struct dual_timestamp ts;
+                        struct iovec iovec;
+                        uint64_t offset;
+
+                        dual_timestamp_get(&ts);
+                        xsprintf(test, "RANDOM=%lu", random() % RANDOM_RANGE);
+                        iovec = IOVEC_MAKE_STRING(test);
+
+                        assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, &offset) == 0);
+
+                        if (i == CORRUPT_FILE && n == N_ENTRIES / 20)
+                                corrupt_offset = offset;
+                }
+
+                (void) journal_file_close(f);
+        }
+
+        /* Give one entry in the middle of one file an invalid object type */
+        assert_se(corrupt_offset > 0);
+        {
+                _cleanup_close_ int fd = -1;
+                uint8_t b = 0xFF;
+
+                fd = open("parallel-" STRINGIFY(CORRUPT_FILE) ".journal", O_RDWR|O_CLOEXEC);
+                assert_se(fd >= 0);
+                assert_se(pwrite(fd, &b, 1, corrupt_offset + offsetof(ObjectHeader, type)) == 1);
+        }
+
+        for (i = 0; i < N_PARALLEL_FILES; i++) {
+                _cleanup_free_ char *fn = NULL;
+
+                assert_se(asprintf(&fn, "parallel-%u.journal", i) >= 0);
+                assert_se(journal_file_open(-1, fn, O_RDONLY, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, files + i) == 0);
+        }
+
+        assert_se(journal_files_verify_parallel(files, N_PARALLEL_FILES, NULL, 2, parallel_report, reported) < 0);
+
+        /* Every file is verified and reported exactly once, including the ones after the corrupt one */
+        for (i = 0; i < N_PARALLEL_FILES; i++) {
+                assert_se(reported[i] == 1);
+                (void) journal_file_close(files[i]);
+        }
+}
+
 int main(int argc, char *argv[]) {
         char t[] = "/tmp/journal-XXXXXX";
         unsigned n;
@@ -99,7 +182,7 @@ int main(int argc, char *argv[]) {
         /* journal_file_print_header(f); */
         journal_file_dump(f);
 
-        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, true) >= 0);
+        assert_se(journal_file_verify(f, verification_key, &from, &to, &total, JOURNAL_VERIFY_SHOW_PROGRESS) >= 0);
 
         if (verification_key && JOURNAL_HEADER_SEALED(f->header))
                 log_info("=> Validated from %s to %s, %s missing",
@@ -126,6 +209,8 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        test_parallel();
+
         log_info("Exiting...");
 
         assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
@@ -1,13 +1,26 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 
+#include "sd-event.h"
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fs-util.h"
+#include "io-util.h"
 #include "journal-authenticate.h"
 #include "journal-file.h"
+#include "journal-verify.h"
 #include "journal-vacuum.h"
 #include "log.h"
+#include "lookup3.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
+#include "strv.h"
 #include "tests.h"
 
 static bool arg_keep = false;
@@ -109,6 +122,571 @@ static void test_non_empty(void) {
         puts("------------------------------------------------------------");
 }
 
+static void test_append_entries(void) {
+        JournalEntryBatchItem entries[3];
+        struct iovec iovec[3][2];
+        static const char common[] = "COMMON=foo", a[] = "TEST=a", b[] = "TEST=b";
+        JournalFile *f;
+        Object *o;
+        uint64_t p, seqnum = 0;
+        unsigned n_appended, i;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                iovec[i][0] = IOVEC_MAKE_STRING(common);
+                iovec[i][1] = i == 1 ? IOVEC_MAKE_STRING(b) : IOVEC_MAKE_STRING(a);
+
+                assert_se(dual_timestamp_get(&entries[i].ts));
+                entries[i].iovec = iovec[i];
+                entries[i].n_iovec = 2;
+        }
+
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), NULL, &seqnum, &n_appended) == 0);
+        assert_se(n_appended == ELEMENTSOF(entries));
+        assert_se(seqnum == 3);
+        assert_se(le64toh(f->header->n_entries) == 3);
+
+        /* The payloads shared by the batch must have been stored only once */
+        assert_se(le64toh(f->header->n_data) == 3);
+
+        assert_se(journal_file_find_data_object(f, common, strlen(common), &o, NULL) == 1);
+        assert_se(le64toh(o->data.n_entries) == 3);
+        assert_se(journal_file_find_data_object(f, a, strlen(a), &o, NULL) == 1);
+        assert_se(le64toh(o->data.n_entries) == 2);
+
+        assert_se(journal_file_find_data_object(f, b, strlen(b), NULL, &p) == 1);
+        assert_se(journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 2);
+
+        /* An invalid timestamp refuses the whole batch */
+        entries[2].ts.realtime = 0;
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), NULL, &seqnum, &n_appended) == -EBADMSG);
+        assert_se(n_appended == 0);
+        assert_se(le64toh(f->header->n_entries) == 3);
+
+        (void) journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void expect_next_for_data(JournalFile *f, uint64_t dp, const uint64_t *all, bool (*matches)(unsigned), unsigned n, uint64_t p, direction_t direction) {
+        uint64_t expected = 0, q;
+        unsigned i;
+        int r;
+
+        for (i = 0; i < n; i++) {
+                if (!matches(i))
+                        continue;
+
+                if (direction == DIRECTION_DOWN && all[i] >= p) {
+                        expected = all[i];
+                        break;
+                }
+                if (direction == DIRECTION_UP && all[i] <= p)
+                        expected = all[i];
+        }
+
+        r = journal_file_move_to_entry_by_offset_for_data(f, dp, p, direction, NULL, &q);
+        assert_se(r >= 0);
+        assert_se(expected == 0 ? r == 0 : (r == 1 && q == expected));
+}
+
+static bool is_even(unsigned i) {
+        return i % 2 == 0;
+}
+
+static bool is_third(unsigned i) {
+        return i % 3 == 0;
+}
+
+static void test_archived_posting_lists(void) {
+        static const char even[] = "EVEN=1", third[] = "THIRD=1";
+        _cleanup_free_ char *archived = NULL;
+        uint64_t offsets[300], dp_even, dp_third, budget;
+        char t[] = "/tmp/journal-XXXXXX";
+        JournalFile *f;
+        Object *o;
+        unsigned i;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < ELEMENTSOF(offsets); i++) {
+                struct iovec iovec[3];
+                char n[DECIMAL_STR_MAX(unsigned) + 3];
+                unsigned k = 0;
+                dual_timestamp ts;
+
+                xsprintf(n, "N=%u", i);
+                iovec[k++] = IOVEC_MAKE_STRING(n);
+                if (is_even(i))
+                        iovec[k++] = IOVEC_MAKE_STRING(even);
+                if (is_third(i))
+                        iovec[k++] = IOVEC_MAKE_STRING(third);
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, k, NULL, NULL, &offsets[i]) == 0);
+        }
+
+        assert_se(journal_file_archive(f) == 0);
+        assert_se(archived = strdup(f->path));
+        (void) journal_file_close(f);
+
+        /* Archived files opened for reading look up entries of a DATA object in its flattened entry array */
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->header->state == STATE_ARCHIVED);
+
+        assert_se(journal_file_find_data_object(f, even, strlen(even), NULL, &dp_even) == 1);
+        assert_se(journal_file_find_data_object(f, third, strlen(third), NULL, &dp_third) == 1);
+
+        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), 0, DIRECTION_DOWN);
+        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), 0, DIRECTION_UP);
+        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), (uint64_t) -1, DIRECTION_DOWN);
+        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), (uint64_t) -1, DIRECTION_UP);
+
+        for (i = 0; i < ELEMENTSOF(offsets); i++) {
+                direction_t d;
+
+                for (d = DIRECTION_UP; d <= DIRECTION_DOWN; d++) {
+                        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), offsets[i], d);
+                        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), offsets[i] + 1, d);
+                        expect_next_for_data(f, dp_third, offsets, is_third, ELEMENTSOF(offsets), offsets[i], d);
+                        expect_next_for_data(f, dp_third, offsets, is_third, ELEMENTSOF(offsets), offsets[i] + 1, d);
+                }
+        }
+
+        assert_se(hashmap_size(f->posting_lists) == 2);
+        assert_se(f->n_posting_list_entries == 150 + 100);
+
+        assert_se(journal_file_move_to_entry_by_offset_for_data(f, dp_third, offsets[4], DIRECTION_DOWN, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 7);
+
+        (void) journal_file_close(f);
+
+        /* With a shared budget that only covers one of the two lists, the other one is bisected on disk */
+        budget = 120;
+
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        f->posting_list_budget = &budget;
+
+        for (i = 0; i < ELEMENTSOF(offsets); i++) {
+                direction_t d;
+
+                for (d = DIRECTION_UP; d <= DIRECTION_DOWN; d++) {
+                        expect_next_for_data(f, dp_third, offsets, is_third, ELEMENTSOF(offsets), offsets[i], d);
+                        expect_next_for_data(f, dp_even, offsets, is_even, ELEMENTSOF(offsets), offsets[i], d);
+                }
+        }
+
+        assert_se(hashmap_size(f->posting_lists) == 1);
+        assert_se(f->n_posting_list_entries == 100);
+        assert_se(budget == 20);
+
+        (void) journal_file_close(f);
+        assert_se(budget == 120);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_bloom_filter(void) {
+        _cleanup_free_ char *archived = NULL;
+        char t[] = "/tmp/journal-XXXXXX", n[DECIMAL_STR_MAX(unsigned) + 7];
+        unsigned i, absent = 0, found = 0;
+        sd_journal *j;
+        JournalFile *f;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 200; i++) {
+                struct iovec iovec;
+                dual_timestamp ts;
+
+                xsprintf(n, "N=%u", i);
+                iovec = IOVEC_MAKE_STRING(n);
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* Files that are still online have no filter, and everything might be in them */
+        assert_se(!JOURNAL_HEADER_BLOOM_FILTER(f->header));
+        assert_se(journal_file_bloom_filter_test(f, hash64("NOPE=1", 6)) == 1);
+
+        assert_se(journal_file_archive(f) == 0);
+        assert_se(archived = strdup(f->path));
+
+        /* Only room for the filter is made when archiving, it is filled in when the file goes offline */
+        assert_se(f->header->bloom_filter_offset != 0);
+        assert_se(!JOURNAL_HEADER_BLOOM_FILTER(f->header));
+        assert_se(journal_file_set_offline(f, false) >= 0);
+        (void) journal_file_close(f);
+
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->header->state == STATE_ARCHIVED);
+        assert_se(JOURNAL_HEADER_BLOOM_FILTER(f->header));
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, JOURNAL_VERIFY_SHOW_PROGRESS) == 0);
+
+        for (i = 0; i < 200; i++) {
+                xsprintf(n, "N=%u", i);
+                assert_se(journal_file_bloom_filter_test(f, hash64(n, strlen(n))) == 1);
+        }
+
+        for (i = 0; i < 1000; i++) {
+                xsprintf(n, "NOPE=%u", i);
+                if (journal_file_bloom_filter_test(f, hash64(n, strlen(n))) == 0)
+                        absent++;
+        }
+
+        log_info("Bloom filter ruled out %u of 1000 absent items", absent);
+        assert_se(absent >= 950);
+
+        /* Find something that the filter rules out for the match test below */
+        for (i = 0;; i++) {
+                xsprintf(n, "NOPE=%u", i);
+                if (journal_file_bloom_filter_test(f, hash64(n, strlen(n))) == 0)
+                        break;
+        }
+
+        (void) journal_file_close(f);
+
+        assert_se(sd_journal_open_files(&j, (const char**) STRV_MAKE(archived), 0) >= 0);
+
+        assert_se(sd_journal_add_match(j, n, 0) >= 0);
+        assert_se(sd_journal_next(j) == 0);
+
+        assert_se(sd_journal_add_disjunction(j) >= 0);
+        assert_se(sd_journal_add_match(j, "N=42", 0) >= 0);
+        SD_JOURNAL_FOREACH(j) {
+                const void *d;
+                size_t l;
+
+                assert_se(sd_journal_get_data(j, "N", &d, &l) >= 0);
+                assert_se(l == 4 && memcmp(d, "N=42", l) == 0);
+                found++;
+        }
+        assert_se(found == 1);
+
+        sd_journal_close(j);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+#define POST_CHANGE_PERIOD_USEC (200 * USEC_PER_MSEC)
+
+typedef struct PostChangeTest {
+        JournalFile *file;
+        int inotify_fd;
+        unsigned n_written;
+} PostChangeTest;
+
+static void append_post_change_entry(JournalFile *f, unsigned i) {
+        char n[DECIMAL_STR_MAX(unsigned) + 2];
+        struct iovec iovec;
+        dual_timestamp ts;
+
+        xsprintf(n, "N=%u", i);
+        iovec = IOVEC_MAKE_STRING(n);
+
+        assert_se(dual_timestamp_get(&ts));
+        assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+}
+
+static bool flush_modified(int fd) {
+        struct pollfd pollfd = {
+                .fd = fd,
+                .events = POLLIN,
+        };
+        bool modified = false;
+
+        /* Returns whether an inotify event is pending right now, without waiting for one */
+
+        while (poll(&pollfd, 1, 0) > 0) {
+                union inotify_event_buffer buffer;
+
+                assert_se(read(fd, &buffer, sizeof(buffer)) > 0);
+                modified = true;
+        }
+
+        return modified;
+}
+
+static int post_change_idle_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        PostChangeTest *t = userdata;
+
+        /* Nothing was written for more than a period, hence this entry must be noticed right away, and not only
+         * when the timer elapses */
+        assert_se(!flush_modified(t->inotify_fd));
+        append_post_change_entry(t->file, t->n_written++);
+        assert_se(flush_modified(t->inotify_fd));
+        assert_se(sd_event_source_get_enabled(t->file->post_change_timer, NULL) == 0);
+
+        return sd_event_exit(sd_event_source_get_event(s), 0);
+}
+
+static void test_post_change(void) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *idle = NULL;
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        _cleanup_close_ int fd = -1;
+        char t[] = "/tmp/journal-XXXXXX";
+        PostChangeTest test = {};
+        uint64_t last, usec;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &test.file) == 0);
+        assert_se(journal_file_enable_post_change_timer(test.file, e, POST_CHANGE_PERIOD_USEC) >= 0);
+
+        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(inotify_add_watch(fd, "test.journal", IN_MODIFY) >= 0);
+        test.inotify_fd = fd;
+
+        /* The first change is posted immediately */
+        append_post_change_entry(test.file, test.n_written++);
+        assert_se(flush_modified(fd));
+        last = test.file->post_change_last;
+        assert_se(last > 0);
+
+        /* The next one within the same period is delayed until its end */
+        append_post_change_entry(test.file, test.n_written++);
+        assert_se(!flush_modified(fd));
+        assert_se(sd_event_source_get_enabled(test.file->post_change_timer, NULL) > 0);
+        assert_se(sd_event_source_get_time(test.file->post_change_timer, &usec) >= 0);
+        assert_se(usec == last + POST_CHANGE_PERIOD_USEC);
+
+        assert_se(sd_event_run(e, (uint64_t) -1) > 0);
+        assert_se(flush_modified(fd));
+        assert_se(test.file->post_change_last >= usec);
+
+        /* Stay idle for more than a period, and then write from within the event loop, as journald does */
+        assert_se(sd_event_add_time(e, &idle, CLOCK_MONOTONIC,
+                                    usec_add(test.file->post_change_last, 2 * POST_CHANGE_PERIOD_USEC), 0,
+                                    post_change_idle_handler, &test) >= 0);
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(test.n_written == 3);
+
+        (void) journal_file_close(test.file);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void append_boot_entry(JournalFile *f, sd_id128_t boot_id, uint64_t monotonic) {
+        char t[STRLEN("_BOOT_ID=") + SD_ID128_STRING_MAX] = "_BOOT_ID=";
+        struct iovec iovec;
+        dual_timestamp ts;
+
+        sd_id128_to_string(boot_id, t + STRLEN("_BOOT_ID="));
+        iovec = IOVEC_MAKE_STRING(t);
+
+        assert_se(dual_timestamp_get(&ts));
+        ts.monotonic = monotonic;
+        assert_se(journal_file_append_entry(f, &ts, &boot_id, &iovec, 1, NULL, NULL, NULL) == 0);
+}
+
+static void check_boot(const JournalFileBoot *b, sd_id128_t boot_id, uint64_t n_entries, uint64_t first_seqnum, uint64_t last_seqnum, uint64_t first_monotonic, uint64_t last_monotonic) {
+        assert_se(sd_id128_equal(b->boot_id, boot_id));
+        assert_se(b->n_entries == n_entries);
+        assert_se(b->first_seqnum == first_seqnum);
+        assert_se(b->last_seqnum == last_seqnum);
+        assert_se(b->first_monotonic == first_monotonic);
+        assert_se(b->last_monotonic == last_monotonic);
+        assert_se(b->first_realtime <= b->last_realtime);
+}
+
+static void test_boots(void) {
+        _cleanup_free_ char *archived = NULL;
+        const JournalFileBoot *boots;
+        char t[] = "/tmp/journal-XXXXXX";
+        sd_id128_t a, b;
+        JournalFile *f;
+        usec_t from, to;
+        size_t n;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(sd_id128_randomize(&a) == 0);
+        assert_se(sd_id128_randomize(&b) == 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        assert_se(journal_file_get_boots(f, &boots, &n) == 0);
+        assert_se(n == 0);
+
+        append_boot_entry(f, a, 10);
+        append_boot_entry(f, a, 20);
+        append_boot_entry(f, a, 30);
+        append_boot_entry(f, b, 5);
+        append_boot_entry(f, b, 15);
+
+        assert_se(journal_file_get_boots(f, &boots, &n) == 0);
+        assert_se(n == 2);
+        assert_se(!f->boots_cached);
+
+        /* Boots are listed in the order their _BOOT_ID= data objects were linked to the field, newest first */
+        check_boot(&boots[0], b, 2, 4, 5, 5, 15);
+        check_boot(&boots[1], a, 3, 1, 3, 10, 30);
+
+        assert_se(journal_file_archive(f) == 0);
+        assert_se(archived = strdup(f->path));
+        (void) journal_file_close(f);
+
+        /* For archived files the summary is calculated once and also used for cutoff queries */
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        assert_se(journal_file_get_boots(f, &boots, &n) == 0);
+        assert_se(n == 2);
+        assert_se(f->boots_cached);
+        check_boot(&boots[1], a, 3, 1, 3, 10, 30);
+
+        assert_se(journal_file_get_cutoff_monotonic_usec(f, a, &from, &to) == 1);
+        assert_se(from == 10 && to == 30);
+        assert_se(journal_file_get_cutoff_monotonic_usec(f, SD_ID128_NULL, &from, &to) == 0);
+
+        (void) journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_compact(void) {
+        static const char even[] = "EVEN=1", same[] = "SAME=1";
+        _cleanup_free_ char *archived = NULL;
+        char t[] = "/tmp/journal-XXXXXX";
+        sd_id128_t seqnum_id;
+        uint64_t p = 0, size, n_data;
+        JournalFile *f;
+        Object *o;
+        unsigned i;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 300; i++) {
+                struct iovec iovec[3];
+                char n[DECIMAL_STR_MAX(unsigned) + 3];
+                unsigned k = 0;
+                dual_timestamp ts;
+
+                xsprintf(n, "N=%u", i);
+                iovec[k++] = IOVEC_MAKE_STRING(n);
+                iovec[k++] = IOVEC_MAKE_STRING(same);
+                if (is_even(i))
+                        iovec[k++] = IOVEC_MAKE_STRING(even);
+
+                assert_se(dual_timestamp_get(&ts));
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, k, NULL, NULL, NULL) == 0);
+        }
+
+        /* Only archived files are compacted */
+        assert_se(journal_file_compact(f, NULL, NULL) == -EBUSY);
+
+        assert_se(journal_file_archive(f) == 0);
+        assert_se(archived = strdup(f->path));
+        (void) journal_file_close(f);
+
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        seqnum_id = f->header->seqnum_id;
+        n_data = le64toh(f->header->n_data);
+        assert_se(journal_file_compact(f, NULL, &size) == 0);
+        assert_se(size > 0);
+        (void) journal_file_close(f);
+
+        assert_se(journal_file_open(-1, archived, O_RDONLY, 0, false, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        journal_file_print_header(f);
+
+        assert_se(f->header->state == STATE_ARCHIVED);
+        assert_se(sd_id128_equal(f->header->seqnum_id, seqnum_id));
+        assert_se(le64toh(f->header->n_entries) == 300);
+        assert_se(le64toh(f->header->n_data) == n_data);
+        assert_se(le64toh(f->header->data_hash_table_size) == DIV_ROUND_UP(n_data * 4, 3) * sizeof(HashItem));
+
+        /* One array for all entries, and one each for EVEN=1 and SAME=1 */
+        assert_se(le64toh(f->header->n_entry_arrays) == 3);
+
+        for (i = 0; i < 300; i++) {
+                char n[DECIMAL_STR_MAX(unsigned) + 3];
+                uint64_t q;
+
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                assert_se(le64toh(o->entry.seqnum) == i + 1);
+
+                xsprintf(n, "N=%u", i);
+                assert_se(journal_file_find_data_object(f, n, strlen(n), &o, &q) == 1);
+                assert_se(le64toh(o->data.n_entries) == 1);
+                assert_se(le64toh(o->data.entry_offset) == p);
+        }
+
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        assert_se(journal_file_find_data_object(f, even, strlen(even), &o, NULL) == 1);
+        assert_se(le64toh(o->data.n_entries) == 150);
+        assert_se(journal_file_find_data_object(f, same, strlen(same), &o, NULL) == 1);
+        assert_se(le64toh(o->data.n_entries) == 300);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, JOURNAL_VERIFY_SHOW_PROGRESS) >= 0);
+
+        (void) journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 static void test_empty(void) {
         JournalFile *f1, *f2, *f3, *f4;
         char t[] = "/tmp/journal-XXXXXX";
@@ -151,7 +729,7 @@ static void test_empty(void) {
         (void) journal_file_close(f4);
 }
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
 static bool check_compressed(uint64_t compress_threshold, uint64_t data_size) {
         dual_timestamp ts;
         JournalFile *f;
@@ -236,6 +814,79 @@ static void test_min_compress_size(void) {
 }
 #endif
 
+#if HAVE_LZ4
+static void test_reopen_lz4(void) {
+        const le32_t lz4 = htole32(HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+        char t[] = "/tmp/journal-XXXXXX";
+        char data[1024];
+        _cleanup_close_ int fd = -1;
+        const void *d;
+        dual_timestamp ts;
+        struct iovec iovec;
+        JournalFile *f;
+        Object *o;
+        sd_journal *j;
+        uint64_t p;
+        size_t l;
+        int r;
+
+        test_setup_logging(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* An empty file created by a journald that prefers LZ4, possibly without support for anything else */
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, 0, false, NULL, NULL, NULL, NULL, &f) == 0);
+        (void) journal_file_close(f);
+
+        fd = open("test.journal", O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(pwrite(fd, &lz4, sizeof(lz4), offsetof(Header, incompatible_flags)) == sizeof(lz4));
+        fd = safe_close(fd);
+
+        /* Data appended after reopening it has to be compressed the way its header says */
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR, 0666, true, 0, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_FILE_COMPRESSION(f) == OBJECT_COMPRESSED_LZ4);
+
+        memset(data, 'x', sizeof(data));
+        memcpy(data, "FIELD=", STRLEN("FIELD="));
+        iovec = IOVEC_MAKE(data, sizeof(data));
+        assert_se(dual_timestamp_get(&ts));
+        assert_se(journal_file_append_entry(f, &ts, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+
+        assert_se(le32toh(f->header->incompatible_flags) == HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+
+        p = le64toh(f->header->header_size);
+        for (;;) {
+                r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
+                assert_se(r == 0);
+                if (o->object.type == OBJECT_DATA)
+                        break;
+
+                assert_se(p < le64toh(f->header->tail_object_offset));
+                p = p + ALIGN64(le64toh(o->object.size));
+        }
+        assert_se((o->object.flags & OBJECT_COMPRESSION_MASK) == OBJECT_COMPRESSED_LZ4);
+
+        (void) journal_file_close(f);
+
+        assert_se(sd_journal_open_files(&j, (const char**) STRV_MAKE("test.journal"), 0) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_get_data(j, "FIELD", &d, &l) >= 0);
+        assert_se(l == sizeof(data) && memcmp(d, data, l) == 0);
+        sd_journal_close(j);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+#endif
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -246,10 +897,19 @@ int main(int argc, char *argv[]) {
                 return log_tests_skipped("/etc/machine-id not found");
 
         test_non_empty();
+        test_append_entries();
+        test_archived_posting_lists();
+        test_bloom_filter();
+        test_post_change();
+        test_boots();
+        test_compact();
         test_empty();
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_XZ || HAVE_LZ4 || HAVE_ZSTD
         test_min_compress_size();
 #endif
+#if HAVE_LZ4
+        test_reopen_lz4();
+#endif
 
         return 0;
 }
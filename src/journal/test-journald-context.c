@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <unistd.h>
+
+#include "sd-event.h"
+
+#include "alloc-util.h"
+#include "journald-context.h"
+#include "journald-server.h"
+#include "log.h"
+#include "process-util.h"
+#include "string-util.h"
+#include "tests.h"
+
+static void test_refresh(void) {
+        Server s = {};
+        ClientContext *c;
+        usec_t t;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(client_context_get(&s, getpid_cached(), NULL, NULL, 0, NULL, &c) >= 0);
+        assert_se(c->in_lru);
+        assert_se(c->comm);
+
+        t = c->timestamp;
+        assert_se(t != USEC_INFINITY);
+        assert_se(c->cgroup_timestamp == t);
+
+        /* Recent data is used as it is */
+        client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + USEC_PER_SEC / 2);
+        assert_se(c->timestamp == t);
+
+        /* Older data is refreshed, including what we derive from the cgroup, as unpinned contexts are never
+         * watched */
+        client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 2 * USEC_PER_SEC);
+        assert_se(c->timestamp == t + 2 * USEC_PER_SEC);
+        assert_se(c->cgroup_timestamp == c->timestamp);
+        assert_se(c->cgroup_wd < 0);
+
+        client_context_flush_all(&s);
+}
+
+static void test_dirty(void) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        ClientContext *c, *parent;
+        Server s = {};
+        usec_t t;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_default(&e) >= 0);
+        s.event = e;
+
+        assert_se(client_context_acquire(&s, getpid_cached(), NULL, NULL, 0, NULL, &c) >= 0);
+        assert_se(!c->in_lru);
+        t = c->timestamp;
+
+        if (c->cgroup_wd < 0 || access("/run/systemd/units", F_OK) < 0) {
+                log_info("Not notified about changes of our cgroup and unit, checking refreshes only.");
+
+                client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 2 * USEC_PER_SEC);
+                assert_se(c->timestamp == t + 2 * USEC_PER_SEC);
+                assert_se(c->cgroup_timestamp == c->timestamp);
+
+                client_context_release(&s, c);
+                client_context_flush_all(&s);
+                return;
+        }
+
+        /* Only the per-process data is refreshed after 1s */
+        client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 2 * USEC_PER_SEC);
+        assert_se(c->timestamp == t + 2 * USEC_PER_SEC);
+        assert_se(c->cgroup_timestamp == t);
+
+        /* Notifications about other units don't concern us */
+        client_context_mark_unit_dirty(&s, "test-journald-context-nonexistent.service");
+        assert_se(!c->cgroup_dirty);
+
+        /* A notification about our unit gets everything reread with the next message */
+        if (c->unit) {
+                client_context_mark_unit_dirty(&s, c->unit);
+                assert_se(c->cgroup_dirty);
+
+                client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 3 * USEC_PER_SEC);
+                assert_se(!c->cgroup_dirty);
+                assert_se(c->cgroup_timestamp == t + 3 * USEC_PER_SEC);
+        }
+
+        /* A process moving to another cgroup is noticed, even though its old cgroup doesn't tell us */
+        assert_se(free_and_strdup(&c->cgroup, "/test-journald-context-nonexistent") >= 0);
+        client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 5 * USEC_PER_SEC);
+        assert_se(!streq(c->cgroup, "/test-journald-context-nonexistent"));
+        assert_se(c->cgroup_timestamp == t + 5 * USEC_PER_SEC);
+
+        /* And everything is reread every now and then anyway */
+        client_context_maybe_refresh(&s, c, NULL, NULL, 0, NULL, t + 60 * USEC_PER_SEC);
+        assert_se(c->cgroup_timestamp == t + 60 * USEC_PER_SEC);
+
+        /* If our parent is in the same unit, it's notified through the index once we are gone */
+        assert_se(client_context_acquire(&s, getppid(), NULL, NULL, 0, NULL, &parent) >= 0);
+        if (c->unit && streq_ptr(c->unit, parent->unit) && parent->cgroup_wd >= 0) {
+                char *unit;
+
+                assert_se(unit = strdup(c->unit));
+                client_context_release(&s, c);
+
+                client_context_mark_unit_dirty(&s, unit);
+                assert_se(parent->cgroup_dirty);
+                free(unit);
+        } else
+                client_context_release(&s, c);
+
+        client_context_release(&s, parent);
+        client_context_flush_all(&s);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_refresh();
+        test_dirty();
+
+        return 0;
+}
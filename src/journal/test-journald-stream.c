@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include "alloc-util.h"
+#include "escape.h"
+#include "journald-stream.h"
+#include "log.h"
+#include "string-util.h"
+#include "tests.h"
+
+static const char* const line_break_table[] = {
+        [LINE_BREAK_NEWLINE] = "newline",
+        [LINE_BREAK_NUL] = "nul",
+        [LINE_BREAK_LINE_MAX] = "line-max",
+        [LINE_BREAK_EOF] = "eof",
+};
+
+static void append_line(char **result, const char *p, size_t length, LineBreak line_break) {
+        _cleanup_free_ char *escaped = NULL;
+
+        assert_se(escaped = cescape_length(p, length));
+        assert_se(strextend(result, escaped, "|", line_break_table[line_break], "\n", NULL));
+}
+
+static char *scan(const char *data, size_t size, size_t chunk, size_t line_max) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t offset = 0, length = 0;
+        char *result;
+
+        assert_se(buffer = malloc(size + 1));
+        assert_se(result = strdup(""));
+
+        /* Feed the data in reads of the given size, and after each read take off the complete lines and move
+         * the rest to the front, the way the stream does with its buffer */
+        while (offset < size) {
+                size_t n, remaining;
+                char *p;
+
+                n = MIN(chunk, size - offset);
+                memcpy(buffer + length, data + offset, n);
+                offset += n;
+                length += n;
+
+                for (p = buffer, remaining = length;;) {
+                        LineBreak line_break;
+                        size_t l, skip;
+
+                        if (!stdout_stream_find_line(p, remaining, line_max, &l, &skip, &line_break))
+                                break;
+
+                        append_line(&result, p, l, line_break);
+                        p += skip;
+                        remaining -= skip;
+                }
+
+                memmove(buffer, p, remaining);
+                length = remaining;
+        }
+
+        /* Whatever is left when the stream ends is logged as it is */
+        if (length > 0)
+                append_line(&result, buffer, length, LINE_BREAK_EOF);
+
+        return result;
+}
+
+static void test_find_line_one(const char *data, size_t size, size_t line_max, const char *expected) {
+        size_t chunk;
+
+        /* However the data is split up between reads, the same lines come out */
+        for (chunk = 1; chunk <= size; chunk++) {
+                _cleanup_free_ char *result = NULL;
+
+                result = scan(data, size, chunk, line_max);
+                if (!streq(result, expected))
+                        log_error("Reads of %zu bytes, expected:\n%sgot:\n%s", chunk, expected, result);
+                assert_se(streq(result, expected));
+        }
+}
+
+#define test_find_line(data, line_max, expected) \
+        test_find_line_one(data, sizeof(data) - 1, line_max, expected)
+
+static void test_split(void) {
+        log_info("/* %s */", __func__);
+
+        test_find_line("hello\nworld\n", 64,
+                       "hello|newline\n"
+                       "world|newline\n");
+
+        test_find_line("\n\nempty\n", 64,
+                       "|newline\n"
+                       "|newline\n"
+                       "empty|newline\n");
+
+        test_find_line("unterminated", 64,
+                       "unterminated|eof\n");
+
+        test_find_line("one\ntwo", 64,
+                       "one|newline\n"
+                       "two|eof\n");
+}
+
+static void test_nul_cr(void) {
+        log_info("/* %s */", __func__);
+
+        /* A NUL byte terminates a line too */
+        test_find_line("one\0two\n", 64,
+                       "one|nul\n"
+                       "two|newline\n");
+
+        test_find_line("\0\0three\0", 64,
+                       "|nul\n"
+                       "|nul\n"
+                       "three|nul\n");
+
+        test_find_line("nul\0\nnewline\n", 64,
+                       "nul|nul\n"
+                       "|newline\n"
+                       "newline|newline\n");
+
+        /* A carriage return doesn't, it stays part of the message */
+        test_find_line("dos\r\nline\r\n", 64,
+                       "dos\\r|newline\n"
+                       "line\\r|newline\n");
+
+        test_find_line("carriage\rreturn\n", 64,
+                       "carriage\\rreturn|newline\n");
+}
+
+static void test_line_max(void) {
+        log_info("/* %s */", __func__);
+
+        test_find_line("0123456789abcdef01\n", 8,
+                       "01234567|line-max\n"
+                       "89abcdef|line-max\n"
+                       "01|newline\n");
+
+        test_find_line("0123456\n01234567\n", 8,
+                       "0123456|newline\n"
+                       "01234567|line-max\n"
+                       "|newline\n");
+
+        /* Terminators are only looked for within the maximum line length */
+        test_find_line("0123456789\0ab\n", 8,
+                       "01234567|line-max\n"
+                       "89|nul\n"
+                       "ab|newline\n");
+
+        test_find_line("0123456789abcdef", 8,
+                       "01234567|line-max\n"
+                       "89abcdef|line-max\n");
+
+        test_find_line("0123456789", 8,
+                       "01234567|line-max\n"
+                       "89|eof\n");
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_INFO);
+
+        test_split();
+        test_nul_cr();
+        test_line_max();
+
+        return 0;
+}
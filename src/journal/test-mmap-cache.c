@@ -15,8 +15,11 @@ int main(int argc, char *argv[]) {
         MMapFileDescriptor *fx;
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
+        MMapCacheContextStatistics stats;
+        uint64_t window_size;
         MMapCache *m;
         void *p, *q;
+        size_t l;
 
         assert_se(m = mmap_cache_new());
 
@@ -55,6 +58,44 @@ int main(int argc, char *argv[]) {
 
         assert_se((uint8_t*) p + 1 == (uint8_t*) q);
 
+        mmap_cache_get_context_statistics(m, 0, &stats);
+        assert_se(stats.n_context_hit == 1);
+        assert_se(stats.n_window_hit == 0);
+        assert_se(stats.n_missed == 2);
+        assert_se(stats.n_sequential == 0);
+
+        mmap_cache_get_context_statistics(m, 1, &stats);
+        assert_se(stats.n_context_hit == 0);
+        assert_se(stats.n_window_hit == 2);
+        assert_se(stats.n_missed == 0);
+
+        /* Reading right past the end of the previous window grows the next one */
+        mmap_cache_get_context_statistics(m, 2, &stats);
+        window_size = stats.window_size;
+
+        r = mmap_cache_get(m, fx, PROT_READ, 2, false, 32ULL*1024ULL*1024ULL, 2, NULL, &p, &l);
+        assert_se(r >= 0);
+
+        r = mmap_cache_get(m, fx, PROT_READ, 2, false, 32ULL*1024ULL*1024ULL + l, 2, NULL, &p, NULL);
+        assert_se(r >= 0);
+
+        mmap_cache_get_context_statistics(m, 2, &stats);
+        assert_se(stats.n_missed == 2);
+        assert_se(stats.n_sequential == 1);
+        assert_se(stats.window_size == 2 * window_size);
+
+        /* ... and jumping elsewhere shrinks it again */
+        r = mmap_cache_get(m, fx, PROT_READ, 2, false, 128ULL*1024ULL*1024ULL, 2, NULL, &p, NULL);
+        assert_se(r >= 0);
+
+        mmap_cache_get_context_statistics(m, 2, &stats);
+        assert_se(stats.n_missed == 3);
+        assert_se(stats.n_sequential == 1);
+        assert_se(stats.window_size == window_size);
+
+        assert_se(mmap_cache_get_hit(m) == 3);
+        assert_se(mmap_cache_get_missed(m) == 5);
+
         mmap_cache_free_fd(m, fx);
         mmap_cache_unref(m);
 
@@ -9,6 +9,7 @@
 #include "bus-error.h"
 #include "bus-kernel.h"
 #include "bus-match.h"
+#include "bus-receive-chunk.h"
 #include "def.h"
 #include "hashmap.h"
 #include "list.h"
@@ -215,9 +216,21 @@ struct sd_bus {
 
         int use_memfd;
 
+        /* Only used during authentication, see rchunk for messages */
         void *rbuffer;
         size_t rbuffer_size;
 
+        /* Messages are read into this chunk. The bytes from rchunk_begin to rchunk_end have been read but not
+         * turned into messages yet, see bus_socket_read_message(). */
+        BusReceiveChunk *rchunk;
+        size_t rchunk_begin, rchunk_end;
+        /* Whether the messages in there have been moved to 8 byte boundaries, see bus_socket_align_messages() */
+        bool rchunk_aligned;
+        /* Earlier chunks that messages still point into. Once there are too many of them, messages are copied out
+         * of the chunk they were read into, see bus_socket_make_message(). */
+        BusReceiveChunk *rchunks_pinned[BUS_RECEIVE_CHUNKS_PINNED_MAX];
+        size_t n_rchunks_pinned;
+
         sd_bus_message **rqueue;
         unsigned rqueue_size;
         size_t rqueue_allocated;
@@ -268,8 +281,10 @@ struct sd_bus {
 
         uint64_t creds_mask;
 
+        /* File descriptors received along with the message starting at fds_offset in rchunk */
         int *fds;
         size_t n_fds;
+        size_t fds_offset;
 
         char *exec_path;
         char **exec_argv;
@@ -115,6 +115,7 @@ static sd_bus_message* message_free(sd_bus_message *m) {
 
         if (m->free_header)
                 free(m->header);
+        bus_receive_chunk_unref(m->chunk);
 
         message_reset_parts(m);
 
@@ -519,7 +520,7 @@ int bus_message_from_header(
         return 0;
 }
 
-int bus_message_from_malloc(
+static int message_from_buffer(
                 sd_bus *bus,
                 void *buffer,
                 size_t length,
@@ -561,11 +562,63 @@ int bus_message_from_malloc(
         if (r < 0)
                 return r;
 
+        *ret = TAKE_PTR(m);
+        return 0;
+}
+
+int bus_message_from_malloc(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                int *fds,
+                size_t n_fds,
+                const char *label,
+                sd_bus_message **ret) {
+
+        sd_bus_message *m;
+        int r;
+
+        r = message_from_buffer(bus, buffer, length, fds, n_fds, label, &m);
+        if (r < 0)
+                return r;
+
         /* We take possession of the memory and fds now */
         m->free_header = true;
         m->free_fds = true;
 
-        *ret = TAKE_PTR(m);
+        *ret = m;
+        return 0;
+}
+
+int bus_message_from_chunk(
+                sd_bus *bus,
+                BusReceiveChunk *chunk,
+                void *buffer,
+                size_t length,
+                int *fds,
+                size_t n_fds,
+                const char *label,
+                sd_bus_message **ret) {
+
+        sd_bus_message *m;
+        int r;
+
+        assert(chunk);
+        assert((uint8_t*) buffer >= chunk->data);
+        assert((uint8_t*) buffer + length <= chunk->data + chunk->allocated);
+
+        /* The message is parsed in place, hence needs to be aligned just like one we allocated ourselves */
+        assert(buffer == ALIGN8_PTR(buffer));
+
+        r = message_from_buffer(bus, buffer, length, fds, n_fds, label, &m);
+        if (r < 0)
+                return r;
+
+        /* We take possession of the fds, and keep the memory the message lives in around until it is freed */
+        m->chunk = bus_receive_chunk_ref(chunk);
+        m->free_fds = true;
+
+        *ret = m;
         return 0;
 }
 
@@ -9,6 +9,7 @@
 
 #include "bus-creds.h"
 #include "bus-protocol.h"
+#include "bus-receive-chunk.h"
 #include "macro.h"
 #include "time-util.h"
 
@@ -81,6 +82,9 @@ struct sd_bus_message {
         struct bus_header *header;
         void *footer;
 
+        /* The chunk the message was received into, if it still lives there, see bus_message_from_chunk() */
+        BusReceiveChunk *chunk;
+
         /* How many bytes are accessible in the above pointers */
         size_t header_accessible;
         size_t footer_accessible;
@@ -190,6 +194,16 @@ int bus_message_from_malloc(
                 const char *label,
                 sd_bus_message **ret);
 
+int bus_message_from_chunk(
+                sd_bus *bus,
+                BusReceiveChunk *chunk,
+                void *buffer,
+                size_t length,
+                int *fds,
+                size_t n_fds,
+                const char *label,
+                sd_bus_message **ret);
+
 int bus_message_get_arg(sd_bus_message *m, unsigned i, const char **str);
 int bus_message_get_arg_strv(sd_bus_message *m, unsigned i, char ***strv);
 
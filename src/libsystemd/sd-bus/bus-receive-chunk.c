@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "bus-receive-chunk.h"
+
+BusReceiveChunk* bus_receive_chunk_new(size_t size) {
+        BusReceiveChunk *c;
+
+        assert(size > 0);
+
+        c = malloc(offsetof(BusReceiveChunk, data) + size);
+        if (!c)
+                return NULL;
+
+        c->n_ref = REFCNT_INIT;
+        c->allocated = size;
+
+        return c;
+}
+
+DEFINE_ATOMIC_REF_UNREF_FUNC(BusReceiveChunk, bus_receive_chunk, mfree);
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macro.h"
+#include "refcnt.h"
+
+/* Messages are read into chunks of this size, unless a single message needs more */
+#define BUS_RECEIVE_CHUNK_SIZE (16U*1024U)
+
+/* How many chunks messages that are kept around by the application may keep from being reused at max */
+#define BUS_RECEIVE_CHUNKS_PINNED_MAX 4U
+
+/* Messages are read from the socket into chunks of memory like this one, as many at a time as fit. Messages are
+ * parsed in place, they keep a reference to the chunk they were read into until they are freed. The reference
+ * counter is atomic, since messages may be freed in a different thread than the one that reads from the bus. */
+typedef struct BusReceiveChunk {
+        RefCount n_ref;
+        size_t allocated;
+        uint8_t data[] _alignas_(uint64_t);
+} BusReceiveChunk;
+
+BusReceiveChunk* bus_receive_chunk_new(size_t size);
+BusReceiveChunk* bus_receive_chunk_ref(BusReceiveChunk *c);
+BusReceiveChunk* bus_receive_chunk_unref(BusReceiveChunk *c);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(BusReceiveChunk*, bus_receive_chunk_unref);
@@ -25,6 +25,7 @@
 #include "signal-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
+#include "unaligned.h"
 #include "user-util.h"
 #include "utf8.h"
 #include "util.h"
@@ -1023,16 +1024,15 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+static int bus_socket_message_need(const void *p, size_t size, size_t *need) {
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
-        assert(bus);
+        assert(p || size == 0);
         assert(need);
-        assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (size < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -1054,16 +1054,14 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
-
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        /* Messages aren't aligned before bus_socket_align_messages() got to them */
+        e = ((const uint8_t*) p)[0];
         if (e == BUS_LITTLE_ENDIAN) {
-                a = le32toh(a);
-                b = le32toh(b);
+                a = unaligned_read_le32((const uint8_t*) p + 4);
+                b = unaligned_read_le32((const uint8_t*) p + 12);
         } else if (e == BUS_BIG_ENDIAN) {
-                a = be32toh(a);
-                b = be32toh(b);
+                a = unaligned_read_be32((const uint8_t*) p + 4);
+                b = unaligned_read_be32((const uint8_t*) p + 12);
         } else
                 return -EBADMSG;
 
@@ -1075,55 +1073,342 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
+static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+        assert(bus);
+        assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
+
+        if (!bus->rchunk)
+                return bus_socket_message_need(NULL, 0, need);
+
+        return bus_socket_message_need(bus->rchunk->data + bus->rchunk_begin,
+                                       bus->rchunk_end - bus->rchunk_begin,
+                                       need);
+}
+
+static void bus_socket_release_chunks(sd_bus *bus) {
+        size_t i, j = 0;
+
+        assert(bus);
+
+        /* Drops the earlier chunks that no message points into anymore. Only we can take new references to
+         * them, hence they can't be in use again once the counter dropped to our own reference. */
+
+        for (i = 0; i < bus->n_rchunks_pinned; i++)
+                if (REFCNT_GET(bus->rchunks_pinned[i]->n_ref) == 1)
+                        bus_receive_chunk_unref(bus->rchunks_pinned[i]);
+                else
+                        bus->rchunks_pinned[j++] = bus->rchunks_pinned[i];
+
+        bus->n_rchunks_pinned = j;
+}
+
+static void bus_socket_retire_chunk(sd_bus *bus, BusReceiveChunk *c) {
+        assert(bus);
+
+        /* Keeps track of a chunk we are done reading into, as long as messages point into it. Chunks of large
+         * messages hold only that message, so they don't waste any memory and aren't tracked. */
+
+        if (c && c->allocated == BUS_RECEIVE_CHUNK_SIZE && REFCNT_GET(c->n_ref) > 1 &&
+            bus->n_rchunks_pinned < BUS_RECEIVE_CHUNKS_PINNED_MAX)
+                bus->rchunks_pinned[bus->n_rchunks_pinned++] = c;
+        else
+                bus_receive_chunk_unref(c);
+}
+
+static int bus_socket_make_room(sd_bus *bus, size_t need) {
+        _cleanup_(bus_receive_chunk_unrefp) BusReceiveChunk *c = NULL;
+        size_t n, size;
+
+        assert(bus);
+
+        /* Makes sure there's room for the remaining need bytes of the message at rchunk_begin in the receive
+         * chunk, and for a few more messages to be read along with it. */
+
+        bus_socket_release_chunks(bus);
+
+        n = bus->rchunk ? bus->rchunk_end - bus->rchunk_begin : 0;
+        assert(need > n);
+
+        /* Large messages get a chunk of their own, which is not reused for the messages after them */
+        size = MAX(BUS_RECEIVE_CHUNK_SIZE, PAGE_ALIGN(need));
+
+        if (bus->rchunk && bus->rchunk->allocated == size) {
+
+                /* If all messages in the chunk have been freed, start over at its beginning */
+                if (REFCNT_GET(bus->rchunk->n_ref) == 1 && bus->rchunk_begin > 0) {
+                        memmove(bus->rchunk->data, bus->rchunk->data + bus->rchunk_begin, n);
+
+                        if (bus->n_fds > 0)
+                                bus->fds_offset -= bus->rchunk_begin;
+                        bus->rchunk_begin = 0;
+                        bus->rchunk_end = n;
+                }
+
+                /* Don't bother reading into the last few bytes of the chunk though, if starting a new one gives
+                 * us more room */
+                if (size - bus->rchunk_begin >= need &&
+                    (size - bus->rchunk_end >= BUS_RECEIVE_CHUNK_SIZE / 16 || bus->rchunk_begin == 0))
+                        return 0;
+        }
+
+        /* Some messages still point into the old chunk, or it doesn't fit. Continue in a new one, and leave the
+         * old one to the messages. */
+        c = bus_receive_chunk_new(size);
+        if (!c)
+                return -ENOMEM;
+
+        if (n > 0)
+                memcpy(c->data, bus->rchunk->data + bus->rchunk_begin, n);
+
+        if (bus->n_fds > 0)
+                bus->fds_offset -= bus->rchunk_begin;
+        bus->rchunk_begin = 0;
+        bus->rchunk_end = n;
+
+        bus_socket_retire_chunk(bus, bus->rchunk);
+        bus->rchunk = TAKE_PTR(c);
+
+        return 0;
+}
+
+static int bus_socket_take_rbuffer(sd_bus *bus) {
+        int r;
+
+        assert(bus);
+
+        /* Moves whatever the other side sent right after the authentication into the receive chunk */
+
+        if (bus->rbuffer_size > 0) {
+                r = bus_socket_make_room(bus, bus->rbuffer_size);
+                if (r < 0)
+                        return r;
+
+                memcpy(bus->rchunk->data + bus->rchunk_end, bus->rbuffer, bus->rbuffer_size);
+                bus->rchunk_end += bus->rbuffer_size;
+                bus->rchunk_aligned = false;
+                bus->rbuffer_size = 0;
+        }
+
+        bus->rbuffer = mfree(bus->rbuffer);
+        return 0;
+}
+
+static size_t bus_socket_last_message(sd_bus *bus) {
+        size_t p, need;
+
+        assert(bus);
+        assert(bus->rchunk);
+
+        /* Returns where the last message starts of which anything has been read so far */
+
+        for (p = bus->rchunk_begin;; p += need)
+                if (bus_socket_message_need(bus->rchunk->data + p, bus->rchunk_end - p, &need) < 0 ||
+                    bus->rchunk_end - p <= need)
+                        return p;
+}
+
+typedef struct MessageMove {
+        size_t from, to;
+} MessageMove;
+
+static int bus_socket_align_messages(sd_bus *bus) {
+        _cleanup_(bus_receive_chunk_unrefp) BusReceiveChunk *c = NULL;
+        _cleanup_free_ MessageMove *moves = NULL;
+        size_t p, q, a, need, n, i;
+
+        assert(bus);
+        assert(bus->rchunk);
+
+        /* Messages are parsed in place, which requires them to be aligned to 8 bytes, but on the wire they are
+         * simply concatenated. Hence move up those that aren't, in a single pass over the chunk, starting with
+         * the last message, so that each one is moved only once. If there's no room for that at the end of the
+         * chunk, copy them over into a new one instead. */
+
+        if (bus->rchunk_aligned)
+                return 0;
+
+        /* First, figure out where the last message of which anything was read would end up, relative to the
+         * first one */
+        p = bus->rchunk_begin;
+        q = 0;
+        for (n = 1;; n++) {
+                if (bus_socket_message_need(bus->rchunk->data + p, bus->rchunk_end - p, &need) < 0 ||
+                    bus->rchunk_end - p <= need)
+                        break;
+
+                p += need;
+                q = ALIGN8(q + need);
+        }
+
+        a = ALIGN8(bus->rchunk_begin);
+
+        if (a + q == p)
+                ; /* Everything is aligned already */
+
+        else if (a + q + bus->rchunk_end - p <= bus->rchunk->allocated) {
+                moves = new(MessageMove, n);
+                if (!moves)
+                        return -ENOMEM;
+
+                p = bus->rchunk_begin;
+                q = 0;
+                for (i = 0; i < n; i++) {
+                        moves[i] = (MessageMove) {
+                                .from = p,
+                                .to = a + q,
+                        };
+
+                        if (i + 1 < n) {
+                                assert_se(bus_socket_message_need(bus->rchunk->data + p, bus->rchunk_end - p, &need) >= 0);
+                                p += need;
+                                q = ALIGN8(q + need);
+                        }
+                }
+
+                /* The last message may be incomplete, it extends up to the end of what was read */
+                for (i = n; i > 0; i--) {
+                        MessageMove *m = moves + i - 1;
+
+                        if (m->from == m->to)
+                                break;
+
+                        memmove(bus->rchunk->data + m->to,
+                                bus->rchunk->data + m->from,
+                                (i == n ? bus->rchunk_end : m[1].from) - m->from);
+
+                        if (bus->n_fds > 0 && bus->fds_offset == m->from)
+                                bus->fds_offset = m->to;
+                }
+
+                bus->rchunk_begin = moves[0].to;
+                bus->rchunk_end = moves[n - 1].to + bus->rchunk_end - moves[n - 1].from;
+
+        } else {
+                c = bus_receive_chunk_new(MAX(BUS_RECEIVE_CHUNK_SIZE, PAGE_ALIGN(q + bus->rchunk_end - p)));
+                if (!c)
+                        return -ENOMEM;
+
+                p = bus->rchunk_begin;
+                q = 0;
+                for (i = 0; i < n; i++) {
+                        if (i + 1 < n)
+                                assert_se(bus_socket_message_need(bus->rchunk->data + p, bus->rchunk_end - p, &need) >= 0);
+                        else
+                                need = bus->rchunk_end - p;
+
+                        memcpy(c->data + q, bus->rchunk->data + p, need);
+
+                        if (bus->n_fds > 0 && bus->fds_offset == p)
+                                bus->fds_offset = q;
+
+                        p += need;
+                        q = i + 1 < n ? ALIGN8(q + need) : q + need;
+                }
+
+                bus_socket_retire_chunk(bus, bus->rchunk);
+                bus->rchunk = TAKE_PTR(c);
+                bus->rchunk_begin = 0;
+                bus->rchunk_end = q;
+        }
+
+        bus->rchunk_aligned = true;
+        return 0;
+}
+
 static int bus_socket_make_message(sd_bus *bus, size_t size) {
         sd_bus_message *t;
-        void *b;
+        int *fds = NULL;
+        size_t n_fds = 0;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rchunk);
+        assert(bus->rchunk_aligned);
+        assert(bus->rchunk_end - bus->rchunk_begin >= size);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        if (bus->n_fds > 0 && bus->fds_offset == bus->rchunk_begin) {
+                fds = bus->fds;
+                n_fds = bus->n_fds;
+        }
+
+        /* If the application holds on to messages from too many chunks already, don't let this message keep
+         * another one from being reused, but give it memory of its own */
+        if (bus->n_rchunks_pinned >= BUS_RECEIVE_CHUNKS_PINNED_MAX &&
+            bus->rchunk->allocated == BUS_RECEIVE_CHUNK_SIZE) {
+                _cleanup_free_ void *b = NULL;
+
+                b = memdup(bus->rchunk->data + bus->rchunk_begin, size);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
 
-        r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
-                                    bus->fds, bus->n_fds,
-                                    NULL,
-                                    &t);
-        if (r < 0) {
-                free(b);
-                return r;
+                r = bus_message_from_malloc(bus, b, size, fds, n_fds, NULL, &t);
+                if (r < 0)
+                        return r;
+
+                b = NULL;
+        } else {
+                r = bus_message_from_chunk(bus,
+                                           bus->rchunk, bus->rchunk->data + bus->rchunk_begin, size,
+                                           fds, n_fds,
+                                           NULL,
+                                           &t);
+                if (r < 0)
+                        return r;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        if (fds) {
+                bus->fds = NULL;
+                bus->n_fds = 0;
+        }
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+        /* Skip over the padding to the next message, if there is one */
+        bus->rchunk_begin = MIN(ALIGN8(bus->rchunk_begin + size), bus->rchunk_end);
 
         bus->rqueue[bus->rqueue_size++] = t;
 
         return 1;
 }
 
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t need;
+        int r, ret = 0;
+
+        assert(bus);
+
+        if (!bus->rchunk)
+                return 0;
+
+        r = bus_socket_align_messages(bus);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                r = bus_socket_read_message_need(bus, &need);
+                if (r < 0)
+                        return r;
+
+                if (bus->rchunk_end - bus->rchunk_begin < need)
+                        return ret;
+
+                r = bus_socket_make_message(bus, need);
+                if (r < 0)
+                        return r;
+
+                ret = 1;
+        }
+}
+
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
         ssize_t k;
-        size_t need;
+        size_t need, size, n_fds;
         int r;
-        void *b;
         union {
                 struct cmsghdr cmsghdr;
                 uint8_t buf[CMSG_SPACE(sizeof(int) * BUS_FDS_MAX)];
@@ -1133,21 +1418,37 @@ int bus_socket_read_message(sd_bus *bus) {
         assert(bus);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
+        r = bus_socket_take_rbuffer(bus);
+        if (r < 0)
+                return r;
+
+        /* Process what's left over from the authentication or the last time, if we stopped early then */
+        r = bus_socket_make_messages(bus);
+        if (r != 0)
+                return r;
+
         r = bus_socket_read_message_need(bus, &need);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+        r = bus_socket_make_room(bus, need);
+        if (r < 0)
+                return r;
 
-        b = realloc(bus->rbuffer, need);
-        if (!b)
-                return -ENOMEM;
+        /* The message at rchunk_begin is the only one that has not been turned into a message yet, hence any file
+         * descriptors we have belong to it */
+        assert(bus->n_fds == 0 || bus->fds_offset == bus->rchunk_begin);
 
-        bus->rbuffer = b;
+        /* Read as many messages as fit into the chunk at once, but leave some room to align them. Unless file
+         * descriptors were received for the current message: as the kernel doesn't tell us where exactly in the
+         * stream they belong, read only up to the end of that message then, so that any file descriptors we
+         * receive next can only belong to that or a later one. */
+        size = bus->rchunk_begin + need - bus->rchunk_end;
+        if (bus->n_fds == 0)
+                size = MAX(size, (bus->rchunk->allocated - bus->rchunk_end) / 8 * 7);
 
-        iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_base = bus->rchunk->data + bus->rchunk_end;
+        iov.iov_len = size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1170,7 +1471,10 @@ int bus_socket_read_message(sd_bus *bus) {
         if (k == 0)
                 return -ECONNRESET;
 
-        bus->rbuffer_size += k;
+        bus->rchunk_end += k;
+        bus->rchunk_aligned = false;
+
+        n_fds = bus->n_fds;
 
         if (handle_cmsg) {
                 struct cmsghdr *cmsg;
@@ -1205,13 +1509,17 @@ int bus_socket_read_message(sd_bus *bus) {
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
+        /* The kernel returns file descriptors with the first part of the data that was sent along with them,
+         * and doesn't return any data sent after that in the same call. Hence they belong to the last message
+         * of which anything was read, as long as the other side sends each message with a separate call, as
+         * everybody does. */
+        if (n_fds == 0 && bus->n_fds > 0)
+                bus->fds_offset = bus_socket_last_message(bus);
+
+        r = bus_socket_make_messages(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
-
         return 1;
 }
 
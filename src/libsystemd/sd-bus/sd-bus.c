@@ -160,6 +160,7 @@ static void bus_reset_queues(sd_bus *b) {
 
 static sd_bus* bus_free(sd_bus *b) {
         sd_bus_slot *s;
+        size_t i;
 
         assert(b);
         assert(!b->track_queue);
@@ -190,6 +191,9 @@ static sd_bus* bus_free(sd_bus *b) {
         free(b->label);
         free(b->groups);
         free(b->rbuffer);
+        bus_receive_chunk_unref(b->rchunk);
+        for (i = 0; i < b->n_rchunks_pinned; i++)
+                bus_receive_chunk_unref(b->rchunks_pinned[i]);
         free(b->unique_name);
         free(b->auth_buffer);
         free(b->address);
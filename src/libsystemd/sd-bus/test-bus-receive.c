@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "sd-bus.h"
+
+#include "alloc-util.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "fd-util.h"
+#include "log.h"
+#include "macro.h"
+#include "string-util.h"
+#include "tests.h"
+#include "util.h"
+
+#define N_MESSAGES 2048U
+
+/* Make the sizes of the messages vary, so that most of them don't end on an 8 byte boundary, and every now and then
+ * send one that doesn't fit into a receive chunk by itself */
+static size_t message_length(unsigned i) {
+        return i % 97 == 42 ? 100 * 1024 : i % 13;
+}
+
+static bool message_has_fd(unsigned i) {
+        return i % 7 == 3;
+}
+
+static void test_receive(bool hold) {
+        _cleanup_(sd_bus_unrefp) sd_bus *server = NULL, *client = NULL;
+        sd_bus_message *held[N_MESSAGES] = {};
+        _cleanup_close_pair_ int fds[2] = { -1, -1 };
+        BusReceiveChunk *pinned[N_MESSAGES];
+        _cleanup_close_ int efd = -1;
+        unsigned i, j, n_received = 0, n_chunk = 0, n_pinned = 0;
+        struct stat st;
+        sd_id128_t id;
+
+        log_info("/* %s(hold=%s) */", __func__, yes_no(hold));
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, fds) >= 0);
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        efd = eventfd(0, EFD_CLOEXEC);
+        assert_se(efd >= 0);
+        assert_se(fstat(efd, &st) >= 0);
+
+        assert_se(sd_bus_new(&server) >= 0);
+        assert_se(sd_bus_set_fd(server, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(server, true, id) >= 0);
+        assert_se(sd_bus_negotiate_fds(server, true) >= 0);
+        assert_se(sd_bus_start(server) >= 0);
+        fds[0] = -1;
+
+        assert_se(sd_bus_new(&client) >= 0);
+        assert_se(sd_bus_set_fd(client, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_negotiate_fds(client, true) >= 0);
+        assert_se(sd_bus_start(client) >= 0);
+        fds[1] = -1;
+
+        /* File descriptors can only be sent once it is known that the server accepts them */
+        while (sd_bus_is_ready(client) <= 0) {
+                assert_se(sd_bus_process(server, NULL) >= 0);
+                assert_se(sd_bus_process(client, NULL) >= 0);
+        }
+
+        for (i = 0; i < N_MESSAGES; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                _cleanup_free_ char *s = NULL;
+
+                s = malloc(message_length(i) + 1);
+                assert_se(s);
+                memset(s, 'x', message_length(i));
+                s[message_length(i)] = 0;
+
+                assert_se(sd_bus_message_new_signal(client, &m, "/test", "org.freedesktop.systemd.test", "Test") >= 0);
+                assert_se(sd_bus_message_append(m, "us", i, s) >= 0);
+                if (message_has_fd(i))
+                        assert_se(sd_bus_message_append(m, "h", efd) >= 0);
+
+                assert_se(sd_bus_send(client, m, NULL) >= 0);
+        }
+
+        while (n_received < N_MESSAGES) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                const char *s;
+                uint32_t u;
+                int r;
+
+                r = sd_bus_process(server, &m);
+                assert_se(r >= 0);
+
+                if (!m) {
+                        assert_se(sd_bus_process(client, NULL) >= 0);
+
+                        if (r == 0)
+                                assert_se(sd_bus_wait(server, 10 * USEC_PER_MSEC) >= 0);
+                        continue;
+                }
+
+                assert_se(sd_bus_message_is_signal(m, "org.freedesktop.systemd.test", "Test"));
+
+                assert_se(sd_bus_message_read(m, "us", &u, &s) >= 0);
+                assert_se(u == n_received);
+                assert_se(strlen(s) == message_length(u));
+                assert_se(!s[0] || s[0] == 'x');
+
+                if (message_has_fd(u)) {
+                        struct stat st2;
+                        int fd;
+
+                        assert_se(sd_bus_message_read(m, "h", &fd) >= 0);
+                        assert_se(fstat(fd, &st2) >= 0);
+                        assert_se(st.st_dev == st2.st_dev && st.st_ino == st2.st_ino);
+                } else
+                        assert_se(sd_bus_message_at_end(m, true) > 0);
+
+                if (m->chunk)
+                        n_chunk++;
+
+                /* Keep some of the messages around, so that the chunks they point into can't be reused */
+                if (hold && u % 5 == 0)
+                        held[u] = TAKE_PTR(m);
+
+                n_received++;
+        }
+
+        log_info("%u of %u messages were received in place.", n_chunk, N_MESSAGES);
+        assert_se(n_chunk > 0);
+
+        /* The held messages must still be intact, and may only keep a limited number of chunks from being
+         * reused, not counting the ones of large messages */
+        for (i = 0; i < N_MESSAGES; i++) {
+                const char *s;
+                uint32_t u;
+
+                if (!held[i])
+                        continue;
+
+                if (held[i]->chunk && held[i]->chunk->allocated == BUS_RECEIVE_CHUNK_SIZE) {
+                        for (j = 0; j < n_pinned; j++)
+                                if (pinned[j] == held[i]->chunk)
+                                        break;
+                        if (j >= n_pinned)
+                                pinned[n_pinned++] = held[i]->chunk;
+                }
+
+                assert_se(sd_bus_message_rewind(held[i], true) >= 0);
+                assert_se(sd_bus_message_read(held[i], "us", &u, &s) >= 0);
+                assert_se(u == i);
+                assert_se(strlen(s) == message_length(i));
+
+                sd_bus_message_unref(held[i]);
+        }
+
+        log_info("Held messages kept %u chunks around.", n_pinned);
+        assert_se(n_pinned <= BUS_RECEIVE_CHUNKS_PINNED_MAX + 1);
+}
+
+int main(int argc, char *argv[]) {
+        test_setup_logging(LOG_DEBUG);
+
+        test_receive(false);
+        test_receive(true);
+
+        return EXIT_SUCCESS;
+}
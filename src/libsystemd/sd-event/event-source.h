@@ -7,10 +7,13 @@
 
 #include "sd-event.h"
 
+#include "event-statistics.h"
+#include "event-uring.h"
 #include "fs-util.h"
 #include "hashmap.h"
 #include "list.h"
 #include "prioq.h"
+#include "timer-wheel.h"
 
 typedef enum EventSourceType {
         SOURCE_IO,
@@ -26,6 +29,8 @@ typedef enum EventSourceType {
         SOURCE_EXIT,
         SOURCE_WATCHDOG,
         SOURCE_INOTIFY,
+        SOURCE_WORK,
+        SOURCE_IO_READ,
         _SOURCE_EVENT_SOURCE_TYPE_MAX,
         _SOURCE_EVENT_SOURCE_TYPE_INVALID = -1
 } EventSourceType;
@@ -38,11 +43,15 @@ typedef enum WakeupType {
         WAKEUP_CLOCK_DATA,
         WAKEUP_SIGNAL_DATA,
         WAKEUP_INOTIFY_DATA,
+        WAKEUP_WORK_DATA,
+        WAKEUP_URING_DATA,
         _WAKEUP_TYPE_MAX,
         _WAKEUP_TYPE_INVALID = -1,
 } WakeupType;
 
 struct inode_data;
+typedef struct WorkItem WorkItem;
+typedef struct IoReadBuffer IoReadBuffer;
 
 struct sd_event_source {
         WakeupType wakeup;
@@ -69,6 +78,9 @@ struct sd_event_source {
 
         sd_event_destroy_t destroy_callback;
 
+        /* Allocated on first use while profiling is enabled */
+        SourceStatistics *statistics;
+
         LIST_FIELDS(sd_event_source, sources);
 
         union {
@@ -85,6 +97,10 @@ struct sd_event_source {
                         usec_t next, accuracy;
                         unsigned earliest_index;
                         unsigned latest_index;
+                        /* Coarse timers are kept in the timer wheels instead of the prioqs */
+                        TimerWheelNode earliest_node;
+                        TimerWheelNode latest_node;
+                        bool wheel:1;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -113,6 +129,21 @@ struct sd_event_source {
                         struct inode_data *inode_data;
                         LIST_FIELDS(sd_event_source, by_inode_data);
                 } inotify;
+                struct {
+                        sd_event_work_done_handler_t callback;
+                        WorkItem *item;
+                        int result;
+                } work;
+                struct {
+                        sd_event_io_read_handler_t callback;
+                        int fd;
+                        ssize_t result;
+                        IoReadBuffer *buffer;
+                        bool uring:1;      /* reads are issued through the io_uring, rather than by us after epoll */
+                        bool registered:1; /* with epoll, if not using the io_uring */
+                        bool queued:1;     /* waiting for its next read to be submitted to the io_uring */
+                        LIST_FIELDS(sd_event_source, submit_queue);
+                } io_read;
         };
 };
 
@@ -129,6 +160,12 @@ struct clock_data {
 
         Prioq *earliest;
         Prioq *latest;
+
+        /* The same for timers with an accuracy of a millisecond or
+         * more, which are the vast majority. These are allocated on
+         * first use. */
+        TimerWheel *earliest_wheel;
+        TimerWheel *latest_wheel;
         usec_t next;
 
         bool needs_rearm:1;
@@ -204,3 +241,45 @@ struct inotify_data {
          * to make it efficient to figure out what inotify objects to process data on next. */
         LIST_FIELDS(struct inotify_data, buffered);
 };
+
+/* The completion queue of work items handed to the thread pool from an event loop. The pool appends finished items
+ * to the list and signals the eventfd, the event loop then collects them and marks their event sources pending. */
+struct work_data {
+        WakeupType wakeup;
+
+        int fd;
+
+        /* Protected by the mutex of the thread pool */
+        LIST_HEAD(WorkItem, completed);
+};
+
+/* The buffer of an io_read event source. When reads are issued through the io_uring the kernel writes into it
+ * asynchronously, hence it is allocated separately, so that it may outlive its event source while a read is still in
+ * flight. */
+struct IoReadBuffer {
+        sd_event_source *source; /* NULL if the event source is gone already */
+        struct iovec iov;
+
+        bool in_flight:1;
+        bool cancelled:1;
+
+        LIST_FIELDS(IoReadBuffer, orphans);
+
+        uint8_t data[];
+};
+
+/* The io_uring reads of io_read event sources are submitted to. Its fd is watched by epoll, and signals readability
+ * whenever there are completions to collect. */
+struct uring_data {
+        WakeupType wakeup;
+
+        Uring *uring;
+
+        /* The io_read sources using the ring plus the buffers of freed ones with reads still in flight. Each may need
+         * two completion queue entries at a time (for the read and its cancellation), we use epoll for further
+         * sources once half of the completion queue is taken. */
+        unsigned n_slots;
+
+        LIST_HEAD(sd_event_source, submit_queue);
+        LIST_HEAD(IoReadBuffer, orphans);
+};
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include "event-statistics.h"
+#include "macro.h"
+#include "string-util.h"
+#include "util.h"
+
+static void histogram_add(unsigned *h, usec_t t) {
+        h[MIN(u64log2(t), SOURCE_STATISTICS_BUCKETS - 1)]++;
+}
+
+void source_statistics_add(SourceStatistics *st, usec_t latency, usec_t wall, usec_t cpu) {
+        assert(st);
+
+        st->n_dispatched++;
+
+        if (latency != USEC_INFINITY) {
+                st->n_latency++;
+                st->latency_total += latency;
+                st->latency_max = MAX(st->latency_max, latency);
+                histogram_add(st->latency_histogram, latency);
+        }
+
+        st->wall_total += wall;
+        st->wall_max = MAX(st->wall_max, wall);
+        histogram_add(st->wall_histogram, wall);
+
+        st->cpu_total += cpu;
+        st->cpu_max = MAX(st->cpu_max, cpu);
+        histogram_add(st->cpu_histogram, cpu);
+}
+
+void source_statistics_merge(SourceStatistics *to, const SourceStatistics *from) {
+        unsigned i;
+
+        assert(to);
+        assert(from);
+
+        to->n_dispatched += from->n_dispatched;
+
+        to->n_latency += from->n_latency;
+        to->latency_total += from->latency_total;
+        to->latency_max = MAX(to->latency_max, from->latency_max);
+
+        to->wall_total += from->wall_total;
+        to->wall_max = MAX(to->wall_max, from->wall_max);
+
+        to->cpu_total += from->cpu_total;
+        to->cpu_max = MAX(to->cpu_max, from->cpu_max);
+
+        for (i = 0; i < SOURCE_STATISTICS_BUCKETS; i++) {
+                to->latency_histogram[i] += from->latency_histogram[i];
+                to->wall_histogram[i] += from->wall_histogram[i];
+                to->cpu_histogram[i] += from->cpu_histogram[i];
+        }
+}
+
+static void dump_times(FILE *f, const char *prefix, const char *name, uint64_t n, usec_t total, usec_t max) {
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX];
+
+        if (n == 0)
+                return;
+
+        fprintf(f, "%s%s: total %s, avg %s, max %s\n",
+                prefix, name,
+                format_timespan(a, sizeof(a), total, 1),
+                format_timespan(b, sizeof(b), total / n, 1),
+                format_timespan(c, sizeof(c), max, 1));
+}
+
+static void dump_histogram(FILE *f, const char *prefix, const char *name, const unsigned *h) {
+        bool first = true;
+        unsigned i;
+
+        for (i = 0; i < SOURCE_STATISTICS_BUCKETS; i++) {
+                char buf[FORMAT_TIMESPAN_MAX];
+
+                if (h[i] == 0)
+                        continue;
+
+                if (first)
+                        fprintf(f, "%s%s histogram:", prefix, name);
+
+                /* Label each bucket with its upper bound, and the last one with its lower bound */
+                if (i == SOURCE_STATISTICS_BUCKETS - 1)
+                        fprintf(f, "%s >=%s: %u", first ? "" : ",", format_timespan(buf, sizeof(buf), UINT64_C(1) << i, 1), h[i]);
+                else
+                        fprintf(f, "%s <%s: %u", first ? "" : ",", format_timespan(buf, sizeof(buf), UINT64_C(1) << (i + 1), 1), h[i]);
+
+                first = false;
+        }
+
+        if (!first)
+                fputc('\n', f);
+}
+
+void source_statistics_dump(const SourceStatistics *st, FILE *f, const char *prefix) {
+        assert(st);
+        assert(f);
+
+        prefix = strempty(prefix);
+
+        fprintf(f, "%sDispatched: %" PRIu64 "\n", prefix, st->n_dispatched);
+
+        dump_times(f, prefix, "Latency", st->n_latency, st->latency_total, st->latency_max);
+        dump_times(f, prefix, "Wall time", st->n_dispatched, st->wall_total, st->wall_max);
+        dump_times(f, prefix, "CPU time", st->n_dispatched, st->cpu_total, st->cpu_max);
+
+        dump_histogram(f, prefix, "Latency", st->latency_histogram);
+        dump_histogram(f, prefix, "Wall time", st->wall_histogram);
+        dump_histogram(f, prefix, "CPU time", st->cpu_histogram);
+}
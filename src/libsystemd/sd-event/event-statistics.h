@@ -0,0 +1,37 @@
+#pragma once
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "time-util.h"
+
+/* Logarithmic histograms, bucket i counts durations in the range 2^i ... 2^(i+1)-1 us, the last one everything
+ * above */
+#define SOURCE_STATISTICS_BUCKETS 32U
+
+/* What is collected for each event source while profiling is turned on for its event loop, see
+ * sd_event_set_profiling() */
+typedef struct SourceStatistics {
+        /* When the event source was last marked pending, 0 if it isn't */
+        usec_t pending_since;
+
+        uint64_t n_dispatched;
+
+        /* The time from being marked pending until the dispatch, only known for sources that are marked pending
+         * before dispatching, i.e. not for exit sources */
+        uint64_t n_latency;
+        usec_t latency_total, latency_max;
+        unsigned latency_histogram[SOURCE_STATISTICS_BUCKETS];
+
+        /* The wall clock and CPU time spent in the callback */
+        usec_t wall_total, wall_max;
+        unsigned wall_histogram[SOURCE_STATISTICS_BUCKETS];
+
+        usec_t cpu_total, cpu_max;
+        unsigned cpu_histogram[SOURCE_STATISTICS_BUCKETS];
+} SourceStatistics;
+
+void source_statistics_add(SourceStatistics *st, usec_t latency, usec_t wall, usec_t cpu);
+void source_statistics_merge(SourceStatistics *to, const SourceStatistics *from);
+void source_statistics_dump(const SourceStatistics *st, FILE *f, const char *prefix);
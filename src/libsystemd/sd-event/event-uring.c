@@ -0,0 +1,322 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "alloc-util.h"
+#include "event-uring.h"
+#include "fd-util.h"
+#include "util.h"
+
+/* We only use the ring if the kernel polls for readiness internally before reading from sockets and pipes, rather
+ * than blocking a kernel thread on each read (which would also make cancellation unreliable), and never drops
+ * completions. Both were added in kernel 5.7 and 5.5, respectively. */
+#if HAVE_LINUX_IO_URING_H && defined(IORING_FEAT_FAST_POLL) && defined(IORING_FEAT_NODROP)
+
+#ifndef __NR_io_uring_setup
+#  if defined __alpha__
+#    define __NR_io_uring_setup 535
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_setup 4425
+#    elif _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_setup 6425
+#    elif _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_setup 5425
+#    endif
+#  else
+#    define __NR_io_uring_setup 425
+#  endif
+#endif
+
+#ifndef __NR_io_uring_enter
+#  if defined __alpha__
+#    define __NR_io_uring_enter 536
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_enter 4426
+#    elif _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_enter 6426
+#    elif _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_enter 5426
+#    endif
+#  else
+#    define __NR_io_uring_enter 426
+#  endif
+#endif
+
+struct Uring {
+        int fd;
+
+        void *sq_ring, *cq_ring;
+        size_t sq_ring_size, cq_ring_size;
+
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        unsigned *sq_head, *sq_tail, *sq_array;
+        unsigned sq_mask, sq_entries;
+
+        /* Entries prepared locally, but not made visible to the kernel yet */
+        unsigned sq_tail_local;
+
+        unsigned *cq_head, *cq_tail;
+        struct io_uring_cqe *cqes;
+        unsigned cq_mask, cq_entries;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_new(Uring **ret, unsigned entries) {
+        _cleanup_(uring_freep) Uring *u = NULL;
+        struct io_uring_params p = {};
+        void *m;
+
+        assert(ret);
+        assert(entries > 0);
+
+        u = new(Uring, 1);
+        if (!u)
+                return -ENOMEM;
+
+        *u = (Uring) {
+                .fd = -1,
+                .sq_ring = MAP_FAILED,
+                .cq_ring = MAP_FAILED,
+                .sqes = MAP_FAILED,
+        };
+
+        u->fd = sys_io_uring_setup(entries, &p);
+        if (u->fd < 0)
+                return -errno;
+
+        u->fd = fd_move_above_stdio(u->fd);
+
+        if ((p.features & (IORING_FEAT_FAST_POLL|IORING_FEAT_NODROP)) != (IORING_FEAT_FAST_POLL|IORING_FEAT_NODROP))
+                return -EOPNOTSUPP;
+
+        u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        /* Kernels since 5.4 always support mapping both rings in one go */
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+                u->sq_ring_size = u->cq_ring_size = MAX(u->sq_ring_size, u->cq_ring_size);
+
+        u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+        if (u->sq_ring == MAP_FAILED)
+                return -errno;
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+                m = u->sq_ring;
+        else {
+                u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+                if (u->cq_ring == MAP_FAILED)
+                        return -errno;
+
+                m = u->cq_ring;
+        }
+
+        u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED)
+                return -errno;
+
+        u->sq_head = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.head);
+        u->sq_tail = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.tail);
+        u->sq_array = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.array);
+        u->sq_mask = *(unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.ring_mask);
+        u->sq_entries = p.sq_entries;
+        u->sq_tail_local = *u->sq_tail;
+
+        u->cq_head = (unsigned*) ((uint8_t*) m + p.cq_off.head);
+        u->cq_tail = (unsigned*) ((uint8_t*) m + p.cq_off.tail);
+        u->cqes = (struct io_uring_cqe*) ((uint8_t*) m + p.cq_off.cqes);
+        u->cq_mask = *(unsigned*) ((uint8_t*) m + p.cq_off.ring_mask);
+        u->cq_entries = p.cq_entries;
+
+        *ret = TAKE_PTR(u);
+        return 0;
+}
+
+Uring *uring_free(Uring *u) {
+        if (!u)
+                return NULL;
+
+        if (u->sqes != MAP_FAILED)
+                (void) munmap(u->sqes, u->sqes_size);
+        if (u->cq_ring != MAP_FAILED)
+                (void) munmap(u->cq_ring, u->cq_ring_size);
+        if (u->sq_ring != MAP_FAILED)
+                (void) munmap(u->sq_ring, u->sq_ring_size);
+
+        safe_close(u->fd);
+
+        return mfree(u);
+}
+
+int uring_get_fd(Uring *u) {
+        assert(u);
+
+        return u->fd;
+}
+
+unsigned uring_get_cq_entries(Uring *u) {
+        assert(u);
+
+        return u->cq_entries;
+}
+
+static int uring_get_sqe(Uring *u, struct io_uring_sqe **ret) {
+        unsigned idx;
+        int r;
+
+        assert(u);
+        assert(ret);
+
+        if (u->sq_tail_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+                /* The submission queue is full, hand what we have to the kernel first */
+                r = uring_submit(u);
+                if (r < 0)
+                        return r;
+
+                if (u->sq_tail_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+                        return -EAGAIN;
+        }
+
+        idx = u->sq_tail_local & u->sq_mask;
+        u->sq_array[idx] = idx;
+        u->sq_tail_local++;
+
+        *ret = memzero(u->sqes + idx, sizeof(struct io_uring_sqe));
+        return 0;
+}
+
+int uring_prep_readv(Uring *u, int fd, const struct iovec *iov, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        int r;
+
+        assert(u);
+        assert(fd >= 0);
+        assert(iov);
+
+        r = uring_get_sqe(u, &sqe);
+        if (r < 0)
+                return r;
+
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->off = (uint64_t) -1; /* read from the current file position, like read() */
+        sqe->addr = (uint64_t) (uintptr_t) iov;
+        sqe->len = 1;
+        sqe->user_data = user_data;
+
+        return 0;
+}
+
+int uring_prep_cancel(Uring *u, uint64_t target, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        int r;
+
+        assert(u);
+
+        r = uring_get_sqe(u, &sqe);
+        if (r < 0)
+                return r;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+
+        return 0;
+}
+
+int uring_submit(Uring *u) {
+        unsigned n;
+        int r;
+
+        assert(u);
+
+        __atomic_store_n(u->sq_tail, u->sq_tail_local, __ATOMIC_RELEASE);
+
+        n = u->sq_tail_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (n == 0)
+                return 0;
+
+        do
+                r = sys_io_uring_enter(u->fd, n, 0, 0);
+        while (r < 0 && errno == EINTR);
+        if (r < 0)
+                return -errno;
+
+        return r;
+}
+
+bool uring_get_completion(Uring *u, uint64_t *ret_user_data, int32_t *ret_result) {
+        struct io_uring_cqe *cqe;
+        unsigned head;
+
+        assert(u);
+        assert(ret_user_data);
+        assert(ret_result);
+
+        head = *u->cq_head;
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+                return false;
+
+        cqe = u->cqes + (head & u->cq_mask);
+        *ret_user_data = cqe->user_data;
+        *ret_result = cqe->res;
+
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+}
+
+#else
+
+int uring_new(Uring **ret, unsigned entries) {
+        return -EOPNOTSUPP;
+}
+
+Uring *uring_free(Uring *u) {
+        assert(!u);
+        return NULL;
+}
+
+int uring_get_fd(Uring *u) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+unsigned uring_get_cq_entries(Uring *u) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+int uring_prep_readv(Uring *u, int fd, const struct iovec *iov, uint64_t user_data) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+int uring_prep_cancel(Uring *u, uint64_t target, uint64_t user_data) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+int uring_submit(Uring *u) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+bool uring_get_completion(Uring *u, uint64_t *ret_user_data, int32_t *ret_result) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+#endif
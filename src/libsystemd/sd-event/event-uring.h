@@ -0,0 +1,26 @@
+#pragma once
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "macro.h"
+
+/* A minimal io_uring instance, only covering what sd-event needs. Submissions are queued locally and handed to the
+ * kernel in one go with uring_submit(), completions are picked up from the shared ring without any system call. */
+
+typedef struct Uring Uring;
+
+int uring_new(Uring **ret, unsigned entries);
+Uring *uring_free(Uring *u);
+DEFINE_TRIVIAL_CLEANUP_FUNC(Uring*, uring_free);
+
+int uring_get_fd(Uring *u) _pure_;
+unsigned uring_get_cq_entries(Uring *u) _pure_;
+
+int uring_prep_readv(Uring *u, int fd, const struct iovec *iov, uint64_t user_data);
+int uring_prep_cancel(Uring *u, uint64_t target, uint64_t user_data);
+int uring_submit(Uring *u);
+
+bool uring_get_completion(Uring *u, uint64_t *ret_user_data, int32_t *ret_result);
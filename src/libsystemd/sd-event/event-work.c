@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "alloc-util.h"
+#include "event-work.h"
+#include "macro.h"
+#include "time-util.h"
+
+/* The thread pool is shared by all event loops of the process. Work is expected to block on I/O about as often as
+ * it burns CPU, hence we don't derive the number of threads from the number of CPUs. */
+#define WORK_THREADS_MAX 16U
+
+/* Threads exit again after having nothing to do for this long */
+#define WORK_THREAD_IDLE_USEC (30 * USEC_PER_SEC)
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_finished = PTHREAD_COND_INITIALIZER;
+
+static LIST_HEAD(WorkItem, pool_queue);
+static WorkItem *pool_queue_tail;
+static unsigned pool_n_queued, pool_n_threads, pool_n_idle;
+
+static void pool_reset_after_fork(void) {
+        /* The worker threads didn't survive the fork(), and whatever is queued belongs to event loops of the parent,
+         * which cannot be used in the child anyway. Let's start from scratch. */
+
+        pool_mutex = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+        pool_queued = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+        pool_finished = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+
+        pool_queue = pool_queue_tail = NULL;
+        pool_n_queued = pool_n_threads = pool_n_idle = 0;
+}
+
+static void pool_setup(void) {
+        assert_se(pthread_atfork(NULL, NULL, pool_reset_after_fork) == 0);
+}
+
+static void pool_dequeue(WorkItem *w) {
+        assert(w);
+        assert(w->state == WORK_QUEUED);
+        assert(pool_n_queued > 0);
+
+        if (pool_queue_tail == w)
+                pool_queue_tail = w->items_prev;
+
+        LIST_REMOVE(items, pool_queue, w);
+        pool_n_queued--;
+}
+
+static void *worker_thread(void *p) {
+        assert_se(pthread_mutex_lock(&pool_mutex) == 0);
+
+        for (;;) {
+                WorkItem *w;
+                int r;
+
+                if (!pool_queue) {
+                        struct timespec ts;
+
+                        pool_n_idle++;
+                        r = pthread_cond_timedwait(&pool_queued, &pool_mutex,
+                                                   timespec_store(&ts, now(CLOCK_REALTIME) + WORK_THREAD_IDLE_USEC));
+                        pool_n_idle--;
+
+                        if (r == ETIMEDOUT && !pool_queue)
+                                break;
+
+                        continue;
+                }
+
+                w = pool_queue;
+                pool_dequeue(w);
+                w->state = WORK_RUNNING;
+
+                assert_se(pthread_mutex_unlock(&pool_mutex) == 0);
+                r = w->work(w->userdata);
+                assert_se(pthread_mutex_lock(&pool_mutex) == 0);
+
+                w->result = r;
+                w->state = WORK_COMPLETED;
+                LIST_PREPEND(items, w->data->completed, w);
+
+                /* Wake up the event loop while we still hold the lock: as soon as we let go of it the item might be
+                 * freed, and the event loop along with its eventfd might go away. */
+                (void) eventfd_write(w->data->fd, 1);
+
+                assert_se(pthread_cond_broadcast(&pool_finished) == 0);
+        }
+
+        pool_n_threads--;
+        assert_se(pthread_mutex_unlock(&pool_mutex) == 0);
+
+        return NULL;
+}
+
+static int pool_start_thread(void) {
+        sigset_t ss, saved_ss;
+        pthread_attr_t a;
+        pthread_t t;
+        int r, k;
+
+        if (sigfillset(&ss) < 0)
+                return -errno;
+
+        /* No signals in worker threads please, they are for the event loops to handle. We set the mask before
+         * creating the thread, so that it never exists with a different mask than a fully blocked one. */
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r > 0)
+                return -r;
+
+        r = pthread_attr_init(&a);
+        if (r > 0)
+                goto finish;
+
+        r = pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+        if (r == 0)
+                r = pthread_create(&t, &a, worker_thread, NULL);
+
+        (void) pthread_attr_destroy(&a);
+
+finish:
+        k = pthread_sigmask(SIG_SETMASK, &saved_ss, NULL);
+        if (r > 0)
+                return -r;
+        if (k > 0)
+                return -k;
+
+        pool_n_threads++;
+        return 0;
+}
+
+int work_pool_submit(WorkItem *w) {
+        int r = 0;
+
+        assert(w);
+        assert(w->state == WORK_NEW);
+        assert(w->work);
+        assert(w->data);
+
+        assert_se(pthread_once(&pool_once, pool_setup) == 0);
+        assert_se(pthread_mutex_lock(&pool_mutex) == 0);
+
+        /* Start another thread, unless the idle ones suffice to pick up everything queued including this item. If
+         * that fails, we can still make do with the threads we already have. */
+        if (pool_n_idle <= pool_n_queued && pool_n_threads < WORK_THREADS_MAX) {
+                r = pool_start_thread();
+                if (r < 0 && pool_n_threads > 0)
+                        r = 0;
+                if (r < 0)
+                        goto finish;
+        }
+
+        LIST_INSERT_AFTER(items, pool_queue, pool_queue_tail, w);
+        pool_queue_tail = w;
+        pool_n_queued++;
+
+        w->state = WORK_QUEUED;
+
+        assert_se(pthread_cond_signal(&pool_queued) == 0);
+
+finish:
+        assert_se(pthread_mutex_unlock(&pool_mutex) == 0);
+        return r;
+}
+
+void work_pool_cancel(WorkItem *w) {
+        assert(w);
+
+        /* Takes the item out of the pool, so that it can be freed. If the item is being worked on right now, we have to
+         * wait for that to finish, as the work function still uses its userdata. */
+
+        if (IN_SET(w->state, WORK_NEW, WORK_DONE))
+                return;
+
+        assert_se(pthread_mutex_lock(&pool_mutex) == 0);
+
+        if (w->state == WORK_QUEUED)
+                pool_dequeue(w);
+
+        while (w->state == WORK_RUNNING)
+                assert_se(pthread_cond_wait(&pool_finished, &pool_mutex) == 0);
+
+        if (w->state == WORK_COMPLETED)
+                LIST_REMOVE(items, w->data->completed, w);
+
+        w->state = WORK_DONE;
+
+        assert_se(pthread_mutex_unlock(&pool_mutex) == 0);
+}
+
+WorkItem *work_pool_steal_completed(struct work_data *d) {
+        WorkItem *l, *w;
+
+        assert(d);
+
+        /* Returns the list of items completed since the last call. The pool doesn't touch them anymore, hence the
+         * event loop may process the list without holding the lock. */
+
+        assert_se(pthread_mutex_lock(&pool_mutex) == 0);
+
+        l = TAKE_PTR(d->completed);
+        LIST_FOREACH(items, w, l)
+                w->state = WORK_DONE;
+
+        assert_se(pthread_mutex_unlock(&pool_mutex) == 0);
+
+        return l;
+}
@@ -0,0 +1,36 @@
+#pragma once
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include "sd-event.h"
+
+#include "event-source.h"
+#include "list.h"
+
+typedef enum WorkState {
+        WORK_NEW,
+        WORK_QUEUED,    /* in the queue of the thread pool */
+        WORK_RUNNING,   /* picked up by a worker thread */
+        WORK_COMPLETED, /* in the completion queue of the event loop */
+        WORK_DONE,      /* collected by the event loop */
+} WorkState;
+
+struct WorkItem {
+        WorkState state;
+
+        sd_event_work_handler_t work;
+        void *userdata;
+        int result;
+
+        /* Where to queue the item when it is finished, and the event source to dispatch then. Only the event loop
+         * looks at the latter. */
+        struct work_data *data;
+        sd_event_source *source;
+
+        /* Either in the queue of the thread pool, or in the completion queue of the event loop */
+        LIST_FIELDS(WorkItem, items);
+};
+
+int work_pool_submit(WorkItem *w);
+void work_pool_cancel(WorkItem *w);
+
+WorkItem *work_pool_steal_completed(struct work_data *d);
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <stdio_ext.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
 
@@ -9,10 +11,16 @@
 #include "sd-id128.h"
 
 #include "alloc-util.h"
+#include "env-util.h"
 #include "event-source.h"
+#include "event-statistics.h"
+#include "event-uring.h"
+#include "event-work.h"
 #include "fd-util.h"
+#include "fileio.h"
 #include "fs-util.h"
 #include "hashmap.h"
+#include "io-util.h"
 #include "list.h"
 #include "macro.h"
 #include "missing.h"
@@ -27,6 +35,12 @@
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* Size of the submission queue of the io_uring used for io_read sources, the completion queue is twice as large */
+#define URING_ENTRIES 256U
+
+/* Timers at least this coarse are kept in a timer wheel rather than in a prioq */
+#define TIMER_WHEEL_ACCURACY_USEC USEC_PER_MSEC
+
 static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX] = {
         [SOURCE_IO] = "io",
         [SOURCE_TIME_REALTIME] = "realtime",
@@ -41,6 +55,8 @@ static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX]
         [SOURCE_EXIT] = "exit",
         [SOURCE_WATCHDOG] = "watchdog",
         [SOURCE_INOTIFY] = "inotify",
+        [SOURCE_WORK] = "work",
+        [SOURCE_IO_READ] = "io-read",
 };
 
 DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(event_source_type, int);
@@ -85,6 +101,12 @@ struct sd_event {
         /* A list of inotify objects that already have events buffered which aren't processed yet */
         LIST_HEAD(struct inotify_data, inotify_data_buffered);
 
+        /* The completion queue for work sources, allocated when the first one is added */
+        struct work_data *work_data;
+
+        /* The io_uring for io_read sources, allocated when the first one is added */
+        struct uring_data *uring_data;
+
         pid_t original_pid;
 
         uint64_t iteration;
@@ -95,6 +117,9 @@ struct sd_event {
         bool need_process_child:1;
         bool watchdog:1;
         bool profile_delays:1;
+        bool timer_wheel:1;
+        bool io_uring:1;
+        bool profiling:1;
 
         int exit_code;
 
@@ -109,6 +134,12 @@ struct sd_event {
 
         usec_t last_run, last_log;
         unsigned delays[sizeof(usec_t) * 8];
+
+        /* When profiling was enabled, and the statistics of the event sources freed since, indexed by
+         * EventSourceType */
+        usec_t profiling_since;
+        uint64_t profiling_iteration;
+        SourceStatistics *statistics_freed;
 };
 
 static thread_local sd_event *default_event = NULL;
@@ -230,6 +261,37 @@ static int exit_prioq_compare(const void *a, const void *b) {
         return CMP(x->priority, y->priority);
 }
 
+static void free_work_data(struct work_data *d) {
+        if (!d)
+                return;
+
+        assert(d->wakeup == WAKEUP_WORK_DATA);
+        assert(!d->completed);
+
+        safe_close(d->fd);
+        free(d);
+}
+
+static void free_uring_data(struct uring_data *d) {
+        IoReadBuffer *b;
+
+        if (!d)
+                return;
+
+        assert(d->wakeup == WAKEUP_URING_DATA);
+        assert(!d->submit_queue);
+
+        /* Closing the ring cancels all reads still in flight, only then their buffers may go */
+        uring_free(d->uring);
+
+        while ((b = d->orphans)) {
+                LIST_REMOVE(orphans, d->orphans, b);
+                free(b);
+        }
+
+        free(d);
+}
+
 static void free_clock_data(struct clock_data *d) {
         assert(d);
         assert(d->wakeup == WAKEUP_CLOCK_DATA);
@@ -237,6 +299,8 @@ static void free_clock_data(struct clock_data *d) {
         safe_close(d->fd);
         prioq_free(d->earliest);
         prioq_free(d->latest);
+        timer_wheel_free(d->earliest_wheel);
+        timer_wheel_free(d->latest_wheel);
 }
 
 static sd_event *event_free(sd_event *e) {
@@ -252,6 +316,8 @@ static sd_event *event_free(sd_event *e) {
 
         assert(e->n_sources == 0);
 
+        free(e->statistics_freed);
+
         if (e->default_event_ptr)
                 *(e->default_event_ptr) = NULL;
 
@@ -273,6 +339,9 @@ static sd_event *event_free(sd_event *e) {
 
         hashmap_free(e->inotify_data);
 
+        free_work_data(e->work_data);
+        free_uring_data(e->uring_data);
+
         hashmap_free(e->child_sources);
         set_free(e->post_sources);
 
@@ -329,6 +398,22 @@ _public_ int sd_event_new(sd_event** ret) {
                 e->profile_delays = true;
         }
 
+        r = getenv_bool_secure("SD_EVENT_TIMER_WHEEL");
+        if (r < 0 && r != -ENXIO)
+                log_debug_errno(r, "Failed to parse $SD_EVENT_TIMER_WHEEL, ignoring: %m");
+        e->timer_wheel = r > 0;
+
+        r = getenv_bool_secure("SD_EVENT_IO_URING");
+        if (r < 0 && r != -ENXIO)
+                log_debug_errno(r, "Failed to parse $SD_EVENT_IO_URING, ignoring: %m");
+        e->io_uring = r != 0;
+
+        r = getenv_bool_secure("SD_EVENT_PROFILING");
+        if (r < 0 && r != -ENXIO)
+                log_debug_errno(r, "Failed to parse $SD_EVENT_PROFILING, ignoring: %m");
+        if (r > 0)
+                (void) sd_event_set_profiling(e, true);
+
         *ret = e;
         return 0;
 
@@ -397,6 +482,115 @@ static int source_io_register(
         return 0;
 }
 
+static void source_io_read_unregister(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_IO_READ);
+        assert(!s->io_read.uring);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->io_read.registered)
+                return;
+
+        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io_read.fd, NULL);
+        if (r < 0)
+                log_debug_errno(errno, "Failed to remove source %s (type %s) from epoll: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+
+        s->io_read.registered = false;
+}
+
+static int source_io_read_register(sd_event_source *s) {
+        struct epoll_event ev;
+
+        assert(s);
+        assert(s->type == SOURCE_IO_READ);
+        assert(!s->io_read.uring);
+
+        if (s->io_read.registered)
+                return 0;
+
+        ev = (struct epoll_event) {
+                .events = EPOLLIN,
+                .data.ptr = s,
+        };
+
+        if (epoll_ctl(s->event->epoll_fd, EPOLL_CTL_ADD, s->io_read.fd, &ev) < 0)
+                return -errno;
+
+        s->io_read.registered = true;
+
+        return 0;
+}
+
+static void source_io_read_cancel(sd_event_source *s) {
+        IoReadBuffer *b;
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_IO_READ);
+        assert(s->io_read.uring);
+
+        b = s->io_read.buffer;
+        if (!b->in_flight || b->cancelled)
+                return;
+
+        /* If this fails, or the read completes before the cancellation takes effect, the result is kept until the
+         * source is enabled again. */
+        r = uring_prep_cancel(s->event->uring_data->uring, PTR_TO_UINT64(b), 0);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to cancel read of source %s (type %s), ignoring: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+                return;
+        }
+
+        b->cancelled = true;
+}
+
+static int source_io_read_update(sd_event_source *s) {
+        struct uring_data *d;
+
+        assert(s);
+        assert(s->type == SOURCE_IO_READ);
+
+        /* Makes sure a read is issued if the source is enabled and has no result waiting for dispatch, and that no
+         * read is going on otherwise. Called whenever any of that changes. */
+
+        if (!s->io_read.uring) {
+                if (s->enabled == SD_EVENT_OFF) {
+                        source_io_read_unregister(s);
+                        return 0;
+                }
+
+                /* The result of the last read may still be pending, we won't read again before it is dispatched */
+                return source_io_read_register(s);
+        }
+
+        d = s->event->uring_data;
+
+        if (s->enabled != SD_EVENT_OFF && !s->pending && !s->io_read.buffer->in_flight) {
+                if (!s->io_read.queued) {
+                        LIST_PREPEND(io_read.submit_queue, d->submit_queue, s);
+                        s->io_read.queued = true;
+                }
+
+                return 0;
+        }
+
+        if (s->io_read.queued) {
+                LIST_REMOVE(io_read.submit_queue, d->submit_queue, s);
+                s->io_read.queued = false;
+        }
+
+        if (s->enabled == SD_EVENT_OFF)
+                source_io_read_cancel(s);
+
+        return 0;
+}
+
 static clockid_t event_source_type_to_clock(EventSourceType t) {
 
         switch (t) {
@@ -470,6 +664,55 @@ static struct clock_data* event_get_clock_data(sd_event *e, EventSourceType t) {
         }
 }
 
+static bool event_use_timer_wheel(sd_event *e, usec_t accuracy) {
+        assert(e);
+
+        return e->timer_wheel && accuracy >= TIMER_WHEEL_ACCURACY_USEC;
+}
+
+static int clock_data_ensure_timer_wheels(struct clock_data *d, EventSourceType type) {
+        usec_t n;
+
+        assert(d);
+
+        if (d->earliest_wheel && d->latest_wheel)
+                return 0;
+
+        n = now(event_source_type_to_clock(type));
+
+        if (!d->earliest_wheel) {
+                d->earliest_wheel = timer_wheel_new(n);
+                if (!d->earliest_wheel)
+                        return -ENOMEM;
+        }
+
+        if (!d->latest_wheel) {
+                d->latest_wheel = timer_wheel_new(n);
+                if (!d->latest_wheel)
+                        return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static void event_source_time_wheel_update(sd_event_source *s, struct clock_data *d) {
+        assert(s);
+        assert(d);
+
+        if (!s->time.wheel)
+                return;
+
+        /* Unlike the prioqs, the wheels only contain the sources that may trigger a wakeup */
+        if (s->enabled == SD_EVENT_OFF || s->pending || s->time.next == USEC_INFINITY) {
+                timer_wheel_remove(d->earliest_wheel, &s->time.earliest_node);
+                timer_wheel_remove(d->latest_wheel, &s->time.latest_node);
+                return;
+        }
+
+        timer_wheel_add(d->earliest_wheel, &s->time.earliest_node, s->time.next);
+        timer_wheel_add(d->latest_wheel, &s->time.latest_node, time_event_source_latest(s));
+}
+
 static int event_make_signal_data(
                 sd_event *e,
                 int sig,
@@ -672,6 +915,10 @@ static void source_disconnect(sd_event_source *s) {
 
                 prioq_remove(d->earliest, s, &s->time.earliest_index);
                 prioq_remove(d->latest, s, &s->time.latest_index);
+                if (s->time.wheel) {
+                        timer_wheel_remove(d->earliest_wheel, &s->time.earliest_node);
+                        timer_wheel_remove(d->latest_wheel, &s->time.latest_node);
+                }
                 d->needs_rearm = true;
                 break;
         }
@@ -747,6 +994,51 @@ static void source_disconnect(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_WORK:
+                if (s->work.item) {
+                        /* This waits for the work function to return, if it is running right now */
+                        work_pool_cancel(s->work.item);
+                        s->work.item = mfree(s->work.item);
+                }
+
+                break;
+
+        case SOURCE_IO_READ: {
+                struct uring_data *d = s->event->uring_data;
+                IoReadBuffer *b = s->io_read.buffer;
+
+                if (!b)
+                        break;
+
+                if (!s->io_read.uring) {
+                        source_io_read_unregister(s);
+                        s->io_read.buffer = mfree(b);
+                        break;
+                }
+
+                if (s->io_read.queued) {
+                        LIST_REMOVE(io_read.submit_queue, d->submit_queue, s);
+                        s->io_read.queued = false;
+                }
+
+                if (b->in_flight && !event_pid_changed(s->event)) {
+                        /* The kernel might still write to the buffer, keep it until the read completed */
+                        source_io_read_cancel(s);
+
+                        b->source = NULL;
+                        LIST_PREPEND(orphans, d->orphans, b);
+                } else {
+                        free(b);
+
+                        assert(d->n_slots > 0);
+                        d->n_slots--;
+                }
+
+                s->io_read.buffer = NULL;
+                s->io_read.uring = false;
+                break;
+        }
+
         default:
                 assert_not_reached("Wut? I shouldn't exist.");
         }
@@ -757,6 +1049,13 @@ static void source_disconnect(sd_event_source *s) {
         if (s->prepare)
                 prioq_remove(s->event->prepare, s, &s->prepare_index);
 
+        if (s->statistics) {
+                if (s->event->statistics_freed)
+                        source_statistics_merge(&s->event->statistics_freed[s->type], s->statistics);
+
+                s->statistics = mfree(s->statistics);
+        }
+
         event = s->event;
 
         s->type = _SOURCE_EVENT_SOURCE_TYPE_INVALID;
@@ -784,6 +1083,20 @@ static void source_free(sd_event_source *s) {
 }
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_source*, source_free);
 
+static SourceStatistics *source_get_statistics(sd_event_source *s) {
+        assert(s);
+        assert(s->event);
+
+        if (!s->event->profiling)
+                return NULL;
+
+        /* If this fails we simply don't collect anything for this event source */
+        if (!s->statistics)
+                s->statistics = new0(SourceStatistics, 1);
+
+        return s->statistics;
+}
+
 static int source_set_pending(sd_event_source *s, bool b) {
         int r;
 
@@ -803,9 +1116,21 @@ static int source_set_pending(sd_event_source *s, bool b) {
                         s->pending = false;
                         return r;
                 }
-        } else
+
+                if (s->event->profiling) {
+                        SourceStatistics *st;
+
+                        st = source_get_statistics(s);
+                        if (st)
+                                st->pending_since = now(CLOCK_MONOTONIC);
+                }
+        } else {
                 assert_se(prioq_remove(s->event->pending, s, &s->pending_index));
 
+                if (s->statistics)
+                        s->statistics->pending_since = 0;
+        }
+
         if (EVENT_SOURCE_IS_TIME(s->type)) {
                 struct clock_data *d;
 
@@ -814,6 +1139,7 @@ static int source_set_pending(sd_event_source *s, bool b) {
 
                 prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
                 prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                event_source_time_wheel_update(s, d);
                 d->needs_rearm = true;
         }
 
@@ -909,6 +1235,109 @@ _public_ int sd_event_add_io(
         return 0;
 }
 
+static int event_make_uring_data(sd_event *e) {
+        _cleanup_(uring_freep) Uring *u = NULL;
+        _cleanup_free_ struct uring_data *d = NULL;
+        struct epoll_event ev;
+        int r;
+
+        assert(e);
+
+        if (e->uring_data)
+                return 1;
+
+        if (!e->io_uring)
+                return 0;
+
+        r = uring_new(&u, URING_ENTRIES);
+        if (r < 0) {
+                /* Old kernel, seccomp, or io_uring turned off via sysctl. Don't try again. */
+                log_debug_errno(r, "Failed to set up io_uring, reading via epoll instead: %m");
+                e->io_uring = false;
+                return 0;
+        }
+
+        d = new(struct uring_data, 1);
+        if (!d)
+                return -ENOMEM;
+
+        *d = (struct uring_data) {
+                .wakeup = WAKEUP_URING_DATA,
+        };
+
+        ev = (struct epoll_event) {
+                .events = EPOLLIN,
+                .data.ptr = d,
+        };
+
+        if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, uring_get_fd(u), &ev) < 0)
+                return -errno;
+
+        d->uring = TAKE_PTR(u);
+        e->uring_data = TAKE_PTR(d);
+        return 1;
+}
+
+_public_ int sd_event_add_io_read(
+                sd_event *e,
+                sd_event_source **ret,
+                int fd,
+                size_t size,
+                sd_event_io_read_handler_t callback,
+                void *userdata) {
+
+        _cleanup_(source_freep) sd_event_source *s = NULL;
+        IoReadBuffer *b;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(fd >= 0, -EBADF);
+        assert_return(size > 0 && size <= INT32_MAX, -EINVAL);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        r = event_make_uring_data(e);
+        if (r < 0)
+                return r;
+
+        s = source_new(e, !ret, SOURCE_IO_READ);
+        if (!s)
+                return -ENOMEM;
+
+        b = malloc(offsetof(IoReadBuffer, data) + size);
+        if (!b)
+                return -ENOMEM;
+
+        *b = (IoReadBuffer) {
+                .source = s,
+                .iov = IOVEC_MAKE(b->data, size),
+        };
+
+        s->wakeup = WAKEUP_EVENT_SOURCE;
+        s->io_read.fd = fd;
+        s->io_read.buffer = b;
+        s->io_read.callback = callback;
+        s->userdata = userdata;
+        s->enabled = SD_EVENT_ON;
+
+        if (e->uring_data && e->uring_data->n_slots < uring_get_cq_entries(e->uring_data->uring) / 2) {
+                s->io_read.uring = true;
+                e->uring_data->n_slots++;
+        }
+
+        r = source_io_read_update(s);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
 static void initialize_perturb(sd_event *e) {
         sd_id128_t bootid = {};
 
@@ -981,6 +1410,7 @@ _public_ int sd_event_add_time(
         EventSourceType type;
         _cleanup_(source_freep) sd_event_source *s = NULL;
         struct clock_data *d;
+        bool wheel;
         int r;
 
         assert_return(e, -EINVAL);
@@ -999,6 +1429,9 @@ _public_ int sd_event_add_time(
         if (!callback)
                 callback = time_exit_callback;
 
+        if (accuracy == 0)
+                accuracy = DEFAULT_ACCURACY_USEC;
+
         d = event_get_clock_data(e, type);
         assert(d);
 
@@ -1010,6 +1443,13 @@ _public_ int sd_event_add_time(
         if (r < 0)
                 return r;
 
+        wheel = event_use_timer_wheel(e, accuracy);
+        if (wheel) {
+                r = clock_data_ensure_timer_wheels(d, type);
+                if (r < 0)
+                        return r;
+        }
+
         if (d->fd < 0) {
                 r = event_setup_timer_fd(e, d, clock);
                 if (r < 0)
@@ -1021,21 +1461,26 @@ _public_ int sd_event_add_time(
                 return -ENOMEM;
 
         s->time.next = usec;
-        s->time.accuracy = accuracy == 0 ? DEFAULT_ACCURACY_USEC : accuracy;
+        s->time.accuracy = accuracy;
         s->time.callback = callback;
         s->time.earliest_index = s->time.latest_index = PRIOQ_IDX_NULL;
+        s->time.wheel = wheel;
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
         d->needs_rearm = true;
 
-        r = prioq_put(d->earliest, s, &s->time.earliest_index);
-        if (r < 0)
-                return r;
+        if (wheel)
+                event_source_time_wheel_update(s, d);
+        else {
+                r = prioq_put(d->earliest, s, &s->time.earliest_index);
+                if (r < 0)
+                        return r;
 
-        r = prioq_put(d->latest, s, &s->time.latest_index);
-        if (r < 0)
-                return r;
+                r = prioq_put(d->latest, s, &s->time.latest_index);
+                if (r < 0)
+                        return r;
+        }
 
         if (ret)
                 *ret = s;
@@ -1229,46 +1674,141 @@ _public_ int sd_event_add_post(
         s->userdata = userdata;
         s->enabled = SD_EVENT_ON;
 
-        r = set_put(e->post_sources, s);
-        if (r < 0)
-                return r;
+        r = set_put(e->post_sources, s);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
+_public_ int sd_event_add_exit(
+                sd_event *e,
+                sd_event_source **ret,
+                sd_event_handler_t callback,
+                void *userdata) {
+
+        _cleanup_(source_freep) sd_event_source *s = NULL;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(callback, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        r = prioq_ensure_allocated(&e->exit, exit_prioq_compare);
+        if (r < 0)
+                return r;
+
+        s = source_new(e, !ret, SOURCE_EXIT);
+        if (!s)
+                return -ENOMEM;
+
+        s->exit.callback = callback;
+        s->userdata = userdata;
+        s->exit.prioq_index = PRIOQ_IDX_NULL;
+        s->enabled = SD_EVENT_ONESHOT;
+
+        r = prioq_put(s->event->exit, s, &s->exit.prioq_index);
+        if (r < 0)
+                return r;
+
+        if (ret)
+                *ret = s;
+        TAKE_PTR(s);
+
+        return 0;
+}
+
+static int event_make_work_data(sd_event *e) {
+        _cleanup_free_ struct work_data *d = NULL;
+        struct epoll_event ev;
+        int fd;
+
+        assert(e);
+
+        if (e->work_data)
+                return 0;
+
+        fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        fd = fd_move_above_stdio(fd);
+
+        d = new(struct work_data, 1);
+        if (!d) {
+                safe_close(fd);
+                return -ENOMEM;
+        }
+
+        *d = (struct work_data) {
+                .wakeup = WAKEUP_WORK_DATA,
+                .fd = fd,
+        };
+
+        ev = (struct epoll_event) {
+                .events = EPOLLIN,
+                .data.ptr = d,
+        };
 
-        if (ret)
-                *ret = s;
-        TAKE_PTR(s);
+        if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, d->fd, &ev) < 0) {
+                safe_close(d->fd);
+                return -errno;
+        }
 
-        return 0;
+        e->work_data = TAKE_PTR(d);
+        return 1;
 }
 
-_public_ int sd_event_add_exit(
+_public_ int sd_event_add_work(
                 sd_event *e,
                 sd_event_source **ret,
-                sd_event_handler_t callback,
+                sd_event_work_handler_t work,
+                sd_event_work_done_handler_t callback,
                 void *userdata) {
 
         _cleanup_(source_freep) sd_event_source *s = NULL;
+        WorkItem *w;
         int r;
 
         assert_return(e, -EINVAL);
         assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(work, -EINVAL);
         assert_return(callback, -EINVAL);
         assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
         assert_return(!event_pid_changed(e), -ECHILD);
 
-        r = prioq_ensure_allocated(&e->exit, exit_prioq_compare);
+        r = event_make_work_data(e);
         if (r < 0)
                 return r;
 
-        s = source_new(e, !ret, SOURCE_EXIT);
+        s = source_new(e, !ret, SOURCE_WORK);
         if (!s)
                 return -ENOMEM;
 
-        s->exit.callback = callback;
+        s->work.callback = callback;
         s->userdata = userdata;
-        s->exit.prioq_index = PRIOQ_IDX_NULL;
         s->enabled = SD_EVENT_ONESHOT;
 
-        r = prioq_put(s->event->exit, s, &s->exit.prioq_index);
+        w = new(WorkItem, 1);
+        if (!w)
+                return -ENOMEM;
+
+        *w = (WorkItem) {
+                .state = WORK_NEW,
+                .work = work,
+                .userdata = userdata,
+                .data = e->work_data,
+                .source = s,
+        };
+        s->work.item = w;
+
+        r = work_pool_submit(w);
         if (r < 0)
                 return r;
 
@@ -1976,7 +2516,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
         if (m == SD_EVENT_OFF) {
 
                 /* Unset the pending flag when this event source is disabled */
-                if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
+                if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT, SOURCE_WORK, SOURCE_IO_READ)) {
                         r = source_set_pending(s, false);
                         if (r < 0)
                                 return r;
@@ -1989,6 +2529,11 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         s->enabled = m;
                         break;
 
+                case SOURCE_IO_READ:
+                        s->enabled = m;
+                        (void) source_io_read_update(s);
+                        break;
+
                 case SOURCE_TIME_REALTIME:
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
@@ -2002,6 +2547,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                         prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
                         prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                        event_source_time_wheel_update(s, d);
                         d->needs_rearm = true;
                         break;
                 }
@@ -2029,6 +2575,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_DEFER:
                 case SOURCE_POST:
                 case SOURCE_INOTIFY:
+                case SOURCE_WORK:
                         s->enabled = m;
                         break;
 
@@ -2039,7 +2586,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
         } else {
 
                 /* Unset the pending flag when this event source is enabled */
-                if (s->enabled == SD_EVENT_OFF && !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
+                if (s->enabled == SD_EVENT_OFF && !IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT, SOURCE_WORK, SOURCE_IO_READ)) {
                         r = source_set_pending(s, false);
                         if (r < 0)
                                 return r;
@@ -2055,6 +2602,17 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         s->enabled = m;
                         break;
 
+                case SOURCE_IO_READ:
+                        s->enabled = m;
+
+                        r = source_io_read_update(s);
+                        if (r < 0) {
+                                s->enabled = SD_EVENT_OFF;
+                                return r;
+                        }
+
+                        break;
+
                 case SOURCE_TIME_REALTIME:
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
@@ -2068,6 +2626,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                         prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
                         prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                        event_source_time_wheel_update(s, d);
                         d->needs_rearm = true;
                         break;
                 }
@@ -2110,6 +2669,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_DEFER:
                 case SOURCE_POST:
                 case SOURCE_INOTIFY:
+                case SOURCE_WORK:
                         s->enabled = m;
                         break;
 
@@ -2157,6 +2717,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
 
         prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
         prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        event_source_time_wheel_update(s, d);
         d->needs_rearm = true;
 
         return 0;
@@ -2174,6 +2735,7 @@ _public_ int sd_event_source_get_time_accuracy(sd_event_source *s, uint64_t *use
 
 _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec) {
         struct clock_data *d;
+        bool wheel;
         int r;
 
         assert_return(s, -EINVAL);
@@ -2189,12 +2751,40 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         if (usec == 0)
                 usec = DEFAULT_ACCURACY_USEC;
 
-        s->time.accuracy = usec;
-
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
+        /* The accuracy decides whether the source belongs into the prioqs or the timer wheels, move it over if
+         * that changes */
+        wheel = event_use_timer_wheel(s->event, usec);
+        if (wheel && !s->time.wheel) {
+                r = clock_data_ensure_timer_wheels(d, s->type);
+                if (r < 0)
+                        return r;
+
+                prioq_remove(d->earliest, s, &s->time.earliest_index);
+                prioq_remove(d->latest, s, &s->time.latest_index);
+
+        } else if (!wheel && s->time.wheel) {
+                r = prioq_put(d->earliest, s, &s->time.earliest_index);
+                if (r < 0)
+                        return r;
+
+                r = prioq_put(d->latest, s, &s->time.latest_index);
+                if (r < 0) {
+                        prioq_remove(d->earliest, s, &s->time.earliest_index);
+                        return r;
+                }
+
+                timer_wheel_remove(d->earliest_wheel, &s->time.earliest_node);
+                timer_wheel_remove(d->latest_wheel, &s->time.latest_node);
+        }
+
+        s->time.accuracy = usec;
+        s->time.wheel = wheel;
+
         prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        event_source_time_wheel_update(s, d);
         d->needs_rearm = true;
 
         return 0;
@@ -2364,8 +2954,9 @@ static int event_arm_timer(
                 struct clock_data *d) {
 
         struct itimerspec its = {};
+        usec_t earliest = USEC_INFINITY, latest = USEC_INFINITY, t;
         sd_event_source *a, *b;
-        usec_t t;
+        TimerWheelNode *n;
         int r;
 
         assert(e);
@@ -2377,7 +2968,25 @@ static int event_arm_timer(
                 d->needs_rearm = false;
 
         a = prioq_peek(d->earliest);
-        if (!a || a->enabled == SD_EVENT_OFF || a->time.next == USEC_INFINITY) {
+        if (a && a->enabled != SD_EVENT_OFF && a->time.next != USEC_INFINITY) {
+                b = prioq_peek(d->latest);
+                assert_se(b && b->enabled != SD_EVENT_OFF);
+
+                earliest = a->time.next;
+                latest = time_event_source_latest(b);
+        }
+
+        /* The timer wheels only contain enabled, non-pending sources, and return the exact minimum, hence we can
+         * combine them with the prioqs and still pick the same wakeup time as if all sources were in the latter */
+        n = timer_wheel_peek(d->earliest_wheel);
+        if (n)
+                earliest = MIN(earliest, n->key);
+
+        n = timer_wheel_peek(d->latest_wheel);
+        if (n)
+                latest = MIN(latest, n->key);
+
+        if (earliest == USEC_INFINITY) {
 
                 if (d->fd < 0)
                         return 0;
@@ -2394,10 +3003,7 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert_se(b && b->enabled != SD_EVENT_OFF);
-
-        t = sleep_between(e, a->time.next, time_event_source_latest(b));
+        t = sleep_between(e, earliest, latest);
         if (d->next == t)
                 return 0;
 
@@ -2468,6 +3074,7 @@ static int process_timer(
                 usec_t n,
                 struct clock_data *d) {
 
+        TimerWheelNode *node;
         sd_event_source *s;
         int r;
 
@@ -2491,6 +3098,24 @@ static int process_timer(
                 d->needs_rearm = true;
         }
 
+        if (!d->earliest_wheel)
+                return 0;
+
+        timer_wheel_set_base(d->earliest_wheel, usec_add(n, 1));
+        timer_wheel_set_base(d->latest_wheel, usec_add(n, 1));
+
+        while ((node = timer_wheel_pop_expired(d->earliest_wheel))) {
+                s = container_of(node, sd_event_source, time.earliest_node);
+
+                r = source_set_pending(s, true);
+                if (r < 0) {
+                        event_source_time_wheel_update(s, d);
+                        return r;
+                }
+
+                d->needs_rearm = true;
+        }
+
         return 0;
 }
 
@@ -2774,8 +3399,192 @@ static int process_inotify(sd_event *e) {
         return done;
 }
 
+static int process_work(sd_event *e, struct work_data *d, uint32_t events) {
+        WorkItem *l, *w;
+        eventfd_t x;
+        int r = 0;
+
+        assert(e);
+        assert(d);
+        assert_return(events == EPOLLIN, -EIO);
+
+        if (eventfd_read(d->fd, &x) < 0 && !IN_SET(errno, EAGAIN, EINTR))
+                return -errno;
+
+        l = work_pool_steal_completed(d);
+        while ((w = l)) {
+                sd_event_source *s = w->source;
+                int k;
+
+                LIST_REMOVE(items, l, w);
+
+                assert(s->type == SOURCE_WORK);
+                assert(s->work.item == w);
+
+                s->work.result = w->result;
+                s->work.item = mfree(w);
+
+                k = source_set_pending(s, true);
+                if (k < 0 && r >= 0)
+                        r = k;
+        }
+
+        return r;
+}
+
+static int process_io_read(sd_event *e, sd_event_source *s, uint32_t revents) {
+        ssize_t n;
+
+        assert(e);
+        assert(s);
+        assert(s->type == SOURCE_IO_READ);
+        assert(!s->io_read.uring);
+
+        /* Don't read again before the previous result has been dispatched */
+        if (s->pending)
+                return 0;
+
+        n = read(s->io_read.fd, s->io_read.buffer->data, s->io_read.buffer->iov.iov_len);
+        if (n < 0) {
+                if (IN_SET(errno, EAGAIN, EINTR))
+                        return 0;
+
+                n = -errno;
+        }
+
+        s->io_read.result = n;
+        return source_set_pending(s, true);
+}
+
+static int process_uring(sd_event *e, struct uring_data *d, uint32_t events) {
+        uint64_t user_data;
+        int32_t res;
+        int r = 0;
+
+        assert(e);
+        assert(d);
+        assert_return(events == EPOLLIN, -EIO);
+
+        while (uring_get_completion(d->uring, &user_data, &res)) {
+                sd_event_source *s;
+                IoReadBuffer *b;
+                bool cancelled;
+                int k;
+
+                /* Cancellation requests are submitted with zero user data, we don't care about their outcome */
+                if (user_data == 0)
+                        continue;
+
+                b = UINT64_TO_PTR(user_data);
+                cancelled = b->cancelled;
+                b->in_flight = b->cancelled = false;
+
+                s = b->source;
+                if (!s) {
+                        LIST_REMOVE(orphans, d->orphans, b);
+                        free(b);
+
+                        assert(d->n_slots > 0);
+                        d->n_slots--;
+                        continue;
+                }
+
+                assert(s->type == SOURCE_IO_READ);
+                assert(s->io_read.buffer == b);
+
+                if (cancelled && IN_SET(res, -ECANCELED, -EINTR)) {
+                        /* Maybe the source was enabled again in the meantime */
+                        k = source_io_read_update(s);
+                        if (k < 0 && r >= 0)
+                                r = k;
+                        continue;
+                }
+
+                s->io_read.result = res;
+
+                k = source_set_pending(s, true);
+                if (k < 0) {
+                        (void) source_io_read_update(s);
+                        if (r >= 0)
+                                r = k;
+                }
+        }
+
+        return r;
+}
+
+static int event_submit_uring(sd_event *e) {
+        struct uring_data *d = e->uring_data;
+        sd_event_source *s;
+        int r;
+
+        assert(e);
+
+        if (!d)
+                return 0;
+
+        /* Queue the reads of all sources that became ready for another one during this iteration, and hand them,
+         * together with any cancellations, to the kernel in a single system call */
+        while ((s = d->submit_queue)) {
+                IoReadBuffer *b = s->io_read.buffer;
+
+                r = uring_prep_readv(d->uring, s->io_read.fd, &b->iov, PTR_TO_UINT64(b));
+                if (r < 0)
+                        return r;
+
+                LIST_REMOVE(io_read.submit_queue, d->submit_queue, s);
+                s->io_read.queued = false;
+                b->in_flight = true;
+        }
+
+        r = uring_submit(d->uring);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+static void source_account_dispatch(
+                sd_event *e,
+                sd_event_source *s,
+                EventSourceType type,
+                usec_t latency,
+                usec_t start,
+                usec_t start_cpu) {
+
+        SourceStatistics *st;
+        usec_t n;
+
+        assert(e);
+        assert(s);
+
+        /* The callback might have turned profiling off */
+        if (!e->profiling)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+
+        /* If the event source was unref'ed by its own callback, its statistics went to the ones of freed event
+         * sources already, hence account the last dispatch there, too */
+        if (s->event)
+                st = source_get_statistics(s);
+        else
+                st = &e->statistics_freed[type];
+        if (!st)
+                return;
+
+        source_statistics_add(st, latency, n - start, now(CLOCK_THREAD_CPUTIME_ID) - start_cpu);
+
+        /* Defer sources (and anything that was marked pending again by the callback) are queued from now on */
+        if (s->event && s->pending)
+                st->pending_since = n;
+}
+
 static int source_dispatch(sd_event_source *s) {
+        usec_t latency = USEC_INFINITY, start = 0, start_cpu = 0;
         EventSourceType saved_type;
+        sd_event *saved_event;
+        bool profiling;
         int r = 0;
 
         assert(s);
@@ -2784,6 +3593,13 @@ static int source_dispatch(sd_event_source *s) {
         /* Save the event source type, here, so that we still know it after the event callback which might invalidate
          * the event. */
         saved_type = s->type;
+        saved_event = s->event;
+
+        /* Remember this now, as the callback might change it */
+        profiling = saved_event->profiling;
+
+        if (profiling && s->statistics && s->statistics->pending_since > 0)
+                latency = usec_sub_unsigned(now(CLOCK_MONOTONIC), s->statistics->pending_since);
 
         if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
                 r = source_set_pending(s, false);
@@ -2814,6 +3630,11 @@ static int source_dispatch(sd_event_source *s) {
                         return r;
         }
 
+        if (profiling) {
+                start = now(CLOCK_MONOTONIC);
+                start_cpu = now(CLOCK_THREAD_CPUTIME_ID);
+        }
+
         s->dispatching = true;
 
         switch (s->type) {
@@ -2882,6 +3703,14 @@ static int source_dispatch(sd_event_source *s) {
                 break;
         }
 
+        case SOURCE_WORK:
+                r = s->work.callback(s, s->work.result, s->userdata);
+                break;
+
+        case SOURCE_IO_READ:
+                r = s->io_read.callback(s, s->io_read.fd, s->io_read.buffer->data, s->io_read.result, s->userdata);
+                break;
+
         case SOURCE_WATCHDOG:
         case _SOURCE_EVENT_SOURCE_TYPE_MAX:
         case _SOURCE_EVENT_SOURCE_TYPE_INVALID:
@@ -2890,6 +3719,9 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (profiling)
+                source_account_dispatch(saved_event, s, saved_type, latency, start, start_cpu);
+
         if (r < 0)
                 log_debug_errno(r, "Event source %s (type %s) returned error, disabling: %m",
                                 strna(s->description), event_source_type_to_string(saved_type));
@@ -2898,6 +3730,15 @@ static int source_dispatch(sd_event_source *s) {
                 source_free(s);
         else if (r < 0)
                 sd_event_source_set_enabled(s, SD_EVENT_OFF);
+        else if (s->type == SOURCE_IO_READ) {
+                /* Now that the buffer has been looked at, we may read into it again */
+                r = source_io_read_update(s);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to read again for event source %s (type %s), disabling: %m",
+                                        strna(s->description), event_source_type_to_string(saved_type));
+                        sd_event_source_set_enabled(s, SD_EVENT_OFF);
+                }
+        }
 
         return 1;
 }
@@ -3116,6 +3957,10 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
         if (e->inotify_data_buffered)
                 timeout = 0;
 
+        r = event_submit_uring(e);
+        if (r < 0)
+                goto finish;
+
         m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
                        timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
         if (m < 0) {
@@ -3139,9 +3984,15 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
 
                         switch (*t) {
 
-                        case WAKEUP_EVENT_SOURCE:
-                                r = process_io(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                        case WAKEUP_EVENT_SOURCE: {
+                                sd_event_source *s = ev_queue[i].data.ptr;
+
+                                if (s->type == SOURCE_IO_READ)
+                                        r = process_io_read(e, s, ev_queue[i].events);
+                                else
+                                        r = process_io(e, s, ev_queue[i].events);
                                 break;
+                        }
 
                         case WAKEUP_CLOCK_DATA: {
                                 struct clock_data *d = ev_queue[i].data.ptr;
@@ -3157,6 +4008,14 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                                 r = event_inotify_data_read(e, ev_queue[i].data.ptr, ev_queue[i].events);
                                 break;
 
+                        case WAKEUP_WORK_DATA:
+                                r = process_work(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                break;
+
+                        case WAKEUP_URING_DATA:
+                                r = process_uring(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                                break;
+
                         default:
                                 assert_not_reached("Invalid wake-up pointer");
                         }
@@ -3497,6 +4356,137 @@ _public_ int sd_event_get_iteration(sd_event *e, uint64_t *ret) {
         return 0;
 }
 
+_public_ int sd_event_set_profiling(sd_event *e, int b) {
+        sd_event_source *s;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->profiling == !!b)
+                return e->profiling;
+
+        if (b) {
+                e->statistics_freed = new0(SourceStatistics, _SOURCE_EVENT_SOURCE_TYPE_MAX);
+                if (!e->statistics_freed)
+                        return -ENOMEM;
+
+                e->profiling_since = now(CLOCK_MONOTONIC);
+                e->profiling_iteration = e->iteration;
+        } else {
+                LIST_FOREACH(sources, s, e->sources)
+                        s->statistics = mfree(s->statistics);
+
+                e->statistics_freed = mfree(e->statistics_freed);
+        }
+
+        e->profiling = b;
+        return e->profiling;
+}
+
+_public_ int sd_event_get_profiling(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->profiling;
+}
+
+typedef struct StatisticsEntry {
+        const SourceStatistics *statistics;
+        EventSourceType type;
+        sd_event_source *source; /* NULL for the event sources freed already */
+} StatisticsEntry;
+
+static int statistics_entry_compare(const void *a, const void *b) {
+        const StatisticsEntry *x = a, *y = b;
+
+        /* Those that took up the most time first */
+        if (x->statistics->wall_total > y->statistics->wall_total)
+                return -1;
+        if (x->statistics->wall_total < y->statistics->wall_total)
+                return 1;
+
+        if (x->statistics->n_dispatched > y->statistics->n_dispatched)
+                return -1;
+        if (x->statistics->n_dispatched < y->statistics->n_dispatched)
+                return 1;
+
+        return 0;
+}
+
+_public_ int sd_event_get_statistics(sd_event *e, char **ret) {
+        _cleanup_free_ StatisticsEntry *entries = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        _cleanup_free_ char *dump = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t n = 0, i, size;
+        sd_event_source *s;
+        EventSourceType t;
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (!e->profiling)
+                return -ENODATA;
+
+        entries = new(StatisticsEntry, e->n_sources + _SOURCE_EVENT_SOURCE_TYPE_MAX);
+        if (!entries)
+                return -ENOMEM;
+
+        LIST_FOREACH(sources, s, e->sources)
+                if (s->statistics && s->statistics->n_dispatched > 0)
+                        entries[n++] = (StatisticsEntry) {
+                                .statistics = s->statistics,
+                                .type = s->type,
+                                .source = s,
+                        };
+
+        for (t = 0; t < _SOURCE_EVENT_SOURCE_TYPE_MAX; t++)
+                if (e->statistics_freed[t].n_dispatched > 0)
+                        entries[n++] = (StatisticsEntry) {
+                                .statistics = e->statistics_freed + t,
+                                .type = t,
+                        };
+
+        qsort_safe(entries, n, sizeof(StatisticsEntry), statistics_entry_compare);
+
+        f = open_memstream(&dump, &size);
+        if (!f)
+                return -errno;
+
+        (void) __fsetlocking(f, FSETLOCKING_BYCALLER);
+
+        fprintf(f, "Collected over %s and %" PRIu64 " iterations.\n",
+                format_timespan(ts, sizeof(ts), usec_sub_unsigned(now(CLOCK_MONOTONIC), e->profiling_since), USEC_PER_MSEC),
+                e->iteration - e->profiling_iteration);
+
+        for (i = 0; i < n; i++) {
+                if (entries[i].source)
+                        fprintf(f, "\n%s (%s, priority %" PRIi64 "):\n",
+                                strna(entries[i].source->description),
+                                event_source_type_to_string(entries[i].type),
+                                entries[i].source->priority);
+                else
+                        fprintf(f, "\nFreed event sources (%s):\n",
+                                event_source_type_to_string(entries[i].type));
+
+                source_statistics_dump(entries[i].statistics, f, "        ");
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return r;
+
+        f = safe_fclose(f);
+
+        *ret = TAKE_PTR(dump);
+        return 0;
+}
+
 _public_ int sd_event_source_set_destroy_callback(sd_event_source *s, sd_event_destroy_t callback) {
         assert_return(s, -EINVAL);
 
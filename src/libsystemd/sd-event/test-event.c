@@ -10,6 +10,7 @@
 #include "fs-util.h"
 #include "log.h"
 #include "macro.h"
+#include "missing.h"
 #include "parse-util.h"
 #include "process-util.h"
 #include "rm-rf.h"
@@ -481,12 +482,374 @@ static void test_inotify(unsigned n_create_events) {
         sd_event_unref(e);
 }
 
+struct work_context {
+        unsigned idx;
+        pid_t tid;
+        bool started, finished, done;
+};
+
+static pid_t loop_tid;
+static unsigned n_work_done;
+static int64_t last_work_priority;
+
+static int work(void *userdata) {
+        struct work_context *c = userdata;
+
+        __atomic_store_n(&c->started, true, __ATOMIC_SEQ_CST);
+        c->tid = gettid();
+
+        (void) usleep(c->idx * 2 * USEC_PER_MSEC);
+
+        __atomic_store_n(&c->finished, true, __ATOMIC_SEQ_CST);
+
+        return c->idx == 7 ? -EIO : (int) c->idx;
+}
+
+static int work_done(sd_event_source *s, int result, void *userdata) {
+        struct work_context *c = userdata;
+        int64_t priority;
+
+        /* Work runs in some other thread, but completion is dispatched in the thread of the event loop */
+        assert_se(gettid() == loop_tid);
+        assert_se(c->tid != loop_tid);
+        assert_se(c->finished);
+        assert_se(!c->done);
+        assert_se(result == (c->idx == 7 ? -EIO : (int) c->idx));
+
+        assert_se(sd_event_source_get_priority(s, &priority) >= 0);
+        assert_se(priority >= last_work_priority);
+        last_work_priority = priority;
+
+        c->done = true;
+        n_work_done++;
+
+        return 0;
+}
+
+static void wait_for_finished(struct work_context *c, size_t n) {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                while (!__atomic_load_n(&c[i].finished, __ATOMIC_SEQ_CST))
+                        (void) usleep(USEC_PER_MSEC);
+
+        /* The item is queued to the event loop only after the work function returned */
+        (void) usleep(50 * USEC_PER_MSEC);
+}
+
+static void test_work(void) {
+        struct work_context c[20] = {}, cancelled = { .idx = 100 };
+        sd_event_source *s[ELEMENTSOF(c)], *t;
+        sd_event *e;
+        unsigned i;
+
+        loop_tid = gettid();
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(c); i++) {
+                c[i].idx = i;
+                assert_se(sd_event_add_work(e, &s[i], work, work_done, c + i) >= 0);
+        }
+
+        while (n_work_done < ELEMENTSOF(c))
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(c); i++) {
+                assert_se(c[i].done);
+                assert_se(sd_event_source_get_enabled(s[i], NULL) == 0);
+                s[i] = sd_event_source_unref(s[i]);
+        }
+
+        /* Completions that are ready at the same time are dispatched in order of priority */
+        n_work_done = 0;
+        zero(c);
+        for (i = 0; i < 3; i++) {
+                assert_se(sd_event_add_work(e, &s[i], work, work_done, c + i) >= 0);
+                assert_se(sd_event_source_set_priority(s[i], SD_EVENT_PRIORITY_IDLE - i * 100) >= 0);
+        }
+
+        wait_for_finished(c, 3);
+        last_work_priority = INT64_MIN;
+
+        while (n_work_done < 3)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        /* Disabled sources are not dispatched, but the completion isn't lost either */
+        n_work_done = 0;
+        zero(c);
+        assert_se(sd_event_add_work(e, &t, work, work_done, c) >= 0);
+        assert_se(sd_event_source_set_enabled(t, SD_EVENT_OFF) >= 0);
+
+        wait_for_finished(c, 1);
+        last_work_priority = INT64_MIN;
+
+        assert_se(sd_event_run(e, 0) >= 0);
+        assert_se(n_work_done == 0);
+        assert_se(sd_event_source_get_pending(t) > 0);
+        assert_se(sd_event_source_set_enabled(t, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) >= 0);
+        assert_se(n_work_done == 1);
+        t = sd_event_source_unref(t);
+
+        /* Dropping a source waits for the work to finish if it is running, and suppresses the completion */
+        assert_se(sd_event_add_work(e, &t, work, work_done, &cancelled) >= 0);
+        while (!__atomic_load_n(&cancelled.started, __ATOMIC_SEQ_CST))
+                (void) usleep(USEC_PER_MSEC);
+        t = sd_event_source_unref(t);
+        assert_se(cancelled.finished);
+
+        assert_se(sd_event_run(e, 100 * USEC_PER_MSEC) >= 0);
+        assert_se(!cancelled.done);
+
+        for (i = 0; i < 3; i++)
+                sd_event_source_unref(s[i]);
+
+        sd_event_unref(e);
+}
+
+#define N_TIMERS 10U
+
+static unsigned last_timer;
+
+static int ordered_time_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        unsigned i = PTR_TO_UINT(userdata);
+        uint64_t t, n;
+
+        log_info("got timer %u", i);
+
+        assert_se(sd_event_source_get_time(s, &t) >= 0);
+        assert_se(sd_event_now(sd_event_source_get_event(s), CLOCK_MONOTONIC, &n) >= 0);
+        assert_se(usec >= t);
+        assert_se(n >= t);
+
+        assert_se(i > last_timer);
+        last_timer = i;
+
+        if (i == N_TIMERS)
+                assert_se(sd_event_exit(sd_event_source_get_event(s), 0) >= 0);
+
+        return 0;
+}
+
+static void test_time_order(bool wheel) {
+        sd_event_source *s[N_TIMERS + 1] = {};
+        sd_event *e = NULL;
+        uint64_t base;
+        unsigned i;
+
+        log_info("/* %s(%s) */", __func__, yes_no(wheel));
+
+        assert_se(setenv("SD_EVENT_TIMER_WHEEL", yes_no(wheel), 1) >= 0);
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(unsetenv("SD_EVENT_TIMER_WHEEL") >= 0);
+
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &base) >= 0);
+        last_timer = 0;
+
+        /* Mix fine and coarse timers, added in reverse order. They are far enough apart that none of them are
+         * dispatched in the same iteration. */
+        for (i = N_TIMERS; i > 0; i--)
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC,
+                                            base + i * 20 * USEC_PER_MSEC,
+                                            i % 2 ? 1 : USEC_PER_MSEC,
+                                            ordered_time_handler, UINT_TO_PTR(i)) >= 0);
+
+        /* Move a timer to the back, and turn it from coarse to fine and back */
+        assert_se(sd_event_source_set_time(s[2], base + (N_TIMERS + 1) * 20 * USEC_PER_MSEC) >= 0);
+        assert_se(sd_event_source_set_time_accuracy(s[2], 1) >= 0);
+        assert_se(sd_event_source_set_time_accuracy(s[4], 1) >= 0);
+        assert_se(sd_event_source_set_time_accuracy(s[5], 5 * USEC_PER_MSEC) >= 0);
+
+        /* Turn some off, and one of them back on again */
+        assert_se(sd_event_source_set_enabled(s[6], SD_EVENT_OFF) >= 0);
+        assert_se(sd_event_source_set_enabled(s[7], SD_EVENT_OFF) >= 0);
+        assert_se(sd_event_source_set_enabled(s[7], SD_EVENT_ONESHOT) >= 0);
+
+        /* And replace one */
+        s[3] = sd_event_source_unref(s[3]);
+        assert_se(sd_event_add_time(e, &s[3], CLOCK_MONOTONIC, base + 3 * 20 * USEC_PER_MSEC, USEC_PER_MSEC,
+                                    ordered_time_handler, UINT_TO_PTR(3)) >= 0);
+
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(last_timer == N_TIMERS);
+
+        /* The one moved to the back is still pending, the one turned off never ran */
+        assert_se(sd_event_source_get_enabled(s[2], NULL) > 0);
+        assert_se(sd_event_source_get_enabled(s[6], NULL) == 0);
+        assert_se(sd_event_source_get_enabled(s[7], NULL) == 0);
+
+        for (i = 1; i <= N_TIMERS; i++)
+                sd_event_source_unref(s[i]);
+
+        sd_event_unref(e);
+}
+
+struct io_read_context {
+        char data[32];
+        size_t n_data;
+        unsigned n_eof;
+};
+
+static int io_read_handler(sd_event_source *s, int fd, const void *buffer, ssize_t size, void *userdata) {
+        struct io_read_context *c = userdata;
+
+        assert_se(size >= 0);
+        assert_se(size <= 3);
+
+        log_info("read %zi bytes", size);
+
+        if (size == 0) {
+                c->n_eof++;
+                return sd_event_exit(sd_event_source_get_event(s), 0);
+        }
+
+        assert_se(c->n_data + size <= sizeof(c->data));
+        memcpy(c->data + c->n_data, buffer, size);
+        c->n_data += size;
+
+        return 0;
+}
+
+static void test_io_read(bool uring) {
+        struct io_read_context c = {}, d = {};
+        sd_event_source *s = NULL, *t = NULL;
+        sd_event *e = NULL;
+        int p[2], q[2];
+        unsigned i;
+
+        log_info("/* %s(%s) */", __func__, yes_no(uring));
+
+        assert_se(setenv("SD_EVENT_IO_URING", yes_no(uring), 1) >= 0);
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(unsetenv("SD_EVENT_IO_URING") >= 0);
+
+        assert_se(pipe2(p, O_CLOEXEC|O_NONBLOCK) >= 0);
+        assert_se(pipe2(q, O_CLOEXEC|O_NONBLOCK) >= 0);
+
+        assert_se(sd_event_add_io_read(e, &s, p[0], 0, io_read_handler, &c) == -EINVAL);
+        assert_se(sd_event_add_io_read(e, &s, p[0], 3, io_read_handler, &c) >= 0);
+        assert_se(sd_event_add_io_read(e, &t, q[0], 3, io_read_handler, &d) >= 0);
+
+        /* Read in chunks of the buffer size */
+        assert_se(write(p[1], "abcdefgh", 8) == 8);
+        for (i = 0; i < 10 && c.n_data < 8; i++)
+                assert_se(sd_event_run(e, 100 * USEC_PER_MSEC) >= 0);
+        assert_se(c.n_data == 8);
+        assert_se(memcmp(c.data, "abcdefgh", 8) == 0);
+
+        /* Nothing is read while disabled, … */
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_OFF) >= 0);
+        assert_se(write(p[1], "ij", 2) == 2);
+        assert_se(sd_event_run(e, 10 * USEC_PER_MSEC) >= 0);
+        assert_se(c.n_data == 8);
+
+        /* … but once enabled again */
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 100 * USEC_PER_MSEC) >= 0);
+        assert_se(c.n_data == 10);
+        assert_se(memcmp(c.data, "abcdefghij", 10) == 0);
+
+        assert_se(write(p[1], "k", 1) == 1);
+        assert_se(sd_event_run(e, 10 * USEC_PER_MSEC) >= 0);
+        assert_se(c.n_data == 10);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+
+        /* Free a source while its read may be in flight, and close its pipe. The buffer must stay valid until
+         * the read is cancelled. */
+        t = sd_event_source_unref(t);
+        safe_close_pair(q);
+        assert_se(sd_event_run(e, 10 * USEC_PER_MSEC) >= 0);
+
+        /* EOF */
+        p[1] = safe_close(p[1]);
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(c.n_data == 11);
+        assert_se(c.n_eof == 1);
+        assert_se(d.n_data == 0);
+
+        sd_event_source_unref(s);
+        safe_close(p[0]);
+        sd_event_unref(e);
+}
+
+static int counting_defer_handler(sd_event_source *s, void *userdata) {
+        unsigned *n = userdata;
+
+        (*n)++;
+        return 0;
+}
+
+static int unref_self_handler(sd_event_source *s, void *userdata) {
+        sd_event_source **p = userdata;
+
+        assert_se(*p == s);
+        *p = sd_event_source_unref(s);
+        return 0;
+}
+
+static void test_profiling(void) {
+        _cleanup_free_ char *stats = NULL;
+        sd_event_source *s = NULL, *t = NULL;
+        sd_event *e = NULL;
+        unsigned n = 0, i;
+
+        log_info("/* %s */", __func__);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_get_profiling(e) == 0);
+        assert_se(sd_event_get_statistics(e, &stats) == -ENODATA);
+
+        assert_se(sd_event_set_profiling(e, true) == 1);
+        assert_se(sd_event_get_profiling(e) == 1);
+
+        assert_se(sd_event_add_defer(e, &s, counting_defer_handler, &n) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ON) >= 0);
+        assert_se(sd_event_source_set_description(s, "busy") >= 0);
+
+        /* Runs first, and frees itself */
+        assert_se(sd_event_add_defer(e, &t, unref_self_handler, &t) >= 0);
+        assert_se(sd_event_source_set_priority(t, -1) >= 0);
+
+        for (i = 0; i < 5; i++)
+                assert_se(sd_event_run(e, 0) > 0);
+
+        assert_se(!t);
+        assert_se(n == 4);
+
+        assert_se(sd_event_get_statistics(e, &stats) >= 0);
+        log_info("%s", stats);
+        assert_se(strstr(stats, "\nbusy (defer, priority 0):\n        Dispatched: 4\n"));
+        assert_se(strstr(stats, "\nFreed event sources (defer):\n        Dispatched: 1\n"));
+
+        /* Turning it off and on again starts from scratch */
+        assert_se(sd_event_set_profiling(e, false) == 0);
+        stats = mfree(stats);
+        assert_se(sd_event_get_statistics(e, &stats) == -ENODATA);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n == 5);
+
+        assert_se(sd_event_set_profiling(e, true) == 1);
+        assert_se(sd_event_get_statistics(e, &stats) >= 0);
+        assert_se(!strstr(stats, "busy"));
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
 int main(int argc, char *argv[]) {
         test_setup_logging(LOG_DEBUG);
 
         test_basic();
         test_sd_event_now();
         test_rtqueue();
+        test_work();
+        test_time_order(true);
+        test_time_order(false);
+        test_io_read(true);
+        test_io_read(false);
+        test_profiling();
 
         test_inotify(100); /* should work without overflow */
         test_inotify(33000); /* should trigger a q overflow */
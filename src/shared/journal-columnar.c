@@ -0,0 +1,446 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "compress.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "journal-columnar.h"
+#include "journal-def.h"
+#include "journal-internal.h"
+#include "log.h"
+#include "siphash24.h"
+#include "string-util.h"
+#include "unaligned.h"
+
+typedef struct ColumnarValue {
+        size_t size;
+        const void *data;
+} ColumnarValue;
+
+typedef struct ColumnarColumn {
+        ColumnarType type;
+
+        /* For COLUMNAR_DICTIONARY: the distinct values in the order we have seen them first, and an index into that
+         * array for each of them, plus one */
+        ColumnarValue **values;
+        size_t n_values, n_values_allocated;
+        Hashmap *dictionary;
+
+        /* The per-entry data, see journal-columnar.h */
+        uint8_t *data;
+        size_t size, allocated;
+} ColumnarColumn;
+
+/* The metadata columns come first, followed by the well-known fields, followed by the catch-all column */
+static const char* const column_names[] = {
+        COLUMNAR_REALTIME,
+        COLUMNAR_MONOTONIC,
+        "_BOOT_ID",
+        "PRIORITY",
+        "SYSLOG_IDENTIFIER",
+        "MESSAGE",
+        "_PID",
+        "_UID",
+        "_COMM",
+        "_SYSTEMD_UNIT",
+        "_TRANSPORT",
+        "_HOSTNAME",
+        COLUMNAR_OTHER,
+};
+
+#define COLUMN_REALTIME 0
+#define COLUMN_MONOTONIC 1
+#define COLUMN_BOOT_ID 2
+#define COLUMN_OTHER (ELEMENTSOF(column_names) - 1)
+
+struct ColumnarWriter {
+        FILE *f;
+        Set *output_fields;
+
+        unsigned block_entries;
+        unsigned n_entries;
+
+        ColumnarColumn columns[ELEMENTSOF(column_names)];
+
+        /* Scratch buffers for assembling and compressing the payload of a column */
+        uint8_t *payload, *compressed;
+        size_t payload_allocated, compressed_allocated;
+};
+
+static void columnar_value_hash_func(const void *p, struct siphash *state) {
+        const ColumnarValue *v = p;
+
+        siphash24_compress(&v->size, sizeof(v->size), state);
+        siphash24_compress(v->data, v->size, state);
+}
+
+static int columnar_value_compare_func(const void *a, const void *b) {
+        const ColumnarValue *x = a, *y = b;
+
+        if (x->size != y->size)
+                return x->size < y->size ? -1 : 1;
+
+        return memcmp(x->data, y->data, x->size);
+}
+
+static const struct hash_ops columnar_value_hash_ops = {
+        .hash = columnar_value_hash_func,
+        .compare = columnar_value_compare_func,
+};
+
+static void column_reset(ColumnarColumn *c) {
+        size_t i;
+
+        assert(c);
+
+        hashmap_clear(c->dictionary);
+
+        for (i = 0; i < c->n_values; i++)
+                free(c->values[i]);
+        c->n_values = 0;
+
+        c->size = 0;
+}
+
+static void column_done(ColumnarColumn *c) {
+        assert(c);
+
+        column_reset(c);
+
+        hashmap_free(c->dictionary);
+        free(c->values);
+        free(c->data);
+}
+
+static int column_append(ColumnarColumn *c, const void *data, size_t size) {
+        assert(c);
+        assert(data || size == 0);
+
+        if (!GREEDY_REALLOC(c->data, c->allocated, c->size + size))
+                return -ENOMEM;
+
+        memcpy_safe(c->data + c->size, data, size);
+        c->size += size;
+
+        return 0;
+}
+
+static int column_append_le32(ColumnarColumn *c, uint32_t x) {
+        le32_t le = htole32(x);
+
+        return column_append(c, &le, sizeof(le));
+}
+
+static int column_append_le64(ColumnarColumn *c, uint64_t x) {
+        le64_t le = htole64(x);
+
+        return column_append(c, &le, sizeof(le));
+}
+
+static int column_append_value(ColumnarColumn *c, const void *data, size_t size) {
+        ColumnarValue key = {
+                .size = size,
+                .data = data,
+        }, *v;
+        unsigned idx;
+        int r;
+
+        assert(c);
+        assert(c->type == COLUMNAR_DICTIONARY);
+
+        idx = PTR_TO_UINT(hashmap_get(c->dictionary, &key));
+        if (idx == 0) {
+                if (c->n_values >= UINT32_MAX - 1)
+                        return -E2BIG;
+
+                if (!GREEDY_REALLOC(c->values, c->n_values_allocated, c->n_values + 1))
+                        return -ENOMEM;
+
+                /* The value is stored right after the ColumnarValue structure */
+                v = malloc(sizeof(ColumnarValue) + size);
+                if (!v)
+                        return -ENOMEM;
+
+                v->size = size;
+                v->data = memcpy(v + 1, data, size);
+
+                r = hashmap_ensure_allocated(&c->dictionary, &columnar_value_hash_ops);
+                if (r >= 0)
+                        r = hashmap_put(c->dictionary, v, UINT_TO_PTR(c->n_values + 1));
+                if (r < 0) {
+                        free(v);
+                        return r;
+                }
+
+                c->values[c->n_values++] = v;
+                idx = c->n_values;
+        }
+
+        return column_append_le32(c, idx);
+}
+
+int columnar_writer_new(FILE *f, Set *output_fields, unsigned block_entries, ColumnarWriter **ret) {
+        ColumnarWriter *w;
+        size_t i;
+
+        assert(f);
+        assert(ret);
+
+        w = new0(ColumnarWriter, 1);
+        if (!w)
+                return -ENOMEM;
+
+        w->f = f;
+        w->output_fields = output_fields;
+        w->block_entries = block_entries > 0 ? block_entries : COLUMNAR_BLOCK_ENTRIES_DEFAULT;
+
+        for (i = 0; i < ELEMENTSOF(column_names); i++)
+                w->columns[i].type =
+                        IN_SET(i, COLUMN_REALTIME, COLUMN_MONOTONIC) ? COLUMNAR_U64 :
+                        i == COLUMN_OTHER ? COLUMNAR_FIELDS : COLUMNAR_DICTIONARY;
+
+        *ret = w;
+        return 0;
+}
+
+ColumnarWriter* columnar_writer_free(ColumnarWriter *w) {
+        size_t i;
+
+        if (!w)
+                return NULL;
+
+        for (i = 0; i < ELEMENTSOF(column_names); i++)
+                column_done(w->columns + i);
+
+        free(w->payload);
+        free(w->compressed);
+
+        return mfree(w);
+}
+
+static size_t find_column(const void *data, size_t field_length) {
+        size_t i;
+
+        for (i = COLUMN_BOOT_ID; i < COLUMN_OTHER; i++)
+                if (strlen(column_names[i]) == field_length &&
+                    memcmp(column_names[i], data, field_length) == 0)
+                        return i;
+
+        return COLUMN_OTHER;
+}
+
+static int columnar_writer_add_entry_internal(ColumnarWriter *w, sd_journal *j) {
+        bool seen[ELEMENTSOF(column_names)] = {};
+        size_t other_begin, n_other = 0, i;
+        usec_t realtime, monotonic;
+        const void *data;
+        size_t length;
+        le32_t le;
+        int r;
+
+        r = sd_journal_get_realtime_usec(j, &realtime);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get realtime timestamp: %m");
+
+        r = sd_journal_get_monotonic_usec(j, &monotonic, NULL);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get monotonic timestamp: %m");
+
+        r = column_append_le64(w->columns + COLUMN_REALTIME, realtime);
+        if (r < 0)
+                return r;
+
+        r = column_append_le64(w->columns + COLUMN_MONOTONIC, monotonic);
+        if (r < 0)
+                return r;
+
+        /* Reserve space for the number of fields in the catch-all column, we fill it in at the end */
+        other_begin = w->columns[COLUMN_OTHER].size;
+        r = column_append_le32(w->columns + COLUMN_OTHER, 0);
+        if (r < 0)
+                return r;
+
+        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
+                const char *c;
+
+                c = memchr(data, '=', length);
+                if (!c) {
+                        log_error("Invalid field.");
+                        return -EINVAL;
+                }
+
+                /* Like the other output modes, always include the boot ID */
+                if (w->output_fields &&
+                    !memory_startswith(data, length, "_BOOT_ID=") &&
+                    !set_contains(w->output_fields, strndupa(data, c - (const char*) data)))
+                        continue;
+
+                i = find_column(data, c - (const char*) data);
+                if (i != COLUMN_OTHER && !seen[i]) {
+                        r = column_append_value(w->columns + i, c + 1, length - (c + 1 - (const char*) data));
+                        if (r < 0)
+                                return r;
+
+                        seen[i] = true;
+                        continue;
+                }
+
+                if (n_other >= UINT32_MAX || length > UINT32_MAX)
+                        return -E2BIG;
+
+                r = column_append_le32(w->columns + COLUMN_OTHER, length);
+                if (r < 0)
+                        return r;
+
+                r = column_append(w->columns + COLUMN_OTHER, data, length);
+                if (r < 0)
+                        return r;
+
+                n_other++;
+        }
+        if (r < 0)
+                return r;
+
+        /* Mark the fields this entry doesn't have */
+        for (i = COLUMN_BOOT_ID; i < COLUMN_OTHER; i++)
+                if (!seen[i]) {
+                        r = column_append_le32(w->columns + i, 0);
+                        if (r < 0)
+                                return r;
+                }
+
+        le = htole32(n_other);
+        memcpy(w->columns[COLUMN_OTHER].data + other_begin, &le, sizeof(le));
+
+        return 0;
+}
+
+int columnar_writer_add_entry(ColumnarWriter *w, sd_journal *j) {
+        size_t sizes[ELEMENTSOF(column_names)], i;
+        int r;
+
+        assert(w);
+        assert(j);
+
+        sd_journal_set_data_threshold(j, 0);
+
+        for (i = 0; i < ELEMENTSOF(column_names); i++)
+                sizes[i] = w->columns[i].size;
+
+        r = columnar_writer_add_entry_internal(w, j);
+        if (r < 0) {
+                /* Drop whatever we added for this entry, so that the columns stay consistent. (Values we added to
+                 * the dictionaries don't hurt.) */
+                for (i = 0; i < ELEMENTSOF(column_names); i++)
+                        w->columns[i].size = sizes[i];
+
+                if (r == -EBADMSG) {
+                        log_debug_errno(r, "Skipping message we can't read: %m");
+                        return 0;
+                }
+
+                return r;
+        }
+
+        w->n_entries++;
+
+        if (w->n_entries >= w->block_entries)
+                return columnar_writer_flush(w);
+
+        return 0;
+}
+
+static int columnar_writer_write_column(ColumnarWriter *w, size_t idx) {
+        ColumnarColumn *c = w->columns + idx;
+        ColumnarColumnHeader h = {
+                .type = c->type,
+                .name_size = htole32(strlen(column_names[idx])),
+        };
+        const uint8_t *payload;
+        size_t size, compressed_size;
+        int r;
+
+        if (c->type == COLUMNAR_DICTIONARY) {
+                uint8_t *p;
+                size_t i;
+
+                /* Prepend the dictionary to the indexes */
+                size = sizeof(le32_t) + c->size;
+                for (i = 0; i < c->n_values; i++)
+                        size += sizeof(le32_t) + c->values[i]->size;
+
+                if (!GREEDY_REALLOC(w->payload, w->payload_allocated, size))
+                        return -ENOMEM;
+
+                p = w->payload;
+                unaligned_write_le32(p, c->n_values);
+                p += sizeof(le32_t);
+
+                for (i = 0; i < c->n_values; i++) {
+                        unaligned_write_le32(p, c->values[i]->size);
+                        p = mempcpy(p + sizeof(le32_t), c->values[i]->data, c->values[i]->size);
+                }
+
+                memcpy_safe(p, c->data, c->size);
+                payload = w->payload;
+        } else {
+                size = c->size;
+                payload = c->data;
+        }
+
+        h.uncompressed_size = htole64(size);
+        h.size = h.uncompressed_size;
+
+        /* Only keep the compressed payload if it is actually smaller */
+        if (size > 1 && GREEDY_REALLOC(w->compressed, w->compressed_allocated, size)) {
+                r = compress_blob(DEFAULT_COMPRESSION, payload, size, w->compressed, size - 1, &compressed_size);
+                if (r > 0 && compressed_size < size) {
+                        h.compression = r;
+                        h.size = htole64(compressed_size);
+                        payload = w->compressed;
+                        size = compressed_size;
+                }
+        }
+
+        fwrite(&h, sizeof(h), 1, w->f);
+        fputs(column_names[idx], w->f);
+        fwrite(payload, 1, size, w->f);
+
+        return 0;
+}
+
+int columnar_writer_flush(ColumnarWriter *w) {
+        ColumnarBlockHeader h = {
+                .n_entries = htole32(w->n_entries),
+                .n_columns = htole32(ELEMENTSOF(column_names)),
+        };
+        size_t i;
+        int r;
+
+        assert(w);
+
+        if (w->n_entries == 0)
+                return 0;
+
+        memcpy(h.signature, COLUMNAR_SIGNATURE, sizeof(h.signature));
+        fwrite(&h, sizeof(h), 1, w->f);
+
+        for (i = 0; i < ELEMENTSOF(column_names); i++) {
+                r = columnar_writer_write_column(w, i);
+                if (r < 0)
+                        return log_oom();
+
+                column_reset(w->columns + i);
+        }
+
+        w->n_entries = 0;
+
+        r = fflush_and_check(w->f);
+        if (r < 0)
+                return log_error_errno(r, "Failed to write columnar block: %m");
+
+        return 0;
+}
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "sd-journal.h"
+
+#include "macro.h"
+#include "set.h"
+#include "sparse-endian.h"
+
+/* The columnar export format stores journal entries in a sequence of independent blocks, each holding up to a few
+ * thousand entries. Within a block, the values of each of a fixed set of well-known fields are stored together in a
+ * column, so that tools that are only interested in a few fields don't need to look at (or decompress) the others.
+ * All other fields of an entry are stored in a catch-all column.
+ *
+ * Each block starts with a ColumnarBlockHeader, followed by n_columns columns. Each column starts with a
+ * ColumnarColumnHeader, followed by the name of the column (name_size bytes, not NUL terminated), followed by size
+ * bytes of payload, compressed with the specified algorithm (see OBJECT_COMPRESSED_XZ and friends), if any. All
+ * integers are little endian. The uncompressed payload depends on the type of the column:
+ *
+ * COLUMNAR_U64: n_entries 64bit integers.
+ *
+ * COLUMNAR_DICTIONARY: a 32bit number of distinct values, followed by each value as 32bit size and data, followed by
+ * n_entries 32bit indexes into the values, starting at 1. An index of 0 means the field is not set for the entry.
+ * If an entry has a field multiple times, only the first value is stored in the column, the others are stored in
+ * the catch-all column.
+ *
+ * COLUMNAR_FIELDS: for each entry a 32bit number of fields, followed by each field as 32bit size and
+ * "FIELD=value" data.
+ */
+
+#define COLUMNAR_SIGNATURE ((const uint8_t[]) { 'J', 'C', 'O', 'L', 'U', 'M', 'N', '1' })
+
+typedef enum ColumnarType {
+        COLUMNAR_U64,
+        COLUMNAR_DICTIONARY,
+        COLUMNAR_FIELDS,
+        _COLUMNAR_TYPE_MAX,
+} ColumnarType;
+
+typedef struct ColumnarBlockHeader {
+        uint8_t signature[8];
+        le32_t n_entries;
+        le32_t n_columns;
+} _packed_ ColumnarBlockHeader;
+
+typedef struct ColumnarColumnHeader {
+        uint8_t type;
+        uint8_t compression;
+        uint8_t reserved[2];
+        le32_t name_size;
+        le64_t size;
+        le64_t uncompressed_size;
+} _packed_ ColumnarColumnHeader;
+
+/* The names of the columns for the entry metadata, and for the catch-all column */
+#define COLUMNAR_REALTIME "__REALTIME_TIMESTAMP"
+#define COLUMNAR_MONOTONIC "__MONOTONIC_TIMESTAMP"
+#define COLUMNAR_OTHER "*"
+
+#define COLUMNAR_BLOCK_ENTRIES_DEFAULT 4096U
+
+typedef struct ColumnarWriter ColumnarWriter;
+
+int columnar_writer_new(FILE *f, Set *output_fields, unsigned block_entries, ColumnarWriter **ret);
+ColumnarWriter* columnar_writer_free(ColumnarWriter *w);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ColumnarWriter*, columnar_writer_free);
+
+int columnar_writer_add_entry(ColumnarWriter *w, sd_journal *j);
+int columnar_writer_flush(ColumnarWriter *w);
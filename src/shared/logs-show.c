@@ -20,6 +20,7 @@
 #include "hashmap.h"
 #include "hostname-util.h"
 #include "io-util.h"
+#include "journal-columnar.h"
 #include "journal-internal.h"
 #include "json.h"
 #include "log.h"
@@ -35,6 +36,7 @@
 #include "strv.h"
 #include "terminal-util.h"
 #include "time-util.h"
+#include "unaligned.h"
 #include "utf8.h"
 #include "util.h"
 
@@ -696,6 +698,46 @@ static int output_export(
         return 0;
 }
 
+/* Bit tricks to check eight bytes at once, see https://graphics.stanford.edu/~seander/bithacks.html */
+#define BYTES_ONES UINT64_C(0x0101010101010101)
+#define BYTES_HIGH (BYTES_ONES * 0x80)
+#define BYTES_ANY_ZERO(w) (((w) - BYTES_ONES) & ~(w) & BYTES_HIGH)
+#define BYTES_ANY_LESS(w, n) (((w) - BYTES_ONES * (n)) & ~(w) & BYTES_HIGH)
+#define BYTES_ANY_MORE(w, n) ((((w) + BYTES_ONES * (127 - (n))) | (w)) & BYTES_HIGH)
+#define BYTES_ANY_EQUAL(w, c) BYTES_ANY_ZERO((w) ^ (BYTES_ONES * (uint8_t) (c)))
+
+static bool json_char_is_plain(char c) {
+        return c >= ' ' && c <= '~' && !IN_SET(c, '"', '\\', '/');
+}
+
+static size_t json_plain_span(const char *p, size_t l) {
+        size_t i = 0;
+
+        assert(p || l == 0);
+
+        /* Returns the length of the prefix of p that consists of printable ASCII characters only and needs no
+         * escaping in JSON strings. Most journal data looks like that, hence we check a word at a time. */
+
+        for (; i + sizeof(uint64_t) <= l; i += sizeof(uint64_t)) {
+                uint64_t w;
+
+                w = unaligned_read_ne64(p + i);
+
+                if (BYTES_ANY_LESS(w, ' ') |
+                    BYTES_ANY_MORE(w, '~') |
+                    BYTES_ANY_EQUAL(w, '"') |
+                    BYTES_ANY_EQUAL(w, '\\') |
+                    BYTES_ANY_EQUAL(w, '/'))
+                        break;
+        }
+
+        for (; i < l; i++)
+                if (!json_char_is_plain(p[i]))
+                        break;
+
+        return i;
+}
+
 void json_escape(
                 FILE *f,
                 const char* p,
@@ -730,6 +772,17 @@ void json_escape(
                 fputc('\"', f);
 
                 while (l > 0) {
+                        size_t k;
+
+                        /* Write runs of characters that need no escaping in one go */
+                        k = json_plain_span(p, l);
+                        if (k > 0) {
+                                fwrite(p, 1, k, f);
+                                p += k;
+                                l -= k;
+                                continue;
+                        }
+
                         if (IN_SET(*p, '"', '\\')) {
                                 fputc('\\', f);
                                 fputc(*p, f);
@@ -838,14 +891,12 @@ static int update_json_data_split(
         return update_json_data(h, flags, name, eq + 1, size - (eq - (const char*) data) - 1);
 }
 
-static int output_json(
+int output_json_variant(
                 FILE *f,
                 sd_journal *j,
                 OutputMode mode,
-                unsigned n_columns,
                 OutputFlags flags,
-                Set *output_fields,
-                const size_t highlight[2]) {
+                Set *output_fields) {
 
         char sid[SD_ID128_STRING_MAX], usecbuf[DECIMAL_STR_MAX(usec_t)];
         _cleanup_(json_variant_unrefp) JsonVariant *object = NULL;
@@ -981,6 +1032,480 @@ finish:
         return r;
 }
 
+typedef enum JsonValueKind {
+        JSON_VALUE_NULL,
+        JSON_VALUE_PLAIN,   /* a string that needs no escaping */
+        JSON_VALUE_STRING,
+        JSON_VALUE_BYTES,
+} JsonValueKind;
+
+typedef struct JsonField {
+        /* Offsets into JsonEntry.data */
+        size_t name, name_size;
+        size_t value, value_size;
+        JsonValueKind kind;
+
+        /* For the first field of a name: the number of values, and the last field with the same name. For all
+         * fields: the next field with the same name, or 0 if there is none. */
+        size_t n_values;
+        size_t last;
+        size_t next;
+        bool duplicate;
+} JsonField;
+
+typedef struct JsonEntry {
+        /* Copies of the field names and values, since the data returned by sd_journal_enumerate_data() is only
+         * valid until the next call. */
+        char *data;
+        size_t data_size, data_allocated;
+
+        JsonField *fields;
+        size_t n_fields, n_fields_allocated;
+
+        /* The formatted entry */
+        char *buffer;
+        size_t buffer_size, buffer_allocated;
+} JsonEntry;
+
+static void json_entry_done(JsonEntry *e) {
+        assert(e);
+
+        free(e->data);
+        free(e->fields);
+        free(e->buffer);
+}
+
+static int json_entry_add(
+                JsonEntry *e,
+                OutputFlags flags,
+                const char *name,
+                size_t name_size,
+                const char *value,
+                size_t size) {
+
+        JsonField *field;
+        size_t i, k;
+
+        assert(e);
+        assert(name);
+        assert(value || size == 0);
+
+        if (!GREEDY_REALLOC(e->fields, e->n_fields_allocated, e->n_fields + 1))
+                return log_oom();
+
+        field = e->fields + e->n_fields;
+        *field = (JsonField) {
+                .name_size = name_size,
+                .n_values = 1,
+                .last = e->n_fields,
+        };
+
+        /* Same rules as in update_json_data(), but only look at the rest if the value isn't plain ASCII */
+        if (!(flags & OUTPUT_SHOW_ALL) && name_size + 1 + size >= JSON_THRESHOLD) {
+                field->kind = JSON_VALUE_NULL;
+                size = 0;
+        } else {
+                k = json_plain_span(value, size);
+                if (k == size)
+                        field->kind = JSON_VALUE_PLAIN;
+                else if (utf8_is_printable(value + k, size - k))
+                        field->kind = JSON_VALUE_STRING;
+                else
+                        field->kind = JSON_VALUE_BYTES;
+        }
+
+        if (!GREEDY_REALLOC(e->data, e->data_allocated, e->data_size + name_size + size))
+                return log_oom();
+
+        field->name = e->data_size;
+        memcpy(e->data + e->data_size, name, name_size);
+        e->data_size += name_size;
+
+        field->value = e->data_size;
+        field->value_size = size;
+        memcpy_safe(e->data + e->data_size, value, size);
+        e->data_size += size;
+
+        /* Entries usually have a few dozen fields at most, hence a linear search is good enough to find
+         * an earlier field of the same name */
+        for (i = 0; i < e->n_fields; i++) {
+                JsonField *first = e->fields + i;
+
+                if (first->duplicate ||
+                    first->name_size != name_size ||
+                    memcmp(e->data + first->name, name, name_size) != 0)
+                        continue;
+
+                field->duplicate = true;
+                e->fields[first->last].next = e->n_fields;
+                first->last = e->n_fields;
+                first->n_values++;
+                break;
+        }
+
+        e->n_fields++;
+        return 0;
+}
+
+static int json_entry_append(JsonEntry *e, const void *p, size_t l) {
+        assert(e);
+
+        if (!GREEDY_REALLOC(e->buffer, e->buffer_allocated, e->buffer_size + l))
+                return -ENOMEM;
+
+        memcpy_safe(e->buffer + e->buffer_size, p, l);
+        e->buffer_size += l;
+        return 0;
+}
+
+static int json_entry_append_string(JsonEntry *e, const char *s) {
+        return json_entry_append(e, s, strlen(s));
+}
+
+static int json_entry_append_indent(JsonEntry *e, size_t depth) {
+        static const char tabs[] = "\t\t\t\t";
+
+        assert(depth < sizeof(tabs));
+        return json_entry_append(e, tabs, depth);
+}
+
+static int json_entry_append_escaped(JsonEntry *e, const char *p, size_t l) {
+        int r;
+
+        assert(e);
+
+        /* Escapes the same way as the JSON_VARIANT_STRING case of json_format() */
+
+        while (l > 0) {
+                char buf[STRLEN("\\u") + 4 + 1];
+                size_t k;
+
+                k = json_plain_span(p, l);
+                if (k > 0) {
+                        r = json_entry_append(e, p, k);
+                        if (r < 0)
+                                return r;
+
+                        p += k;
+                        l -= k;
+                        continue;
+                }
+
+                switch (*p) {
+
+                case '"':
+                case '\\':
+                case '/':
+                        buf[0] = '\\';
+                        buf[1] = *p;
+                        buf[2] = 0;
+                        break;
+
+                case '\b':
+                        strcpy(buf, "\\b");
+                        break;
+
+                case '\f':
+                        strcpy(buf, "\\f");
+                        break;
+
+                case '\n':
+                        strcpy(buf, "\\n");
+                        break;
+
+                case '\r':
+                        strcpy(buf, "\\r");
+                        break;
+
+                case '\t':
+                        strcpy(buf, "\\t");
+                        break;
+
+                default:
+                        if ((signed char) *p >= 0 && *p < ' ')
+                                xsprintf(buf, "\\u%04x", *p);
+                        else {
+                                buf[0] = *p;
+                                buf[1] = 0;
+                        }
+                }
+
+                r = json_entry_append_string(e, buf);
+                if (r < 0)
+                        return r;
+
+                p++;
+                l--;
+        }
+
+        return 0;
+}
+
+static int json_entry_append_value(JsonEntry *e, const JsonField *field, bool pretty, size_t depth) {
+        const char *value;
+        size_t i;
+        int r;
+
+        assert(e);
+        assert(field);
+
+        value = e->data + field->value;
+
+        switch (field->kind) {
+
+        case JSON_VALUE_NULL:
+                return json_entry_append_string(e, "null");
+
+        case JSON_VALUE_PLAIN:
+        case JSON_VALUE_STRING:
+                r = json_entry_append(e, "\"", 1);
+                if (r < 0)
+                        return r;
+
+                if (field->kind == JSON_VALUE_PLAIN)
+                        r = json_entry_append(e, value, field->value_size);
+                else
+                        r = json_entry_append_escaped(e, value, field->value_size);
+                if (r < 0)
+                        return r;
+
+                return json_entry_append(e, "\"", 1);
+
+        case JSON_VALUE_BYTES:
+                r = json_entry_append_string(e, pretty ? "[\n" : "[");
+                if (r < 0)
+                        return r;
+
+                for (i = 0; i < field->value_size; i++) {
+                        char buf[STRLEN(",\n") + DECIMAL_STR_MAX(uint8_t)];
+
+                        if (i > 0) {
+                                r = json_entry_append_string(e, pretty ? ",\n" : ",");
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        if (pretty) {
+                                r = json_entry_append_indent(e, depth + 1);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        xsprintf(buf, "%u", (uint8_t) value[i]);
+                        r = json_entry_append_string(e, buf);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (pretty) {
+                        r = json_entry_append(e, "\n", 1);
+                        if (r < 0)
+                                return r;
+
+                        r = json_entry_append_indent(e, depth);
+                        if (r < 0)
+                                return r;
+                }
+
+                return json_entry_append(e, "]", 1);
+
+        default:
+                assert_not_reached("Unexpected value kind.");
+        }
+}
+
+static int json_entry_format(JsonEntry *e, OutputMode mode) {
+        bool pretty = mode == OUTPUT_JSON_PRETTY, first = true;
+        size_t i, k;
+        int r;
+
+        assert(e);
+
+        /* Formats the entry the same way as json_variant_dump() would, except that fields are ordered as they
+         * appear in the entry. */
+
+        r = json_entry_append_string(e,
+                                     mode == OUTPUT_JSON_SSE ? "data: {" :
+                                     mode == OUTPUT_JSON_SEQ ? "\x1e{" :
+                                     pretty ? "{\n" : "{");
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < e->n_fields; i++) {
+                const JsonField *field = e->fields + i;
+
+                if (field->duplicate)
+                        continue;
+
+                if (!first) {
+                        r = json_entry_append_string(e, pretty ? ",\n" : ",");
+                        if (r < 0)
+                                return r;
+                }
+                first = false;
+
+                if (pretty) {
+                        r = json_entry_append_indent(e, 1);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = json_entry_append(e, "\"", 1);
+                if (r < 0)
+                        return r;
+
+                r = json_entry_append_escaped(e, e->data + field->name, field->name_size);
+                if (r < 0)
+                        return r;
+
+                r = json_entry_append_string(e, pretty ? "\" : " : "\":");
+                if (r < 0)
+                        return r;
+
+                if (field->n_values == 1) {
+                        r = json_entry_append_value(e, field, pretty, 1);
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                /* Multiple values for the same field are turned into an array */
+                r = json_entry_append_string(e, pretty ? "[\n" : "[");
+                if (r < 0)
+                        return r;
+
+                for (k = i; ; k = e->fields[k].next) {
+                        if (k != i) {
+                                r = json_entry_append_string(e, pretty ? ",\n" : ",");
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        if (pretty) {
+                                r = json_entry_append_indent(e, 2);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        r = json_entry_append_value(e, e->fields + k, pretty, 2);
+                        if (r < 0)
+                                return r;
+
+                        if (e->fields[k].next == 0)
+                                break;
+                }
+
+                r = json_entry_append_string(e, pretty ? "\n\t]" : "]");
+                if (r < 0)
+                        return r;
+        }
+
+        return json_entry_append_string(e,
+                                        mode == OUTPUT_JSON_SSE ? "}\n\n" :
+                                        pretty ? "\n}\n" : "}\n");
+}
+
+static bool json_field_wanted(Set *output_fields, const char *name, size_t name_size) {
+        return set_contains(output_fields, strndupa(name, name_size));
+}
+
+static int output_json(
+                FILE *f,
+                sd_journal *j,
+                OutputMode mode,
+                unsigned n_columns,
+                OutputFlags flags,
+                Set *output_fields,
+                const size_t highlight[2]) {
+
+        char sid[SD_ID128_STRING_MAX], usecbuf[DECIMAL_STR_MAX(usec_t)];
+        _cleanup_(json_entry_done) JsonEntry e = {};
+        _cleanup_free_ char *cursor = NULL;
+        uint64_t realtime, monotonic;
+        sd_id128_t boot_id;
+        int r;
+
+        assert(j);
+
+        /* Colors are added by json_variant_dump(), hence let it do the work in that case. Otherwise we format
+         * the entry directly into a buffer and write it out in one go, which is a lot faster than building a
+         * JsonVariant object for each entry first. */
+        if (flags & OUTPUT_COLOR)
+                return output_json_variant(f, j, mode, flags, output_fields);
+
+        (void) sd_journal_set_data_threshold(j, flags & OUTPUT_SHOW_ALL ? 0 : JSON_THRESHOLD);
+
+        r = sd_journal_get_realtime_usec(j, &realtime);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get realtime timestamp: %m");
+
+        r = sd_journal_get_monotonic_usec(j, &monotonic, &boot_id);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get monotonic timestamp: %m");
+
+        r = sd_journal_get_cursor(j, &cursor);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get cursor: %m");
+
+        r = json_entry_add(&e, flags, "__CURSOR", STRLEN("__CURSOR"), cursor, strlen(cursor));
+        if (r < 0)
+                return r;
+
+        xsprintf(usecbuf, USEC_FMT, realtime);
+        r = json_entry_add(&e, flags, "__REALTIME_TIMESTAMP", STRLEN("__REALTIME_TIMESTAMP"), usecbuf, strlen(usecbuf));
+        if (r < 0)
+                return r;
+
+        xsprintf(usecbuf, USEC_FMT, monotonic);
+        r = json_entry_add(&e, flags, "__MONOTONIC_TIMESTAMP", STRLEN("__MONOTONIC_TIMESTAMP"), usecbuf, strlen(usecbuf));
+        if (r < 0)
+                return r;
+
+        sd_id128_to_string(boot_id, sid);
+        r = json_entry_add(&e, flags, "_BOOT_ID", STRLEN("_BOOT_ID"), sid, strlen(sid));
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                const char *data, *eq;
+                size_t size, name_size;
+
+                r = sd_journal_enumerate_data(j, (const void**) &data, &size);
+                if (r == -EBADMSG) {
+                        log_debug_errno(r, "Skipping message we can't read: %m");
+                        return 0;
+                }
+                if (r < 0)
+                        return log_error_errno(r, "Failed to read journal: %m");
+                if (r == 0)
+                        break;
+
+                /* Same filtering as in update_json_data_split() */
+                if (memory_startswith(data, size, "_BOOT_ID="))
+                        continue;
+
+                eq = memchr(data, '=', MIN(size, JSON_THRESHOLD));
+                if (!eq || eq == data)
+                        continue;
+
+                name_size = eq - data;
+                if (output_fields && !json_field_wanted(output_fields, data, name_size))
+                        continue;
+
+                r = json_entry_add(&e, flags, data, name_size, eq + 1, size - name_size - 1);
+                if (r < 0)
+                        return r;
+        }
+
+        r = json_entry_format(&e, mode);
+        if (r < 0)
+                return log_oom();
+
+        fwrite(e.buffer, 1, e.buffer_size, f);
+        return 0;
+}
+
 static int output_cat(
                 FILE *f,
                 sd_journal *j,
@@ -1036,6 +1561,34 @@ static int output_cat(
         return 0;
 }
 
+static int output_columnar(
+                FILE *f,
+                sd_journal *j,
+                OutputMode mode,
+                unsigned n_columns,
+                OutputFlags flags,
+                Set *output_fields,
+                const size_t highlight[2]) {
+
+        _cleanup_(columnar_writer_freep) ColumnarWriter *w = NULL;
+        int r;
+
+        assert(j);
+
+        /* Without any state to keep between entries, we write each entry as a block of its own. Callers that
+         * output many entries should use a ColumnarWriter directly. */
+
+        r = columnar_writer_new(f, output_fields, 1, &w);
+        if (r < 0)
+                return log_oom();
+
+        r = columnar_writer_add_entry(w, j);
+        if (r < 0)
+                return r;
+
+        return columnar_writer_flush(w);
+}
+
 static int (*output_funcs[_OUTPUT_MODE_MAX])(
                 FILE *f,
                 sd_journal*j,
@@ -1060,6 +1613,7 @@ static int (*output_funcs[_OUTPUT_MODE_MAX])(
         [OUTPUT_JSON_SEQ] = output_json,
         [OUTPUT_CAT] = output_cat,
         [OUTPUT_WITH_UNIT] = output_short,
+        [OUTPUT_COLUMNAR] = output_columnar,
 };
 
 int show_journal_entry(
@@ -10,6 +10,7 @@
 
 #include "macro.h"
 #include "output-mode.h"
+#include "set.h"
 #include "time-util.h"
 #include "util.h"
 
@@ -22,6 +23,15 @@ int show_journal_entry(
                 char **output_fields,
                 const size_t highlight[2],
                 bool *ellipsized);
+/* Formats the current entry in one of the JSON output modes through a JsonVariant object, which is what is done
+ * for colored output. show_journal_entry() formats the other JSON output directly, which is a lot faster. */
+int output_json_variant(
+                FILE *f,
+                sd_journal *j,
+                OutputMode mode,
+                OutputFlags flags,
+                Set *output_fields);
+
 int show_journal(
                 FILE *f,
                 sd_journal *j,
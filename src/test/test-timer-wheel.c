@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "time-util.h"
+#include "timer-wheel.h"
+#include "util.h"
+
+#define N_NODES 1024*4
+
+struct test {
+        TimerWheelNode node;
+        uint64_t value;
+        bool expired;
+};
+
+static uint64_t random_key(uint64_t base) {
+        /* Spread the keys over all levels of the wheel, and beyond */
+        return base + ((uint64_t) rand() >> (rand() % 31)) * (UINT64_C(1) << (rand() % 24));
+}
+
+static struct test *find_min(struct test *t, size_t n) {
+        struct test *m = NULL;
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                if (timer_wheel_node_linked(&t[i].node) && (!m || t[i].value < m->value))
+                        m = t + i;
+
+        return m;
+}
+
+static void test_peek_and_set_base(void) {
+        _cleanup_(timer_wheel_freep) TimerWheel *w = NULL;
+        _cleanup_free_ struct test *t = NULL;
+        uint64_t base = 4711;
+        size_t i, n = 0;
+
+        srand(0);
+
+        assert_se(w = timer_wheel_new(base));
+        assert_se(t = new0(struct test, N_NODES));
+
+        assert_se(!timer_wheel_peek(w));
+        assert_se(!timer_wheel_pop_expired(w));
+
+        for (i = 0; i < N_NODES; i++) {
+                t[i].value = random_key(base);
+                timer_wheel_add(w, &t[i].node, t[i].value);
+                assert_se(timer_wheel_node_linked(&t[i].node));
+        }
+
+        assert_se(timer_wheel_size(w) == N_NODES);
+
+        /* Remove some, and move some others */
+        for (i = 0; i < N_NODES; i += 3) {
+                timer_wheel_remove(w, &t[i].node);
+                assert_se(!timer_wheel_node_linked(&t[i].node));
+                timer_wheel_remove(w, &t[i].node);
+        }
+
+        for (i = 1; i < N_NODES; i += 3) {
+                t[i].value = random_key(base);
+                timer_wheel_add(w, &t[i].node, t[i].value);
+        }
+
+        assert_se(timer_wheel_size(w) == N_NODES - (N_NODES + 2) / 3);
+
+        while (timer_wheel_size(w) > 0) {
+                TimerWheelNode *p;
+                struct test *m;
+
+                m = find_min(t, N_NODES);
+                assert_se(m);
+                assert_se(timer_wheel_peek(w)->key == m->value);
+
+                /* Advance in steps of varying length, sometimes right up to the next key, sometimes beyond */
+                if (rand() % 2)
+                        base = m->value + 1;
+                else
+                        base += (uint64_t) rand() % (UINT64_C(1) << (rand() % 40));
+
+                timer_wheel_set_base(w, base);
+
+                while ((p = timer_wheel_pop_expired(w))) {
+                        struct test *e = container_of(p, struct test, node);
+
+                        assert_se(e->value < base);
+                        assert_se(!e->expired);
+                        assert_se(!timer_wheel_node_linked(p));
+                        e->expired = true;
+                        n++;
+                }
+
+                m = find_min(t, N_NODES);
+                assert_se(!m || m->value >= base);
+        }
+
+        assert_se(n == N_NODES - (N_NODES + 2) / 3);
+}
+
+static void test_peek_cached(void) {
+        /* The wheel still has nodes linked at the end, hence it has to go first */
+        _cleanup_free_ struct test *t = NULL;
+        _cleanup_(timer_wheel_freep) TimerWheel *w = NULL;
+        uint64_t base = 4711;
+        unsigned i;
+
+        srand(1);
+
+        assert_se(w = timer_wheel_new(base));
+        assert_se(t = new0(struct test, N_NODES));
+
+        /* The minimum is cached, make sure it follows nodes being added, moved in either direction and removed */
+        for (i = 0; i < 8 * N_NODES; i++) {
+                struct test *m;
+                size_t k;
+
+                k = (size_t) rand() % N_NODES;
+
+                switch (rand() % 4) {
+
+                case 0:
+                        timer_wheel_remove(w, &t[k].node);
+                        break;
+
+                case 1:
+                        /* Move the current minimum, later or earlier */
+                        m = find_min(t, N_NODES);
+                        if (m) {
+                                m->value = random_key(base);
+                                timer_wheel_add(w, &m->node, m->value);
+                        }
+                        break;
+
+                default:
+                        t[k].value = random_key(base);
+                        timer_wheel_add(w, &t[k].node, t[k].value);
+                }
+
+                if (i % 64 == 0) {
+                        base += (uint64_t) rand() % (UINT64_C(1) << (rand() % 24));
+                        timer_wheel_set_base(w, base);
+                }
+
+                m = find_min(t, N_NODES);
+                if (m)
+                        assert_se(timer_wheel_peek(w)->key == m->value);
+                else
+                        assert_se(!timer_wheel_peek(w));
+        }
+}
+
+static void test_backwards(void) {
+        _cleanup_(timer_wheel_freep) TimerWheel *w = NULL;
+        struct test t[2] = {};
+
+        assert_se(w = timer_wheel_new(USEC_PER_DAY));
+
+        timer_wheel_add(w, &t[0].node, USEC_PER_DAY - USEC_PER_HOUR);
+        timer_wheel_add(w, &t[1].node, USEC_PER_DAY + USEC_PER_HOUR);
+        assert_se(timer_wheel_peek(w) == &t[0].node);
+
+        /* Nodes are no longer expired if the base moves back before them */
+        timer_wheel_set_base(w, USEC_PER_DAY - 2 * USEC_PER_HOUR);
+        assert_se(!timer_wheel_pop_expired(w));
+        assert_se(timer_wheel_peek(w) == &t[0].node);
+
+        timer_wheel_set_base(w, USEC_PER_DAY + 2 * USEC_PER_HOUR);
+        assert_se(timer_wheel_pop_expired(w));
+        assert_se(timer_wheel_pop_expired(w));
+        assert_se(!timer_wheel_pop_expired(w));
+        assert_se(timer_wheel_size(w) == 0);
+}
+
+static void test_free(void) {
+        TimerWheel *w;
+        struct test t[3] = {};
+
+        assert_se(w = timer_wheel_new(0));
+
+        timer_wheel_add(w, &t[0].node, 0);
+        timer_wheel_add(w, &t[1].node, 1000000);
+        timer_wheel_add(w, &t[2].node, UINT64_MAX);
+        timer_wheel_set_base(w, 1);
+
+        assert_se(timer_wheel_size(w) == 3);
+        assert_se(timer_wheel_peek(w) == &t[0].node);
+
+        assert_se(!timer_wheel_free(w));
+
+        assert_se(!timer_wheel_node_linked(&t[0].node));
+        assert_se(!timer_wheel_node_linked(&t[1].node));
+        assert_se(!timer_wheel_node_linked(&t[2].node));
+}
+
+int main(int argc, char* argv[]) {
+
+        test_peek_and_set_base();
+        test_peek_cached();
+        test_backwards();
+        test_free();
+
+        return 0;
+}